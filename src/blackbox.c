@@ -2,12 +2,73 @@
 #include "mw.h"
 #include "buzzer.h"
 
+#include <stddef.h>
+
 #include "blackbox_fielddefs.h"
+#include "blackbox_compress.h"
 #include "blackbox.h"
+#include "flashfs.h"
+#include "perf.h"
 
-#define BLACKBOX_BAUDRATE 115200
+// The rate every serial logger starts out at, which the baud rate negotiation begins with and falls back to
+#define BLACKBOX_BASE_BAUDRATE 115200
 #define BLACKBOX_INITIAL_PORT_MODE MODE_TX
-#define BLACKBOX_I_INTERVAL 32
+
+/*
+ * With blackbox_baudrate set to 0, the blackbox asks the logger how fast it can go before the first log is written.
+ * The conversation starts at BLACKBOX_BASE_BAUDRATE:
+ *
+ *   us:     "BBPROBE\n"
+ *   logger: "BBOK <the highest baud rate it supports>\n"
+ *   us:     "BBBAUD <the rate we picked>\n"       then both sides switch to the new rate
+ *   us:     "BBPROBE\n"
+ *   logger: "BBOK <anything>\n"                  which confirms that the new rate works
+ *
+ * We pick the fastest of blackboxBaudRates that the logger supports. A logger that doesn't answer within
+ * BLACKBOX_NEGOTIATE_TIMEOUT_MS (a plain OpenLog, or one with its TX pin left unconnected) is logged to at the base
+ * rate, and we ask again on the next arm. If the new rate isn't confirmed, we go back to the base rate (the logger
+ * should do the same if it doesn't hear our second probe). Once a rate has worked it's used for every following log
+ * without asking again. A logger that doesn't know this protocol just stores the probe in front of the log's header,
+ * where decoders skip over it.
+ */
+#define BLACKBOX_NEGOTIATE_TIMEOUT_MS 100
+
+// Time for the logger to switch its UART over after it has read our "BBBAUD" line
+#define BLACKBOX_NEGOTIATE_SWITCH_MS 10
+
+static const uint32_t blackboxBaudRates[] = { 2000000, 1000000, 500000, 250000, 230400, BLACKBOX_BASE_BAUDRATE };
+
+// The longest line we expect to hear from the logger
+#define BLACKBOX_REPLY_LENGTH 24
+
+/*
+ * The whole text header is rendered into RAM when logging starts, so it can be sent as fast as the device will take it.
+ * While disarmed, the same buffer collects the pre-arm frames (see blackboxCapturePrearmFrame()), which are sent right
+ * after the header. Headers come to 1.3kB for a quadcopter and 1.5kB for an octocopter, plus about 0.3kB with GPS,
+ * so this leaves room for at least 0.7kB of them while keeping the NAZE's 20kB of RAM clear of the stack.
+ */
+#define BLACKBOX_START_BUFFER_SIZE 2560
+
+// Most pre-arm frames we keep track of, more than fit in the buffer at their smallest
+#define BLACKBOX_PREARM_MAX_FRAMES 96
+
+// Time the serial port is given to settle after it's been opened, before anything is sent
+#define BLACKBOX_UART_SETTLE_MS 100
+
+/*
+ * With blackbox_compression on, the frames of each iteration are Huffman coded onto a block in RAM (see
+ * blackbox_compress.h), which is sent once it reaches BLACKBOX_BLOCK_TARGET bytes or has been open for
+ * BLACKBOX_BLOCK_MAX_ITERATIONS iterations. Iterations that write more than BLACKBOX_COMPRESS_MAX_BYTES (a keyframe on
+ * a craft with lots of motors, say) are sent uncompressed in a block of their own instead, which puts a fixed bound on
+ * the time compression can take in any one loop.
+ */
+#define BLACKBOX_COMPRESS_MAX_BYTES 96
+#define BLACKBOX_BLOCK_TARGET 96
+#define BLACKBOX_BLOCK_MAX_ITERATIONS 16
+#define BLACKBOX_BLOCK_BUFFER_SIZE (BLACKBOX_BLOCK_TARGET + (BLACKBOX_COMPRESS_MAX_BYTES * BLACKBOX_HUFFMAN_MAX_CODE_LENGTH + 7) / 8)
+
+// The marker, a raw length (which never needs more than 2 bytes) and the CRC
+#define BLACKBOX_BLOCK_OVERHEAD 4
 
 #define ARRAY_LENGTH(x) (sizeof((x))/sizeof((x)[0]))
 
@@ -23,6 +84,8 @@
 #define CONDITION(x) CONCAT(FLIGHT_LOG_FIELD_CONDITION_, x)
 #define UNSIGNED FLIGHT_LOG_FIELD_UNSIGNED
 #define SIGNED FLIGHT_LOG_FIELD_SIGNED
+#define VALUE(member, type) .valueOffset = offsetof(blackboxValues_t, member), .valueType = CONCAT(BLACKBOX_VALUE_, type)
+#define SLOW_VALUE(member, type) .valueOffset = offsetof(blackboxSlowValues_t, member), .valueType = CONCAT(BLACKBOX_VALUE_, type)
 
 /* 
  * Translate variable names from Cleanflight where possible to reduce the diff between editions.
@@ -34,8 +97,7 @@
 static const char blackboxHeader[] =
     "H Product:Blackbox flight data recorder by Nicholas Sherlock\n"
     "H Blackbox version:1\n"
-    "H Data version:2\n"
-    "H I interval:" STR(BLACKBOX_I_INTERVAL) "\n";
+    "H Data version:2\n";
 
 static const char* const blackboxMainHeaderNames[] = {
     "I name",
@@ -62,12 +124,27 @@ static const char* const blackboxGPSHHeaderNames[] = {
 };
 #endif
 
+static const char* const blackboxSlowHeaderNames[] = {
+    "S name",
+    "S signed",
+    "S predictor",
+    "S encoding"
+};
+
 /* All field definition structs should look like this (but with longer arrs): */
 typedef struct blackboxFieldDefinition_t {
     const char *name;
     uint8_t arr[1];
 } blackboxFieldDefinition_t;
 
+// How a field's value is stored in blackboxValues_t
+typedef enum BlackboxValueType {
+    BLACKBOX_VALUE_INT16 = 0,
+    BLACKBOX_VALUE_UINT16,
+    BLACKBOX_VALUE_INT32,
+    BLACKBOX_VALUE_UINT32
+} BlackboxValueType;
+
 typedef struct blackboxMainFieldDefinition_t {
     const char *name;
     uint8_t isSigned;
@@ -76,76 +153,119 @@ typedef struct blackboxMainFieldDefinition_t {
     uint8_t Ppredict;
     uint8_t Pencode;
     uint8_t condition; // Decide whether this field should appear in the log
+    uint8_t valueOffset; // Where the field lives in blackboxValues_t (which is small enough for a byte offset)
+    uint8_t valueType;
 } blackboxMainFieldDefinition_t;
 
-typedef struct blackboxGPSFieldDefinition_t {
+/*
+ * One field of the encoding plan for I, P or slow frames. The plan only holds the fields that are actually written to
+ * the log, with their predictor and encoding copied out of the field table, so the encoder just walks it.
+ */
+typedef struct blackboxPlanField_t {
+    uint8_t valueOffset;
+    uint8_t valueType;
+    uint8_t predictor;
+    uint8_t encoding;
+    uint8_t groupSize; // For group encodings, the number of fields (starting with this one) written in the group
+} blackboxPlanField_t;
+
+// The compressed block that's being filled, apart from its payload bytes
+typedef struct blackboxBlockState_t {
+    uint32_t bitBuffer;
+    uint8_t bitCount; // Bits at the bottom of bitBuffer that haven't made it into the payload yet (fewer than 8)
+    uint8_t crc;
+    uint16_t rawLength;
+    uint16_t payloadLength;
+} blackboxBlockState_t;
+
+// Definition for the frame types that only have one predictor and encoding per field (GPS frames)
+typedef struct blackboxSimpleFieldDefinition_t {
+    const char *name;
+    uint8_t isSigned;
+    uint8_t predict;
+    uint8_t encode;
+} blackboxSimpleFieldDefinition_t;
+
+// Like blackboxSimpleFieldDefinition_t, but for frames whose fields only appear in the log if their condition holds
+typedef struct blackboxConditionalFieldDefinition_t {
     const char *name;
     uint8_t isSigned;
     uint8_t predict;
     uint8_t encode;
-} blackboxGPSFieldDefinition_t;
+    uint8_t condition; // Decide whether this field should appear in the log
+    uint8_t valueOffset; // Where the field lives in blackboxSlowValues_t
+    uint8_t valueType;
+} blackboxConditionalFieldDefinition_t;
+
+// The values of a slow frame, gathered up by writeSlowFrame() for the slow frame's encoding plan to pick from
+typedef struct blackboxSlowValues_t {
+    uint32_t loopOverruns;
+    uint16_t loopMaxJitter;
+    uint16_t vbatLatest;
+    int32_t amperage;
+    int32_t mAhdrawn;
+    uint16_t rssi;
+    int16_t magADC[XYZ_AXIS_COUNT];
+    int32_t BaroAlt;
+} blackboxSlowValues_t;
 
 /**
  * Description of the blackbox fields we are writing in our main intra (I) and inter (P) frames. This description is
- * written into the flight log header so the log can be properly interpreted (but these definitions don't actually cause
- * the encoding to happen, we have to encode the flight log ourselves in write{Inter|Intra}frame() in a way that matches
- * the encoding we've promised here).
+ * written into the flight log header so the log can be properly interpreted, and it also drives the encoder: when a log
+ * starts, blackboxBuildEncodingPlans() turns it into the list of fields to write for each frame type. So adding a field
+ * only takes a new line here (and a member in blackboxValues_t to load it into).
+ *
+ * Fields which share a group encoding (TAG2_3S32, TAG8_4S16, TAG8_8SVB, TAG5_4SNBIT) in P-frames are written together,
+ * so they must be consecutive in this table.
  */
 static const blackboxMainFieldDefinition_t blackboxMainFields[] = {
     /* loopIteration doesn't appear in P frames since it always increments */
-    {"loopIteration", UNSIGNED, .Ipredict = PREDICT(0),       .Iencode = ENCODING(UNSIGNED_VB), .Ppredict = PREDICT(INC),           .Pencode = FLIGHT_LOG_FIELD_ENCODING_NULL, CONDITION(ALWAYS)},
+    {"loopIteration", UNSIGNED, .Ipredict = PREDICT(0),       .Iencode = ENCODING(UNSIGNED_VB), .Ppredict = PREDICT(INC),           .Pencode = FLIGHT_LOG_FIELD_ENCODING_NULL, CONDITION(ALWAYS), VALUE(loopIteration, UINT32)},
     /* Time advances pretty steadily so the P-frame prediction is a straight line */
-    {"time",          UNSIGNED, .Ipredict = PREDICT(0),       .Iencode = ENCODING(UNSIGNED_VB), .Ppredict = PREDICT(STRAIGHT_LINE), .Pencode = ENCODING(SIGNED_VB), CONDITION(ALWAYS)},
-    {"axisP[0]",      SIGNED,   .Ipredict = PREDICT(0),       .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(PREVIOUS),      .Pencode = ENCODING(SIGNED_VB), CONDITION(ALWAYS)},
-    {"axisP[1]",      SIGNED,   .Ipredict = PREDICT(0),       .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(PREVIOUS),      .Pencode = ENCODING(SIGNED_VB), CONDITION(ALWAYS)},
-    {"axisP[2]",      SIGNED,   .Ipredict = PREDICT(0),       .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(PREVIOUS),      .Pencode = ENCODING(SIGNED_VB), CONDITION(ALWAYS)},
+    {"time",          UNSIGNED, .Ipredict = PREDICT(0),       .Iencode = ENCODING(UNSIGNED_VB), .Ppredict = PREDICT(STRAIGHT_LINE), .Pencode = ENCODING(SIGNED_VB), CONDITION(ALWAYS), VALUE(time, UINT32)},
+    {"axisP[0]",      SIGNED,   .Ipredict = PREDICT(0),       .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(PREVIOUS),      .Pencode = ENCODING(SIGNED_VB), CONDITION(ALWAYS), VALUE(axisPID_P[0], INT32)},
+    {"axisP[1]",      SIGNED,   .Ipredict = PREDICT(0),       .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(PREVIOUS),      .Pencode = ENCODING(SIGNED_VB), CONDITION(ALWAYS), VALUE(axisPID_P[1], INT32)},
+    {"axisP[2]",      SIGNED,   .Ipredict = PREDICT(0),       .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(PREVIOUS),      .Pencode = ENCODING(SIGNED_VB), CONDITION(ALWAYS), VALUE(axisPID_P[2], INT32)},
     /* I terms get special packed encoding in P frames: */
-    {"axisI[0]",      SIGNED,   .Ipredict = PREDICT(0),       .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(PREVIOUS),      .Pencode = ENCODING(TAG2_3S32), CONDITION(ALWAYS)},
-    {"axisI[1]",      SIGNED,   .Ipredict = PREDICT(0),       .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(PREVIOUS),      .Pencode = ENCODING(TAG2_3S32), CONDITION(ALWAYS)},
-    {"axisI[2]",      SIGNED,   .Ipredict = PREDICT(0),       .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(PREVIOUS),      .Pencode = ENCODING(TAG2_3S32), CONDITION(ALWAYS)},
-    {"axisD[0]",      SIGNED,   .Ipredict = PREDICT(0),       .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(PREVIOUS),      .Pencode = ENCODING(SIGNED_VB), CONDITION(NONZERO_PID_D_0)},
-    {"axisD[1]",      SIGNED,   .Ipredict = PREDICT(0),       .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(PREVIOUS),      .Pencode = ENCODING(SIGNED_VB), CONDITION(NONZERO_PID_D_1)},
-    {"axisD[2]",      SIGNED,   .Ipredict = PREDICT(0),       .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(PREVIOUS),      .Pencode = ENCODING(SIGNED_VB), CONDITION(NONZERO_PID_D_2)},
+    {"axisI[0]",      SIGNED,   .Ipredict = PREDICT(0),       .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(PREVIOUS),      .Pencode = ENCODING(TAG2_3S32), CONDITION(ALWAYS), VALUE(axisPID_I[0], INT32)},
+    {"axisI[1]",      SIGNED,   .Ipredict = PREDICT(0),       .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(PREVIOUS),      .Pencode = ENCODING(TAG2_3S32), CONDITION(ALWAYS), VALUE(axisPID_I[1], INT32)},
+    {"axisI[2]",      SIGNED,   .Ipredict = PREDICT(0),       .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(PREVIOUS),      .Pencode = ENCODING(TAG2_3S32), CONDITION(ALWAYS), VALUE(axisPID_I[2], INT32)},
+    {"axisD[0]",      SIGNED,   .Ipredict = PREDICT(0),       .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(PREVIOUS),      .Pencode = ENCODING(SIGNED_VB), CONDITION(NONZERO_PID_D_0), VALUE(axisPID_D[0], INT32)},
+    {"axisD[1]",      SIGNED,   .Ipredict = PREDICT(0),       .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(PREVIOUS),      .Pencode = ENCODING(SIGNED_VB), CONDITION(NONZERO_PID_D_1), VALUE(axisPID_D[1], INT32)},
+    {"axisD[2]",      SIGNED,   .Ipredict = PREDICT(0),       .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(PREVIOUS),      .Pencode = ENCODING(SIGNED_VB), CONDITION(NONZERO_PID_D_2), VALUE(axisPID_D[2], INT32)},
     /* rcCommands are encoded together as a group in P-frames: */
-    {"rcCommand[0]",  SIGNED,   .Ipredict = PREDICT(0),       .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(PREVIOUS),      .Pencode = ENCODING(TAG8_4S16), CONDITION(ALWAYS)},
-    {"rcCommand[1]",  SIGNED,   .Ipredict = PREDICT(0),       .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(PREVIOUS),      .Pencode = ENCODING(TAG8_4S16), CONDITION(ALWAYS)},
-    {"rcCommand[2]",  SIGNED,   .Ipredict = PREDICT(0),       .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(PREVIOUS),      .Pencode = ENCODING(TAG8_4S16), CONDITION(ALWAYS)},
+    {"rcCommand[0]",  SIGNED,   .Ipredict = PREDICT(0),       .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(PREVIOUS),      .Pencode = ENCODING(TAG8_4S16), CONDITION(ALWAYS), VALUE(rcCommand[0], INT16)},
+    {"rcCommand[1]",  SIGNED,   .Ipredict = PREDICT(0),       .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(PREVIOUS),      .Pencode = ENCODING(TAG8_4S16), CONDITION(ALWAYS), VALUE(rcCommand[1], INT16)},
+    {"rcCommand[2]",  SIGNED,   .Ipredict = PREDICT(0),       .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(PREVIOUS),      .Pencode = ENCODING(TAG8_4S16), CONDITION(ALWAYS), VALUE(rcCommand[2], INT16)},
     /* Throttle is always in the range [minthrottle..maxthrottle]: */
-    {"rcCommand[3]",  UNSIGNED, .Ipredict = PREDICT(MINTHROTTLE), .Iencode = ENCODING(UNSIGNED_VB), .Ppredict = PREDICT(PREVIOUS),  .Pencode = ENCODING(TAG8_4S16), CONDITION(ALWAYS)},
-
-    {"vbatLatest",    UNSIGNED, .Ipredict = PREDICT(VBATREF), .Iencode = ENCODING(NEG_14BIT),   .Ppredict = PREDICT(PREVIOUS),      .Pencode = ENCODING(TAG8_8SVB), FLIGHT_LOG_FIELD_CONDITION_VBAT},
-#ifdef MAG
-    {"magADC[0]",     SIGNED,   .Ipredict = PREDICT(0),       .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(PREVIOUS),      .Pencode = ENCODING(TAG8_8SVB), FLIGHT_LOG_FIELD_CONDITION_MAG},
-    {"magADC[1]",     SIGNED,   .Ipredict = PREDICT(0),       .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(PREVIOUS),      .Pencode = ENCODING(TAG8_8SVB), FLIGHT_LOG_FIELD_CONDITION_MAG},
-    {"magADC[2]",     SIGNED,   .Ipredict = PREDICT(0),       .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(PREVIOUS),      .Pencode = ENCODING(TAG8_8SVB), FLIGHT_LOG_FIELD_CONDITION_MAG},
-#endif
-#ifdef BARO
-    {"BaroAlt",       SIGNED,   .Ipredict = PREDICT(0),       .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(PREVIOUS),      .Pencode = ENCODING(TAG8_8SVB), FLIGHT_LOG_FIELD_CONDITION_BARO},
-#endif
+    {"rcCommand[3]",  UNSIGNED, .Ipredict = PREDICT(MINTHROTTLE), .Iencode = ENCODING(UNSIGNED_VB), .Ppredict = PREDICT(PREVIOUS),  .Pencode = ENCODING(TAG8_4S16), CONDITION(ALWAYS), VALUE(rcCommand[3], INT16)},
 
-    /* Gyros and accelerometers base their P-predictions on the average of the previous 2 frames to reduce noise impact */
-    {"gyroData[0]",   SIGNED,   .Ipredict = PREDICT(0),       .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(AVERAGE_2),     .Pencode = ENCODING(SIGNED_VB), CONDITION(ALWAYS)},
-    {"gyroData[1]",   SIGNED,   .Ipredict = PREDICT(0),       .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(AVERAGE_2),     .Pencode = ENCODING(SIGNED_VB), CONDITION(ALWAYS)},
-    {"gyroData[2]",   SIGNED,   .Ipredict = PREDICT(0),       .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(AVERAGE_2),     .Pencode = ENCODING(SIGNED_VB), CONDITION(ALWAYS)},
-    {"accSmooth[0]",  SIGNED,   .Ipredict = PREDICT(0),       .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(AVERAGE_2),     .Pencode = ENCODING(SIGNED_VB), CONDITION(ALWAYS)},
-    {"accSmooth[1]",  SIGNED,   .Ipredict = PREDICT(0),       .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(AVERAGE_2),     .Pencode = ENCODING(SIGNED_VB), CONDITION(ALWAYS)},
-    {"accSmooth[2]",  SIGNED,   .Ipredict = PREDICT(0),       .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(AVERAGE_2),     .Pencode = ENCODING(SIGNED_VB), CONDITION(ALWAYS)},
+    /*
+     * Gyros and accelerometers base their P-predictions on the average of the previous 2 frames to reduce noise impact.
+     * Their deltas (and the motors') are mostly small, so each axis group is bit-packed at a width picked per frame.
+     */
+    {"gyroData[0]",   SIGNED,   .Ipredict = PREDICT(0),       .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(AVERAGE_2),     .Pencode = ENCODING(TAG5_4SNBIT), CONDITION(ALWAYS), VALUE(gyroData[0], INT16)},
+    {"gyroData[1]",   SIGNED,   .Ipredict = PREDICT(0),       .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(AVERAGE_2),     .Pencode = ENCODING(TAG5_4SNBIT), CONDITION(ALWAYS), VALUE(gyroData[1], INT16)},
+    {"gyroData[2]",   SIGNED,   .Ipredict = PREDICT(0),       .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(AVERAGE_2),     .Pencode = ENCODING(TAG5_4SNBIT), CONDITION(ALWAYS), VALUE(gyroData[2], INT16)},
+    {"accSmooth[0]",  SIGNED,   .Ipredict = PREDICT(0),       .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(AVERAGE_2),     .Pencode = ENCODING(TAG5_4SNBIT), CONDITION(ALWAYS), VALUE(accSmooth[0], INT16)},
+    {"accSmooth[1]",  SIGNED,   .Ipredict = PREDICT(0),       .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(AVERAGE_2),     .Pencode = ENCODING(TAG5_4SNBIT), CONDITION(ALWAYS), VALUE(accSmooth[1], INT16)},
+    {"accSmooth[2]",  SIGNED,   .Ipredict = PREDICT(0),       .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(AVERAGE_2),     .Pencode = ENCODING(TAG5_4SNBIT), CONDITION(ALWAYS), VALUE(accSmooth[2], INT16)},
     /* Motors only rarely drops under minthrottle (when stick falls below mincommand), so predict minthrottle for it and use *unsigned* encoding (which is large for negative numbers but more compact for positive ones): */
-    {"motor[0]",      UNSIGNED, .Ipredict = PREDICT(MINTHROTTLE), .Iencode = ENCODING(UNSIGNED_VB), .Ppredict = PREDICT(AVERAGE_2), .Pencode = ENCODING(SIGNED_VB), CONDITION(AT_LEAST_MOTORS_1)},
+    {"motor[0]",      UNSIGNED, .Ipredict = PREDICT(MINTHROTTLE), .Iencode = ENCODING(UNSIGNED_VB), .Ppredict = PREDICT(AVERAGE_2), .Pencode = ENCODING(TAG5_4SNBIT), CONDITION(AT_LEAST_MOTORS_1), VALUE(motor[0], INT16)},
     /* Subsequent motors base their I-frame values on the first one, P-frame values on the average of last two frames: */
-    {"motor[1]",      UNSIGNED, .Ipredict = PREDICT(MOTOR_0), .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(AVERAGE_2),     .Pencode = ENCODING(SIGNED_VB), CONDITION(AT_LEAST_MOTORS_2)},
-    {"motor[2]",      UNSIGNED, .Ipredict = PREDICT(MOTOR_0), .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(AVERAGE_2),     .Pencode = ENCODING(SIGNED_VB), CONDITION(AT_LEAST_MOTORS_3)},
-    {"motor[3]",      UNSIGNED, .Ipredict = PREDICT(MOTOR_0), .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(AVERAGE_2),     .Pencode = ENCODING(SIGNED_VB), CONDITION(AT_LEAST_MOTORS_4)},
-    {"motor[4]",      UNSIGNED, .Ipredict = PREDICT(MOTOR_0), .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(AVERAGE_2),     .Pencode = ENCODING(SIGNED_VB), CONDITION(AT_LEAST_MOTORS_5)},
-    {"motor[5]",      UNSIGNED, .Ipredict = PREDICT(MOTOR_0), .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(AVERAGE_2),     .Pencode = ENCODING(SIGNED_VB), CONDITION(AT_LEAST_MOTORS_6)},
-    {"motor[6]",      UNSIGNED, .Ipredict = PREDICT(MOTOR_0), .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(AVERAGE_2),     .Pencode = ENCODING(SIGNED_VB), CONDITION(AT_LEAST_MOTORS_7)},
-    {"motor[7]",      UNSIGNED, .Ipredict = PREDICT(MOTOR_0), .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(AVERAGE_2),     .Pencode = ENCODING(SIGNED_VB), CONDITION(AT_LEAST_MOTORS_8)},
-    {"servo[5]",      UNSIGNED, .Ipredict = PREDICT(1500),    .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(PREVIOUS),      .Pencode = ENCODING(SIGNED_VB), CONDITION(TRICOPTER)}
+    {"motor[1]",      UNSIGNED, .Ipredict = PREDICT(MOTOR_0), .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(AVERAGE_2),     .Pencode = ENCODING(TAG5_4SNBIT), CONDITION(AT_LEAST_MOTORS_2), VALUE(motor[1], INT16)},
+    {"motor[2]",      UNSIGNED, .Ipredict = PREDICT(MOTOR_0), .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(AVERAGE_2),     .Pencode = ENCODING(TAG5_4SNBIT), CONDITION(AT_LEAST_MOTORS_3), VALUE(motor[2], INT16)},
+    {"motor[3]",      UNSIGNED, .Ipredict = PREDICT(MOTOR_0), .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(AVERAGE_2),     .Pencode = ENCODING(TAG5_4SNBIT), CONDITION(AT_LEAST_MOTORS_4), VALUE(motor[3], INT16)},
+    {"motor[4]",      UNSIGNED, .Ipredict = PREDICT(MOTOR_0), .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(AVERAGE_2),     .Pencode = ENCODING(TAG5_4SNBIT), CONDITION(AT_LEAST_MOTORS_5), VALUE(motor[4], INT16)},
+    {"motor[5]",      UNSIGNED, .Ipredict = PREDICT(MOTOR_0), .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(AVERAGE_2),     .Pencode = ENCODING(TAG5_4SNBIT), CONDITION(AT_LEAST_MOTORS_6), VALUE(motor[5], INT16)},
+    {"motor[6]",      UNSIGNED, .Ipredict = PREDICT(MOTOR_0), .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(AVERAGE_2),     .Pencode = ENCODING(TAG5_4SNBIT), CONDITION(AT_LEAST_MOTORS_7), VALUE(motor[6], INT16)},
+    {"motor[7]",      UNSIGNED, .Ipredict = PREDICT(MOTOR_0), .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(AVERAGE_2),     .Pencode = ENCODING(TAG5_4SNBIT), CONDITION(AT_LEAST_MOTORS_8), VALUE(motor[7], INT16)},
+    {"servo[5]",      UNSIGNED, .Ipredict = PREDICT(1500),    .Iencode = ENCODING(SIGNED_VB),   .Ppredict = PREDICT(PREVIOUS),      .Pencode = ENCODING(SIGNED_VB), CONDITION(TRICOPTER), VALUE(servo[5], INT16)}
 };
 
 #ifdef GPS
 // GPS position/vel frame
-static const blackboxGPSFieldDefinition_t blackboxGpsGFields[] = {
+static const blackboxSimpleFieldDefinition_t blackboxGpsGFields[] = {
     {"GPS_numSat",    UNSIGNED, PREDICT(0),          ENCODING(UNSIGNED_VB)},
     {"GPS_coord[0]",  SIGNED,   PREDICT(HOME_COORD), ENCODING(SIGNED_VB)},
     {"GPS_coord[1]",  SIGNED,   PREDICT(HOME_COORD), ENCODING(SIGNED_VB)},
@@ -155,22 +275,46 @@ static const blackboxGPSFieldDefinition_t blackboxGpsGFields[] = {
 };
 
 // GPS home frame
-static const blackboxGPSFieldDefinition_t blackboxGpsHFields[] = {
+static const blackboxSimpleFieldDefinition_t blackboxGpsHFields[] = {
     {"GPS_home[0]",   SIGNED,   PREDICT(0),          ENCODING(SIGNED_VB)},
     {"GPS_home[1]",   SIGNED,   PREDICT(0),          ENCODING(SIGNED_VB)}
 };
 #endif
 
+/*
+ * Slow frame, for the values that only change every few loop iterations (battery, current, RSSI, magnetometer and
+ * barometer) and for loop timing statistics covering the iterations since the last one. It's written every
+ * blackbox_slow_interval iterations rather than in every main frame. Its fields only predict from constants, so each
+ * slow frame can be decoded on its own. Like the main frames, the encoder is driven from this table.
+ */
+static const blackboxConditionalFieldDefinition_t blackboxSlowFields[] = {
+    /* Number of looptime slots that were skipped because an iteration started too late */
+    {"loopOverruns",  UNSIGNED, PREDICT(0),          ENCODING(UNSIGNED_VB), CONDITION(ALWAYS),               SLOW_VALUE(loopOverruns, UINT32)},
+    /* Longest delay in microseconds between an iteration being due and it starting */
+    {"loopMaxJitter", UNSIGNED, PREDICT(0),          ENCODING(UNSIGNED_VB), CONDITION(ALWAYS),               SLOW_VALUE(loopMaxJitter, UINT16)},
+
+    {"vbatLatest",    UNSIGNED, PREDICT(VBATREF),    ENCODING(NEG_14BIT),   FLIGHT_LOG_FIELD_CONDITION_VBAT, SLOW_VALUE(vbatLatest, UINT16)},
+    {"amperage",      SIGNED,   PREDICT(0),          ENCODING(SIGNED_VB),   CONDITION(AMPERAGE),             SLOW_VALUE(amperage, INT32)},
+    {"mAhdrawn",      SIGNED,   PREDICT(0),          ENCODING(SIGNED_VB),   CONDITION(AMPERAGE),             SLOW_VALUE(mAhdrawn, INT32)},
+    {"rssi",          UNSIGNED, PREDICT(0),          ENCODING(UNSIGNED_VB), CONDITION(RSSI),                 SLOW_VALUE(rssi, UINT16)},
+#ifdef MAG
+    {"magADC[0]",     SIGNED,   PREDICT(0),          ENCODING(SIGNED_VB),   FLIGHT_LOG_FIELD_CONDITION_MAG,  SLOW_VALUE(magADC[0], INT16)},
+    {"magADC[1]",     SIGNED,   PREDICT(0),          ENCODING(SIGNED_VB),   FLIGHT_LOG_FIELD_CONDITION_MAG,  SLOW_VALUE(magADC[1], INT16)},
+    {"magADC[2]",     SIGNED,   PREDICT(0),          ENCODING(SIGNED_VB),   FLIGHT_LOG_FIELD_CONDITION_MAG,  SLOW_VALUE(magADC[2], INT16)},
+#endif
+#ifdef BARO
+    {"BaroAlt",       SIGNED,   PREDICT(0),          ENCODING(SIGNED_VB),   FLIGHT_LOG_FIELD_CONDITION_BARO, SLOW_VALUE(BaroAlt, INT32)},
+#endif
+};
+
 typedef enum BlackboxState {
     BLACKBOX_STATE_DISABLED = 0,
     BLACKBOX_STATE_STOPPED,
+    BLACKBOX_STATE_NEGOTIATE_BAUDRATE,
     BLACKBOX_STATE_SEND_HEADER,
-    BLACKBOX_STATE_SEND_FIELDINFO,
-    BLACKBOX_STATE_SEND_GPS_H_HEADERS,
-    BLACKBOX_STATE_SEND_GPS_G_HEADERS,
-    BLACKBOX_STATE_SEND_SYSINFO,
     BLACKBOX_STATE_PRERUN,
-    BLACKBOX_STATE_RUNNING
+    BLACKBOX_STATE_RUNNING,
+    BLACKBOX_STATE_SHUTTING_DOWN
 } BlackboxState;
 
 typedef struct gpsState_t {
@@ -181,31 +325,184 @@ typedef struct gpsState_t {
 //From mixer.c:
 extern uint8_t motorCount;
 
-// How many bytes should we transmit per loop iteration?
-static uint8_t serialChunkSize = 16;
-
 static BlackboxState blackboxState = BLACKBOX_STATE_DISABLED;
 
-static struct {
-    uint32_t headerIndex;
+static uint8_t blackboxStartBuffer[BLACKBOX_START_BUFFER_SIZE];
+static int blackboxHeaderStart;         // where the header is being rendered in blackboxStartBuffer
+static int blackboxHeaderLength;        // may run past the end of the buffer if the header didn't fit
+static int blackboxStartLength;         // how much of blackboxStartBuffer is to be sent when the log starts (or ends)
+static int blackboxStartPos;            // and how much of that has been sent
+
+// The pre-arm frames at the front of blackboxStartBuffer, oldest first
+static bool blackboxPrearmStarted;
+static int blackboxPrearmLength;
+static int blackboxPrearmFrameCount;
+static uint8_t blackboxPrearmFrameLength[BLACKBOX_PREARM_MAX_FRAMES];
+#ifdef SITL
+static blackboxValues_t blackboxPrearmValues[BLACKBOX_PREARM_MAX_FRAMES];
+#endif
 
-    /* Since these fields are used during different blackbox states (never simultaneously) we can
-     * overlap them to save on RAM
-     */
-    union {
-        int fieldIndex;
-        int serialBudget;
-        uint32_t startTime;
-    } u;
-} xmitState;
+// What the pre-arm frames were encoded with, the header has to agree for them to be any use
+static uint32_t blackboxPrearmConditionCache;
+static uint8_t blackboxPrearmFrameCheck;
+
+// When the logging device was opened, it gets BLACKBOX_UART_SETTLE_MS before we send it anything
+static uint32_t blackboxDeviceOpenTime;
 
 static uint32_t blackboxConditionCache;
 
+// What to write for each I, P and slow frame of the current log, built by blackboxBuildEncodingPlans()
+static blackboxPlanField_t blackboxIntraPlan[ARRAY_LENGTH(blackboxMainFields)];
+static blackboxPlanField_t blackboxInterPlan[ARRAY_LENGTH(blackboxMainFields)];
+static blackboxPlanField_t blackboxSlowPlan[ARRAY_LENGTH(blackboxSlowFields)];
+static uint8_t blackboxIntraPlanLength, blackboxInterPlanLength, blackboxSlowPlanLength;
+
 static uint32_t blackboxIteration;
 static uint32_t blackboxPFrameIndex, blackboxIFrameIndex;
 
+/*
+ * For the adaptive keyframe policy (blackbox_i_threshold): when the last keyframe was written, and the size of the
+ * largest P-frame since then.
+ */
+static uint32_t blackboxLastKeyframeIteration;
+static int blackboxLargestInterframe;
+
+/*
+ * Capture windows (blackbox_capture_window): when a trigger fires, every iteration is logged until the window runs
+ * out, whatever the P interval says. The last few iterations that the P interval skipped are kept as well, so the
+ * window starts a little ahead of the trigger. CAPTURE_START and CAPTURE_END events mark the window in the log, which
+ * also tells decoders which iterations to expect frames for.
+ */
+#define BLACKBOX_CAPTURE_LOOKBACK 3
+
+static uint32_t blackboxCaptureUntil;               // first iteration after the current window
+static bool blackboxCaptureLogged;                  // whether the log has the current window's start (and not its end)
+static uint8_t blackboxCaptureTriggers;             // FlightLogCaptureTrigger mask for the next start event
+static int16_t blackboxCaptureLastGyro[XYZ_AXIS_COUNT];
+
+// The iterations skipped since the last logged frame, oldest first
+static blackboxValues_t blackboxCaptureLookback[BLACKBOX_CAPTURE_LOOKBACK];
+static int blackboxCaptureLookbackCount;
+
+/*
+ * Events from the rest of the flight controller (see blackboxLogEvent()) wait here until they're written, a couple per
+ * iteration so they don't crowd the frames out of the frame buffer. They stay until they're safely out, and when the
+ * queue is full the oldest give way. Events are only queued while a log is open (see blackboxLogEvent()), and the
+ * ones still waiting when it ends go out just ahead of its footer.
+ */
+#define BLACKBOX_EVENT_QUEUE_LENGTH 8
+#define BLACKBOX_EVENTS_PER_ITERATION 2
+
+typedef struct blackboxEvent_t {
+    uint8_t event;
+    uint32_t time;
+    uint32_t data;
+} blackboxEvent_t;
+
+static blackboxEvent_t blackboxEventQueue[BLACKBOX_EVENT_QUEUE_LENGTH];
+static int blackboxEventCount;
+
+/*
+ * The footer at the end of each log indexes some of its keyframes (see FLIGHT_LOG_FOOTER_MAGIC). Only so many fit in
+ * RAM, so once the index fills up every other entry is dropped and only every other keyframe is indexed from then on,
+ * which keeps the entries spread evenly over flights of any length. 32 of them still find any point of a flight to within
+ * a sixteenth of its length, and keep the index to 256 bytes of the F103's 20kB of RAM.
+ */
+#define BLACKBOX_INDEX_LENGTH 32
+
+typedef struct blackboxIndexEntry_t {
+    uint32_t time;
+    uint32_t offset;
+} blackboxIndexEntry_t;
+
+static blackboxIndexEntry_t blackboxIndex[BLACKBOX_INDEX_LENGTH];
+static int blackboxIndexLength;
+static uint32_t blackboxIndexStride;    // index one in this many keyframes
+static uint32_t blackboxKeyframeCount;  // keyframes stored in this log
+
+// A keyframe in the compressed block that's being built, which can only be indexed once we know where the block goes
+static bool blackboxIndexPending;
+static uint32_t blackboxIndexPendingTime;
+
+// Bytes sent to the logging device since the log's header started, and where the last compressed block went
+static uint32_t blackboxBytesWritten;
+static uint32_t blackboxLastBlockOffset;
+
+// For the footer
+static uint32_t blackboxLogStartTime, blackboxLogStartIteration;
+static uint32_t blackboxLoggedEvents;
+
+// When we started sending the end of the log, we give up waiting for the port to send it after this long
+#define BLACKBOX_SHUTDOWN_TIMEOUT_MS 500
+
+static uint32_t blackboxShutdownTime;
+
 static serialPort_t *blackboxPort;
 
+typedef enum {
+    BLACKBOX_NEGOTIATE_ASK = 0,
+    BLACKBOX_NEGOTIATE_WAIT_OFFER,
+    BLACKBOX_NEGOTIATE_SWITCH,
+    BLACKBOX_NEGOTIATE_CONFIRM,
+    BLACKBOX_NEGOTIATE_WAIT_CONFIRM
+} blackboxNegotiateStep_e;
+
+static struct {
+    blackboxNegotiateStep_e step;
+    uint32_t stepTime;
+    uint32_t baudRate;                  // the rate we offered the logger
+
+    char reply[BLACKBOX_REPLY_LENGTH];
+    uint8_t replyLength;
+} blackboxNegotiation;
+
+// The rate that the logger has agreed to, or 0 if we haven't negotiated one yet
+static uint32_t blackboxNegotiatedBaudRate;
+
+/*
+ * Everything an iteration writes is encoded into RAM first and then committed to the logging device in one go, so the
+ * frame buffer has to hold the most that one iteration can write: the queued events and a capture event, a slow frame,
+ * a FRAMES_DROPPED event and a main frame (an I-frame at its largest), and the GPS home and GPS frames. Frames take a
+ * marker, at most 5 bytes per field and a CRC, events at most 13 bytes. If the buffer overflows anyway, the iteration
+ * is thrown away just like one that the device had no room for.
+ */
+#define BLACKBOX_MAX_EVENT_SIZE 13
+#define BLACKBOX_MAX_FRAME_SIZE(fields) (1 + (int) ARRAY_LENGTH(fields) * 5 + 1)
+
+#ifdef GPS
+#define BLACKBOX_MAX_GPS_SIZE (BLACKBOX_MAX_FRAME_SIZE(blackboxGpsHFields) + BLACKBOX_MAX_FRAME_SIZE(blackboxGpsGFields))
+#else
+#define BLACKBOX_MAX_GPS_SIZE 0
+#endif
+
+#define BLACKBOX_FRAME_BUFFER_SIZE ((BLACKBOX_EVENTS_PER_ITERATION + 2) * BLACKBOX_MAX_EVENT_SIZE \
+    + BLACKBOX_MAX_FRAME_SIZE(blackboxSlowFields) + BLACKBOX_MAX_FRAME_SIZE(blackboxMainFields) + BLACKBOX_MAX_GPS_SIZE)
+
+static uint8_t blackboxFrameBuffer[BLACKBOX_FRAME_BUFFER_SIZE];
+static int blackboxFrameBufferPos;
+static bool blackboxFrameBufferOverflowed;  // bytes were lost since the last flush, so it must not be committed
+
+// Where the frame that's being written starts in blackboxFrameBuffer
+static int blackboxFrameStart;
+
+// Whether the frames are going into compressed blocks, which starts once the text header has been sent
+static bool blackboxCompressing;
+static blackboxBlockState_t blackboxBlock;
+static uint8_t blackboxBlockPayload[BLACKBOX_BLOCK_BUFFER_SIZE];
+static uint32_t blackboxBlockStartIteration;
+
+/*
+ * Number of frames we've thrown away because the serial port couldn't accept them since the last frame that made it
+ * out. While this is non-zero we only attempt I-frames, since P-frames can't be decoded without the frames we lost.
+ */
+static uint32_t blackboxDroppedFrames;
+
+// Value of loopOverrunCount when the last slow frame made it out, slow frames log the overruns since then
+static uint32_t blackboxLastLoopOverrunCount;
+
+// blackboxIteration when the last slow frame made it out
+static uint32_t blackboxLastSlowFrameIteration;
+
 /*
  * We store voltages in I-frames relative to this, which was the voltage when the blackbox was activated.
  * This helps out since the voltage is only expected to fall from that point and we can reduce our diffs
@@ -214,24 +511,270 @@ static serialPort_t *blackboxPort;
 static uint16_t vbatReference;
 static gpsState_t gpsHistory;
 
-// Keep a history of length 2, plus a buffer for MW to store the new values into
-static blackboxValues_t blackboxHistoryRing[3];
+// Keep a history of length 3, plus a buffer for MW to store the new values into
+#define BLACKBOX_HISTORY_LENGTH 4
+
+static blackboxValues_t blackboxHistoryRing[BLACKBOX_HISTORY_LENGTH];
 
-// These point into blackboxHistoryRing, use them to know where to store history of a given age (0, 1 or 2 generations old)
-static blackboxValues_t* blackboxHistory[3];
+// These point into blackboxHistoryRing, use them to know where to store history of a given age (0, 1, 2 or 3 generations old)
+static blackboxValues_t* blackboxHistory[BLACKBOX_HISTORY_LENGTH];
 
+/*
+ * The mixer's motor coefficients (throttle, roll, pitch, yaw) scaled by 1000, as written to the header for the MIXER
+ * predictor. The yaw coefficient already includes the yaw_direction setting.
+ */
+static int16_t blackboxMotorMix[MAX_MOTORS][4];
+
+/**
+ * Append a byte to the frame buffer. Nothing reaches the serial port until blackboxFlush() is called.
+ */
 static void blackboxWrite(uint8_t value)
 {
-    serialWrite(blackboxPort, value);
+    if (blackboxFrameBufferPos < BLACKBOX_FRAME_BUFFER_SIZE)
+        blackboxFrameBuffer[blackboxFrameBufferPos++] = value;
+    else
+        blackboxFrameBufferOverflowed = true;
+}
+
+/**
+ * How many bytes can we hand to the logging device right now without overwriting data it hasn't stored yet?
+ */
+static uint32_t blackboxDeviceFreeSpace(void)
+{
+    switch (masterConfig.blackbox_device) {
+#ifdef FLASHFS
+        case BLACKBOX_DEVICE_FLASH:
+            return flashfsGetWriteBufferFreeSpace();
+#endif
+        case BLACKBOX_DEVICE_SERIAL:
+        default:
+            return serialTxBytesFree(blackboxPort);
+    }
+}
+
+/**
+ * Hand bytes to the logging device and return how many it accepted, which is fewer than `count` if more was asked of
+ * it than blackboxDeviceFreeSpace() allowed, or if the flash chip filled up or stopped responding.
+ */
+static int blackboxDeviceWrite(const uint8_t *data, int count)
+{
+    switch (masterConfig.blackbox_device) {
+#ifdef FLASHFS
+        case BLACKBOX_DEVICE_FLASH:
+            count = flashfsWrite(data, count);
+        break;
+#endif
+        case BLACKBOX_DEVICE_SERIAL:
+        default:
+            count = serialWriteBuf(blackboxPort, data, count);
+        break;
+    }
+
+    blackboxBytesWritten += count;
+
+    return count;
+}
+
+/**
+ * Has the logging device stored everything we've given it?
+ */
+static bool blackboxDeviceIsIdle(void)
+{
+    switch (masterConfig.blackbox_device) {
+#ifdef FLASHFS
+        case BLACKBOX_DEVICE_FLASH:
+            // Closing the device waits for the flash chip to catch up
+            return true;
+#endif
+        case BLACKBOX_DEVICE_SERIAL:
+        default:
+            return isSerialTransmitBufferEmpty(blackboxPort);
+    }
+}
+
+static void blackboxAddIndexEntry(uint32_t time, uint32_t offset)
+{
+    int i;
+
+    if (blackboxIndexLength == BLACKBOX_INDEX_LENGTH) {
+        for (i = 0; i < BLACKBOX_INDEX_LENGTH / 2; i++)
+            blackboxIndex[i] = blackboxIndex[i * 2];
+        blackboxIndexLength = BLACKBOX_INDEX_LENGTH / 2;
+        blackboxIndexStride *= 2;
+    }
+
+    blackboxIndex[blackboxIndexLength].time = time;
+    blackboxIndex[blackboxIndexLength].offset = offset;
+    blackboxIndexLength++;
+}
+
+// Fill in a block's marker and raw length (at most 3 bytes), returning how many bytes that took
+static int blackboxRenderBlockHeader(uint8_t *header, uint8_t marker, uint16_t rawLength)
+{
+    int headerLength = 0;
+
+    header[headerLength++] = marker;
+    while (rawLength > 127) {
+        header[headerLength++] = (uint8_t) (rawLength | 0x80);
+        rawLength >>= 7;
+    }
+    header[headerLength++] = rawLength;
+
+    return headerLength;
+}
+
+// Write a block's marker and raw length to the logging device
+static void blackboxWriteBlockHeader(uint8_t marker, uint16_t rawLength)
+{
+    uint8_t header[3];
+
+    blackboxDeviceWrite(header, blackboxRenderBlockHeader(header, marker, rawLength));
+}
+
+/**
+ * Send the compressed block to the logging device, if it holds anything. The room it needs was checked as each
+ * iteration was added to it, and the device's free space can only have grown since, so this always succeeds.
+ */
+static void blackboxCloseBlock(void)
+{
+    if (blackboxBlock.rawLength == 0)
+        return;
+
+    blackboxLastBlockOffset = blackboxBytesWritten;
+    if (blackboxIndexPending) {
+        blackboxAddIndexEntry(blackboxIndexPendingTime, blackboxLastBlockOffset);
+        blackboxIndexPending = false;
+    }
+
+    // Pad out the last byte with zero bits
+    if (blackboxBlock.bitCount > 0) {
+        blackboxBlockPayload[blackboxBlock.payloadLength++] =
+            (uint8_t) (blackboxBlock.bitBuffer << (8 - blackboxBlock.bitCount));
+    }
+
+    blackboxWriteBlockHeader(BLACKBOX_BLOCK_HUFFMAN, blackboxBlock.rawLength);
+    blackboxDeviceWrite(blackboxBlockPayload, blackboxBlock.payloadLength);
+    blackboxDeviceWrite(&blackboxBlock.crc, 1);
+
+    memset(&blackboxBlock, 0, sizeof(blackboxBlock));
+}
+
+/**
+ * Send the frame buffer uncompressed in a block of its own. Returns false if the device doesn't have room for it.
+ */
+static bool blackboxWriteStoredBlock(void)
+{
+    uint8_t crc = 0;
+    int i;
+
+    if (blackboxDeviceFreeSpace() < (uint32_t) (blackboxFrameBufferPos + BLACKBOX_BLOCK_OVERHEAD))
+        return false;
+
+    for (i = 0; i < blackboxFrameBufferPos; i++)
+        crc = blackboxCrc8(crc, blackboxFrameBuffer[i]);
+
+    blackboxLastBlockOffset = blackboxBytesWritten;
+    blackboxWriteBlockHeader(BLACKBOX_BLOCK_STORED, blackboxFrameBufferPos);
+    blackboxDeviceWrite(blackboxFrameBuffer, blackboxFrameBufferPos);
+    blackboxDeviceWrite(&crc, 1);
+
+    return true;
+}
+
+/**
+ * Huffman code the frame buffer onto the end of the current block. If the logging device wouldn't have room for the
+ * block with these frames added, the block is left as it was and false is returned, just as for a failed write.
+ */
+static bool blackboxCompressFrameBuffer(void)
+{
+    blackboxBlockState_t block = blackboxBlock;
+    const blackboxHuffmanCode_t *code;
+    int i;
+
+    if (blackboxFrameBufferPos > BLACKBOX_COMPRESS_MAX_BYTES) {
+        blackboxCloseBlock();
+        return blackboxWriteStoredBlock();
+    }
+
+    // Payload bytes written past the end of the old block are simply ignored if we give up on these frames
+    for (i = 0; i < blackboxFrameBufferPos; i++) {
+        code = &blackboxHuffmanTable[blackboxFrameBuffer[i]];
+
+        block.crc = blackboxCrc8(block.crc, blackboxFrameBuffer[i]);
+        block.bitBuffer = (block.bitBuffer << code->length) | code->code;
+        block.bitCount += code->length;
+
+        while (block.bitCount >= 8) {
+            block.bitCount -= 8;
+            blackboxBlockPayload[block.payloadLength++] = (uint8_t) (block.bitBuffer >> block.bitCount);
+        }
+    }
+
+    if (blackboxDeviceFreeSpace() < (uint32_t) (block.payloadLength + 1 + BLACKBOX_BLOCK_OVERHEAD))
+        return false;
+
+    if (blackboxBlock.rawLength == 0)
+        blackboxBlockStartIteration = blackboxIteration;
+
+    block.rawLength += blackboxFrameBufferPos;
+    blackboxBlock = block;
+
+    if (blackboxBlock.payloadLength >= BLACKBOX_BLOCK_TARGET)
+        blackboxCloseBlock();
+
+    return true;
+}
+
+/**
+ * Commit everything written since the last flush to the logging device with a single bulk write (or to the current
+ * compressed block, which is as good as written).
+ *
+ * If the device doesn't have room for all of it, nothing is written (so we never overwrite data that hasn't been
+ * stored yet, nor store half a frame) and false is returned. The same goes if the frame buffer overflowed.
+ */
+static bool blackboxFlush(void)
+{
+    bool written = true;
+    uint32_t compressStart;
+
+    if (blackboxFrameBufferOverflowed) {
+        written = false;
+        blackboxFrameBufferOverflowed = false;
+    } else if (blackboxFrameBufferPos > 0) {
+        if (blackboxCompressing) {
+            compressStart = DWT_CYCCNT;
+            written = blackboxCompressFrameBuffer();
+            perfRecord(PERF_STAGE_BLACKBOX_COMPRESS, compressStart);
+        } else {
+            written = blackboxDeviceFreeSpace() >= (uint32_t) blackboxFrameBufferPos;
+
+            if (written)
+                blackboxDeviceWrite(blackboxFrameBuffer, blackboxFrameBufferPos);
+        }
+    }
+
+    blackboxFrameBufferPos = 0;
+
+    // Don't sit on a block for long, so the log never lags far behind the flight
+    if (blackboxBlock.rawLength > 0 && blackboxIteration - blackboxBlockStartIteration >= BLACKBOX_BLOCK_MAX_ITERATIONS)
+        blackboxCloseBlock();
+
+#ifdef FLASHFS
+    // Program any complete pages into the chip if it's idle
+    if (masterConfig.blackbox_device == BLACKBOX_DEVICE_FLASH)
+        flashfsFlushAsync();
+#endif
+
+    return written;
 }
 
 static void _putc(void *p, char c)
 {
     (void)p;
-    serialWrite(blackboxPort, c);
+    blackboxWrite(c);
 }
 
-//printf() to the blackbox serial port with no blocking shenanigans (so it's caller's responsibility to not write too fast!)
+//printf() to the blackbox frame buffer with no blocking shenanigans (so it's caller's responsibility to not write too fast!)
 static void blackboxPrintf(char *fmt, ...)
 {
     va_list va;
@@ -240,19 +783,44 @@ static void blackboxPrintf(char *fmt, ...)
     va_end(va);
 }
 
-// Print the null-terminated string 's' to the serial port and return the number of bytes written
+// Print the null-terminated string 's' to the frame buffer and return the number of bytes written
 static int blackboxPrint(const char *s)
 {
     const char *pos = s;
 
     while (*pos) {
-        serialWrite(blackboxPort, *pos);
+        blackboxWrite(*pos);
         pos++;
     }
 
     return pos - s;
 }
 
+// Start a new frame (or event) of the given type in the frame buffer
+static void blackboxBeginFrame(uint8_t marker)
+{
+    blackboxFrameStart = blackboxFrameBufferPos;
+    blackboxWrite(marker);
+}
+
+/**
+ * Finish the frame that blackboxBeginFrame() started. With blackbox_frame_check on this adds a CRC-8 of the whole frame
+ * (marker included), which lets decoders tell a damaged frame from a good one.
+ */
+static void blackboxEndFrame(void)
+{
+    uint8_t crc = 0;
+    int i;
+
+    if (!masterConfig.blackbox_frame_check)
+        return;
+
+    for (i = blackboxFrameStart; i < blackboxFrameBufferPos; i++)
+        crc = blackboxCrc8(crc, blackboxFrameBuffer[i]);
+
+    blackboxWrite(crc);
+}
+
 /**
  * Write an unsigned integer to the blackbox serial port using variable byte encoding.
  */
@@ -514,6 +1082,62 @@ static void writeTag8_8SVB(int32_t *values, int valueCount)
     }
 }
 
+/**
+ * Write a 5-bit tag holding the number of bits needed for the largest of the `valueCount` fields in `values`, then each
+ * field with that many bits. The fields are packed with no gaps, most significant bit first, and the final byte is
+ * padded with zeros. So a group of small deltas only costs a couple of bytes in total.
+ *
+ * valueCount must be 4 or less.
+ */
+static void writeTag5_4SNBit(int32_t *values, int valueCount)
+{
+    uint32_t magnitudes = 0, value;
+    uint8_t buffer;
+    int width, tag, bufferBits, bits, take, i;
+    bool nonZero = false;
+
+    // A signed field needs one bit more than its magnitude (for negative numbers, the magnitude of -value - 1)
+    for (i = 0; i < valueCount; i++) {
+        magnitudes |= values[i] ^ (values[i] >> 31);
+        nonZero |= values[i] != 0;
+    }
+
+    if (magnitudes)
+        width = 33 - __builtin_clz(magnitudes);
+    else
+        width = nonZero ? 1 : 0; // All zeros, or -1 which fits in one bit
+
+    // There's no room in the tag for a width of 32, so 31-bit fields are written with 32 bits as well
+    if (width >= 31) {
+        width = 32;
+        tag = 31;
+    } else {
+        tag = width;
+    }
+
+    buffer = tag << 3;
+    bufferBits = 5;
+
+    for (i = 0; i < valueCount; i++) {
+        value = values[i];
+
+        for (bits = width; bits > 0; bits -= take) {
+            take = min(8 - bufferBits, bits);
+            buffer |= ((value >> (bits - take)) & ((1 << take) - 1)) << (8 - bufferBits - take);
+            bufferBits += take;
+
+            if (bufferBits == 8) {
+                blackboxWrite(buffer);
+                buffer = 0;
+                bufferBits = 0;
+            }
+        }
+    }
+
+    if (bufferBits > 0)
+        blackboxWrite(buffer);
+}
+
 static bool testBlackboxConditionUncached(FlightLogFieldCondition condition)
 {
     switch (condition) {
@@ -555,6 +1179,13 @@ static bool testBlackboxConditionUncached(FlightLogFieldCondition condition)
         case FLIGHT_LOG_FIELD_CONDITION_VBAT:
             return feature(FEATURE_VBAT);
 
+        case FLIGHT_LOG_FIELD_CONDITION_AMPERAGE:
+            // The current sensor is only sampled alongside the battery voltage
+            return feature(FEATURE_VBAT) && masterConfig.power_adc_channel > 0;
+
+        case FLIGHT_LOG_FIELD_CONDITION_RSSI:
+            return masterConfig.rssi_aux_channel > 0 || masterConfig.rssi_adc_channel > 0;
+
         case FLIGHT_LOG_FIELD_CONDITION_NEVER:
             return false;
         default:
@@ -579,191 +1210,644 @@ static bool testBlackboxCondition(FlightLogFieldCondition condition)
     return (blackboxConditionCache & (1 << condition)) != 0;
 }
 
-static void blackboxSetState(BlackboxState newState)
+// How many fields a group encoding packs together at most
+static int blackboxEncodingGroupLimit(uint8_t encoding)
 {
-    //Perform initial setup required for the new state
-    switch (newState) {
-        case BLACKBOX_STATE_SEND_HEADER:
-            xmitState.headerIndex = 0;
-            xmitState.u.startTime = millis();
-        break;
-        case BLACKBOX_STATE_SEND_FIELDINFO:
-        case BLACKBOX_STATE_SEND_GPS_G_HEADERS:
-        case BLACKBOX_STATE_SEND_GPS_H_HEADERS:
-            xmitState.headerIndex = 0;
-            xmitState.u.fieldIndex = -1;
-        break;
-        case BLACKBOX_STATE_SEND_SYSINFO:
-            xmitState.headerIndex = 0;
-        break;
-        case BLACKBOX_STATE_RUNNING:
-            blackboxIteration = 0;
-            blackboxPFrameIndex = 0;
-            blackboxIFrameIndex = 0;
-        break;
+    switch (encoding) {
+        case FLIGHT_LOG_FIELD_ENCODING_TAG8_8SVB:
+            return 8;
+        case FLIGHT_LOG_FIELD_ENCODING_TAG2_3S32:
+            return 3;
+        case FLIGHT_LOG_FIELD_ENCODING_TAG8_4S16:
+        case FLIGHT_LOG_FIELD_ENCODING_TAG5_4SNBIT:
+            return 4;
         default:
-            ;
+            return 1;
     }
-    blackboxState = newState;
 }
 
-static void writeIntraframe(void)
+// Do these field names refer to elements of the same array, e.g. "gyroData[0]" and "gyroData[2]"?
+static bool blackboxFieldsShareArray(const char *a, const char *b)
 {
-    blackboxValues_t *blackboxCurrent = blackboxHistory[0];
-    int x;
+    while (*a && *a == *b && *a != '[') {
+        a++;
+        b++;
+    }
 
-    blackboxWrite('I');
+    return *a == '[' && *b == '[';
+}
 
-    writeUnsignedVB(blackboxIteration);
-    writeUnsignedVB(blackboxCurrent->time);
+/**
+ * Pick out the fields of blackboxMainFields that this log will contain (according to the condition cache) and note how
+ * each is predicted and encoded in I and P frames. Fields that aren't written at all (encoding NULL) are left out, and
+ * consecutive fields with the same group encoding are marked as one group (TAG5_4SNBIT groups also stop at the end of
+ * an array, since they share one bit width).
+ */
+static uint8_t blackboxBuildEncodingPlan(blackboxPlanField_t *plan, bool intra)
+{
+    const blackboxMainFieldDefinition_t *def;
+    blackboxPlanField_t *field, *groupStart = NULL;
+    const char *groupName = NULL;
+    uint8_t length = 0;
+    unsigned int i;
+
+    for (i = 0; i < ARRAY_LENGTH(blackboxMainFields); i++) {
+        def = &blackboxMainFields[i];
+
+        if (!testBlackboxCondition(def->condition))
+            continue;
+
+        field = &plan[length];
+        field->valueOffset = def->valueOffset;
+        field->valueType = def->valueType;
+        field->predictor = intra ? def->Ipredict : def->Ppredict;
+        field->encoding = intra ? def->Iencode : def->Pencode;
+        field->groupSize = 1;
+
+        if (field->encoding == FLIGHT_LOG_FIELD_ENCODING_NULL)
+            continue;
+
+        if (groupStart && groupStart->encoding == field->encoding
+                && groupStart->groupSize < blackboxEncodingGroupLimit(field->encoding)
+                && (field->encoding != FLIGHT_LOG_FIELD_ENCODING_TAG5_4SNBIT || blackboxFieldsShareArray(groupName, def->name))) {
+            groupStart->groupSize++;
+        } else {
+            groupStart = blackboxEncodingGroupLimit(field->encoding) > 1 ? field : NULL;
+            groupName = def->name;
+        }
 
-    for (x = 0; x < XYZ_AXIS_COUNT; x++)
-        writeSignedVB(blackboxCurrent->axisPID_P[x]);
+        length++;
+    }
 
-    for (x = 0; x < XYZ_AXIS_COUNT; x++)
-        writeSignedVB(blackboxCurrent->axisPID_I[x]);
+    return length;
+}
 
-    for (x = 0; x < XYZ_AXIS_COUNT; x++)
-        if (testBlackboxCondition(FLIGHT_LOG_FIELD_CONDITION_NONZERO_PID_D_0 + x))
-            writeSignedVB(blackboxCurrent->axisPID_D[x]);
+// Slow frames have no group encodings, so their plan is just the fields whose condition holds
+static uint8_t blackboxBuildSlowPlan(blackboxPlanField_t *plan)
+{
+    const blackboxConditionalFieldDefinition_t *def;
+    blackboxPlanField_t *field;
+    uint8_t length = 0;
+    unsigned int i;
+
+    for (i = 0; i < ARRAY_LENGTH(blackboxSlowFields); i++) {
+        def = &blackboxSlowFields[i];
+
+        if (!testBlackboxCondition(def->condition))
+            continue;
+
+        field = &plan[length++];
+        field->valueOffset = def->valueOffset;
+        field->valueType = def->valueType;
+        field->predictor = def->predict;
+        field->encoding = def->encode;
+        field->groupSize = 1;
+    }
 
-    for (x = 0; x < 3; x++)
-        writeSignedVB(blackboxCurrent->rcCommand[x]);
+    return length;
+}
 
-    writeUnsignedVB(blackboxCurrent->rcCommand[3] - masterConfig.minthrottle); //Throttle lies in range [minthrottle..maxthrottle]
+static void blackboxBuildEncodingPlans(void)
+{
+    blackboxIntraPlanLength = blackboxBuildEncodingPlan(blackboxIntraPlan, true);
+    blackboxInterPlanLength = blackboxBuildEncodingPlan(blackboxInterPlan, false);
+    blackboxSlowPlanLength = blackboxBuildSlowPlan(blackboxSlowPlan);
+}
 
-    if (testBlackboxCondition(FLIGHT_LOG_FIELD_CONDITION_VBAT)) {
-        /*
-         * Our voltage is expected to decrease over the course of the flight, so store our difference from
-         * the reference:
-         *
-         * Write 14 bits even if the number is negative (which would otherwise result in 32 bits)
-         */
-        writeUnsignedVB((vbatReference - blackboxCurrent->vbatLatest) & 0x3FFF);
+static int16_t blackboxScaleMix(float mix)
+{
+    return mix * 1000 + (mix < 0 ? -0.5f : 0.5f);
+}
+
+/**
+ * Take a copy of the mixer coefficients for the MIXER predictor, so they can't change under the log.
+ */
+static void blackboxLoadMotorMix(void)
+{
+    const motorMixer_t *mix;
+    int i;
+
+    for (i = 0; i < motorCount; i++) {
+        if (f.FIXED_WING) {
+            // The mixer doesn't mix for planes, motor 0 just follows the throttle
+            blackboxMotorMix[i][0] = 1000;
+            blackboxMotorMix[i][1] = blackboxMotorMix[i][2] = blackboxMotorMix[i][3] = 0;
+        } else {
+            mix = mixerGetMotorMix(i);
+            blackboxMotorMix[i][0] = blackboxScaleMix(mix->throttle);
+            blackboxMotorMix[i][1] = blackboxScaleMix(mix->roll);
+            blackboxMotorMix[i][2] = blackboxScaleMix(mix->pitch);
+            blackboxMotorMix[i][3] = blackboxScaleMix(-cfg.yaw_direction * mix->yaw);
+        }
     }
+}
 
-#ifdef MAG
-        if (testBlackboxCondition(FLIGHT_LOG_FIELD_CONDITION_MAG)) {
-            for (x = 0; x < XYZ_AXIS_COUNT; x++)
-                writeSignedVB(blackboxCurrent->magADC[x]);
+static void blackboxHeaderPutc(void *p, char c)
+{
+    (void)p;
+
+    if (blackboxHeaderStart + blackboxHeaderLength < BLACKBOX_START_BUFFER_SIZE)
+        blackboxStartBuffer[blackboxHeaderStart + blackboxHeaderLength] = c;
+    blackboxHeaderLength++;
+}
+
+// printf() to the end of the header buffer
+static void blackboxHeaderPrintf(char *fmt, ...)
+{
+    va_list va;
+    va_start(va, fmt);
+    tfp_format(NULL, blackboxHeaderPutc, fmt, va);
+    va_end(va);
+}
+
+static void blackboxHeaderPrint(const char *s)
+{
+    while (*s)
+        blackboxHeaderPutc(NULL, *s++);
+}
+
+/**
+ * Render the header lines for the given field definitions, which look like:
+ *
+ * H Field I name:a,b,c
+ * H Field I predictor:0,1,2
+ *
+ * Provide an array 'conditions' of FlightLogFieldCondition enums if you want these conditions to decide whether a field
+ * should be included or not. Otherwise provide NULL for this parameter and NULL for secondCondition.
+ *
+ * secondFieldDefinition and secondCondition element pointers need to be provided in order to compute the stride of the
+ * fieldDefinition and secondCondition arrays.
+ */
+static void blackboxRenderFieldDefinition(const char * const *headerNames, unsigned int headerCount,
+        const void *fieldDefinitions, const void *secondFieldDefinition, int fieldCount, const uint8_t *conditions,
+        const uint8_t *secondCondition)
+{
+    const blackboxFieldDefinition_t *def;
+    size_t definitionStride = (char*) secondFieldDefinition - (char*) fieldDefinitions;
+    size_t conditionsStride = (char*) secondCondition - (char*) conditions;
+    unsigned int headerIndex;
+    int fieldIndex;
+    bool needComma;
+
+    for (headerIndex = 0; headerIndex < headerCount; headerIndex++) {
+        blackboxHeaderPrint("H Field ");
+        blackboxHeaderPrint(headerNames[headerIndex]);
+        blackboxHeaderPrint(":");
+
+        needComma = false;
+
+        for (fieldIndex = 0; fieldIndex < fieldCount; fieldIndex++) {
+            def = (const blackboxFieldDefinition_t*) ((const char*)fieldDefinitions + definitionStride * fieldIndex);
+
+            if (conditions && !testBlackboxCondition(conditions[conditionsStride * fieldIndex]))
+                continue;
+
+            if (needComma)
+                blackboxHeaderPrint(",");
+            else
+                needComma = true;
+
+            // The first header is a field name, the other headers are integers
+            if (headerIndex == 0)
+                blackboxHeaderPrint(def->name);
+            else
+                blackboxHeaderPrintf("%u", def->arr[headerIndex - 1]);
         }
-#endif
 
-#ifdef BARO
-        if (testBlackboxCondition(FLIGHT_LOG_FIELD_CONDITION_BARO))
-            writeSignedVB(blackboxCurrent->BaroAlt);
+        blackboxHeaderPrint("\n");
+    }
+}
+
+// Render the system information headers
+static void blackboxRenderSysinfo(void)
+{
+    union floatConvert_t {
+        float f;
+        uint32_t u;
+    } floatConvert;
+    int motorIndex;
+
+    blackboxHeaderPrintf("H Firmware type:Baseflight\n");
+    // No firmware revision info to write
+    blackboxHeaderPrintf("H Firmware date:%s %s\n", __DATE__, __TIME__);
+    blackboxHeaderPrintf("H P interval:%d/%d\n", masterConfig.blackbox_rate_num, masterConfig.blackbox_rate_denom);
+    blackboxHeaderPrintf("H rcRate:%d\n", cfg.rcRate8);
+    blackboxHeaderPrintf("H minthrottle:%d\n", masterConfig.minthrottle);
+    blackboxHeaderPrintf("H maxthrottle:%d\n", masterConfig.maxthrottle);
+
+    floatConvert.f = gyro.scale;
+    blackboxHeaderPrintf("H gyro.scale:0x%x\n", floatConvert.u);
+
+    blackboxHeaderPrintf("H acc_1G:%u\n", acc_1G);
+    blackboxHeaderPrintf("H vbatscale:%u\n", masterConfig.vbatscale);
+    blackboxHeaderPrintf("H vbatcellvoltage:%u,0,%u\n", masterConfig.vbatmincellvoltage, masterConfig.vbatmaxcellvoltage);
+    blackboxHeaderPrintf("H vbatref:%u\n", vbatReference);
+    blackboxHeaderPrintf("H I interval:%u\n", masterConfig.blackbox_i_interval);
+    blackboxHeaderPrintf("H Data compression:%u\n",
+        masterConfig.blackbox_compression ? FLIGHT_LOG_COMPRESSION_HUFFMAN : FLIGHT_LOG_COMPRESSION_NONE);
+    blackboxHeaderPrintf("H Frame check:%u\n",
+        masterConfig.blackbox_frame_check ? FLIGHT_LOG_FRAME_CHECK_CRC8 : FLIGHT_LOG_FRAME_CHECK_NONE);
+
+    // Then one line of mixer coefficients for each motor
+    for (motorIndex = 0; motorIndex < motorCount; motorIndex++)
+        blackboxHeaderPrintf("H motorMix[%d]:%d,%d,%d,%d\n", motorIndex, blackboxMotorMix[motorIndex][0],
+            blackboxMotorMix[motorIndex][1], blackboxMotorMix[motorIndex][2], blackboxMotorMix[motorIndex][3]);
+}
+
+/**
+ * Render the whole text header of the log into blackboxStartBuffer at blackboxHeaderStart. Returns false if it didn't
+ * fit.
+ */
+static bool blackboxRenderHeader(void)
+{
+    blackboxHeaderPrint(blackboxHeader);
+
+    blackboxRenderFieldDefinition(blackboxMainHeaderNames, ARRAY_LENGTH(blackboxMainHeaderNames), blackboxMainFields,
+        blackboxMainFields + 1, ARRAY_LENGTH(blackboxMainFields), &blackboxMainFields[0].condition,
+        &blackboxMainFields[1].condition);
+#ifdef GPS
+    if (feature(FEATURE_GPS)) {
+        blackboxRenderFieldDefinition(blackboxGPSHHeaderNames, ARRAY_LENGTH(blackboxGPSHHeaderNames), blackboxGpsHFields,
+            blackboxGpsHFields + 1, ARRAY_LENGTH(blackboxGpsHFields), NULL, NULL);
+        blackboxRenderFieldDefinition(blackboxGPSGHeaderNames, ARRAY_LENGTH(blackboxGPSGHeaderNames), blackboxGpsGFields,
+            blackboxGpsGFields + 1, ARRAY_LENGTH(blackboxGpsGFields), NULL, NULL);
+    }
 #endif
+    blackboxRenderFieldDefinition(blackboxSlowHeaderNames, ARRAY_LENGTH(blackboxSlowHeaderNames), blackboxSlowFields,
+        blackboxSlowFields + 1, ARRAY_LENGTH(blackboxSlowFields), &blackboxSlowFields[0].condition,
+        &blackboxSlowFields[1].condition);
 
-    for (x = 0; x < XYZ_AXIS_COUNT; x++)
-        writeSignedVB(blackboxCurrent->gyroData[x]);
+    blackboxRenderSysinfo();
 
-    for (x = 0; x < XYZ_AXIS_COUNT; x++)
-        writeSignedVB(blackboxCurrent->accSmooth[x]);
+    return blackboxHeaderStart + blackboxHeaderLength <= BLACKBOX_START_BUFFER_SIZE;
+}
 
-    //Motors can be below minthrottle when disarmed, but that doesn't happen much
-    writeUnsignedVB(blackboxCurrent->motor[0] - masterConfig.minthrottle);
+// Forget the oldest pre-arm frames, until at least 'bytes' of the buffer have been freed or there are none left
+static void blackboxDropPrearmFrames(int bytes)
+{
+    int dropped = 0, count = 0;
 
-    //Motors tend to be similar to each other
-    for (x = 1; x < motorCount; x++)
-        writeSignedVB(blackboxCurrent->motor[x] - blackboxCurrent->motor[0]);
+    while (count < blackboxPrearmFrameCount && dropped < bytes)
+        dropped += blackboxPrearmFrameLength[count++];
 
-    if (testBlackboxCondition(FLIGHT_LOG_FIELD_CONDITION_TRICOPTER))
-        writeSignedVB(blackboxHistory[0]->servo[5] - 1500);
+    blackboxPrearmLength -= dropped;
+    blackboxPrearmFrameCount -= count;
 
-    //Rotate our history buffers:
+    memmove(blackboxStartBuffer, blackboxStartBuffer + dropped, blackboxPrearmLength);
+    memmove(blackboxPrearmFrameLength, blackboxPrearmFrameLength + count, blackboxPrearmFrameCount);
+#ifdef SITL
+    memmove(blackboxPrearmValues, blackboxPrearmValues + count, blackboxPrearmFrameCount * sizeof(blackboxValues_t));
+#endif
+}
 
-    //The current state becomes the new "before" state
-    blackboxHistory[1] = blackboxHistory[0];
-    //And since we have no other history, we also use it for the "before, before" state
-    blackboxHistory[2] = blackboxHistory[0];
-    //And advance the current state over to a blank space ready to be filled
-    blackboxHistory[0] = ((blackboxHistory[0] - blackboxHistoryRing + 1) % 3) + blackboxHistoryRing;
+static void blackboxReverse(uint8_t *start, uint8_t *end)
+{
+    uint8_t swap;
+
+    while (start < --end) {
+        swap = *start;
+        *start++ = *end;
+        *end = swap;
+    }
 }
 
-static void writeInterframe(void)
+/**
+ * Lay out the start of the log in blackboxStartBuffer: the header, followed by as many of the pre-arm frames as fit
+ * alongside it. Returns false if not even the header fits.
+ */
+static bool blackboxArrangeLogStart(void)
 {
-    int x;
-    int32_t deltas[5];
+    uint8_t blockHeader[3];
+    uint8_t *frames;
+    uint8_t crc = 0;
+    int overhead, i;
 
-    blackboxValues_t *blackboxCurrent = blackboxHistory[0];
-    blackboxValues_t *blackboxLast = blackboxHistory[1];
+    // Frames encoded with other fields (or frame checks) than the header is going to describe can't be decoded
+    if (!blackboxPrearmStarted || masterConfig.blackbox_prearm_interval == 0
+            || blackboxPrearmConditionCache != blackboxConditionCache
+            || blackboxPrearmFrameCheck != masterConfig.blackbox_frame_check)
+        blackboxDropPrearmFrames(blackboxPrearmLength);
 
-    blackboxWrite('P');
+    // The next capture starts afresh once this log is done
+    blackboxPrearmStarted = false;
 
-    //No need to store iteration count since its delta is always 1
+    // Render after the frames, giving up the oldest of them if the header needs their room
+    for (;;) {
+        blackboxHeaderStart = blackboxPrearmLength;
+        blackboxHeaderLength = 0;
 
-    /*
-     * Since the difference between the difference between successive times will be nearly zero, use
-     * second-order differences.
-     */
-    writeSignedVB((int32_t) (blackboxHistory[0]->time - 2 * blackboxHistory[1]->time + blackboxHistory[2]->time));
+        // In a compressed log the frames have to be wrapped up in a block
+        overhead = masterConfig.blackbox_compression && blackboxPrearmFrameCount > 0 ? BLACKBOX_BLOCK_OVERHEAD : 0;
 
-    for (x = 0; x < XYZ_AXIS_COUNT; x++)
-        writeSignedVB(blackboxCurrent->axisPID_P[x] - blackboxLast->axisPID_P[x]);
+        if (blackboxRenderHeader() && blackboxHeaderStart + blackboxHeaderLength + overhead <= BLACKBOX_START_BUFFER_SIZE)
+            break;
 
-    for (x = 0; x < XYZ_AXIS_COUNT; x++)
-        deltas[x] = blackboxCurrent->axisPID_I[x] - blackboxLast->axisPID_I[x];
+        if (blackboxPrearmFrameCount == 0)
+            return false;
 
-    /* 
-     * The PID I field changes very slowly, most of the time +-2, so use an encoding
-     * that can pack all three fields into one byte in that situation.
-     */
-    writeTag2_3S32(deltas);
-    
-    /*
-     * The PID D term is frequently set to zero for yaw, which makes the result from the calculation
-     * always zero. So don't bother recording D results when PID D terms are zero.
-     */
-    for (x = 0; x < XYZ_AXIS_COUNT; x++)
-        if (testBlackboxCondition(FLIGHT_LOG_FIELD_CONDITION_NONZERO_PID_D_0 + x))
-            writeSignedVB(blackboxCurrent->axisPID_D[x] - blackboxLast->axisPID_D[x]);
+        blackboxDropPrearmFrames(blackboxHeaderStart + blackboxHeaderLength + overhead - BLACKBOX_START_BUFFER_SIZE);
+    }
 
-    /*
-     * RC tends to stay the same or fairly small for many frames at a time, so use an encoding that
-     * can pack multiple values per byte:
-     */
-    for (x = 0; x < 4; x++)
-        deltas[x] = blackboxCurrent->rcCommand[x] - blackboxLast->rcCommand[x];
+    // Then swap the two around in place, since the header has to come first
+    blackboxStartLength = blackboxPrearmLength + blackboxHeaderLength;
+
+    blackboxReverse(blackboxStartBuffer, blackboxStartBuffer + blackboxPrearmLength);
+    blackboxReverse(blackboxStartBuffer + blackboxPrearmLength, blackboxStartBuffer + blackboxStartLength);
+    blackboxReverse(blackboxStartBuffer, blackboxStartBuffer + blackboxStartLength);
+
+    if (overhead > 0) {
+        frames = blackboxStartBuffer + blackboxHeaderLength;
+
+        for (i = 0; i < blackboxPrearmLength; i++)
+            crc = blackboxCrc8(crc, frames[i]);
 
-    writeTag8_4S16(deltas);
+        i = blackboxRenderBlockHeader(blockHeader, BLACKBOX_BLOCK_STORED, blackboxPrearmLength);
 
-    //Check for sensors that are updated periodically (so deltas are normally zero) VBAT, MAG, BARO
-    int optionalFieldCount = 0;
+        memmove(frames + i, frames, blackboxPrearmLength);
+        memcpy(frames, blockHeader, i);
+        frames[i + blackboxPrearmLength] = crc;
 
-    if (testBlackboxCondition(FLIGHT_LOG_FIELD_CONDITION_VBAT)) {
-        deltas[optionalFieldCount++] = (int32_t) blackboxCurrent->vbatLatest - blackboxLast->vbatLatest;
+        blackboxStartLength += i + 1;
     }
 
-#ifdef MAG
-    if (testBlackboxCondition(FLIGHT_LOG_FIELD_CONDITION_MAG)) {
-        for (x = 0; x < XYZ_AXIS_COUNT; x++)
-            deltas[optionalFieldCount++] = blackboxCurrent->magADC[x] - blackboxLast->magADC[x];
+    return true;
+}
+
+static void blackboxSetState(BlackboxState newState)
+{
+    //Perform initial setup required for the new state
+    switch (newState) {
+        case BLACKBOX_STATE_NEGOTIATE_BAUDRATE:
+            blackboxNegotiation.step = BLACKBOX_NEGOTIATE_ASK;
+            blackboxNegotiation.replyLength = 0;
+        break;
+        case BLACKBOX_STATE_SEND_HEADER:
+            blackboxStartPos = 0;
+            blackboxBytesWritten = 0;
+        break;
+        case BLACKBOX_STATE_SHUTTING_DOWN:
+            blackboxStartPos = 0;
+            blackboxShutdownTime = millis();
+        break;
+        case BLACKBOX_STATE_RUNNING:
+            // Carry on counting from the pre-arm frames, from the start of a keyframe interval like decoders expect
+            if (blackboxPrearmFrameCount > 0)
+                blackboxIteration = (blackboxIteration / masterConfig.blackbox_i_interval + 1) * masterConfig.blackbox_i_interval;
+            else
+                blackboxIteration = 0;
+            blackboxPFrameIndex = 0;
+            blackboxIFrameIndex = 0;
+            // So that the first slow frame is due straight away
+            blackboxLastSlowFrameIteration = blackboxIteration - masterConfig.blackbox_slow_interval;
+            // The block holding the sync beep counts as starting with the first iteration
+            blackboxBlockStartIteration = blackboxIteration;
+
+            blackboxCaptureUntil = blackboxIteration;
+            blackboxCaptureLogged = false;
+            blackboxCaptureTriggers = 0;
+            blackboxCaptureLookbackCount = 0;
+            memcpy(blackboxCaptureLastGyro, gyroData, sizeof(blackboxCaptureLastGyro));
+
+            blackboxIndexLength = 0;
+            blackboxIndexStride = 1;
+            blackboxKeyframeCount = 0;
+            blackboxIndexPending = false;
+            blackboxLogStartTime = currentTime;
+            blackboxLogStartIteration = blackboxIteration;
+            blackboxLoggedEvents = 0;
+        break;
+        default:
+            ;
     }
-#endif
+    blackboxState = newState;
+}
 
-#ifdef BARO
-    if (testBlackboxCondition(FLIGHT_LOG_FIELD_CONDITION_BARO))
-        deltas[optionalFieldCount++] = blackboxCurrent->BaroAlt - blackboxLast->BaroAlt;
-#endif
-    writeTag8_8SVB(deltas, optionalFieldCount);
+/**
+ * Work out what the mixer would have commanded this motor to do given the logged throttle and PID sums. This skips most
+ * of the mixer's special cases (motor stop, 3D, scaling back when a motor saturates), the prediction only has to be
+ * close.
+ * It's all done in wrapping 32-bit arithmetic, which the decoder copies exactly.
+ */
+static int32_t blackboxPredictMotor(const blackboxValues_t *values, int motorIndex)
+{
+    const int16_t *mix = blackboxMotorMix[motorIndex];
+    uint32_t pidSum[XYZ_AXIS_COUNT];
+    int32_t prediction;
+    int axis;
+
+    // With the throttle stick at the bottom the motors are held at minthrottle (unless MOTOR_STOP is on)
+    if (values->rcCommand[THROTTLE] <= masterConfig.minthrottle)
+        return masterConfig.minthrottle;
+
+    for (axis = 0; axis < XYZ_AXIS_COUNT; axis++)
+        pidSum[axis] = (uint32_t) values->axisPID_P[axis] + values->axisPID_I[axis] + values->axisPID_D[axis];
+
+    // Same limit as mixTable() applies to prevent "yaw jump"
+    if (motorCount > 3)
+        pidSum[YAW] = constrain((int32_t) pidSum[YAW], -100 - abs(values->rcCommand[YAW]), +100 + abs(values->rcCommand[YAW]));
+
+    prediction = (int32_t) (mix[0] * (uint32_t) values->rcCommand[THROTTLE] + mix[1] * pidSum[ROLL]
+        + mix[2] * pidSum[PITCH] + mix[3] * pidSum[YAW]) / 1000;
+
+    return constrain(prediction, masterConfig.minthrottle, masterConfig.maxthrottle);
+}
+
+static inline __attribute__((always_inline)) int32_t blackboxLoadValue(const void *values, const blackboxPlanField_t *field)
+{
+    const void *value = (const uint8_t *) values + field->valueOffset;
+
+    switch (field->valueType) {
+        case BLACKBOX_VALUE_INT16:
+            return *(const int16_t *) value;
+        case BLACKBOX_VALUE_UINT16:
+            return *(const uint16_t *) value;
+        case BLACKBOX_VALUE_INT32:
+        case BLACKBOX_VALUE_UINT32:
+        default:
+            return *(const int32_t *) value;
+    }
+}
 
-    //Since gyros, accs and motors are noisy, base the prediction on the average of the history:
-    for (x = 0; x < XYZ_AXIS_COUNT; x++)
-        writeSignedVB(blackboxHistory[0]->gyroData[x] - (blackboxHistory[1]->gyroData[x] + blackboxHistory[2]->gyroData[x]) / 2);
+/**
+ * Compute the difference between the field's value in the current frame and its prediction, which is what gets
+ * written to the log. Unsigned values wrap around just like the decoder expects. The history predictors only apply to
+ * main frames, whose current values are blackboxHistory[0].
+ */
+static inline __attribute__((always_inline)) int32_t blackboxFieldResidual(const void *values, const blackboxPlanField_t *field)
+{
+    int32_t value = blackboxLoadValue(values, field);
+    uint32_t prediction;
+
+    switch (field->predictor) {
+        case FLIGHT_LOG_FIELD_PREDICTOR_PREVIOUS:
+            prediction = blackboxLoadValue(blackboxHistory[1], field);
+        break;
+        case FLIGHT_LOG_FIELD_PREDICTOR_STRAIGHT_LINE:
+            prediction = 2 * (uint32_t) blackboxLoadValue(blackboxHistory[1], field) - blackboxLoadValue(blackboxHistory[2], field);
+        break;
+        case FLIGHT_LOG_FIELD_PREDICTOR_AVERAGE_2:
+            prediction = (blackboxLoadValue(blackboxHistory[1], field) + blackboxLoadValue(blackboxHistory[2], field)) / 2;
+        break;
+        case FLIGHT_LOG_FIELD_PREDICTOR_LINEAR_3:
+            // The least-squares line through the last 3 values, evaluated one step on: (4 * h1 + h2 - 2 * h3) / 3
+            prediction = (int32_t) (4 * (uint32_t) blackboxLoadValue(blackboxHistory[1], field)
+                + blackboxLoadValue(blackboxHistory[2], field) - 2 * (uint32_t) blackboxLoadValue(blackboxHistory[3], field)) / 3;
+        break;
+        case FLIGHT_LOG_FIELD_PREDICTOR_MIXER:
+            prediction = blackboxPredictMotor(blackboxHistory[0], (field->valueOffset - offsetof(blackboxValues_t, motor)) / sizeof(int16_t));
+        break;
+        case FLIGHT_LOG_FIELD_PREDICTOR_MINTHROTTLE:
+            prediction = masterConfig.minthrottle;
+        break;
+        case FLIGHT_LOG_FIELD_PREDICTOR_MOTOR_0:
+            prediction = blackboxHistory[0]->motor[0];
+        break;
+        case FLIGHT_LOG_FIELD_PREDICTOR_1500:
+            prediction = 1500;
+        break;
+        case FLIGHT_LOG_FIELD_PREDICTOR_VBATREF:
+            prediction = vbatReference;
+        break;
+        case FLIGHT_LOG_FIELD_PREDICTOR_0:
+        default:
+            prediction = 0;
+        break;
+    }
+
+    return (int32_t) ((uint32_t) value - prediction);
+}
+
+/**
+ * Write a frame holding the given values by walking the given plan.
+ */
+static void writeFrameFromPlan(const void *current, const blackboxPlanField_t *plan, int planLength)
+{
+    const blackboxPlanField_t *field;
+    int32_t values[8];
+    int i, x;
 
-    for (x = 0; x < XYZ_AXIS_COUNT; x++)
-        writeSignedVB(blackboxHistory[0]->accSmooth[x] - (blackboxHistory[1]->accSmooth[x] + blackboxHistory[2]->accSmooth[x]) / 2);
+    for (i = 0; i < planLength; ) {
+        field = &plan[i];
 
-    for (x = 0; x < motorCount; x++)
-        writeSignedVB(blackboxHistory[0]->motor[x] - (blackboxHistory[1]->motor[x] + blackboxHistory[2]->motor[x]) / 2);
+        switch (field->encoding) {
+            case FLIGHT_LOG_FIELD_ENCODING_SIGNED_VB:
+                writeSignedVB(blackboxFieldResidual(current, field));
+                i++;
+            break;
+            case FLIGHT_LOG_FIELD_ENCODING_UNSIGNED_VB:
+                writeUnsignedVB(blackboxFieldResidual(current, field));
+                i++;
+            break;
+            case FLIGHT_LOG_FIELD_ENCODING_NEG_14BIT:
+                // Write 14 bits even if the number is negative (which would otherwise result in 32 bits)
+                writeUnsignedVB(-blackboxFieldResidual(current, field) & 0x3FFF);
+                i++;
+            break;
+            case FLIGHT_LOG_FIELD_ENCODING_TAG8_8SVB:
+            case FLIGHT_LOG_FIELD_ENCODING_TAG2_3S32:
+            case FLIGHT_LOG_FIELD_ENCODING_TAG8_4S16:
+            case FLIGHT_LOG_FIELD_ENCODING_TAG5_4SNBIT:
+                // The fixed-size groups are padded out with zeros if the log has fewer fields than that
+                memset(values, 0, sizeof(values));
+                for (x = 0; x < field->groupSize; x++)
+                    values[x] = blackboxFieldResidual(current, field + x);
+
+                if (field->encoding == FLIGHT_LOG_FIELD_ENCODING_TAG8_8SVB)
+                    writeTag8_8SVB(values, field->groupSize);
+                else if (field->encoding == FLIGHT_LOG_FIELD_ENCODING_TAG2_3S32)
+                    writeTag2_3S32(values);
+                else if (field->encoding == FLIGHT_LOG_FIELD_ENCODING_TAG5_4SNBIT)
+                    writeTag5_4SNBit(values, field->groupSize);
+                else
+                    writeTag8_4S16(values);
 
-    if (testBlackboxCondition(FLIGHT_LOG_FIELD_CONDITION_TRICOPTER))
-        writeSignedVB(blackboxCurrent->servo[5] - blackboxLast->servo[5]);
+                i += field->groupSize;
+            break;
+            default:
+                i++;
+            break;
+        }
+    }
+}
+
+static void writeIntraframe(void)
+{
+    blackboxBeginFrame('I');
+
+    writeFrameFromPlan(blackboxHistory[0], blackboxIntraPlan, blackboxIntraPlanLength);
+    blackboxEndFrame();
+
+    blackboxLastKeyframeIteration = blackboxIteration;
+    blackboxLargestInterframe = 0;
+
+    //Rotate our history buffers:
+
+    //The current state becomes the new "before" state
+    blackboxHistory[1] = blackboxHistory[0];
+    //And since we have no other history, we also use it for the older states
+    blackboxHistory[2] = blackboxHistory[0];
+    blackboxHistory[3] = blackboxHistory[0];
+    //And advance the current state over to a blank space ready to be filled
+    blackboxHistory[0] = ((blackboxHistory[0] - blackboxHistoryRing + 1) % BLACKBOX_HISTORY_LENGTH) + blackboxHistoryRing;
+}
+
+/**
+ * Write a P-frame for the current state. If it comes out bigger than blackbox_i_threshold (say after a sharp stick
+ * input) it's replaced with an I-frame, which costs little more and lets us put off the next scheduled keyframe.
+ * Returns true if that happened.
+ */
+static bool writeInterframe(void)
+{
+    int frameSize;
+    bool overflowedBefore = blackboxFrameBufferOverflowed;
+
+    blackboxBeginFrame('P');
+
+    writeFrameFromPlan(blackboxHistory[0], blackboxInterPlan, blackboxInterPlanLength);
+
+    frameSize = blackboxFrameBufferPos - blackboxFrameStart;
+
+    if (masterConfig.blackbox_i_threshold > 0 && frameSize > masterConfig.blackbox_i_threshold) {
+        // Bytes the P-frame lost to an overflow went with it, the I-frame gets the chance to fit on its own
+        blackboxFrameBufferPos = blackboxFrameStart;
+        blackboxFrameBufferOverflowed = overflowedBefore;
+        writeIntraframe();
+        return true;
+    }
+
+    blackboxEndFrame();
+
+    if (frameSize > blackboxLargestInterframe)
+        blackboxLargestInterframe = frameSize;
 
     //Rotate our history buffers
+    blackboxHistory[3] = blackboxHistory[2];
     blackboxHistory[2] = blackboxHistory[1];
     blackboxHistory[1] = blackboxHistory[0];
-    blackboxHistory[0] = ((blackboxHistory[0] - blackboxHistoryRing + 1) % 3) + blackboxHistoryRing;
+    blackboxHistory[0] = ((blackboxHistory[0] - blackboxHistoryRing + 1) % BLACKBOX_HISTORY_LENGTH) + blackboxHistoryRing;
+
+    return false;
+}
+
+/**
+ * Is it time for a scheduled keyframe? These fall at the start of each blackbox_i_interval. In adaptive mode we skip
+ * the ones that come too soon after an early keyframe, and while every P-frame since the last keyframe has been under
+ * half the threshold (smooth flight, like a hover) we keep skipping them until blackbox_i_max_interval has passed.
+ */
+static bool blackboxKeyframeDue(void)
+{
+    uint32_t sinceKeyframe = blackboxIteration - blackboxLastKeyframeIteration;
+
+    if (blackboxPFrameIndex != 0)
+        return false;
+
+    if (masterConfig.blackbox_i_threshold == 0 || blackboxIFrameIndex == 0)
+        return true;
+
+    if (sinceKeyframe < masterConfig.blackbox_i_interval)
+        return false;
+
+    return sinceKeyframe >= masterConfig.blackbox_i_max_interval || blackboxLargestInterframe > masterConfig.blackbox_i_threshold / 2;
 }
 
 static int gcd(int num, int denom)
@@ -784,83 +1868,327 @@ static void validateBlackboxConfig()
     } else {
         div = gcd(masterConfig.blackbox_rate_num, masterConfig.blackbox_rate_denom);
 
-        masterConfig.blackbox_rate_num /= div;
-        masterConfig.blackbox_rate_denom /= div;
+        masterConfig.blackbox_rate_num /= div;
+        masterConfig.blackbox_rate_denom /= div;
+    }
+
+    if (masterConfig.blackbox_i_interval == 0)
+        masterConfig.blackbox_i_interval = 32;
+
+    if (masterConfig.blackbox_i_max_interval < masterConfig.blackbox_i_interval)
+        masterConfig.blackbox_i_max_interval = masterConfig.blackbox_i_interval;
+
+    if (masterConfig.blackbox_slow_interval == 0)
+        masterConfig.blackbox_slow_interval = 32;
+
+    // 0 asks for the rate to be negotiated, anything else slower than a GPS would be a typo
+    if (masterConfig.blackbox_baudrate != 0 && masterConfig.blackbox_baudrate < 9600)
+        masterConfig.blackbox_baudrate = BLACKBOX_BASE_BAUDRATE;
+}
+
+/**
+ * Prepare the logging device for a new log. Returns false if it isn't available.
+ */
+static bool blackboxDeviceOpen(void)
+{
+    switch (masterConfig.blackbox_device) {
+#ifdef FLASHFS
+        case BLACKBOX_DEVICE_FLASH:
+            // Can't log while the chip is being erased, or once it's full
+            if (!flashfsIsReady() || flashfsIsEOF())
+                return false;
+
+            // The flash chip is ready as soon as it's idle
+            blackboxDeviceOpenTime = millis() - BLACKBOX_UART_SETTLE_MS;
+
+            return true;
+#endif
+        case BLACKBOX_DEVICE_SERIAL:
+        default:
+            serialInit(BLACKBOX_BASE_BAUDRATE);
+
+            blackboxPort = core.mainport;
+            if (!blackboxPort)
+                return false;
+
+            blackboxDeviceOpenTime = millis();
+
+            if (masterConfig.blackbox_baudrate != 0)
+                serialSetBaudRate(blackboxPort, masterConfig.blackbox_baudrate);
+            else if (blackboxNegotiatedBaudRate != 0)
+                serialSetBaudRate(blackboxPort, blackboxNegotiatedBaudRate);
+            else
+                serialSetBaudRate(blackboxPort, BLACKBOX_BASE_BAUDRATE);
+
+            return true;
+    }
+}
+
+static void blackboxDeviceClose(void)
+{
+    switch (masterConfig.blackbox_device) {
+#ifdef FLASHFS
+        case BLACKBOX_DEVICE_FLASH:
+            // Now that we're disarmed we can afford to wait for the rest of the log to be programmed
+            flashfsFlushSync();
+        break;
+#endif
+        case BLACKBOX_DEVICE_SERIAL:
+        default:
+            // Give the serial port back to the CLI
+            serialInit(masterConfig.serial_baudrate);
+        break;
+    }
+}
+
+static void blackboxResetHistory(void)
+{
+    blackboxHistory[0] = &blackboxHistoryRing[0];
+    blackboxHistory[1] = &blackboxHistoryRing[1];
+    blackboxHistory[2] = &blackboxHistoryRing[2];
+    blackboxHistory[3] = &blackboxHistoryRing[3];
+
+    //No need to clear the content of blackboxHistoryRing since our first frame will be an intra which overwrites it
+}
+
+void startBlackbox(void)
+{
+    if (blackboxState == BLACKBOX_STATE_STOPPED) {
+        validateBlackboxConfig();
+
+        // If the device isn't available (e.g. the flash is full or being erased) we'll try again on the next arm
+        if (!blackboxDeviceOpen())
+            return;
+
+        memset(&gpsHistory, 0, sizeof(gpsHistory));
+
+        blackboxFrameBufferPos = 0;
+        blackboxFrameBufferOverflowed = false;
+        blackboxDroppedFrames = 0;
+        // Any events the last log didn't get round to writing belong to that flight
+        blackboxEventCount = 0;
+
+        blackboxCompressing = false;
+        memset(&blackboxBlock, 0, sizeof(blackboxBlock));
+
+        // Don't blame the log for anything that happened before it started
+        blackboxLastLoopOverrunCount = loopOverrunCount;
+        loopMaxJitter = 0;
+
+        blackboxResetHistory();
+
+        vbatReference = vbatLatest;
+
+        /*
+         * We use conditional tests to decide whether or not certain fields should be logged. Since our headers
+         * must always agree with the logged data, the results of these tests must not change during logging. So
+         * cache those now.
+         */
+        blackboxBuildConditionCache();
+        blackboxBuildEncodingPlans();
+        blackboxLoadMotorMix();
+
+        // Everything the header describes is settled now, so it can be rendered in one go
+        if (!blackboxArrangeLogStart()) {
+            blackboxDeviceClose();
+            return;
+        }
+
+        if (masterConfig.blackbox_device == BLACKBOX_DEVICE_SERIAL && masterConfig.blackbox_baudrate == 0
+                && blackboxNegotiatedBaudRate == 0)
+            blackboxSetState(BLACKBOX_STATE_NEGOTIATE_BAUDRATE);
+        else
+            blackboxSetState(BLACKBOX_STATE_SEND_HEADER);
+    }
+}
+
+void blackboxLogEvent(uint8_t event, uint32_t data)
+{
+    blackboxEvent_t *queued;
+
+    // Only queue events while there's a log to write them to, so stale ones can't turn up at the start of the next log
+    if (blackboxState == BLACKBOX_STATE_DISABLED || blackboxState == BLACKBOX_STATE_STOPPED
+            || blackboxState == BLACKBOX_STATE_SHUTTING_DOWN)
+        return;
+
+    if (blackboxEventCount == BLACKBOX_EVENT_QUEUE_LENGTH) {
+        memmove(blackboxEventQueue, blackboxEventQueue + 1, (BLACKBOX_EVENT_QUEUE_LENGTH - 1) * sizeof(blackboxEvent_t));
+        blackboxEventCount--;
+    }
+
+    queued = &blackboxEventQueue[blackboxEventCount++];
+    queued->event = event;
+    queued->time = micros();
+    queued->data = data;
+}
+
+// Write up to 'count' of the queued events to the frame buffer, returning how many that was
+static int writeQueuedEvents(int count)
+{
+    int i;
+
+    count = min(count, blackboxEventCount);
+
+    for (i = 0; i < count; i++) {
+        blackboxBeginFrame('E');
+        blackboxWrite(blackboxEventQueue[i].event);
+
+        writeUnsignedVB(blackboxEventQueue[i].time);
+        writeUnsignedVB(blackboxEventQueue[i].data);
+        blackboxEndFrame();
+    }
+
+    return count;
+}
+
+// Forget the first 'count' queued events, now they've been stored
+static void blackboxEventsStored(int count)
+{
+    blackboxEventCount -= count;
+    memmove(blackboxEventQueue, blackboxEventQueue + count, blackboxEventCount * sizeof(blackboxEvent_t));
+}
+
+/**
+ * Index the keyframe that was just stored, if it's one the index takes. 'offset' is where its iteration's frames
+ * started, which is only any use when the log isn't compressed.
+ */
+static void blackboxIndexKeyframe(uint32_t time, uint32_t offset)
+{
+    if (blackboxKeyframeCount++ % blackboxIndexStride != 0)
+        return;
+
+    if (!blackboxCompressing) {
+        blackboxAddIndexEntry(time, offset);
+    } else if (blackboxBlock.rawLength == 0) {
+        // The block it went into has already been sent
+        blackboxAddIndexEntry(time, blackboxLastBlockOffset);
+    } else if (!blackboxIndexPending) {
+        blackboxIndexPending = true;
+        blackboxIndexPendingTime = time;
     }
 }
 
-static void configureBlackboxPort(void)
+// Write an unsigned variable-byte value to 'out', returning how many bytes that took
+static int blackboxRenderUnsignedVB(uint8_t *out, uint32_t value)
 {
-    serialInit(115200);
+    int length = 0;
 
-    blackboxPort = core.mainport;
-    
-    /*
-     * We want to write at about 7200 bytes per second to give the OpenLog a good chance to save to disk. If
-     * about looptime microseconds elapse between our writes, this is the budget of how many bytes we should
-     * transmit with each write.
-     *
-     * 9 / 1250 = 7200 / 1000000
-     */
-    serialChunkSize = max((masterConfig.looptime * 9) / 1250, 4);
+    while (value > 127) {
+        out[length++] = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+    out[length++] = value;
+
+    return length;
 }
 
-static void releaseBlackboxPort(void)
+/**
+ * Render the footer with the keyframe index and the totals for the log (see FLIGHT_LOG_FOOTER_MAGIC), returning its
+ * length including the trailer.
+ */
+static int blackboxRenderFooter(uint8_t *footer)
 {
-    // Give the serial port back to the CLI
-    serialInit(masterConfig.serial_baudrate);
+    uint32_t time = blackboxLogStartTime, offset = 0;
+    int length = 0, i;
+    uint8_t crc = 0;
+
+    length += blackboxRenderUnsignedVB(footer + length, blackboxLogStartTime);
+    length += blackboxRenderUnsignedVB(footer + length, blackboxLogStartIteration);
+    length += blackboxRenderUnsignedVB(footer + length, currentTime - blackboxLogStartTime);
+    length += blackboxRenderUnsignedVB(footer + length, blackboxIteration - blackboxLogStartIteration);
+    length += blackboxRenderUnsignedVB(footer + length, blackboxKeyframeCount);
+    length += blackboxRenderUnsignedVB(footer + length, blackboxLoggedEvents);
+    length += blackboxRenderUnsignedVB(footer + length, blackboxIndexLength);
+
+    for (i = 0; i < blackboxIndexLength; i++) {
+        length += blackboxRenderUnsignedVB(footer + length, blackboxIndex[i].time - time);
+        length += blackboxRenderUnsignedVB(footer + length, blackboxIndex[i].offset - offset);
+        time = blackboxIndex[i].time;
+        offset = blackboxIndex[i].offset;
+    }
+
+    for (i = 0; i < length; i++)
+        crc = blackboxCrc8(crc, footer[i]);
+
+    footer[length] = length & 0xFF;
+    footer[length + 1] = length >> 8;
+    footer[length + 2] = crc;
+    memcpy(footer + length + 3, FLIGHT_LOG_FOOTER_MAGIC, FLIGHT_LOG_FOOTER_MAGIC_LENGTH);
+
+    return length + FLIGHT_LOG_FOOTER_TRAILER_LENGTH;
 }
 
-void startBlackbox(void)
+/**
+ * Render the end of the log into blackboxStartBuffer, which is free again now that the log has started: whatever
+ * events are still waiting to go out, the LOG_END event and the footer. The last compressed block is sent ahead of it.
+ */
+static void blackboxRenderLogEnd(void)
 {
-    if (blackboxState == BLACKBOX_STATE_STOPPED) {
-        validateBlackboxConfig();
+    uint8_t *out = blackboxStartBuffer, crc = 0;
+    int length = 0, eventsWritten, i;
 
-        configureBlackboxPort();
+    blackboxFrameBufferPos = 0;
 
-        if (!blackboxPort) {
-            blackboxSetState(BLACKBOX_STATE_DISABLED);
-            return;
-        }
+    eventsWritten = writeQueuedEvents(BLACKBOX_EVENT_QUEUE_LENGTH);
+    blackboxEventsStored(eventsWritten);
+    blackboxLoggedEvents += eventsWritten;
 
-        memset(&gpsHistory, 0, sizeof(gpsHistory));
+    blackboxBeginFrame('E');
+    blackboxWrite(FLIGHT_LOG_EVENT_LOG_END);
 
-        blackboxHistory[0] = &blackboxHistoryRing[0];
-        blackboxHistory[1] = &blackboxHistoryRing[1];
-        blackboxHistory[2] = &blackboxHistoryRing[2];
+    writeUnsignedVB(micros());
+    blackboxEndFrame();
 
-        vbatReference = vbatLatest;
+    // This also gives a keyframe that's waiting on the block its place in the index
+    blackboxCloseBlock();
 
-        //No need to clear the content of blackboxHistoryRing since our first frame will be an intra which overwrites it
+    if (blackboxCompressing) {
+        for (i = 0; i < blackboxFrameBufferPos; i++)
+            crc = blackboxCrc8(crc, blackboxFrameBuffer[i]);
 
-        /*
-         * We use conditional tests to decide whether or not certain fields should be logged. Since our headers
-         * must always agree with the logged data, the results of these tests must not change during logging. So
-         * cache those now.
-         */
-        blackboxBuildConditionCache();
+        length = blackboxRenderBlockHeader(out, BLACKBOX_BLOCK_STORED, blackboxFrameBufferPos);
+    }
+
+    memcpy(out + length, blackboxFrameBuffer, blackboxFrameBufferPos);
+    length += blackboxFrameBufferPos;
+    blackboxFrameBufferPos = 0;
 
-        blackboxSetState(BLACKBOX_STATE_SEND_HEADER);
+    if (blackboxCompressing) {
+        out[length++] = crc;
+        blackboxCompressing = false;
     }
+
+    length += blackboxRenderFooter(out + length);
+
+    blackboxStartLength = length;
 }
 
 void finishBlackbox(void)
 {
-    if (blackboxState != BLACKBOX_STATE_DISABLED && blackboxState != BLACKBOX_STATE_STOPPED) {
+    if (blackboxState == BLACKBOX_STATE_RUNNING) {
+        // Anything left of the last iteration goes first, SHUTTING_DOWN sends the rest and then closes the device
+        blackboxFlush();
+        blackboxRenderLogEnd();
+
+        blackboxSetState(BLACKBOX_STATE_SHUTTING_DOWN);
+    } else if (blackboxState != BLACKBOX_STATE_DISABLED && blackboxState != BLACKBOX_STATE_STOPPED
+            && blackboxState != BLACKBOX_STATE_SHUTTING_DOWN) {
+        // The log never got as far as the frames
         blackboxSetState(BLACKBOX_STATE_STOPPED);
-        
-        releaseBlackboxPort();
+
+        blackboxDeviceClose();
     }
 }
 
 #ifdef GPS
 static void writeGPSHomeFrame()
 {
-    blackboxWrite('H');
+    blackboxBeginFrame('H');
 
     writeSignedVB(GPS_home[0]);
     writeSignedVB(GPS_home[1]);
     //TODO it'd be great if we could grab the GPS current time and write that too
+    blackboxEndFrame();
 
     gpsHistory.GPS_home[0] = GPS_home[0];
     gpsHistory.GPS_home[1] = GPS_home[1];
@@ -868,7 +2196,7 @@ static void writeGPSHomeFrame()
 
 static void writeGPSFrame()
 {
-    blackboxWrite('G');
+    blackboxBeginFrame('G');
 
     writeUnsignedVB(GPS_numSat);
     writeSignedVB(GPS_coord[0] - gpsHistory.GPS_home[0]);
@@ -876,6 +2204,7 @@ static void writeGPSFrame()
     writeUnsignedVB(GPS_altitude);
     writeUnsignedVB(GPS_speed);
     writeUnsignedVB(GPS_ground_course);
+    blackboxEndFrame();
 
     gpsHistory.GPS_numSat = GPS_numSat;
     gpsHistory.GPS_coord[0] = GPS_coord[0];
@@ -883,6 +2212,32 @@ static void writeGPSFrame()
 }
 #endif
 
+static void writeSlowFrame(void)
+{
+    blackboxSlowValues_t values;
+
+    values.loopOverruns = loopOverrunCount - blackboxLastLoopOverrunCount;
+    values.loopMaxJitter = loopMaxJitter;
+    values.vbatLatest = vbatLatest;
+    values.amperage = amperage;
+    values.mAhdrawn = mAhdrawn;
+    values.rssi = rssi;
+    memcpy(values.magADC, magADC, sizeof(values.magADC));
+    values.BaroAlt = BaroAlt;
+
+    blackboxBeginFrame('S');
+    writeFrameFromPlan(&values, blackboxSlowPlan, blackboxSlowPlanLength);
+    blackboxEndFrame();
+}
+
+// Start the statistics for the next slow frame, once the last one has been stored
+static void blackboxSlowFrameStored(void)
+{
+    blackboxLastLoopOverrunCount = loopOverrunCount;
+    loopMaxJitter = 0;
+    blackboxLastSlowFrameIteration = blackboxIteration;
+}
+
 /**
  * Fill the current state of the blackbox using values read from the flight controller
  */
@@ -891,6 +2246,7 @@ static void loadBlackboxState(void)
     blackboxValues_t *blackboxCurrent = blackboxHistory[0];
     int i;
 
+    blackboxCurrent->loopIteration = blackboxIteration;
     blackboxCurrent->time = currentTime;
 
     for (i = 0; i < XYZ_AXIS_COUNT; i++)
@@ -912,274 +2268,350 @@ static void loadBlackboxState(void)
     for (i = 0; i < motorCount; i++)
         blackboxCurrent->motor[i] = motor[i];
 
-    blackboxCurrent->vbatLatest = vbatLatest;
+    //Tail servo for tricopters
+    blackboxCurrent->servo[5] = servo[5];
+}
 
-#ifdef MAG
-    for (i = 0; i < XYZ_AXIS_COUNT; i++)
-        blackboxCurrent->magADC[i] = magADC[i];
-#endif
+// Beep the buzzer and write the current time to the log as a synchronization point
+static void blackboxPlaySyncBeep()
+{
+    uint32_t now = micros();
 
-#ifdef BARO
-    blackboxCurrent->BaroAlt = BaroAlt;
-#endif
+    /*
+     * The regular beep routines aren't going to work for us, because they queue up the beep to be executed later.
+     * Our beep is timing sensitive, so start beeping now without setting the beeperIsOn flag.
+     */
+    BEEP_ON;
 
-    //Tail servo for tricopters
-    blackboxCurrent->servo[5] = servo[5];
+    // Have the regular beeper code turn off the beep for us eventually, since that's not timing-sensitive
+    buzzer(BUZZER_ARMING);
+
+    blackboxBeginFrame('E');
+    blackboxWrite(FLIGHT_LOG_EVENT_SYNC_BEEP);
+
+    writeUnsignedVB(now);
+    blackboxEndFrame();
 }
 
 /**
- * Transmit the header information for the given field definitions. Transmitted header lines look like:
- *
- * H Field I name:a,b,c
- * H Field I predictor:0,1,2
- *
- * Provide an array 'conditions' of FlightLogFieldCondition enums if you want these conditions to decide whether a field
- * should be included or not. Otherwise provide NULL for this parameter and NULL for secondCondition.
- *
- * Set xmitState.headerIndex to 0 and xmitState.u.fieldIndex to -1 before calling for the first time.
- *
- * secondFieldDefinition and secondCondition element pointers need to be provided in order to compute the stride of the
- * fieldDefinition and secondCondition arrays.
- *
- * Returns true if there is still header left to transmit (so call again to continue transmission).
+ * Record that we had to throw frames away because the serial port couldn't keep up. This is always followed by an
+ * I-frame so the decoder can resynchronise.
  */
-static bool sendFieldDefinition(const char * const *headerNames, unsigned int headerCount, const void *fieldDefinitions,
-        const void *secondFieldDefinition, int fieldCount, const uint8_t *conditions, const uint8_t *secondCondition)
+static void writeFramesDroppedEvent(void)
 {
-    const blackboxFieldDefinition_t *def;
-    int charsWritten;
-    static bool needComma = false;
-    size_t definitionStride = (char*) secondFieldDefinition - (char*) fieldDefinitions;
-    size_t conditionsStride = (char*) secondCondition - (char*) conditions;
+    blackboxBeginFrame('E');
+    blackboxWrite(FLIGHT_LOG_EVENT_FRAMES_DROPPED);
 
-    /*
-     * We're chunking up the header data so we don't exceed our datarate. So we'll be called multiple times to transmit
-     * the whole header.
-     */
-    if (xmitState.u.fieldIndex == -1) {
-        if (xmitState.headerIndex >= headerCount)
-            return false; //Someone probably called us again after we had already completed transmission
+    writeUnsignedVB(blackboxDroppedFrames);
+    blackboxEndFrame();
+}
 
-        charsWritten = blackboxPrint("H Field ");
-        charsWritten += blackboxPrint(headerNames[xmitState.headerIndex]);
-        charsWritten += blackboxPrint(":");
+static void writeCaptureEvent(uint8_t event, uint32_t iteration)
+{
+    blackboxBeginFrame('E');
+    blackboxWrite(event);
 
-        xmitState.u.fieldIndex++;
-        needComma = false;
-    } else
-        charsWritten = 0;
+    writeUnsignedVB(iteration);
+    if (event == FLIGHT_LOG_EVENT_CAPTURE_START)
+        blackboxWrite(blackboxCaptureTriggers);
+    blackboxEndFrame();
+}
+
+/**
+ * Check the capture triggers, opening a window (or extending the current one) if any of them fired. Returns true if
+ * this iteration falls in a window.
+ */
+static bool blackboxUpdateCaptureWindow(void)
+{
+    uint8_t triggers = 0;
+    int i;
 
-    for (; xmitState.u.fieldIndex < fieldCount && charsWritten < serialChunkSize; xmitState.u.fieldIndex++) {
-        def = (const blackboxFieldDefinition_t*) ((const char*)fieldDefinitions + definitionStride * xmitState.u.fieldIndex);
+    // mixTable() had to pull the motors back to keep them under maxthrottle
+    if (f.MOTOR_LIMIT_REACHED)
+        triggers |= FLIGHT_LOG_CAPTURE_MOTOR_LIMIT;
 
-        if (!conditions || testBlackboxCondition(conditions[conditionsStride * xmitState.u.fieldIndex])) {
-            if (needComma) {
-                blackboxWrite(',');
-                charsWritten++;
-            } else
-                needComma = true;
+    if ((feature(FEATURE_FAILSAFE) || feature(FEATURE_FW_FAILSAFE_RTH)) && failsafeCnt > 5 * cfg.failsafe_delay)
+        triggers |= FLIGHT_LOG_CAPTURE_FAILSAFE;
 
-            // The first header is a field name
-            if (xmitState.headerIndex == 0) {
-                charsWritten += blackboxPrint(def->name);
-            } else {
-                //The other headers are integers
-                if (def->arr[xmitState.headerIndex - 1] >= 10) {
-                    blackboxWrite(def->arr[xmitState.headerIndex - 1] / 10 + '0');
-                    blackboxWrite(def->arr[xmitState.headerIndex - 1] % 10 + '0');
-                    charsWritten += 2;
-                } else {
-                    blackboxWrite(def->arr[xmitState.headerIndex - 1] + '0');
-                    charsWritten++;
-                }
+    for (i = 0; i < XYZ_AXIS_COUNT; i++) {
+        if (masterConfig.blackbox_capture_gyro > 0
+                && abs(gyroData[i] - blackboxCaptureLastGyro[i]) > masterConfig.blackbox_capture_gyro)
+            triggers |= FLIGHT_LOG_CAPTURE_GYRO_SPIKE;
+
+        blackboxCaptureLastGyro[i] = gyroData[i];
+    }
+
+    if (triggers) {
+        blackboxCaptureTriggers |= triggers;
+        blackboxCaptureUntil = blackboxIteration + masterConfig.blackbox_capture_window;
+    }
+
+    return (int32_t) (blackboxIteration - blackboxCaptureUntil) < 0;
+}
+
+/**
+ * Log the start of a capture window, along with the iterations skipped just before it if the log is intact up to
+ * them. Those are sent one at a time, since together they could overflow the frame buffer. If the start doesn't make
+ * it out with them, it's left in the frame buffer to go out with this iteration's frames.
+ */
+static void blackboxStartCaptureWindow(void)
+{
+    bool keyframe;
+    int i;
+
+    if (blackboxCaptureLookbackCount > 0 && blackboxDroppedFrames == 0) {
+        writeCaptureEvent(FLIGHT_LOG_EVENT_CAPTURE_START, blackboxCaptureLookback[0].loopIteration);
+
+        for (i = 0; i < blackboxCaptureLookbackCount; i++) {
+            *blackboxHistory[0] = blackboxCaptureLookback[i];
+            keyframe = writeInterframe();
+
+            if (!blackboxFlush()) {
+                // These go down as dropped frames, so an I-frame comes next
+                blackboxDroppedFrames += blackboxCaptureLookbackCount - i;
+                break;
             }
+
+            // Counted, but not indexed: a decoder starting here would miss the start of the window
+            if (keyframe)
+                blackboxKeyframeCount++;
+
+            blackboxCaptureLogged = true;
+#ifdef SITL
+            sitlBlackboxFrameLogged(blackboxCaptureLookback[i].loopIteration, &blackboxCaptureLookback[i]);
+#endif
         }
     }
 
-    // Did we complete this line?
-    if (xmitState.u.fieldIndex == fieldCount) {
-        blackboxWrite('\n');
-        xmitState.headerIndex++;
-        xmitState.u.fieldIndex = -1;
+    blackboxCaptureLookbackCount = 0;
+
+    if (!blackboxCaptureLogged)
+        writeCaptureEvent(FLIGHT_LOG_EVENT_CAPTURE_START, blackboxIteration);
+    else
+        blackboxCaptureTriggers = 0;
+}
+
+// Keep this iteration's state in case a capture window starts before the next frame is logged
+static void blackboxKeepCaptureLookback(void)
+{
+    if (blackboxCaptureLookbackCount == BLACKBOX_CAPTURE_LOOKBACK) {
+        memmove(blackboxCaptureLookback, blackboxCaptureLookback + 1,
+            (BLACKBOX_CAPTURE_LOOKBACK - 1) * sizeof(blackboxValues_t));
+        blackboxCaptureLookbackCount--;
     }
 
-    return xmitState.headerIndex < headerCount;
+    // The slot for the next frame is free until then
+    loadBlackboxState();
+    blackboxCaptureLookback[blackboxCaptureLookbackCount++] = *blackboxHistory[0];
 }
 
 /**
- * Transmit a portion of the system information headers. Call the first time with xmitState.headerIndex == 0. Returns
- * true iff transmission is complete, otherwise call again later to continue transmission.
+ * While disarmed, encode an I-frame every blackbox_prearm_interval iterations and keep it at the front of
+ * blackboxStartBuffer, so the next log can start with the moments before the arm. Only I-frames are kept since the
+ * oldest frames are thrown away as the buffer fills, and the rest need to decode without them.
  */
-static bool blackboxWriteSysinfo()
+static void blackboxCapturePrearmFrame(void)
 {
-    union floatConvert_t {
-        float f;
-        uint32_t u;
-    } floatConvert;
+    if (!blackboxPrearmStarted) {
+        validateBlackboxConfig();
+        blackboxResetHistory();
+        blackboxBuildConditionCache();
+        blackboxBuildEncodingPlans();
+
+        blackboxPrearmConditionCache = blackboxConditionCache;
+        blackboxPrearmFrameCheck = masterConfig.blackbox_frame_check;
+        blackboxPrearmLength = 0;
+        blackboxPrearmFrameCount = 0;
+        blackboxIteration = 0;
+        blackboxPrearmStarted = true;
+    }
+
+    if (blackboxIteration % masterConfig.blackbox_prearm_interval == 0) {
+        loadBlackboxState();
+        writeIntraframe();
+
+        // Make room a quarter of the buffer at a time, rather than shuffling it along for every frame
+        if (blackboxPrearmLength + blackboxFrameBufferPos > BLACKBOX_START_BUFFER_SIZE
+                || blackboxPrearmFrameCount == BLACKBOX_PREARM_MAX_FRAMES)
+            blackboxDropPrearmFrames(max(BLACKBOX_START_BUFFER_SIZE / 4, blackboxFrameBufferPos));
+
+        memcpy(blackboxStartBuffer + blackboxPrearmLength, blackboxFrameBuffer, blackboxFrameBufferPos);
+        blackboxPrearmLength += blackboxFrameBufferPos;
+        blackboxPrearmFrameLength[blackboxPrearmFrameCount] = blackboxFrameBufferPos;
+#ifdef SITL
+        // The frame we just wrote has already been rotated into the history
+        blackboxPrearmValues[blackboxPrearmFrameCount] = *blackboxHistory[1];
+#endif
+        blackboxPrearmFrameCount++;
 
-    if (xmitState.headerIndex == 0) {
-        xmitState.u.serialBudget = 0;
-        xmitState.headerIndex = 1;
+        // It's not for the device yet
+        blackboxFrameBufferPos = 0;
     }
 
-    // How many bytes can we afford to transmit this loop?
-    xmitState.u.serialBudget = min(xmitState.u.serialBudget + serialChunkSize, 64);
+    blackboxIteration++;
+}
 
-    // Most headers will consume at least 20 bytes so wait until we've built up that much link budget
-    if (xmitState.u.serialBudget < 20) {
-        return false;
+/**
+ * Collect what the logger has sent us into blackboxNegotiation.reply. Returns true once a whole line has arrived.
+ */
+static bool blackboxReadReply(void)
+{
+    uint8_t c;
+
+    while (serialTotalBytesWaiting(blackboxPort)) {
+        c = serialRead(blackboxPort);
+
+        if (c == '\n') {
+            blackboxNegotiation.reply[blackboxNegotiation.replyLength] = '\0';
+            blackboxNegotiation.replyLength = 0;
+            return true;
+        }
+
+        if (blackboxNegotiation.replyLength < BLACKBOX_REPLY_LENGTH - 1)
+            blackboxNegotiation.reply[blackboxNegotiation.replyLength++] = c;
     }
 
-    switch (xmitState.headerIndex) {
-        case 0:
-            //Shouldn't ever get here
-        break;
-        case 1:
-            blackboxPrintf("H Firmware type:Baseflight\n");
-            
-            xmitState.u.serialBudget -= strlen("H Firmware type:Baseflight\n");
-        break;
-        case 2:
-            // No firmware revision info to write
-        break;
-        case 3:
-            blackboxPrintf("H Firmware date:%s %s\n", __DATE__, __TIME__);
-            
-            /* Don't need to be super exact about the budget so don't mind the fact that we're including the length of
-             * the placeholder "%s"
-             */
-            xmitState.u.serialBudget -= strlen("H Firmware date:%s %s\n") + strlen(__DATE__) + strlen(__TIME__);
-        break;
-        case 4:
-            blackboxPrintf("H P interval:%d/%d\n", masterConfig.blackbox_rate_num, masterConfig.blackbox_rate_denom);
+    return false;
+}
 
-            xmitState.u.serialBudget -= strlen("H P interval:%d/%d\n");
-        break;
-        case 5:
-            blackboxPrintf("H rcRate:%d\n", cfg.rcRate8);
+// Has the logger sent us a "BBOK" line?
+static bool blackboxLoggerAcknowledged(void)
+{
+    while (blackboxReadReply()) {
+        if (strncmp(blackboxNegotiation.reply, "BBOK", 4) == 0)
+            return true;
+    }
 
-            xmitState.u.serialBudget -= strlen("H rcRate:%d\n");
-        break;
-        case 6:
-            blackboxPrintf("H minthrottle:%d\n", masterConfig.minthrottle);
+    return false;
+}
 
-            xmitState.u.serialBudget -= strlen("H minthrottle:%d\n");
-        break;
-        case 7:
-            blackboxPrintf("H maxthrottle:%d\n", masterConfig.maxthrottle);
+/**
+ * Take the next step of the baud rate negotiation with the logger (see BLACKBOX_BASE_BAUDRATE). Returns true once the
+ * port is running at the rate we'll log at.
+ */
+static bool blackboxNegotiateBaudRate(void)
+{
+    uint32_t now = millis(), loggerBaudRate;
+    unsigned int i;
+
+    switch (blackboxNegotiation.step) {
+        case BLACKBOX_NEGOTIATE_ASK:
+            if ((int32_t) (now - (blackboxDeviceOpenTime + BLACKBOX_UART_SETTLE_MS)) < 0)
+                return false;
 
-            xmitState.u.serialBudget -= strlen("H maxthrottle:%d\n");
+            blackboxPrint("BBPROBE\n");
+
+            blackboxNegotiation.step = BLACKBOX_NEGOTIATE_WAIT_OFFER;
+            blackboxNegotiation.stepTime = now;
         break;
-        case 8:
-            floatConvert.f = gyro.scale;
-            blackboxPrintf("H gyro.scale:0x%x\n", floatConvert.u);
+        case BLACKBOX_NEGOTIATE_WAIT_OFFER:
+            if (!blackboxLoggerAcknowledged())
+                // A logger that doesn't answer can only take the base rate
+                return (int32_t) (now - (blackboxNegotiation.stepTime + BLACKBOX_NEGOTIATE_TIMEOUT_MS)) >= 0;
+
+            loggerBaudRate = strtoul(blackboxNegotiation.reply + 4, NULL, 10);
+
+            for (i = 0; i < ARRAY_LENGTH(blackboxBaudRates) - 1 && blackboxBaudRates[i] > loggerBaudRate; i++)
+                ;
+
+            if (blackboxBaudRates[i] == BLACKBOX_BASE_BAUDRATE) {
+                blackboxNegotiatedBaudRate = BLACKBOX_BASE_BAUDRATE;
+                return true;
+            }
+
+            blackboxNegotiation.baudRate = blackboxBaudRates[i];
+            blackboxPrintf("BBBAUD %u\n", (unsigned int) blackboxNegotiation.baudRate);
 
-            xmitState.u.serialBudget -= strlen("H gyro.scale:0x%x\n") + 6;
+            blackboxNegotiation.step = BLACKBOX_NEGOTIATE_SWITCH;
+            blackboxNegotiation.stepTime = now;
         break;
-        case 9:
-            blackboxPrintf("H acc_1G:%u\n", acc_1G);
-            
-            xmitState.u.serialBudget -= strlen("H acc_1G:%u\n");
+        case BLACKBOX_NEGOTIATE_SWITCH:
+            // Changing the rate while our request is still going out would garble the end of it
+            if (!isSerialTransmitBufferEmpty(blackboxPort))
+                blackboxNegotiation.stepTime = now;
+            else if ((int32_t) (now - blackboxNegotiation.stepTime) >= 1) {
+                serialSetBaudRate(blackboxPort, blackboxNegotiation.baudRate);
+
+                blackboxNegotiation.step = BLACKBOX_NEGOTIATE_CONFIRM;
+                blackboxNegotiation.stepTime = now;
+            }
         break;
-        case 10:
-            blackboxPrintf("H vbatscale:%u\n", masterConfig.vbatscale);
+        case BLACKBOX_NEGOTIATE_CONFIRM:
+            if ((int32_t) (now - (blackboxNegotiation.stepTime + BLACKBOX_NEGOTIATE_SWITCH_MS)) < 0)
+                return false;
 
-            xmitState.u.serialBudget -= strlen("H vbatscale:%u\n");
-        break;
-        case 11:
-            blackboxPrintf("H vbatcellvoltage:%u,0,%u\n", masterConfig.vbatmincellvoltage, masterConfig.vbatmaxcellvoltage);
+            blackboxPrint("BBPROBE\n");
 
-            xmitState.u.serialBudget -= strlen("H vbatcellvoltage:%u,0,%u\n");
+            blackboxNegotiation.step = BLACKBOX_NEGOTIATE_WAIT_CONFIRM;
+            blackboxNegotiation.stepTime = now;
         break;
-        case 12:
-            blackboxPrintf("H vbatref:%u\n", vbatReference);
+        case BLACKBOX_NEGOTIATE_WAIT_CONFIRM:
+            if (blackboxLoggerAcknowledged()) {
+                blackboxNegotiatedBaudRate = blackboxNegotiation.baudRate;
+                return true;
+            }
 
-            xmitState.u.serialBudget -= strlen("H vbatref:%u\n");
+            if ((int32_t) (now - (blackboxNegotiation.stepTime + BLACKBOX_NEGOTIATE_TIMEOUT_MS)) >= 0) {
+                serialSetBaudRate(blackboxPort, BLACKBOX_BASE_BAUDRATE);
+                return true;
+            }
         break;
-        default:
-            return true;
     }
 
-    xmitState.headerIndex++;
     return false;
 }
 
-// Beep the buzzer and write the current time to the log as a synchronization point
-static void blackboxPlaySyncBeep()
+bool blackboxIsNegotiating(void)
 {
-    uint32_t now = micros();
-
-    /*
-     * The regular beep routines aren't going to work for us, because they queue up the beep to be executed later.
-     * Our beep is timing sensitive, so start beeping now without setting the beeperIsOn flag.
-     */
-    BEEP_ON;
-
-    // Have the regular beeper code turn off the beep for us eventually, since that's not timing-sensitive
-    buzzer(BUZZER_ARMING);
-
-    blackboxWrite('E');
-    blackboxWrite(FLIGHT_LOG_EVENT_SYNC_BEEP);
+    return blackboxState == BLACKBOX_STATE_NEGOTIATE_BAUDRATE;
+}
 
-    writeUnsignedVB(now);
+bool blackboxIsShuttingDown(void)
+{
+    return blackboxState == BLACKBOX_STATE_SHUTTING_DOWN;
 }
 
 void handleBlackbox(void)
 {
-    int i;
+    int i, eventsWritten = 0;
+    bool frameWritten = false, keyframeWritten = false, slowFrameWritten = false, capturing = false;
+    bool captureEventWritten = false;
+    uint32_t iterationOffset, encodeStart;
+#ifdef GPS
+    gpsState_t gpsHistoryBackup;
+#endif
 
     switch (blackboxState) {
+        case BLACKBOX_STATE_NEGOTIATE_BAUDRATE:
+            if (blackboxNegotiateBaudRate())
+                blackboxSetState(BLACKBOX_STATE_SEND_HEADER);
+        break;
+        case BLACKBOX_STATE_STOPPED:
+            if (masterConfig.blackbox_prearm_interval > 0)
+                blackboxCapturePrearmFrame();
+        break;
         case BLACKBOX_STATE_SEND_HEADER:
-            //On entry of this state, xmitState.headerIndex is 0 and startTime is intialised
+            //On entry of this state, blackboxStartPos is 0
 
-            /*
-             * Once the UART has had time to init, transmit the header in chunks so we don't overflow our transmit
-             * buffer.
-             */
-            if (millis() > xmitState.u.startTime + 100) {
-                for (i = 0; i < serialChunkSize && blackboxHeader[xmitState.headerIndex] != '\0'; i++, xmitState.headerIndex++)
-                    blackboxWrite(blackboxHeader[xmitState.headerIndex]);
+            // Send as much of the header (and pre-arm frames) as the device has room for, straight from the buffer
+            if ((int32_t) (millis() - (blackboxDeviceOpenTime + BLACKBOX_UART_SETTLE_MS)) >= 0) {
+                i = min(blackboxStartLength - blackboxStartPos, (int) blackboxDeviceFreeSpace());
 
-                if (blackboxHeader[xmitState.headerIndex] == '\0')
-                    blackboxSetState(BLACKBOX_STATE_SEND_FIELDINFO);
-            }
-        break;
-        case BLACKBOX_STATE_SEND_FIELDINFO:
-            //On entry of this state, xmitState.headerIndex is 0 and xmitState.u.fieldIndex is -1
-            if (!sendFieldDefinition(blackboxMainHeaderNames, ARRAY_LENGTH(blackboxMainHeaderNames), blackboxMainFields, blackboxMainFields + 1,
-                    ARRAY_LENGTH(blackboxMainFields), &blackboxMainFields[0].condition, &blackboxMainFields[1].condition)) {
-#ifdef GPS
-                if (feature(FEATURE_GPS))
-                    blackboxSetState(BLACKBOX_STATE_SEND_GPS_H_HEADERS);
-                else
-#endif
-                    blackboxSetState(BLACKBOX_STATE_SEND_SYSINFO);
-            }
-        break;
-#ifdef GPS
-        case BLACKBOX_STATE_SEND_GPS_H_HEADERS:
-            //On entry of this state, xmitState.headerIndex is 0 and xmitState.u.fieldIndex is -1
-            if (!sendFieldDefinition(blackboxGPSHHeaderNames, ARRAY_LENGTH(blackboxGPSHHeaderNames), blackboxGpsHFields, blackboxGpsHFields + 1,
-                    ARRAY_LENGTH(blackboxGpsHFields), NULL, NULL)) {
-                blackboxSetState(BLACKBOX_STATE_SEND_GPS_G_HEADERS);
-            }
-        break;
-        case BLACKBOX_STATE_SEND_GPS_G_HEADERS:
-            //On entry of this state, xmitState.headerIndex is 0 and xmitState.u.fieldIndex is -1
-            if (!sendFieldDefinition(blackboxGPSGHeaderNames, ARRAY_LENGTH(blackboxGPSGHeaderNames), blackboxGpsGFields, blackboxGpsGFields + 1,
-                    ARRAY_LENGTH(blackboxGpsGFields), NULL, NULL)) {
-                blackboxSetState(BLACKBOX_STATE_SEND_SYSINFO);
+                blackboxStartPos += blackboxDeviceWrite(blackboxStartBuffer + blackboxStartPos, i);
+
+                if (blackboxStartPos == blackboxStartLength)
+                    blackboxSetState(BLACKBOX_STATE_PRERUN);
             }
         break;
+        case BLACKBOX_STATE_PRERUN:
+#ifdef SITL
+            for (i = 0; i < blackboxPrearmFrameCount; i++)
+                sitlBlackboxFrameLogged(blackboxPrearmValues[i].loopIteration, &blackboxPrearmValues[i]);
 #endif
-        case BLACKBOX_STATE_SEND_SYSINFO:
-            //On entry of this state, xmitState.headerIndex is 0
 
-            //Keep writing chunks of the system info headers until it returns true to signal completion
-            if (blackboxWriteSysinfo())
-                blackboxSetState(BLACKBOX_STATE_PRERUN);
-        break;
-        case BLACKBOX_STATE_PRERUN:
+            // The header is all out, so everything from here on goes into compressed blocks if they're enabled
+            blackboxCompressing = masterConfig.blackbox_compression;
+
             blackboxPlaySyncBeep();
 
             blackboxSetState(BLACKBOX_STATE_RUNNING);
@@ -1187,15 +2619,74 @@ void handleBlackbox(void)
         case BLACKBOX_STATE_RUNNING:
             // On entry to this state, blackboxIteration, blackboxPFrameIndex and blackboxIFrameIndex are reset to 0
 
-            // Write a keyframe every BLACKBOX_I_INTERVAL frames so we can resynchronise upon missing frames
-            if (blackboxPFrameIndex == 0) {
+#ifdef GPS
+            // If the GPS frames don't make it out we need to send them again, so we may have to roll back this history
+            gpsHistoryBackup = gpsHistory;
+#endif
+
+            /*
+             * Decoders learn of capture windows from their events, so a window's frames must never go out ahead of them.
+             * A new window's lookback frames are flushed one at a time, so this comes before anything else is written
+             * this iteration, which then only goes out (or is thrown away) with the final flush.
+             */
+            if (masterConfig.blackbox_capture_window > 0) {
+                capturing = blackboxUpdateCaptureWindow();
+
+                if (capturing && !blackboxCaptureLogged) {
+                    blackboxStartCaptureWindow();
+                    captureEventWritten = !blackboxCaptureLogged;
+                } else if (!capturing && blackboxCaptureLogged) {
+                    writeCaptureEvent(FLIGHT_LOG_EVENT_CAPTURE_END, blackboxIteration);
+                    captureEventWritten = true;
+                }
+            }
+
+            // Where this iteration's frames will go, if they aren't compressed
+            iterationOffset = blackboxBytesWritten;
+
+            eventsWritten = writeQueuedEvents(BLACKBOX_EVENTS_PER_ITERATION);
+
+            /*
+             * The slow fields keep their own schedule, and a slow frame that gets dropped is retried on the next iteration.
+             * It goes ahead of the main frame so the decoder already has these values when it reaches that one.
+             */
+            if (blackboxIteration - blackboxLastSlowFrameIteration >= masterConfig.blackbox_slow_interval) {
+                writeSlowFrame();
+                slowFrameWritten = true;
+            }
+
+            /*
+             * Write a keyframe every blackbox_i_interval frames (or as blackboxKeyframeDue() decides in adaptive mode)
+             * so we can resynchronise upon missing frames. If we've had to drop frames, keep trying to write one every
+             * iteration until it fits in the port's buffer.
+             *
+             * Keyframes only ever replace P-frames on iterations that would be logged anyway, so the pattern of logged
+             * iterations is set by blackbox_i_interval and the rate alone, which is what decoders expect.
+             */
+            if (blackboxKeyframeDue() || blackboxDroppedFrames > 0) {
+                if (blackboxDroppedFrames > 0)
+                    writeFramesDroppedEvent();
+
+                // Repeat where we are with capture windows, so a decoder that lost the last capture event can catch up
+                if (masterConfig.blackbox_capture_window > 0 && !captureEventWritten)
+                    writeCaptureEvent(capturing ? FLIGHT_LOG_EVENT_CAPTURE_START : FLIGHT_LOG_EVENT_CAPTURE_END,
+                        blackboxIteration);
+
                 // Copy current system values into the blackbox
                 loadBlackboxState();
+                encodeStart = DWT_CYCCNT;
                 writeIntraframe();
+                perfRecord(PERF_STAGE_BLACKBOX_IFRAME, encodeStart);
+                frameWritten = true;
+                keyframeWritten = true;
             } else {
-                if ((blackboxPFrameIndex + masterConfig.blackbox_rate_num - 1) % masterConfig.blackbox_rate_denom < masterConfig.blackbox_rate_num) {
+                if (capturing
+                        || (blackboxPFrameIndex + masterConfig.blackbox_rate_num - 1) % masterConfig.blackbox_rate_denom < masterConfig.blackbox_rate_num) {
                     loadBlackboxState();
-                    writeInterframe();
+                    encodeStart = DWT_CYCCNT;
+                    keyframeWritten = writeInterframe();
+                    perfRecord(keyframeWritten ? PERF_STAGE_BLACKBOX_IFRAME : PERF_STAGE_BLACKBOX_PFRAME, encodeStart);
+                    frameWritten = true;
                 }
 #ifdef GPS
                 if (feature(FEATURE_GPS)) {
@@ -1207,7 +2698,7 @@ void handleBlackbox(void)
                      * still be interpreted correctly.
                      */
                     if (GPS_home[0] != gpsHistory.GPS_home[0] || GPS_home[1] != gpsHistory.GPS_home[1]
-                        || (blackboxPFrameIndex == BLACKBOX_I_INTERVAL / 2 && blackboxIFrameIndex % 128 == 0)) {
+                        || (blackboxPFrameIndex == masterConfig.blackbox_i_interval / 2u && blackboxIFrameIndex % 128 == 0)) {
 
                         writeGPSHomeFrame();
                         writeGPSFrame();
@@ -1220,17 +2711,78 @@ void handleBlackbox(void)
 #endif
             }
 
+#ifdef FLASHFS
+            // Stop cleanly once the flash chip fills up
+            if (masterConfig.blackbox_device == BLACKBOX_DEVICE_FLASH && flashfsIsEOF()) {
+                finishBlackbox();
+                return;
+            }
+#endif
+
+            if (blackboxFlush()) {
+                if (frameWritten) {
+                    blackboxDroppedFrames = 0;
+#ifdef SITL
+                    // The frame we just wrote has already been rotated into the history
+                    sitlBlackboxFrameLogged(blackboxIteration, blackboxHistory[1]);
+#endif
+                }
+                if (keyframeWritten)
+                    blackboxIndexKeyframe(blackboxHistory[1]->time, iterationOffset);
+                if (slowFrameWritten)
+                    blackboxSlowFrameStored();
+                blackboxEventsStored(eventsWritten);
+                blackboxLoggedEvents += eventsWritten;
+                if (captureEventWritten) {
+                    blackboxCaptureLogged = capturing;
+                    blackboxCaptureTriggers = 0;
+                }
+            } else {
+                // The port is backed up, throw this iteration away and resynchronise with an I-frame later
+                if (frameWritten)
+                    blackboxDroppedFrames++;
+#ifdef GPS
+                gpsHistory = gpsHistoryBackup;
+#endif
+            }
+
+            // Only the iterations since the last frame that made it out can be filled in by a capture window
+            if (masterConfig.blackbox_capture_window > 0) {
+                if (frameWritten || blackboxDroppedFrames > 0)
+                    blackboxCaptureLookbackCount = 0;
+                else
+                    blackboxKeepCaptureLookback();
+            }
+
             blackboxIteration++;
             blackboxPFrameIndex++;
             
-            if (blackboxPFrameIndex == BLACKBOX_I_INTERVAL) {
+            if (blackboxPFrameIndex == masterConfig.blackbox_i_interval) {
                 blackboxPFrameIndex = 0;
                 blackboxIFrameIndex++;
             }
         break;
+        case BLACKBOX_STATE_SHUTTING_DOWN:
+            //On entry of this state, blackboxStartPos is 0
+
+            // Send the end of the log, then give the port back once it has all gone out (or we've waited long enough)
+            i = min(blackboxStartLength - blackboxStartPos, (int) blackboxDeviceFreeSpace());
+
+            blackboxStartPos += blackboxDeviceWrite(blackboxStartBuffer + blackboxStartPos, i);
+
+            if ((blackboxStartPos == blackboxStartLength && blackboxDeviceIsIdle())
+                    || (int32_t) (millis() - (blackboxShutdownTime + BLACKBOX_SHUTDOWN_TIMEOUT_MS)) >= 0) {
+                blackboxSetState(BLACKBOX_STATE_STOPPED);
+
+                blackboxDeviceClose();
+            }
+        break;
         default:
         break;
     }
+
+    // Send everything we encoded during this iteration to the port at once (a no-op if the running state already has)
+    blackboxFlush();
 }
 
 static bool canUseBlackboxWithCurrentConfiguration(void)
@@ -14,6 +14,7 @@
 #endif
 
 typedef struct blackboxValues_t {
+    uint32_t loopIteration;
     uint32_t time;
 
     int32_t axisPID_P[XYZ_AXIS_COUNT], axisPID_I[XYZ_AXIS_COUNT], axisPID_D[XYZ_AXIS_COUNT];
@@ -23,20 +24,29 @@ typedef struct blackboxValues_t {
     int16_t accSmooth[XYZ_AXIS_COUNT];
     int16_t motor[MAX_MOTORS];
     int16_t servo[MAX_SERVOS];
-    
-    uint16_t vbatLatest;
-
-#ifdef BARO
-    int32_t BaroAlt;
-#endif
-#ifdef MAG
-    int16_t magADC[XYZ_AXIS_COUNT];
-#endif
 } blackboxValues_t;
 
+typedef enum BlackboxDevice {
+    BLACKBOX_DEVICE_SERIAL = 0,
+    BLACKBOX_DEVICE_FLASH = 1
+} BlackboxDevice;
+
 void initBlackbox(void);
 void handleBlackbox(void);
 void startBlackbox(void);
 void finishBlackbox(void);
 
+/**
+ * Log an event (a FlightLogEvent from blackbox_fielddefs.h) with the current time and the given data. Events are
+ * queued until the log has room for them, so this can be called from anywhere. Events while no log is open (or while
+ * one is shutting down) are dropped.
+ */
+void blackboxLogEvent(uint8_t event, uint32_t data);
+
+// Whether the blackbox is waiting for its logger to answer on the main serial port, so MSP mustn't read from it
+bool blackboxIsNegotiating(void);
+
+// Whether the end of a log is still going out, which has to finish (and hand the port back) even in the CLI
+bool blackboxIsShuttingDown(void);
+
 #endif /* BLACKBOX_H_ */
@@ -0,0 +1,99 @@
+/*
+ * This file is part of baseflight
+ * Licensed under GPL V3 or modified DCL - see https://github.com/multiwii/baseflight/blob/master/README.md
+ */
+
+#ifndef BLACKBOX_COMPRESS_H_
+#define BLACKBOX_COMPRESS_H_
+
+#include <stdint.h>
+
+/*
+ * Block format for compressed logs, shared by the firmware and the decoder. The text header is written as usual (with
+ * "H Data compression:1"), and everything after it is carried in blocks which each hold the frames of one or more
+ * whole loop iterations:
+ *
+ *   'Z', raw length (unsigned VB), Huffman codes of the raw bytes, CRC-8 of the raw bytes
+ *   'R', raw length (unsigned VB), the raw bytes as they are, CRC-8 of the raw bytes
+ *
+ * The codes are packed most significant bit first, and the last byte is padded out with zero bits. A decoder that
+ * loses its place (or finds a block whose CRC doesn't match) skips ahead to the next marker byte that starts a good
+ * block, and treats the frames after the gap like those after a dropped frame.
+ */
+
+#define BLACKBOX_BLOCK_HUFFMAN 'Z'
+#define BLACKBOX_BLOCK_STORED  'R'
+
+#define BLACKBOX_HUFFMAN_MAX_CODE_LENGTH 12
+
+typedef struct blackboxHuffmanCode_t {
+    uint16_t code;
+    uint8_t length;
+} blackboxHuffmanCode_t;
+
+/*
+ * The static code for each byte value, a canonical Huffman code built from the byte frequencies of typical logs (SITL
+ * flights of a quadcopter) by "blackbox_predict --huffman". Changing it changes the log format, so a new table needs
+ * a new FlightLogCompression number.
+ */
+static const blackboxHuffmanCode_t blackboxHuffmanTable[256] = {
+    {0x000,  2}, {0x00a,  5}, {0x00b,  5}, {0x00c,  5}, {0x00d,  5}, {0x01e,  6}, {0x01f,  6}, {0x04c,  7},
+    {0x020,  6}, {0x04d,  7}, {0x04e,  7}, {0x0ba,  8}, {0x04f,  7}, {0x0bb,  8}, {0x0bc,  8}, {0x0bd,  8},
+    {0x021,  6}, {0x0be,  8}, {0x19e,  9}, {0x19f,  9}, {0x0bf,  8}, {0x1a0,  9}, {0x1a1,  9}, {0x1a2,  9},
+    {0x0c0,  8}, {0x1a3,  9}, {0x0c1,  8}, {0x1a4,  9}, {0x0c2,  8}, {0x1a5,  9}, {0x1a6,  9}, {0x1a7,  9},
+    {0x022,  6}, {0x0c3,  8}, {0x050,  7}, {0x0c4,  8}, {0x051,  7}, {0x0c5,  8}, {0x052,  7}, {0x0c6,  8},
+    {0x023,  6}, {0x053,  7}, {0x054,  7}, {0x0c7,  8}, {0x0c8,  8}, {0x055,  7}, {0x1a8,  9}, {0x024,  6},
+    {0x025,  6}, {0x390, 10}, {0x1a9,  9}, {0x1aa,  9}, {0x0c9,  8}, {0x1ab,  9}, {0x1ac,  9}, {0x391, 10},
+    {0x1ad,  9}, {0x392, 10}, {0x393, 10}, {0x394, 10}, {0x1ae,  9}, {0x1af,  9}, {0x1b0,  9}, {0x1b1,  9},
+    {0x056,  7}, {0x1b2,  9}, {0x0ca,  8}, {0x395, 10}, {0x396, 10}, {0x397, 10}, {0x1b3,  9}, {0x1b4,  9},
+    {0x1b5,  9}, {0x1b6,  9}, {0x398, 10}, {0x7ac, 11}, {0x7ad, 11}, {0x399, 10}, {0x7ae, 11}, {0x39a, 10},
+    {0x004,  4}, {0x7af, 11}, {0x7b0, 11}, {0x057,  7}, {0x39b, 10}, {0x7b1, 11}, {0x7b2, 11}, {0x7b3, 11},
+    {0x1b7,  9}, {0x7b4, 11}, {0x7b5, 11}, {0xff2, 12}, {0x7b6, 11}, {0x7b7, 11}, {0x7b8, 11}, {0x7b9, 11},
+    {0x0cb,  8}, {0x7ba, 11}, {0x39c, 10}, {0x7bb, 11}, {0x7bc, 11}, {0x7bd, 11}, {0x7be, 11}, {0x7bf, 11},
+    {0x39d, 10}, {0x7c0, 11}, {0x39e, 10}, {0xff3, 12}, {0x7c1, 11}, {0x7c2, 11}, {0x7c3, 11}, {0x7c4, 11},
+    {0x0cc,  8}, {0x7c5, 11}, {0x7c6, 11}, {0xff4, 12}, {0x7c7, 11}, {0x7c8, 11}, {0x7c9, 11}, {0x39f, 10},
+    {0x1b8,  9}, {0x7ca, 11}, {0x3a0, 10}, {0x7cb, 11}, {0x3a1, 10}, {0x3a2, 10}, {0x3a3, 10}, {0x3a4, 10},
+    {0x00e,  5}, {0x1b9,  9}, {0x3a5, 10}, {0x7cc, 11}, {0x3a6, 10}, {0x7cd, 11}, {0x3a7, 10}, {0x3a8, 10},
+    {0x1ba,  9}, {0x3a9, 10}, {0x3aa, 10}, {0x7ce, 11}, {0x3ab, 10}, {0x7cf, 11}, {0x3ac, 10}, {0x3ad, 10},
+    {0x0cd,  8}, {0x7d0, 11}, {0x7d1, 11}, {0xff5, 12}, {0x7d2, 11}, {0xff6, 12}, {0x3ae, 10}, {0x7d3, 11},
+    {0x3af, 10}, {0xff7, 12}, {0x3b0, 10}, {0xff8, 12}, {0x7d4, 11}, {0x7d5, 11}, {0x1bb,  9}, {0x7d6, 11},
+    {0x058,  7}, {0x7d7, 11}, {0x3b1, 10}, {0xff9, 12}, {0x7d8, 11}, {0x7d9, 11}, {0x1bc,  9}, {0x7da, 11},
+    {0x1bd,  9}, {0x3b2, 10}, {0x1be,  9}, {0xffa, 12}, {0x3b3, 10}, {0xffb, 12}, {0x3b4, 10}, {0x7db, 11},
+    {0x0ce,  8}, {0x7dc, 11}, {0x3b5, 10}, {0x7dd, 11}, {0x3b6, 10}, {0x7de, 11}, {0x3b7, 10}, {0x7df, 11},
+    {0x3b8, 10}, {0x3b9, 10}, {0x3ba, 10}, {0x3bb, 10}, {0x3bc, 10}, {0x7e0, 11}, {0x3bd, 10}, {0x3be, 10},
+    {0x059,  7}, {0x3bf, 10}, {0x3c0, 10}, {0x7e1, 11}, {0x3c1, 10}, {0x7e2, 11}, {0x3c2, 10}, {0x7e3, 11},
+    {0x3c3, 10}, {0x3c4, 10}, {0x3c5, 10}, {0x3c6, 10}, {0x3c7, 10}, {0x7e4, 11}, {0x1bf,  9}, {0x3c8, 10},
+    {0x05a,  7}, {0x1c0,  9}, {0x3c9, 10}, {0x7e5, 11}, {0x3ca, 10}, {0x7e6, 11}, {0x7e7, 11}, {0x7e8, 11},
+    {0x1c1,  9}, {0x7e9, 11}, {0xffc, 12}, {0xffd, 12}, {0x7ea, 11}, {0x7eb, 11}, {0x7ec, 11}, {0x7ed, 11},
+    {0x05b,  7}, {0x7ee, 11}, {0x7ef, 11}, {0x7f0, 11}, {0x7f1, 11}, {0xffe, 12}, {0x7f2, 11}, {0x7f3, 11},
+    {0x1c2,  9}, {0x7f4, 11}, {0x3cb, 10}, {0x7f5, 11}, {0x3cc, 10}, {0xfff, 12}, {0x3cd, 10}, {0x3ce, 10},
+    {0x05c,  7}, {0x1c3,  9}, {0x1c4,  9}, {0x3cf, 10}, {0x1c5,  9}, {0x3d0, 10}, {0x1c6,  9}, {0x1c7,  9},
+    {0x3d1, 10}, {0x7f6, 11}, {0x3d2, 10}, {0x7f7, 11}, {0x3d3, 10}, {0x7f8, 11}, {0x3d4, 10}, {0x3d5, 10},
+};
+
+// CRC-8 with polynomial 0x07, for the blocks and for the optional per-frame check
+static const uint8_t blackboxCrc8Table[256] = {
+    0x00, 0x07, 0x0e, 0x09, 0x1c, 0x1b, 0x12, 0x15, 0x38, 0x3f, 0x36, 0x31, 0x24, 0x23, 0x2a, 0x2d,
+    0x70, 0x77, 0x7e, 0x79, 0x6c, 0x6b, 0x62, 0x65, 0x48, 0x4f, 0x46, 0x41, 0x54, 0x53, 0x5a, 0x5d,
+    0xe0, 0xe7, 0xee, 0xe9, 0xfc, 0xfb, 0xf2, 0xf5, 0xd8, 0xdf, 0xd6, 0xd1, 0xc4, 0xc3, 0xca, 0xcd,
+    0x90, 0x97, 0x9e, 0x99, 0x8c, 0x8b, 0x82, 0x85, 0xa8, 0xaf, 0xa6, 0xa1, 0xb4, 0xb3, 0xba, 0xbd,
+    0xc7, 0xc0, 0xc9, 0xce, 0xdb, 0xdc, 0xd5, 0xd2, 0xff, 0xf8, 0xf1, 0xf6, 0xe3, 0xe4, 0xed, 0xea,
+    0xb7, 0xb0, 0xb9, 0xbe, 0xab, 0xac, 0xa5, 0xa2, 0x8f, 0x88, 0x81, 0x86, 0x93, 0x94, 0x9d, 0x9a,
+    0x27, 0x20, 0x29, 0x2e, 0x3b, 0x3c, 0x35, 0x32, 0x1f, 0x18, 0x11, 0x16, 0x03, 0x04, 0x0d, 0x0a,
+    0x57, 0x50, 0x59, 0x5e, 0x4b, 0x4c, 0x45, 0x42, 0x6f, 0x68, 0x61, 0x66, 0x73, 0x74, 0x7d, 0x7a,
+    0x89, 0x8e, 0x87, 0x80, 0x95, 0x92, 0x9b, 0x9c, 0xb1, 0xb6, 0xbf, 0xb8, 0xad, 0xaa, 0xa3, 0xa4,
+    0xf9, 0xfe, 0xf7, 0xf0, 0xe5, 0xe2, 0xeb, 0xec, 0xc1, 0xc6, 0xcf, 0xc8, 0xdd, 0xda, 0xd3, 0xd4,
+    0x69, 0x6e, 0x67, 0x60, 0x75, 0x72, 0x7b, 0x7c, 0x51, 0x56, 0x5f, 0x58, 0x4d, 0x4a, 0x43, 0x44,
+    0x19, 0x1e, 0x17, 0x10, 0x05, 0x02, 0x0b, 0x0c, 0x21, 0x26, 0x2f, 0x28, 0x3d, 0x3a, 0x33, 0x34,
+    0x4e, 0x49, 0x40, 0x47, 0x52, 0x55, 0x5c, 0x5b, 0x76, 0x71, 0x78, 0x7f, 0x6a, 0x6d, 0x64, 0x63,
+    0x3e, 0x39, 0x30, 0x37, 0x22, 0x25, 0x2c, 0x2b, 0x06, 0x01, 0x08, 0x0f, 0x1a, 0x1d, 0x14, 0x13,
+    0xae, 0xa9, 0xa0, 0xa7, 0xb2, 0xb5, 0xbc, 0xbb, 0x96, 0x91, 0x98, 0x9f, 0x8a, 0x8d, 0x84, 0x83,
+    0xde, 0xd9, 0xd0, 0xd7, 0xc2, 0xc5, 0xcc, 0xcb, 0xe6, 0xe1, 0xe8, 0xef, 0xfa, 0xfd, 0xf4, 0xf3,
+};
+
+static inline uint8_t blackboxCrc8(uint8_t crc, uint8_t value)
+{
+    return blackboxCrc8Table[crc ^ value];
+}
+
+#endif
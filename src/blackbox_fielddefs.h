@@ -16,6 +16,8 @@ typedef enum FlightLogFieldCondition {
     FLIGHT_LOG_FIELD_CONDITION_MAG,
     FLIGHT_LOG_FIELD_CONDITION_BARO,
     FLIGHT_LOG_FIELD_CONDITION_VBAT,
+    FLIGHT_LOG_FIELD_CONDITION_AMPERAGE,
+    FLIGHT_LOG_FIELD_CONDITION_RSSI,
 
     FLIGHT_LOG_FIELD_CONDITION_NONZERO_PID_D_0,
     FLIGHT_LOG_FIELD_CONDITION_NONZERO_PID_D_1,
@@ -56,7 +58,13 @@ typedef enum FlightLogFieldPredictor {
     FLIGHT_LOG_FIELD_PREDICTOR_1500           = 8,
 
     //Predict vbatref, the reference ADC level stored in the header
-    FLIGHT_LOG_FIELD_PREDICTOR_VBATREF        = 9
+    FLIGHT_LOG_FIELD_PREDICTOR_VBATREF        = 9,
+
+    //Fit a straight line through the last three history items (least squares) and extrapolate it to this frame:
+    FLIGHT_LOG_FIELD_PREDICTOR_LINEAR_3       = 10,
+
+    //Predict this motor from the mixer, using this frame's throttle and PID sums and the motorMix header lines
+    FLIGHT_LOG_FIELD_PREDICTOR_MIXER          = 11
 
 } FlightLogFieldPredictor;
 
@@ -67,7 +75,13 @@ typedef enum FlightLogFieldEncoding {
     FLIGHT_LOG_FIELD_ENCODING_TAG8_8SVB       = 6,
     FLIGHT_LOG_FIELD_ENCODING_TAG2_3S32       = 7,
     FLIGHT_LOG_FIELD_ENCODING_TAG8_4S16       = 8,
-    FLIGHT_LOG_FIELD_ENCODING_NULL            = 9 // Nothing is written to the file, take value to be zero
+    FLIGHT_LOG_FIELD_ENCODING_NULL            = 9, // Nothing is written to the file, take value to be zero
+    /*
+     * A 5-bit tag giving a bit width (0-30, or 31 meaning 32), followed by up to 4 signed fields of that width, packed
+     * most significant bit first and padded out to a whole byte. Only neighbouring fields from the same array (e.g.
+     * gyroData[0..2]) are grouped together.
+     */
+    FLIGHT_LOG_FIELD_ENCODING_TAG5_4SNBIT     = 10
 } FlightLogFieldEncoding;
 
 typedef enum FlightLogFieldSign {
@@ -75,9 +89,83 @@ typedef enum FlightLogFieldSign {
     FLIGHT_LOG_FIELD_SIGNED   = 1
 } FlightLogFieldSign;
 
+// How the data after the text header is stored, from the "H Data compression" header line (see blackbox_compress.h)
+typedef enum FlightLogCompression {
+    FLIGHT_LOG_COMPRESSION_NONE    = 0, // Frames are written one after another as they are
+    FLIGHT_LOG_COMPRESSION_HUFFMAN = 1  // Frames are written in blocks, coded with the static Huffman table
+} FlightLogCompression;
+
+// What follows each frame and event, from the "H Frame check" header line
+typedef enum FlightLogFrameCheck {
+    FLIGHT_LOG_FRAME_CHECK_NONE = 0,    // Nothing, the frame ends with its last field
+    FLIGHT_LOG_FRAME_CHECK_CRC8 = 1     // A CRC-8 (polynomial 0x07) of the frame's bytes, starting with its marker
+} FlightLogFrameCheck;
+
+/*
+ * The events from FLIGHT_MODE on (and LOG_END) carry the time from micros() when they happened, and all but LOG_END
+ * are followed by a data value: a FlightLogFlightMode mask, 1 on entering failsafe and 0 on leaving it, a
+ * FlightLogCalibration, the number of satellites on getting a GPS fix and 0 on losing it, or the MSP command that
+ * changed the settings. Events are only logged while a log is open, so the only calibration that shows up is the
+ * in-flight accelerometer one (the rest can only be started while disarmed).
+ */
 typedef enum FlightLogEvent {
     FLIGHT_LOG_EVENT_SYNC_BEEP = 0,
+    FLIGHT_LOG_EVENT_FRAMES_DROPPED = 1,
+    FLIGHT_LOG_EVENT_CAPTURE_START = 2,
+    FLIGHT_LOG_EVENT_CAPTURE_END = 3,
+    FLIGHT_LOG_EVENT_FLIGHT_MODE = 4,
+    FLIGHT_LOG_EVENT_FAILSAFE = 5,
+    FLIGHT_LOG_EVENT_CALIBRATION = 6,
+    FLIGHT_LOG_EVENT_GPS_FIX = 7,
+    FLIGHT_LOG_EVENT_CONFIG_CHANGE = 8,
     FLIGHT_LOG_EVENT_LOG_END = 255
 } FlightLogEvent;
 
+typedef enum FlightLogFlightMode {
+    FLIGHT_LOG_MODE_ANGLE = 1 << 0,
+    FLIGHT_LOG_MODE_HORIZON = 1 << 1,
+    FLIGHT_LOG_MODE_BARO = 1 << 2,
+    FLIGHT_LOG_MODE_MAG = 1 << 3,
+    FLIGHT_LOG_MODE_HEADFREE = 1 << 4,
+    FLIGHT_LOG_MODE_GPS_HOME = 1 << 5,
+    FLIGHT_LOG_MODE_GPS_HOLD = 1 << 6,
+    FLIGHT_LOG_MODE_PASSTHRU = 1 << 7
+} FlightLogFlightMode;
+
+typedef enum FlightLogCalibration {
+    FLIGHT_LOG_CALIBRATION_GYRO = 0,
+    FLIGHT_LOG_CALIBRATION_ACC = 1,
+    FLIGHT_LOG_CALIBRATION_MAG = 2,
+    FLIGHT_LOG_CALIBRATION_INFLIGHT_ACC = 3
+} FlightLogCalibration;
+
+/*
+ * Every iteration is logged from the first iteration given by a CAPTURE_START event, which is followed by a mask of
+ * these saying what opened the window, until the iteration given by the CAPTURE_END event. The event for the current
+ * state is repeated ahead of each I-frame (with an empty mask for CAPTURE_START).
+ */
+typedef enum FlightLogCaptureTrigger {
+    FLIGHT_LOG_CAPTURE_MOTOR_LIMIT = 1 << 0,
+    FLIGHT_LOG_CAPTURE_FAILSAFE = 1 << 1,
+    FLIGHT_LOG_CAPTURE_GYRO_SPIKE = 1 << 2
+} FlightLogCaptureTrigger;
+
+/*
+ * After the end of a log (and outside any compressed block) comes a footer indexing some of its keyframes, so tools can
+ * jump straight to a point in a long flight. It holds unsigned variable-byte values:
+ *
+ *   the time (from micros()) and loop iteration the log started at, its duration in microseconds, how many iterations
+ *   it covers, how many keyframes it holds and how many events from FLIGHT_MODE on, and the number of index entries,
+ *   then for each entry the time of an iteration that has a keyframe and the byte offset, from the start of the log's
+ *   text header, to start decoding from to reach it (each as the difference from the entry before, the first time
+ *   from the log's start)
+ *
+ * The offset is where that iteration's frames start, or in a compressed log, the block they are in. The footer is
+ * followed by its length (16 bits, little-endian), a CRC-8 of it as for the frames, and FLIGHT_LOG_FOOTER_MAGIC, so it
+ * can be found by searching back from the end of the log.
+ */
+#define FLIGHT_LOG_FOOTER_MAGIC "BBIX"
+#define FLIGHT_LOG_FOOTER_MAGIC_LENGTH 4
+#define FLIGHT_LOG_FOOTER_TRAILER_LENGTH (3 + FLIGHT_LOG_FOOTER_MAGIC_LENGTH)
+
 #endif
@@ -40,9 +40,15 @@
 #define abs(x) ((x) > 0 ? (x) : -(x))
 
 // Chip Unique ID on F103
+#ifdef SITL
+#define U_ID_0 0x53495443
+#define U_ID_1 0x00000000
+#define U_ID_2 0x00000001
+#else
 #define U_ID_0 (*(uint32_t*)0x1FFFF7E8)
 #define U_ID_1 (*(uint32_t*)0x1FFFF7EC)
 #define U_ID_2 (*(uint32_t*)0x1FFFF7F0)
+#endif
 
 
 typedef enum HardwareRevision {
@@ -174,6 +180,7 @@ typedef struct sensor_data_t {
 
 typedef void (*sensorInitFuncPtr)(sensor_align_e align);   // sensor init prototype
 typedef void (*sensorReadFuncPtr)(int16_t *data);          // sensor read and align prototype
+typedef void (*sensorPrefetchFuncPtr)(void);               // start a background read for the next sensor read
 typedef void (*baroOpFuncPtr)(void);                       // baro start operation
 typedef void (*baroCalculateFuncPtr)(int32_t *pressure, int32_t *temperature);             // baro calculation (filled params are pressure and temperature)
 typedef void (*serialReceiveCallbackPtr)(uint16_t data);   // used by serial drivers to return frames to app
@@ -185,6 +192,7 @@ typedef struct sensor_t {
     sensorReadFuncPtr read;                                 // read 3 axis data function
     sensorReadFuncPtr temperature;                          // read temperature if available
     float scale;                                            // scalefactor (currently used for gyro only, todo for accel)
+    sensorPrefetchFuncPtr prefetch;                         // optional, start reading the next sample in the background
 } sensor_t;
 
 typedef struct baro_t {
@@ -218,6 +226,7 @@ typedef struct baro_t {
 #define MAG
 #define BARO
 #define GPS
+#define FLASHFS
 #define LEDRING
 #define SONAR
 #define BUZZER
@@ -244,6 +253,7 @@ typedef struct baro_t {
 #include "drv_ak8975.h"
 #include "drv_i2c.h"
 #include "drv_spi.h"
+#include "drv_m25p16.h"
 #include "drv_ledring.h"
 #include "drv_mma845x.h"
 #include "drv_mpu3050.h"
@@ -287,6 +297,35 @@ typedef struct baro_t {
 #include "drv_serial.h"
 #include "drv_uart.h"
 
+#elif defined(SITL)
+// Software-in-the-loop host build, the drv_* layer is simulated by the code in src/sitl
+
+#define GYRO
+#define ACC
+#define MAG
+#define BARO
+#define FLASHFS
+#define MOTOR_PWM_RATE 400
+
+#define SENSORS_SET (SENSOR_ACC | SENSOR_BARO | SENSOR_MAG)
+
+#include "drv_adc.h"
+#include "drv_adxl345.h"
+#include "drv_bmp085.h"
+#include "drv_ms5611.h"
+#include "drv_hmc5883l.h"
+#include "drv_i2c.h"
+#include "drv_spi.h"
+#include "drv_m25p16.h"
+#include "drv_mpu3050.h"
+#include "drv_mpu6050.h"
+#include "drv_mpu6500.h"
+#include "drv_l3g4200d.h"
+#include "drv_pwm.h"
+#include "drv_serial.h"
+#include "drv_uart.h"
+#include "sitl.h"
+
 #else
 #error TARGET NOT DEFINED!
 #endif /* all conditions */
@@ -297,9 +336,9 @@ typedef struct baro_t {
 #define LED0_OFF                 digitalHi(LED0_GPIO, LED0_PIN);
 #define LED0_ON                  digitalLo(LED0_GPIO, LED0_PIN);
 #else
-#define LED0_TOGGLE
-#define LED0_OFF
-#define LED0_ON
+#define LED0_TOGGLE             ((void)0)
+#define LED0_OFF                ((void)0)
+#define LED0_ON                 ((void)0)
 #endif
 
 #ifdef LED1
@@ -307,9 +346,9 @@ typedef struct baro_t {
 #define LED1_OFF                 digitalHi(LED1_GPIO, LED1_PIN);
 #define LED1_ON                  digitalLo(LED1_GPIO, LED1_PIN);
 #else
-#define LED1_TOGGLE
-#define LED1_OFF
-#define LED1_ON
+#define LED1_TOGGLE             ((void)0)
+#define LED1_OFF                ((void)0)
+#define LED1_ON                 ((void)0)
 #endif
 
 #ifdef BEEP_GPIO
@@ -317,9 +356,9 @@ typedef struct baro_t {
 #define BEEP_OFF                 systemBeep(false);
 #define BEEP_ON                  systemBeep(true);
 #else
-#define BEEP_TOGGLE              ;
-#define BEEP_OFF                 ;
-#define BEEP_ON                  ;
+#define BEEP_TOGGLE             ((void)0)
+#define BEEP_OFF                ((void)0)
+#define BEEP_ON                 ((void)0)
 #endif
 
 #ifdef INV_GPIO
@@ -56,8 +56,10 @@ static const uint8_t buzz_2shortBeeps[] = {
 static const uint8_t buzz_3shortBeeps[] = {
     5,5, 5,5, 5,5, 0xFF
 };
+#ifdef GPS
 // Array used for beeps when reporting GPS satellite count (up to 10 satellites)
 static uint8_t buzz_countSats[22];
+#endif
 
 // Current Buzzer mode
 static uint8_t buzzerMode = BUZZER_STOPPED;
@@ -79,7 +81,9 @@ static void buzzerCalculations(void);
  */
 void buzzer(uint8_t mode)
 {
+#ifdef GPS
     uint8_t i = 0;
+#endif
 
     // Just return if same or higher priority sound is active.
     if (buzzerMode <= mode)
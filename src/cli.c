@@ -5,6 +5,9 @@
 
 #include "board.h"
 #include "mw.h"
+#include "flashfs.h"
+#include "perf.h"
+#include "scheduler.h"
 
 // we unset this on 'exit'
 extern uint8_t cliMode;
@@ -14,6 +17,11 @@ static void cliDefaults(char *cmdline);
 static void cliDump(char *cmdLine);
 static void cliExit(char *cmdline);
 static void cliFeature(char *cmdline);
+#ifdef FLASHFS
+static void cliFlashErase(char *cmdline);
+static void cliFlashInfo(char *cmdline);
+static void cliFlashRead(char *cmdline);
+#endif
 #ifdef GPS
 static void cliGpsPassthrough(char *cmdline);
 #endif
@@ -21,11 +29,13 @@ static void cliHelp(char *cmdline);
 static void cliMap(char *cmdline);
 static void cliMixer(char *cmdline);
 static void cliMotor(char *cmdline);
+static void cliPerf(char *cmdline);
 static void cliProfile(char *cmdline);
 static void cliSave(char *cmdline);
 static void cliSet(char *cmdline);
 static void cliServoMix(char *cmdline);
 static void cliStatus(char *cmdline);
+static void cliTasks(char *cmdline);
 static void cliVersion(char *cmdline);
 
 // from sensors.c
@@ -95,6 +105,11 @@ const clicmd_t cmdTable[] = {
     { "dump", "print configurable settings in a pastable form", cliDump },
     { "exit", "", cliExit },
     { "feature", "list or -val or val", cliFeature },
+#ifdef FLASHFS
+    { "flash_erase", "erase the blackbox logs on the flash chip", cliFlashErase },
+    { "flash_info", "show flash chip usage", cliFlashInfo },
+    { "flash_read", "address length, hex dump of flash contents", cliFlashRead },
+#endif
 #ifdef GPS
     { "gpspassthrough", "passthrough gps to serial", cliGpsPassthrough },
 #endif
@@ -102,11 +117,13 @@ const clicmd_t cmdTable[] = {
     { "map", "mapping of rc channel order", cliMap },
     { "mixer", "mixer name or list", cliMixer },
     { "motor", "get/set motor output value", cliMotor },
+    { "perf", "show loop timing stats, or reset", cliPerf },
     { "profile", "index (0 to 2)", cliProfile },
     { "save", "save and reboot", cliSave },
     { "set", "name=value or blank or * for list", cliSet },
     { "smix", "design custom servo mixer", cliServoMix },
     { "status", "show system status", cliStatus },
+    { "tasks", "show background task timing", cliTasks },
     { "version", "", cliVersion },
 };
 #define CMD_COUNT (sizeof(cmdTable) / sizeof(clicmd_t))
@@ -273,6 +290,17 @@ const clivalue_t valueTable[] = {
 
     { "blackbox_rate_num", VAR_UINT8, &mcfg.blackbox_rate_num, 1, 32 },
     { "blackbox_rate_denom", VAR_UINT8, &mcfg.blackbox_rate_denom, 1, 32 },
+    { "blackbox_device", VAR_UINT8, &mcfg.blackbox_device, 0, 1 },
+    { "blackbox_i_interval", VAR_UINT16, &mcfg.blackbox_i_interval, 1, 1024 },
+    { "blackbox_i_threshold", VAR_UINT8, &mcfg.blackbox_i_threshold, 0, 250 },
+    { "blackbox_i_max_interval", VAR_UINT16, &mcfg.blackbox_i_max_interval, 1, 8192 },
+    { "blackbox_slow_interval", VAR_UINT16, &mcfg.blackbox_slow_interval, 1, 8192 },
+    { "blackbox_compression", VAR_UINT8, &mcfg.blackbox_compression, 0, 1 },
+    { "blackbox_frame_check", VAR_UINT8, &mcfg.blackbox_frame_check, 0, 1 },
+    { "blackbox_baudrate", VAR_UINT32, &mcfg.blackbox_baudrate, 0, 2000000 },
+    { "blackbox_prearm_interval", VAR_UINT8, &mcfg.blackbox_prearm_interval, 0, 255 },
+    { "blackbox_capture_window", VAR_UINT16, &mcfg.blackbox_capture_window, 0, 10000 },
+    { "blackbox_capture_gyro", VAR_UINT16, &mcfg.blackbox_capture_gyro, 0, 16000 },
 };
 
 #define VALUE_COUNT (sizeof(valueTable) / sizeof(clivalue_t))
@@ -904,6 +932,73 @@ static void cliGpsPassthrough(char *cmdline)
 }
 #endif
 
+#ifdef FLASHFS
+static void cliFlashErase(char *cmdline)
+{
+    (void)cmdline;
+
+    if (!flashfsIsSupported()) {
+        cliPrint("No flash chip present\r\n");
+        return;
+    }
+
+    cliPrint("Erasing, this may take a while...\r\n");
+    flashfsErase();
+
+    while (!flashfsIsReady()) {
+        flashfsProcess();
+        delay(100);
+    }
+
+    cliPrint("Done\r\n");
+}
+
+static void cliFlashInfo(char *cmdline)
+{
+    (void)cmdline;
+
+    if (!flashfsIsSupported()) {
+        cliPrint("No flash chip present\r\n");
+        return;
+    }
+
+    printf("Flash sectors: %u, size: %u bytes, used: %u bytes\r\n", m25p16GetGeometry()->sectors, flashfsGetSize(), flashfsGetOffset());
+}
+
+static void cliFlashRead(char *cmdline)
+{
+    uint32_t address, length;
+    uint8_t buffer[16];
+    int bytesRead, i;
+    char *pch;
+
+    address = atoi(cmdline);
+    pch = strchr(cmdline, ' ');
+
+    if (!pch) {
+        cliPrint("Usage: flash_read address length\r\n");
+        return;
+    }
+
+    length = atoi(pch + 1);
+
+    printf("Reading %u bytes at %u:\r\n", length, address);
+
+    while (length > 0) {
+        bytesRead = flashfsReadAbs(address, buffer, min(length, sizeof(buffer)));
+        if (bytesRead <= 0)
+            break;
+
+        for (i = 0; i < bytesRead; i++)
+            printf("%02x ", buffer[i]);
+        cliPrint("\r\n");
+
+        address += bytesRead;
+        length -= bytesRead;
+    }
+}
+#endif
+
 static void cliHelp(char *cmdline)
 {
     (void)cmdline;
@@ -1035,6 +1130,29 @@ static void cliMotor(char *cmdline)
     motor_disarmed[motor_index] = motor_value;
 }
 
+static void cliPerf(char *cmdline)
+{
+    const perfStageStats_t *stats;
+    uint8_t cyclesPerMicro = perfGetCyclesPerMicro();
+    int i, j;
+
+    if (strncasecmp(cmdline, "reset", 5) == 0) {
+        perfReset();
+        cliPrint("Loop timing stats cleared\r\n");
+        return;
+    }
+
+    printf("Stage\tCount\tMin\tAvg\tMax (us), histogram from <%dus doubling per bucket\r\n", PERF_HISTOGRAM_FIRST_MICROS);
+    for (i = 0; i < PERF_STAGE_COUNT; i++) {
+        stats = perfGetStats(i);
+        printf("%s\t%u\t%u\t%u\t%u\t", perfStageNames[i], stats->count, stats->minCycles / cyclesPerMicro,
+            perfGetAverageCycles(i) / cyclesPerMicro, stats->maxCycles / cyclesPerMicro);
+        for (j = 0; j < PERF_HISTOGRAM_BUCKETS; j++)
+            printf(" %u", stats->histogram[j]);
+        cliPrint("\r\n");
+    }
+}
+
 static void cliProfile(char *cmdline)
 {
     uint8_t len;
@@ -1218,7 +1336,21 @@ static void cliStatus(char *cmdline)
     }
     cliPrint("\r\n");
 
-    printf("Cycle Time: %d, I2C Errors: %d, config size: %d\r\n", cycleTime, i2cGetErrorCounter(), sizeof(master_t));
+    printf("Cycle Time: %d, Loop overruns: %u, I2C Errors: %d, config size: %d\r\n", cycleTime, loopOverrunCount, i2cGetErrorCounter(), sizeof(master_t));
+}
+
+static void cliTasks(char *cmdline)
+{
+    const task_t *task;
+    int i;
+
+    (void)cmdline;
+
+    cliPrint("Task\tPriority\tPeriod\tRecent\tMax (us)\r\n");
+    for (i = 0; i < schedulerGetTaskCount(); i++) {
+        task = schedulerGetTask(i);
+        printf("%s\t%u\t%u\t%u\t%u\r\n", task->name, task->priority, task->period, task->executionTime, task->maxExecutionTime);
+    }
 }
 
 static void cliVersion(char *cmdline)
@@ -24,11 +24,18 @@ master_t mcfg;  // master config struct with data independent from profiles
 config_t cfg;   // profile config struct
 const char rcChannelLetters[] = "AERT1234";
 
-static const uint8_t EEPROM_CONF_VERSION = 73;
+static const uint8_t EEPROM_CONF_VERSION = 81;
 static uint32_t enabledSensors = 0;
 static void resetConf(void);
 static const uint32_t FLASH_WRITE_ADDR = 0x08000000 + (FLASH_PAGE_SIZE * (FLASH_PAGE_COUNT - (CONFIG_SIZE / 1024)));
 
+#ifdef SITL
+// the simulated flash is a RAM buffer, see sitl_system.c
+#define FLASH_READ_PTR(addr) sitlFlashPointer(addr)
+#else
+#define FLASH_READ_PTR(addr) ((const void *)(addr))
+#endif
+
 void initEEPROM(void)
 {
     // make sure (at compile time) that config struct doesn't overflow allocated flash pages
@@ -48,7 +55,7 @@ void parseRcChannels(const char *input)
 
 static uint8_t validEEPROM(void)
 {
-    const master_t *temp = (const master_t *)FLASH_WRITE_ADDR;
+    const master_t *temp = (const master_t *)FLASH_READ_PTR(FLASH_WRITE_ADDR);
     const uint8_t *p;
     uint8_t chk = 0;
 
@@ -79,7 +86,7 @@ void readEEPROM(void)
         failureMode(10);
 
     // Read flash
-    memcpy(&mcfg, (char *)FLASH_WRITE_ADDR, sizeof(master_t));
+    memcpy(&mcfg, FLASH_READ_PTR(FLASH_WRITE_ADDR), sizeof(master_t));
     // Copy current profile
     if (mcfg.current_profile > 2) // sanity check
         mcfg.current_profile = 0;
@@ -255,6 +262,17 @@ static void resetConf(void)
     mcfg.rssi_adc_max = 4095;
     mcfg.blackbox_rate_num = 1;
     mcfg.blackbox_rate_denom = 1;
+    mcfg.blackbox_device = 0;
+    mcfg.blackbox_i_interval = 32;
+    mcfg.blackbox_i_threshold = 0;
+    mcfg.blackbox_i_max_interval = 256;
+    mcfg.blackbox_slow_interval = 32;
+    mcfg.blackbox_compression = 0;
+    mcfg.blackbox_frame_check = 0;
+    mcfg.blackbox_baudrate = 115200;
+    mcfg.blackbox_prearm_interval = 0;
+    mcfg.blackbox_capture_window = 0;
+    mcfg.blackbox_capture_gyro = 0;
     
     cfg.pidController = 0;
     cfg.P8[ROLL] = 40;
@@ -81,6 +81,10 @@
 static sensor_align_e magAlign = CW180_DEG;
 static float magGain[3] = { 1.0f, 1.0f, 1.0f };
 
+static uint8_t magPrefetchBuffer[6];
+static i2cJob_t magPrefetchJob;
+static bool magPrefetched = false;      // the prefetched sample hasn't been used yet
+
 bool hmc5883lDetect(sensor_t *mag)
 {
     bool ack = false;
@@ -92,6 +96,7 @@ bool hmc5883lDetect(sensor_t *mag)
 
     mag->init = hmc5883lInit;
     mag->read = hmc5883lRead;
+    mag->prefetch = hmc5883lPrefetch;
     
     return true;
 }
@@ -182,12 +187,25 @@ void hmc5883lInit(sensor_align_e align)
     }
 }
 
+// Start reading the data registers in the background for the next hmc5883lRead()
+void hmc5883lPrefetch(void)
+{
+    if (magPrefetched || i2cJobIsPending(&magPrefetchJob))
+        return;
+
+    magPrefetched = i2cReadAsync(&magPrefetchJob, MAG_ADDRESS, MAG_DATA_REGISTER, 6, magPrefetchBuffer);
+}
+
 void hmc5883lRead(int16_t *magData)
 {
     uint8_t buf[6];
     int16_t mag[3];
 
-    i2cRead(MAG_ADDRESS, MAG_DATA_REGISTER, 6, buf);
+    if (magPrefetched && i2cJobWait(&magPrefetchJob))
+        memcpy(buf, magPrefetchBuffer, sizeof(buf));
+    else
+        i2cRead(MAG_ADDRESS, MAG_DATA_REGISTER, 6, buf);
+    magPrefetched = false;
     // During calibration, magGain is 1.0, so the read returns normal non-calibrated values.
     // After calibration is done, magGain is set to calculated gain values.
     mag[X] = (int16_t)(buf[0] << 8 | buf[1]) * magGain[X];
@@ -3,3 +3,4 @@
 bool hmc5883lDetect(sensor_t *mag);
 void hmc5883lInit(sensor_align_e align);
 void hmc5883lRead(int16_t *magData);
+void hmc5883lPrefetch(void);
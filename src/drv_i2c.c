@@ -61,7 +61,6 @@ void I2C2_EV_IRQHandler(void)
 static volatile uint16_t i2cErrorCount = 0;
 
 static volatile bool error = false;
-static volatile bool busy;
 
 static volatile uint8_t addr;
 static volatile uint8_t reg;
@@ -71,6 +70,115 @@ static volatile uint8_t reading;
 static volatile uint8_t* write_p;
 static volatile uint8_t* read_p;
 
+/*
+ * Jobs waiting for the bus are queued here and started one after another from the interrupt handlers, so a driver can
+ * kick off a sensor read and pick up the result later without waiting on the bus in between.
+ */
+#define I2C_JOB_QUEUE_SIZE 4
+
+static i2cJob_t *jobQueue[I2C_JOB_QUEUE_SIZE];
+static volatile uint8_t jobQueueHead, jobQueueCount;
+static i2cJob_t * volatile currentJob = NULL;
+
+// The interrupt handlers never wait on the bus or reset the peripheral, they leave that to i2cPoll() with these
+static volatile bool resetPending = false;              // an error left the peripheral stuck sending a start
+static volatile uint32_t stopWaits;                     // times the next job has been held up by the last one's stop
+
+// Keep the I2C interrupts from touching the queue while we're changing it
+static void i2cLockQueue(void)
+{
+    NVIC_DisableIRQ((IRQn_Type)i2cHardwareMap[I2Cx_index].ev_irq);
+    NVIC_DisableIRQ((IRQn_Type)i2cHardwareMap[I2Cx_index].er_irq);
+}
+
+static void i2cUnlockQueue(void)
+{
+    NVIC_EnableIRQ((IRQn_Type)i2cHardwareMap[I2Cx_index].ev_irq);
+    NVIC_EnableIRQ((IRQn_Type)i2cHardwareMap[I2Cx_index].er_irq);
+}
+
+static void i2cJobFinished(i2cJob_t *job, bool success)
+{
+    job->status = success ? I2C_JOB_COMPLETE : I2C_JOB_FAILED;
+    if (job->callback)
+        job->callback(job);
+}
+
+// Fail the running job and everything in the queue, used when the peripheral is reset
+static void i2cAbortJobs(void)
+{
+    i2cJob_t *job = currentJob;
+
+    currentJob = NULL;
+    if (job)
+        i2cJobFinished(job, false);
+
+    while (jobQueueCount > 0) {
+        job = jobQueue[jobQueueHead];
+        jobQueueHead = (jobQueueHead + 1) % I2C_JOB_QUEUE_SIZE;
+        jobQueueCount--;
+        i2cJobFinished(job, false);
+    }
+}
+
+/**
+ * If the bus is idle, start the next job from the queue. Called with the I2C interrupts unable to run, either from the
+ * handlers themselves or with the queue locked.
+ *
+ * This never waits: a job that finishes from the interrupt has only just programmed its stop, so the next one usually
+ * stays at the head of the queue until i2cPoll() finds the stop sent.
+ */
+static void i2cStartNextJob(void)
+{
+    i2cJob_t *job;
+
+    if (currentJob || jobQueueCount == 0 || resetPending)
+        return;
+
+    if (!(I2Cx->CR2 & I2C_IT_EVT)) {                                        // if we are restarting the driver
+        if (!(I2Cx->CR1 & 0x0100) && (I2Cx->CR1 & 0x0200)) {                // a stop is still being sent
+            stopWaits++;
+            return;
+        }
+    }
+    stopWaits = 0;
+
+    job = jobQueue[jobQueueHead];
+    jobQueueHead = (jobQueueHead + 1) % I2C_JOB_QUEUE_SIZE;
+    jobQueueCount--;
+
+    addr = job->addr << 1;
+    reg = job->reg;
+    writing = !job->read;
+    reading = job->read;
+    write_p = job->data;
+    read_p = job->data;
+    bytes = job->len;
+    error = false;
+
+    job->status = I2C_JOB_BUSY;
+    currentJob = job;
+
+    if (!(I2Cx->CR2 & I2C_IT_EVT)) {                                        // if we are restarting the driver
+        if (!(I2Cx->CR1 & 0x0100))                                          // ensure sending a start
+            I2C_GenerateSTART(I2Cx, ENABLE);                                // send the start for the new job
+        I2C_ITConfig(I2Cx, I2C_IT_EVT | I2C_IT_ERR, ENABLE);                // allow the interrupts to fire off again
+    }
+}
+
+// Called from the interrupt handlers when the bus has finished with the current job
+static void i2cCurrentJobDone(void)
+{
+    i2cJob_t *job = currentJob;
+
+    if (!job)
+        return;
+
+    currentJob = NULL;
+    i2cJobFinished(job, !error);
+    i2cStartNextJob();
+}
+
 static bool i2cHandleHardwareFailure(void)
 {
     i2cErrorCount++;
@@ -79,39 +187,131 @@ static bool i2cHandleHardwareFailure(void)
     return false;
 }
 
-bool i2cWriteBuffer(uint8_t addr_, uint8_t reg_, uint8_t len_, uint8_t *data)
+/**
+ * Do what the interrupt handlers left for us: reset the peripheral if an error left it stuck, otherwise start the job at
+ * the head of the queue once the bus is free. Never called from an interrupt.
+ */
+static void i2cPoll(void)
 {
-    uint32_t timeout = I2C_DEFAULT_TIMEOUT;
-
-    addr = addr_ << 1;
-    reg = reg_;
-    writing = 1;
-    reading = 0;
-    write_p = data;
-    read_p = data;
-    bytes = len_;
-    busy = 1;
-    error = false;
-    
+    uint32_t timeout;
+
     if (!I2Cx)
+        return;
+
+    if (resetPending) {
+        timeout = I2C_DEFAULT_TIMEOUT;
+        while (I2Cx->CR1 & 0x0100 && --timeout > 0) { ; }                  // wait for any start to finish sending
+        I2C_GenerateSTOP(I2Cx, ENABLE);                                     // send stop to finalise bus transaction
+        timeout = I2C_DEFAULT_TIMEOUT;
+        while (I2Cx->CR1 & 0x0200 && --timeout > 0) { ; }                  // wait for stop to finish sending
+        i2cInit(I2Cx_index);                                                // reset and configure the hardware
+        return;
+    }
+
+    if (currentJob || jobQueueCount == 0)
+        return;
+
+    // A stop that never finishes sending means the bus is stuck
+    if (stopWaits > I2C_DEFAULT_TIMEOUT) {
+        i2cHandleHardwareFailure();
+        return;
+    }
+
+    i2cLockQueue();
+    i2cStartNextJob();
+    i2cUnlockQueue();
+}
+
+/**
+ * Queue a job to run in the background. job must stay in place until its status is no longer queued or busy.
+ *
+ * Returns false if the job couldn't be queued, in which case it is marked as failed and its callback isn't called.
+ */
+bool i2cSubmit(i2cJob_t *job)
+{
+    bool queued = false;
+
+    if (!I2Cx || i2cJobIsPending(job)) {
+        job->status = I2C_JOB_FAILED;
         return false;
+    }
 
-    if (!(I2Cx->CR2 & I2C_IT_EVT)) {                                    // if we are restarting the driver
-        if (!(I2Cx->CR1 & 0x0100)) {                                    // ensure sending a start
-            while (I2Cx->CR1 & 0x0200 && --timeout > 0) { ; }           // wait for any stop to finish sending
-            if (timeout == 0)
-                return i2cHandleHardwareFailure();
-            I2C_GenerateSTART(I2Cx, ENABLE);                            // send the start for the new job
-        }
-        I2C_ITConfig(I2Cx, I2C_IT_EVT | I2C_IT_ERR, ENABLE);            // allow the interrupts to fire off again
+    i2cPoll();
+
+    i2cLockQueue();
+    if (jobQueueCount < I2C_JOB_QUEUE_SIZE) {
+        job->status = I2C_JOB_QUEUED;
+        jobQueue[(jobQueueHead + jobQueueCount) % I2C_JOB_QUEUE_SIZE] = job;
+        jobQueueCount++;
+        queued = true;
+        i2cStartNextJob();
+    } else {
+        job->status = I2C_JOB_FAILED;
     }
+    i2cUnlockQueue();
+
+    return queued;
+}
+
+/**
+ * Start reading len registers from reg into buf in the background, check on it with i2cJobIsPending()/i2cJobWait().
+ */
+bool i2cReadAsync(i2cJob_t *job, uint8_t addr_, uint8_t reg_, uint8_t len, uint8_t *buf)
+{
+    job->addr = addr_;
+    job->reg = reg_;
+    job->len = len;
+    job->read = true;
+    job->data = buf;
+    job->callback = NULL;
+
+    return i2cSubmit(job);
+}
+
+/**
+ * Check on a submitted job. Polling this is what gets a job started that the interrupt couldn't start, so keep calling
+ * it (or i2cJobWait()) until the job is done.
+ */
+bool i2cJobIsPending(const i2cJob_t *job)
+{
+    if (job->status == I2C_JOB_QUEUED)
+        i2cPoll();
+
+    return job->status == I2C_JOB_QUEUED || job->status == I2C_JOB_BUSY;
+}
 
-    timeout = I2C_DEFAULT_TIMEOUT;
-    while (busy && --timeout > 0) { ; }
+/**
+ * Wait for a submitted job to finish, returns true if it succeeded. If the bus appears to be stuck the peripheral is
+ * reset, which fails every job that was waiting.
+ */
+bool i2cJobWait(i2cJob_t *job)
+{
+    // Allow for the jobs queued ahead of this one
+    uint32_t timeout = I2C_DEFAULT_TIMEOUT * (I2C_JOB_QUEUE_SIZE + 1);
+
+    while (i2cJobIsPending(job) && --timeout > 0) { ; }
     if (timeout == 0)
         return i2cHandleHardwareFailure();
 
-    return !error;
+    return job->status == I2C_JOB_COMPLETE;
+}
+
+bool i2cWriteBuffer(uint8_t addr_, uint8_t reg_, uint8_t len_, uint8_t *data)
+{
+    i2cJob_t job;
+
+    job.addr = addr_;
+    job.reg = reg_;
+    job.len = len_;
+    job.read = false;
+    job.data = data;
+    job.callback = NULL;
+    job.status = I2C_JOB_IDLE;
+
+    if (!i2cSubmit(&job))
+        return false;
+
+    return i2cJobWait(&job);
 }
 
 bool i2cWrite(uint8_t addr_, uint8_t reg_, uint8_t data)
@@ -121,37 +321,14 @@ bool i2cWrite(uint8_t addr_, uint8_t reg_, uint8_t data)
 
 bool i2cRead(uint8_t addr_, uint8_t reg_, uint8_t len, uint8_t* buf)
 {
-    uint32_t timeout = I2C_DEFAULT_TIMEOUT;
-
-    addr = addr_ << 1;
-    reg = reg_;
-    writing = 0;
-    reading = 1;
-    read_p = buf;
-    write_p = buf;
-    bytes = len;
-    busy = 1;
-    error = false;
+    i2cJob_t job;
 
-    if (!I2Cx)
-        return false;
-
-    if (!(I2Cx->CR2 & I2C_IT_EVT)) {                                    // if we are restarting the driver
-        if (!(I2Cx->CR1 & 0x0100)) {                                    // ensure sending a start
-            while (I2Cx->CR1 & 0x0200 && --timeout > 0) { ; }           // wait for any stop to finish sending
-            if (timeout == 0)
-                return i2cHandleHardwareFailure();
-            I2C_GenerateSTART(I2Cx, ENABLE);                            // send the start for the new job
-        }
-        I2C_ITConfig(I2Cx, I2C_IT_EVT | I2C_IT_ERR, ENABLE);            // allow the interrupts to fire off again
-    }
+    job.status = I2C_JOB_IDLE;
 
-    timeout = I2C_DEFAULT_TIMEOUT;
-    while (busy && --timeout > 0) { ; }
-    if (timeout == 0)
-        return i2cHandleHardwareFailure();
+    if (!i2cReadAsync(&job, addr_, reg_, len, buf))
+        return false;
 
-    return !error;
+    return i2cJobWait(&job);
 }
 
 static void i2c_er_handler(void)
@@ -168,10 +345,8 @@ static void i2c_er_handler(void)
         I2C_ITConfig(I2Cx, I2C_IT_BUF, DISABLE);                        // disable the RXNE/TXE interrupt - prevent the ISR tailchaining onto the ER (hopefully)
         if (!(SR1Register & 0x0200) && !(I2Cx->CR1 & 0x0200)) {         // if we dont have an ARLO error, ensure sending of a stop
             if (I2Cx->CR1 & 0x0100) {                                   // We are currently trying to send a start, this is very bad as start, stop will hang the peripheral
-                while (I2Cx->CR1 & 0x0100) { ; }                        // wait for any start to finish sending
-                I2C_GenerateSTOP(I2Cx, ENABLE);                         // send stop to finalise bus transaction
-                while (I2Cx->CR1 & 0x0200) { ; }                        // wait for stop to finish sending
-                i2cInit(I2Cx_index);                                    // reset and configure the hardware
+                resetPending = true;                                    // so leave the stop and the reset to i2cPoll()
+                I2C_ITConfig(I2Cx, I2C_IT_EVT | I2C_IT_ERR, DISABLE);   // Disable EVT and ERR interrupts until then
             } else {
                 I2C_GenerateSTOP(I2Cx, ENABLE);                         // stop to free up the bus
                 I2C_ITConfig(I2Cx, I2C_IT_EVT | I2C_IT_ERR, DISABLE);   // Disable EVT and ERR interrupts while bus inactive
@@ -179,7 +354,7 @@ static void i2c_er_handler(void)
         }
     }
     I2Cx->SR1 &= ~0x0F00;                                               // reset all the error bits to clear the interrupt
-    busy = 0;
+    i2cCurrentJobDone();
 }
 
 void i2c_ev_handler(void)
@@ -278,7 +453,7 @@ void i2c_ev_handler(void)
         subaddress_sent = 0;                                            // reset this here
         if (final_stop)                                                 // If there is a final stop and no more jobs, bus is inactive, disable interrupts to prevent BTF
             I2C_ITConfig(I2Cx, I2C_IT_EVT | I2C_IT_ERR, DISABLE);       // Disable EVT and ERR interrupts while bus inactive
-        busy = 0;
+        i2cCurrentJobDone();                                            // and start the next one if there is one
     }
 }
 
@@ -290,6 +465,12 @@ void i2cInit(I2CDevice index)
     if (index > I2CDEV_MAX)
         index = I2CDEV_MAX;
 
+    // Anything we were in the middle of is lost, the interrupts are enabled again below
+    i2cLockQueue();
+    i2cAbortJobs();
+    resetPending = false;
+    stopWaits = 0;
+
     // Turn on peripheral clock, save device and index
     I2Cx = i2cHardwareMap[index].dev;
     I2Cx_index = index;
@@ -10,8 +10,36 @@ typedef enum I2CDevice {
     I2CDEV_MAX = I2CDEV_2,
 } I2CDevice;
 
+typedef enum {
+    I2C_JOB_IDLE = 0,
+    I2C_JOB_QUEUED,
+    I2C_JOB_BUSY,
+    I2C_JOB_COMPLETE,
+    I2C_JOB_FAILED,
+} i2cJobStatus_e;
+
+typedef struct i2cJob_t i2cJob_t;
+typedef void (*i2cJobCallbackPtr)(i2cJob_t *job);
+
+// A register read or write that is carried out in the background by the I2C interrupt
+struct i2cJob_t {
+    uint8_t addr;
+    uint8_t reg;
+    uint8_t len;
+    bool read;
+    uint8_t *data;
+    i2cJobCallbackPtr callback;             // Optional, called from the I2C interrupt once the job has finished (or from
+                                            // whichever call resets the bus, with the interrupt held off)
+    volatile uint8_t status;                // i2cJobStatus_e
+};
+
 void i2cInit(I2CDevice index);
 bool i2cWriteBuffer(uint8_t addr_, uint8_t reg_, uint8_t len_, uint8_t *data);
 bool i2cWrite(uint8_t addr_, uint8_t reg, uint8_t data);
 bool i2cRead(uint8_t addr_, uint8_t reg, uint8_t len, uint8_t* buf);
 uint16_t i2cGetErrorCounter(void);
+
+bool i2cSubmit(i2cJob_t *job);
+bool i2cReadAsync(i2cJob_t *job, uint8_t addr_, uint8_t reg_, uint8_t len, uint8_t *buf);
+bool i2cJobIsPending(const i2cJob_t *job);
+bool i2cJobWait(i2cJob_t *job);
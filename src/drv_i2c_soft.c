@@ -229,6 +229,47 @@ bool i2cRead(uint8_t addr, uint8_t reg, uint8_t len, uint8_t *buf)
     return true;
 }
 
+// There's no interrupt to run jobs in the background, so they're carried out right away
+bool i2cSubmit(i2cJob_t *job)
+{
+    bool success;
+
+    if (job->read)
+        success = i2cRead(job->addr, job->reg, job->len, job->data);
+    else
+        success = i2cWriteBuffer(job->addr, job->reg, job->len, job->data);
+
+    job->status = success ? I2C_JOB_COMPLETE : I2C_JOB_FAILED;
+    if (job->callback)
+        job->callback(job);
+
+    return success;
+}
+
+bool i2cReadAsync(i2cJob_t *job, uint8_t addr, uint8_t reg, uint8_t len, uint8_t *buf)
+{
+    job->addr = addr;
+    job->reg = reg;
+    job->len = len;
+    job->read = true;
+    job->data = buf;
+    job->callback = NULL;
+
+    return i2cSubmit(job);
+}
+
+bool i2cJobIsPending(const i2cJob_t *job)
+{
+    // Jobs run to completion as they're submitted
+    (void)job;
+    return false;
+}
+
+bool i2cJobWait(i2cJob_t *job)
+{
+    return job->status == I2C_JOB_COMPLETE;
+}
+
 uint16_t i2cGetErrorCounter(void)
 {
     // TODO maybe fix this, but since this is test code, doesn't matter.
@@ -0,0 +1,204 @@
+/*
+ * This file is part of baseflight
+ * Licensed under GPL V3 or modified DCL - see https://github.com/multiwii/baseflight/blob/master/README.md
+ */
+
+#include "board.h"
+
+// M25P16 16Mbit SPI NOR flash on SPI2, 32 sectors of 64kB, each made of 256 byte pages
+
+#define M25P16_INSTRUCTION_RDID             (0x9F)
+#define M25P16_INSTRUCTION_READ_BYTES       (0x03)
+#define M25P16_INSTRUCTION_READ_STATUS_REG  (0x05)
+#define M25P16_INSTRUCTION_WRITE_ENABLE     (0x06)
+#define M25P16_INSTRUCTION_PAGE_PROGRAM     (0x02)
+#define M25P16_INSTRUCTION_SECTOR_ERASE     (0xD8)
+
+#define M25P16_STATUS_FLAG_WRITE_IN_PROGRESS (0x01)
+
+#define M25P16_SECTORS                      (32)
+#define M25P16_PAGES_PER_SECTOR             (256)
+
+static flashGeometry_t geometry;
+
+/*
+ * Whether we've issued a program or erase which the chip may still be busy with. Saves us from polling the status
+ * register when we know the chip must be idle.
+ */
+static bool couldBeBusy = false;
+
+static void m25p16PerformOneByteCommand(uint8_t command)
+{
+    spiSelect(true);
+    spiTransferByte(command);
+    spiSelect(false);
+}
+
+static void m25p16WriteEnable(void)
+{
+    // Needed before every program or erase, the chip clears the write enable latch when it finishes
+    m25p16PerformOneByteCommand(M25P16_INSTRUCTION_WRITE_ENABLE);
+}
+
+static uint8_t m25p16ReadStatus(void)
+{
+    uint8_t command[2] = { M25P16_INSTRUCTION_READ_STATUS_REG, 0 };
+    uint8_t in[2];
+
+    spiSelect(true);
+    spiTransfer(in, command, sizeof(command));
+    spiSelect(false);
+
+    return in[1];
+}
+
+static void m25p16SendAddress(uint8_t instruction, uint32_t address)
+{
+    spiTransferByte(instruction);
+    spiTransferByte((address >> 16) & 0xFF);
+    spiTransferByte((address >> 8) & 0xFF);
+    spiTransferByte(address & 0xFF);
+}
+
+bool m25p16IsReady(void)
+{
+    // We can't even ask the chip while an asynchronous page program is still being sent to it
+    if (spiIsBusy())
+        return false;
+
+    couldBeBusy = couldBeBusy && (m25p16ReadStatus() & M25P16_STATUS_FLAG_WRITE_IN_PROGRESS) != 0;
+
+    return !couldBeBusy;
+}
+
+bool m25p16WaitForReady(uint32_t timeoutMillis)
+{
+    uint32_t start = millis();
+
+    while (!m25p16IsReady()) {
+        if (millis() - start > timeoutMillis)
+            return false;
+    }
+
+    return true;
+}
+
+bool m25p16Init(void)
+{
+    uint8_t out[] = { M25P16_INSTRUCTION_RDID, 0, 0, 0 };
+    uint8_t in[4];
+    uint32_t chipID;
+
+    spiSelect(true);
+    spiTransfer(in, out, sizeof(out));
+    spiSelect(false);
+
+    chipID = (in[1] << 16) | (in[2] << 8) | in[3];
+
+    if (chipID != FLASH_M25P16) {
+        geometry.sectors = 0;
+        geometry.totalSize = 0;
+        return false;
+    }
+
+    geometry.sectors = M25P16_SECTORS;
+    geometry.pagesPerSector = M25P16_PAGES_PER_SECTOR;
+    geometry.pageSize = M25P16_PAGESIZE;
+    geometry.sectorSize = geometry.pagesPerSector * geometry.pageSize;
+    geometry.totalSize = geometry.sectorSize * geometry.sectors;
+
+    // The chip might still be finishing off a write from before we were reset
+    couldBeBusy = true;
+
+    return true;
+}
+
+const flashGeometry_t *m25p16GetGeometry(void)
+{
+    return &geometry;
+}
+
+/**
+ * Start erasing the sector containing the given address. This takes around 0.6 seconds (3 seconds worst case), during
+ * which the chip can't be read or written, so only call this when the chip is ready and we're not flying.
+ */
+void m25p16EraseSector(uint32_t address)
+{
+    m25p16WriteEnable();
+
+    spiSelect(true);
+    m25p16SendAddress(M25P16_INSTRUCTION_SECTOR_ERASE, address);
+    spiSelect(false);
+
+    couldBeBusy = true;
+}
+
+/**
+ * Begin a page program at the given address, feed it data with one or more calls to m25p16PageProgramContinue(), then
+ * end it with m25p16PageProgramFinish(). The data must not cross a page boundary (the chip would wrap around to the
+ * start of the page), and the chip must be ready.
+ */
+void m25p16PageProgramBegin(uint32_t address)
+{
+    m25p16WriteEnable();
+
+    spiSelect(true);
+    m25p16SendAddress(M25P16_INSTRUCTION_PAGE_PROGRAM, address);
+}
+
+void m25p16PageProgramContinue(const uint8_t *data, int length)
+{
+    spiTransfer(NULL, data, length);
+}
+
+void m25p16PageProgramFinish(void)
+{
+    // The chip starts programming when we release it, which takes up to 5ms for a full page
+    spiSelect(false);
+
+    couldBeBusy = true;
+}
+
+static void m25p16PageProgramAsyncComplete(void)
+{
+    // Called from the SPI interrupt, the chip starts programming as soon as it's deselected
+    spiSelect(false);
+}
+
+/**
+ * Like m25p16PageProgram(), but returns as soon as the command has been sent and transfers the data in the background.
+ * data must stay unchanged until m25p16IsReady() returns true again.
+ */
+void m25p16PageProgramAsync(uint32_t address, const uint8_t *data, int length)
+{
+    m25p16PageProgramBegin(address);
+
+    couldBeBusy = true;
+
+    spiTransferAsync(NULL, data, length, m25p16PageProgramAsyncComplete);
+}
+
+void m25p16PageProgram(uint32_t address, const uint8_t *data, int length)
+{
+    m25p16PageProgramBegin(address);
+    m25p16PageProgramContinue(data, length);
+    m25p16PageProgramFinish();
+}
+
+/**
+ * Read length bytes into buffer starting at address. Waits for any program or erase in progress to complete first.
+ *
+ * Returns the number of bytes read, or 0 if the chip stayed busy.
+ */
+int m25p16ReadBytes(uint32_t address, uint8_t *buffer, int length)
+{
+    if (!m25p16WaitForReady(10))
+        return 0;
+
+    spiSelect(true);
+    m25p16SendAddress(M25P16_INSTRUCTION_READ_BYTES, address);
+    spiTransfer(buffer, NULL, length);
+    spiSelect(false);
+
+    return length;
+}
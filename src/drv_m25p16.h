@@ -0,0 +1,27 @@
+#pragma once
+
+#define M25P16_PAGESIZE 256
+
+typedef struct flashGeometry_t {
+    uint16_t sectors;                       // Count of the number of erasable blocks on the device
+    uint16_t pagesPerSector;
+    uint16_t pageSize;                      // In bytes
+    uint32_t sectorSize;                    // This is just pagesPerSector * pageSize
+    uint32_t totalSize;                     // This is just sectorSize * sectors
+} flashGeometry_t;
+
+bool m25p16Init(void);
+const flashGeometry_t *m25p16GetGeometry(void);
+
+bool m25p16IsReady(void);
+bool m25p16WaitForReady(uint32_t timeoutMillis);
+
+void m25p16EraseSector(uint32_t address);
+
+void m25p16PageProgramBegin(uint32_t address);
+void m25p16PageProgramContinue(const uint8_t *data, int length);
+void m25p16PageProgramFinish(void);
+void m25p16PageProgram(uint32_t address, const uint8_t *data, int length);
+void m25p16PageProgramAsync(uint32_t address, const uint8_t *data, int length);
+
+int m25p16ReadBytes(uint32_t address, uint8_t *buffer, int length);
@@ -146,10 +146,19 @@ static void mpu6050AccInit(sensor_align_e align);
 static void mpu6050AccRead(int16_t *accData);
 static void mpu6050GyroInit(sensor_align_e align);
 static void mpu6050GyroRead(int16_t *gyroData);
+static void mpu6050Prefetch(void);
 
 extern uint16_t acc_1G;
 static uint8_t mpuAccelHalf = 0;
 
+// The accel, temperature and gyro registers are contiguous, so mpu6050Prefetch() fetches all of them with one read
+#define MPU_PREFETCH_SIZE           (MPU_RA_GYRO_XOUT_H - MPU_RA_ACCEL_XOUT_H + 6)
+
+static uint8_t mpuPrefetchBuffer[MPU_PREFETCH_SIZE];
+static i2cJob_t mpuPrefetchJob;
+// Whether the acc and gyro have yet to use the sample being prefetched
+static bool mpuAccPrefetched = false, mpuGyroPrefetched = false;
+
 bool mpu6050Detect(sensor_t *acc, sensor_t *gyro, uint16_t lpf, uint8_t *scale)
 {
     bool ack;
@@ -197,6 +206,8 @@ bool mpu6050Detect(sensor_t *acc, sensor_t *gyro, uint16_t lpf, uint8_t *scale)
     acc->read = mpu6050AccRead;
     gyro->init = mpu6050GyroInit;
     gyro->read = mpu6050GyroRead;
+    acc->prefetch = mpu6050Prefetch;
+    gyro->prefetch = mpu6050Prefetch;
 
     // 16.4 dps/lsb scalefactor
     gyro->scale = (4.0f / 16.4f) * (M_PI / 180.0f) * 0.000001f;
@@ -233,12 +244,41 @@ static void mpu6050AccInit(sensor_align_e align)
         accAlign = align;
 }
 
+/**
+ * Start reading the next acc and gyro sample in the background, so it's ready by the time the next loop iteration asks
+ * for it. Does nothing if the last prefetch is still running.
+ */
+static void mpu6050Prefetch(void)
+{
+    if (i2cJobIsPending(&mpuPrefetchJob))
+        return;
+
+    mpuAccPrefetched = mpuGyroPrefetched = i2cReadAsync(&mpuPrefetchJob, MPU6050_ADDRESS, MPU_RA_ACCEL_XOUT_H, MPU_PREFETCH_SIZE, mpuPrefetchBuffer);
+}
+
+/**
+ * Read 6 bytes of sensor data starting at reg, using the prefetched sample if it hasn't been used yet (waiting for it to
+ * arrive if need be). Otherwise the registers are read directly.
+ */
+static void mpu6050ReadData(uint8_t reg, bool *prefetched, uint8_t *buf)
+{
+    if (*prefetched) {
+        *prefetched = false;
+        if (i2cJobWait(&mpuPrefetchJob)) {
+            memcpy(buf, mpuPrefetchBuffer + (reg - MPU_RA_ACCEL_XOUT_H), 6);
+            return;
+        }
+    }
+
+    i2cRead(MPU6050_ADDRESS, reg, 6, buf);
+}
+
 static void mpu6050AccRead(int16_t *accData)
 {
     uint8_t buf[6];
     int16_t data[3];
 
-    i2cRead(MPU6050_ADDRESS, MPU_RA_ACCEL_XOUT_H, 6, buf);
+    mpu6050ReadData(MPU_RA_ACCEL_XOUT_H, &mpuAccPrefetched, buf);
     data[0] = (int16_t)((buf[0] << 8) | buf[1]);
     data[1] = (int16_t)((buf[2] << 8) | buf[3]);
     data[2] = (int16_t)((buf[4] << 8) | buf[5]);
@@ -279,7 +319,7 @@ static void mpu6050GyroRead(int16_t *gyroData)
     uint8_t buf[6];
     int16_t data[3];
 
-    i2cRead(MPU6050_ADDRESS, MPU_RA_GYRO_XOUT_H, 6, buf);
+    mpu6050ReadData(MPU_RA_GYRO_XOUT_H, &mpuGyroPrefetched, buf);
     data[0] = (int16_t)((buf[0] << 8) | buf[1]) / 4;
     data[1] = (int16_t)((buf[2] << 8) | buf[3]) / 4;
     data[2] = (int16_t)((buf[4] << 8) | buf[5]) / 4;
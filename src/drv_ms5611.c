@@ -33,11 +33,22 @@ static void ms5611_start_up(void);
 static void ms5611_get_up(void);
 static void ms5611_calculate(int32_t *pressure, int32_t *temperature);
 
-static uint32_t ms5611_ut;  // static result of temperature measurement
-static uint32_t ms5611_up;  // static result of pressure measurement
+static volatile uint32_t ms5611_ut;  // static result of temperature measurement
+static volatile uint32_t ms5611_up;  // static result of pressure measurement
 static uint16_t ms5611_c[PROM_NB];  // on-chip ROM
 static uint8_t ms5611_osr = CMD_ADC_4096;
 
+/*
+ * The ADC reads and conversion commands issued from Baro_update() are queued in the background, so the loop never waits
+ * on the bus for the baro. A completed ADC read lands in ms5611_ut or ms5611_up from the I2C interrupt, so
+ * Baro_update() leaves ms5611_calculate() until the next step, once the pressure read has had time to finish.
+ */
+static i2cJob_t ms5611_adc_job;
+static uint8_t ms5611_adc_buf[3];
+static volatile uint32_t * volatile ms5611_adc_dest;     // where the result of ms5611_adc_job goes
+static i2cJob_t ms5611_cmd_job;
+static uint8_t ms5611_cmd_data = 1;
+
 bool ms5611Detect(baro_t *baro)
 {
     bool ack = false;
@@ -136,24 +147,64 @@ static uint32_t ms5611_read_adc(void)
     return (rxbuf[0] << 16) | (rxbuf[1] << 8) | rxbuf[2];
 }
 
+static void ms5611_read_adc_done(i2cJob_t *job)
+{
+    if (job->status == I2C_JOB_COMPLETE)
+        *ms5611_adc_dest = (ms5611_adc_buf[0] << 16) | (ms5611_adc_buf[1] << 8) | ms5611_adc_buf[2];
+}
+
+// Read the ADC into dest in the background, or right away if the last read still hasn't finished
+static void ms5611_read_adc_async(volatile uint32_t *dest)
+{
+    if (!i2cJobIsPending(&ms5611_adc_job)) {
+        ms5611_adc_dest = dest;
+        ms5611_adc_job.addr = MS5611_ADDR;
+        ms5611_adc_job.reg = CMD_ADC_READ;
+        ms5611_adc_job.len = sizeof(ms5611_adc_buf);
+        ms5611_adc_job.read = true;
+        ms5611_adc_job.data = ms5611_adc_buf;
+        ms5611_adc_job.callback = ms5611_read_adc_done;
+        if (i2cSubmit(&ms5611_adc_job))
+            return;
+    }
+
+    *dest = ms5611_read_adc();
+}
+
+static void ms5611_command_async(uint8_t command)
+{
+    if (!i2cJobIsPending(&ms5611_cmd_job)) {
+        ms5611_cmd_job.addr = MS5611_ADDR;
+        ms5611_cmd_job.reg = command;
+        ms5611_cmd_job.len = 1;
+        ms5611_cmd_job.read = false;
+        ms5611_cmd_job.data = &ms5611_cmd_data;
+        ms5611_cmd_job.callback = NULL;
+        if (i2cSubmit(&ms5611_cmd_job))
+            return;
+    }
+
+    i2cWrite(MS5611_ADDR, command, 1);
+}
+
 static void ms5611_start_ut(void)
 {
-    i2cWrite(MS5611_ADDR, CMD_ADC_CONV + CMD_ADC_D2 + ms5611_osr, 1); // D2 (temperature) conversion start!
+    ms5611_command_async(CMD_ADC_CONV + CMD_ADC_D2 + ms5611_osr); // D2 (temperature) conversion start!
 }
 
 static void ms5611_get_ut(void)
 {
-    ms5611_ut = ms5611_read_adc();
+    ms5611_read_adc_async(&ms5611_ut);
 }
 
 static void ms5611_start_up(void)
 {
-    i2cWrite(MS5611_ADDR, CMD_ADC_CONV + CMD_ADC_D1 + ms5611_osr, 1); // D1 (pressure) conversion start!
+    ms5611_command_async(CMD_ADC_CONV + CMD_ADC_D1 + ms5611_osr); // D1 (pressure) conversion start!
 }
 
 static void ms5611_get_up(void)
 {
-    ms5611_up = ms5611_read_adc();
+    ms5611_read_adc_async(&ms5611_up);
 }
 
 static void ms5611_calculate(int32_t *pressure, int32_t *temperature)
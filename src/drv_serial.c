@@ -23,6 +23,11 @@ uint8_t serialTotalBytesWaiting(serialPort_t *instance)
     return instance->vTable->serialTotalBytesWaiting(instance);
 }
 
+uint32_t serialTxBytesFree(serialPort_t *instance)
+{
+    return instance->vTable->serialTxBytesFree(instance);
+}
+
 uint8_t serialRead(serialPort_t *instance)
 {
     return instance->vTable->serialRead(instance);
@@ -33,6 +38,11 @@ void serialSetBaudRate(serialPort_t *instance, uint32_t baudRate)
     instance->vTable->serialSetBaudRate(instance, baudRate);
 }
 
+int serialWriteBuf(serialPort_t *instance, const uint8_t *data, int count)
+{
+    return instance->vTable->serialWriteBuf(instance, data, count);
+}
+
 bool isSerialTransmitBufferEmpty(serialPort_t *instance)
 {
     return instance->vTable->isSerialTransmitBufferEmpty(instance);
@@ -30,8 +30,15 @@ typedef struct serialPort {
 struct serialPortVTable {
     void (*serialWrite)(serialPort_t *instance, uint8_t ch);
 
+    // Copy as much of a span as there's room for into the transmit buffer, start transmission once and return the
+    // number of bytes accepted
+    int (*serialWriteBuf)(serialPort_t *instance, const uint8_t *data, int count);
+
     uint8_t (*serialTotalBytesWaiting)(serialPort_t *instance);
 
+    // Number of bytes that can be written without overwriting data that hasn't been transmitted yet
+    uint32_t (*serialTxBytesFree)(serialPort_t *instance);
+
     uint8_t (*serialRead)(serialPort_t *instance);
 
     // Specified baud rate may not be allowed by an implementation, use serialGetBaudRate to determine actual baud rate in use.
@@ -43,7 +50,9 @@ struct serialPortVTable {
 };
 
 void serialWrite(serialPort_t *instance, uint8_t ch);
+int serialWriteBuf(serialPort_t *instance, const uint8_t *data, int count);
 uint8_t serialTotalBytesWaiting(serialPort_t *instance);
+uint32_t serialTxBytesFree(serialPort_t *instance);
 uint8_t serialRead(serialPort_t *instance);
 void serialSetBaudRate(serialPort_t *instance, uint32_t baudRate);
 void serialSetMode(serialPort_t *instance, portMode_t mode);
@@ -388,6 +388,23 @@ uint8_t softSerialTotalBytesWaiting(serialPort_t *instance)
     return availableBytes;
 }
 
+uint32_t softSerialTxBytesFree(serialPort_t *instance)
+{
+    uint32_t bytesUsed;
+
+    if ((instance->mode & MODE_TX) == 0) {
+        return 0;
+    }
+
+    if (instance->txBufferHead >= instance->txBufferTail) {
+        bytesUsed = instance->txBufferHead - instance->txBufferTail;
+    } else {
+        bytesUsed = instance->txBufferSize + instance->txBufferHead - instance->txBufferTail;
+    }
+
+    return instance->txBufferSize - 1 - bytesUsed;
+}
+
 static void moveHeadToNextByte(softSerial_t *softSerial)
 {
     if (softSerial->port.rxBufferHead < softSerial->port.rxBufferSize - 1) {
@@ -425,6 +442,29 @@ void softSerialWriteByte(serialPort_t *s, uint8_t ch)
     s->txBufferHead = (s->txBufferHead + 1) % s->txBufferSize;
 }
 
+int softSerialWriteBuf(serialPort_t *s, const uint8_t *data, int count)
+{
+    uint32_t head, chunk;
+
+    // Free space is zero when the port isn't in transmit mode
+    count = min(count, (int) softSerialTxBytesFree(s));
+    if (count <= 0) {
+        return 0;
+    }
+
+    head = s->txBufferHead;
+
+    // The bit-banging timer ISR picks bytes up from the tail, so just fill the ring in at most two pieces
+    chunk = min((uint32_t)count, s->txBufferSize - head);
+    memcpy((uint8_t *)&s->txBuffer[head], data, chunk);
+    if ((uint32_t)count > chunk)
+        memcpy((uint8_t *)s->txBuffer, data + chunk, count - chunk);
+
+    s->txBufferHead = (head + count) % s->txBufferSize;
+
+    return count;
+}
+
 void softSerialSetBaudRate(serialPort_t *s, uint32_t baudRate)
 {
     uint32_t newbaudRate;
@@ -453,7 +493,9 @@ bool isSoftSerialTransmitBufferEmpty(serialPort_t *instance)
 const struct serialPortVTable softSerialVTable[] = {
     {
         softSerialWriteByte,
+        softSerialWriteBuf,
         softSerialTotalBytesWaiting,
+        softSerialTxBytesFree,
         softSerialReadByte,
         softSerialSetBaudRate,
         isSoftSerialTransmitBufferEmpty,
@@ -47,7 +47,9 @@ void setupSoftSerialSecondary(uint8_t inverted);
 
 // serialPort API
 void softSerialWriteByte(serialPort_t *instance, uint8_t ch);
+int softSerialWriteBuf(serialPort_t *instance, const uint8_t *data, int count);
 uint8_t softSerialTotalBytesWaiting(serialPort_t *instance);
+uint32_t softSerialTxBytesFree(serialPort_t *instance);
 uint8_t softSerialReadByte(serialPort_t *instance);
 void softSerialSetBaudRate(serialPort_t *s, uint32_t baudRate);
 bool isSoftSerialTransmitBufferEmpty(serialPort_t *s);
@@ -13,12 +13,22 @@
 
 static int spiDetect(void);
 
-#define FLASH_M25P16    (0x202015)
+/*
+ * State of the asynchronous transfer in progress, if any. SPI2's DMA channels (DMA1 channel 4 and 5) are already taken
+ * by USART1, so asynchronous transfers are driven by the RXNE interrupt instead: each received byte triggers the
+ * transmission of the next.
+ */
+static volatile bool spiBusy = false;
+static uint8_t *asyncOut;
+static const uint8_t *asyncIn;
+static volatile int asyncRemaining;
+static spiCallbackPtr asyncCallback;
 
 int spiInit(void)
 {
     gpio_config_t gpio;
     SPI_InitTypeDef spi;
+    NVIC_InitTypeDef nvic;
 
     // Enable SPI2 clock
     RCC_APB1PeriphClockCmd(RCC_APB1Periph_SPI2, ENABLE);
@@ -51,6 +61,13 @@ int spiInit(void)
     SPI_Init(SPI2, &spi);
     SPI_Cmd(SPI2, ENABLE);
 
+    // RXNE interrupt for asynchronous transfers, only enabled while one is running
+    nvic.NVIC_IRQChannel = SPI2_IRQn;
+    nvic.NVIC_IRQChannelPreemptionPriority = 1;
+    nvic.NVIC_IRQChannelSubPriority = 0;
+    nvic.NVIC_IRQChannelCmd = ENABLE;
+    NVIC_Init(&nvic);
+
     return spiDetect();
 }
 
@@ -66,6 +83,10 @@ void spiSelect(bool select)
 uint8_t spiTransferByte(uint8_t in)
 {
     uint8_t rx;
+
+    // Let any asynchronous transfer finish first
+    while (spiBusy);
+
     SPI2->DR;
     SPI2->DR = in;
     while (!(SPI2->SR & SPI_I2S_FLAG_RXNE));
@@ -75,9 +96,12 @@ uint8_t spiTransferByte(uint8_t in)
     return rx;
 }
 
-bool spiTransfer(uint8_t *out, uint8_t *in, int len)
+bool spiTransfer(uint8_t *out, const uint8_t *in, int len)
 {
     uint8_t b;
+
+    while (spiBusy);
+
     SPI2->DR;
     while (len--) {
         b = in ? *(in++) : 0xFF;
@@ -92,6 +116,62 @@ bool spiTransfer(uint8_t *out, uint8_t *in, int len)
     return true;
 }
 
+/**
+ * Start a transfer of len bytes which runs in the background, sending from in (or 0xFF if NULL) and receiving into out
+ * (unless NULL). Both buffers must stay valid until the transfer completes. Chip select is left to the caller.
+ *
+ * callback, if not NULL, is called from the SPI interrupt once the last byte has been received, so it must be brief.
+ *
+ * Returns false if another asynchronous transfer is still in progress.
+ */
+bool spiTransferAsync(uint8_t *out, const uint8_t *in, int len, spiCallbackPtr callback)
+{
+    if (spiBusy)
+        return false;
+
+    if (len <= 0) {
+        if (callback)
+            callback();
+        return true;
+    }
+
+    asyncOut = out;
+    asyncIn = in;
+    asyncRemaining = len;
+    asyncCallback = callback;
+    spiBusy = true;
+
+    // Discard anything left over in the receive register so we don't interrupt immediately
+    SPI2->DR;
+    SPI_I2S_ITConfig(SPI2, SPI_I2S_IT_RXNE, ENABLE);
+    SPI2->DR = asyncIn ? *(asyncIn++) : 0xFF;
+
+    return true;
+}
+
+bool spiIsBusy(void)
+{
+    return spiBusy;
+}
+
+void SPI2_IRQHandler(void)
+{
+    uint8_t b = SPI2->DR; // Reading DR clears RXNE
+
+    if (asyncOut)
+        *(asyncOut++) = b;
+
+    if (--asyncRemaining > 0) {
+        SPI2->DR = asyncIn ? *(asyncIn++) : 0xFF;
+    } else {
+        SPI_I2S_ITConfig(SPI2, SPI_I2S_IT_RXNE, DISABLE);
+        spiBusy = false;
+
+        if (asyncCallback)
+            asyncCallback();
+    }
+}
+
 static int spiDetect(void)
 {
     uint8_t out[] = { 0x9F, 0, 0, 0 };
@@ -4,7 +4,13 @@
 #define SPI_DEVICE_FLASH    (1)
 #define SPI_DEVICE_MPU      (2)
 
+#define FLASH_M25P16        (0x202015)
+
+typedef void (*spiCallbackPtr)(void);
+
 int spiInit(void);
 void spiSelect(bool select);
 uint8_t spiTransferByte(uint8_t in);
-bool spiTransfer(uint8_t *out, uint8_t *in, int len);
+bool spiTransfer(uint8_t *out, const uint8_t *in, int len);
+bool spiTransferAsync(uint8_t *out, const uint8_t *in, int len, spiCallbackPtr callback);
+bool spiIsBusy(void);
@@ -16,11 +16,20 @@ static void beepRev5(bool onoff);
 void (*systemBeepPtr)(bool onoff) = NULL;
 #endif
 
+// The CMSIS headers we use predate the DWT definitions
+#define DWT_CTRL (*(volatile uint32_t *)0xE0001000)
+#define DWT_CTRL_CYCCNTENA 0x00000001
+
 static void cycleCounterInit(void)
 {
     RCC_ClocksTypeDef clocks;
     RCC_GetClocksFreq(&clocks);
     usTicks = clocks.SYSCLK_Frequency / 1000000;
+
+    // Start the DWT cycle counter, used for profiling the main loop
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT_CYCCNT = 0;
+    DWT_CTRL |= DWT_CTRL_CYCCNTENA;
 }
 
 // SysTick
@@ -175,7 +184,7 @@ void failureMode(uint8_t mode)
         LED1_TOGGLE;
         LED0_TOGGLE;
         delay(475 * mode - 2);
-        BEEP_ON
+        BEEP_ON;
         delay(25);
         BEEP_OFF;
     }
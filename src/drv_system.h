@@ -9,6 +9,14 @@ void delay(uint32_t ms);
 uint32_t micros(void);
 uint32_t millis(void);
 
+// DWT cycle counter, counts core clock cycles. Started by systemInit()
+#ifdef SITL
+#define DWT_CYCCNT sitlCycleCounter()
+uint32_t sitlCycleCounter(void);
+#else
+#define DWT_CYCCNT (*(volatile uint32_t *)0xE0001004)
+#endif
+
 // Backup SRAM R/W
 uint32_t rccReadBkpDr(void);
 void rccWriteBkpDr(uint32_t value);
@@ -299,6 +299,28 @@ uint8_t uartTotalBytesWaiting(serialPort_t *instance)
         return s->port.rxBufferTail != s->port.rxBufferHead;
 }
 
+uint32_t uartTxBytesFree(serialPort_t *instance)
+{
+    uartPort_t *s = (uartPort_t *)instance;
+    uint32_t bytesUsed;
+
+    if (s->port.txBufferHead >= s->port.txBufferTail)
+        bytesUsed = s->port.txBufferHead - s->port.txBufferTail;
+    else
+        bytesUsed = s->port.txBufferSize + s->port.txBufferHead - s->port.txBufferTail;
+
+    if (s->txDMAChannel) {
+        /*
+         * uartStartTxDMA() advances the tail as soon as a transfer starts, so the bytes the DMA engine is still
+         * reading sit just behind the tail and must be counted as used too.
+         */
+        bytesUsed += s->txDMAChannel->CNDTR;
+    }
+
+    // Keep one slot free so a full ring can't be mistaken for an empty one
+    return bytesUsed < s->port.txBufferSize ? s->port.txBufferSize - 1 - bytesUsed : 0;
+}
+
 // BUGBUG TODO TODO FIXME - What is the bug?
 bool isUartTransmitBufferEmpty(serialPort_t *instance)
 {
@@ -340,10 +362,42 @@ void uartWrite(serialPort_t *instance, uint8_t ch)
     }
 }
 
+int uartWriteBuf(serialPort_t *instance, const uint8_t *data, int count)
+{
+    uartPort_t *s = (uartPort_t *)instance;
+    uint32_t head = s->port.txBufferHead;
+    uint32_t chunk;
+
+    // Never run the head into bytes that haven't been sent yet
+    count = min(count, (int) uartTxBytesFree(instance));
+    if (count <= 0)
+        return 0;
+
+    // Copy up to the end of the ring, then wrap around and copy the remainder to the start
+    chunk = min((uint32_t)count, s->port.txBufferSize - head);
+    memcpy((uint8_t *)&s->port.txBuffer[head], data, chunk);
+    if ((uint32_t)count > chunk)
+        memcpy((uint8_t *)s->port.txBuffer, data + chunk, count - chunk);
+
+    s->port.txBufferHead = (head + count) % s->port.txBufferSize;
+
+    // Kick off transmission once for the whole span
+    if (s->txDMAChannel) {
+        if (!(s->txDMAChannel->CCR & 1))
+            uartStartTxDMA(s);
+    } else {
+        USART_ITConfig(s->USARTx, USART_IT_TXE, ENABLE);
+    }
+
+    return count;
+}
+
 const struct serialPortVTable uartVTable[] = {
     { 
         uartWrite, 
+        uartWriteBuf,
         uartTotalBytesWaiting,
+        uartTxBytesFree,
         uartRead,
         uartSetBaudRate,
         isUartTransmitBufferEmpty,
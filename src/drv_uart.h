@@ -33,7 +33,9 @@ serialPort_t *uartOpen(USART_TypeDef *USARTx, serialReceiveCallbackPtr callback,
 
 // serialPort API
 void uartWrite(serialPort_t *instance, uint8_t ch);
+int uartWriteBuf(serialPort_t *instance, const uint8_t *data, int count);
 uint8_t uartTotalBytesWaiting(serialPort_t *instance);
+uint32_t uartTxBytesFree(serialPort_t *instance);
 uint8_t uartRead(serialPort_t *instance);
 void uartSetBaudRate(serialPort_t *s, uint32_t baudRate);
 bool isUartTransmitBufferEmpty(serialPort_t *s);
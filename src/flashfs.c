@@ -0,0 +1,298 @@
+/*
+ * This file is part of baseflight
+ * Licensed under GPL V3 or modified DCL - see https://github.com/multiwii/baseflight/blob/master/README.md
+ */
+
+#include "board.h"
+#include "flashfs.h"
+
+/*
+ * A very simple append-only log store on top of the SPI flash chip. Writes are collected in a RAM ring buffer and
+ * programmed into the chip a page at a time when the chip is idle, so callers in the control loop never have to wait on
+ * the flash. Erasing is done one sector at a time from flashfsProcess(), which must only be called while disarmed.
+ */
+
+// Granularity of the search for the end of the log data on startup
+#define FLASHFS_FREE_BLOCK_SIZE 16
+
+// How long we'll wait for a page program to complete (the datasheet maximum is 5ms)
+#define FLASHFS_PROGRAM_TIMEOUT_MS 10
+
+// How long we'll wait at startup for an erase that was in progress when we were reset
+#define FLASHFS_ERASE_TIMEOUT_MS 3000
+
+static bool flashfsSupported = false;
+
+/*
+ * The byte destined for flash address A is kept at flashWriteBuffer[A % FLASHFS_WRITE_BUFFER_SIZE]. Since the buffer is
+ * a whole number of pages long, the data for one page never wraps around the end of the buffer, so it can be programmed
+ * straight out of the buffer with one transfer.
+ */
+#if FLASHFS_WRITE_BUFFER_SIZE % M25P16_PAGESIZE != 0
+#error "FLASHFS_WRITE_BUFFER_SIZE must be a multiple of the flash page size"
+#endif
+
+static uint8_t flashWriteBuffer[FLASHFS_WRITE_BUFFER_SIZE];
+static uint32_t bufferedBytes;              // Number of bytes waiting in flashWriteBuffer
+static uint32_t programAddress;             // Address on the chip where the oldest buffered byte belongs
+
+// Bytes just behind programAddress which an asynchronous page program may still be reading out of the buffer
+static uint32_t programInFlight;
+
+// Sectors [eraseNextSector..eraseEndSector) are still waiting to be erased
+static uint32_t eraseNextSector, eraseEndSector;
+
+static bool flashfsIsErasing(void)
+{
+    return eraseNextSector < eraseEndSector;
+}
+
+static bool flashfsIsBlockErased(uint32_t address)
+{
+    uint8_t block[FLASHFS_FREE_BLOCK_SIZE];
+    int i;
+
+    if (m25p16ReadBytes(address, block, sizeof(block)) != sizeof(block))
+        return false;
+
+    for (i = 0; i < FLASHFS_FREE_BLOCK_SIZE; i++)
+        if (block[i] != 0xFF)
+            return false;
+
+    return true;
+}
+
+/**
+ * Since we only ever append to the log, everything before the first erased block is in use and everything after it is
+ * free, so we can binary search for the end of the existing data. Logged data is very unlikely to contain a whole
+ * block of 0xFF.
+ */
+static uint32_t flashfsIdentifyStartOfFreeSpace(void)
+{
+    uint32_t left = 0, right = flashfsGetSize() / FLASHFS_FREE_BLOCK_SIZE, mid;
+
+    // Blocks before left are known to be used, blocks from right onwards are known to be free
+    while (left < right) {
+        mid = (left + right) / 2;
+
+        if (flashfsIsBlockErased(mid * FLASHFS_FREE_BLOCK_SIZE))
+            right = mid;
+        else
+            left = mid + 1;
+    }
+
+    return left * FLASHFS_FREE_BLOCK_SIZE;
+}
+
+void flashfsInit(void)
+{
+    flashfsSupported = m25p16Init() && m25p16WaitForReady(FLASHFS_ERASE_TIMEOUT_MS);
+
+    bufferedBytes = 0;
+    programInFlight = 0;
+    eraseNextSector = eraseEndSector = 0;
+    programAddress = flashfsSupported ? flashfsIdentifyStartOfFreeSpace() : 0;
+}
+
+bool flashfsIsSupported(void)
+{
+    return flashfsSupported;
+}
+
+/**
+ * True if the chip is idle and not being erased, so a new log can be started.
+ */
+bool flashfsIsReady(void)
+{
+    return flashfsSupported && !flashfsIsErasing() && m25p16IsReady();
+}
+
+uint32_t flashfsGetSize(void)
+{
+    return m25p16GetGeometry()->totalSize;
+}
+
+/**
+ * Get the address that the next byte passed to flashfsWrite() will be stored at, i.e. the amount of space used.
+ */
+uint32_t flashfsGetOffset(void)
+{
+    return programAddress + bufferedBytes;
+}
+
+bool flashfsIsEOF(void)
+{
+    return flashfsGetOffset() >= flashfsGetSize();
+}
+
+/**
+ * The number of bytes that flashfsWrite() can accept without having to wait for the chip.
+ */
+uint32_t flashfsGetWriteBufferFreeSpace(void)
+{
+    if (!flashfsSupported || flashfsIsErasing())
+        return 0;
+
+    if (programInFlight > 0 && !spiIsBusy())
+        programInFlight = 0;
+
+    return min(FLASHFS_WRITE_BUFFER_SIZE - bufferedBytes - programInFlight, flashfsGetSize() - flashfsGetOffset());
+}
+
+/**
+ * Program count bytes from the buffer, which the caller must ensure doesn't cross a page boundary. The chip must be
+ * ready.
+ *
+ * If async is true the data is transferred to the chip in the background by the SPI interrupt.
+ */
+static void flashfsProgramFromBuffer(uint32_t count, bool async)
+{
+    const uint8_t *data = flashWriteBuffer + programAddress % FLASHFS_WRITE_BUFFER_SIZE;
+
+    if (async) {
+        m25p16PageProgramAsync(programAddress, data, count);
+        programInFlight = count;
+    } else {
+        m25p16PageProgram(programAddress, data, count);
+        programInFlight = 0;
+    }
+
+    bufferedBytes -= count;
+    programAddress += count;
+}
+
+static uint32_t flashfsBytesUntilPageEnd(void)
+{
+    uint16_t pageSize = m25p16GetGeometry()->pageSize;
+
+    return pageSize - programAddress % pageSize;
+}
+
+/**
+ * If the chip is idle, program the buffered data into it. To keep the number of page programs down we only program
+ * once we have all the data for the rest of the current page, unless the buffer is starting to fill up.
+ *
+ * This never waits for the chip, and the data is sent to the chip in the background, so it's safe to call from the
+ * control loop.
+ */
+void flashfsFlushAsync(void)
+{
+    uint32_t bytesUntilPageEnd;
+
+    if (bufferedBytes == 0 || !m25p16IsReady())
+        return;
+
+    bytesUntilPageEnd = flashfsBytesUntilPageEnd();
+
+    if (bufferedBytes < bytesUntilPageEnd && bufferedBytes < FLASHFS_WRITE_BUFFER_SIZE / 2)
+        return;
+
+    flashfsProgramFromBuffer(min(bufferedBytes, bytesUntilPageEnd), true);
+}
+
+/**
+ * Program everything in the buffer into the chip, waiting for the chip as needed.
+ */
+void flashfsFlushSync(void)
+{
+    while (bufferedBytes > 0) {
+        if (!m25p16WaitForReady(FLASHFS_PROGRAM_TIMEOUT_MS))
+            return;
+
+        flashfsProgramFromBuffer(min(bufferedBytes, flashfsBytesUntilPageEnd()), false);
+    }
+}
+
+/**
+ * Append data to the log. If there isn't room in the buffer this waits for the chip to accept some of the buffered
+ * data, so callers which can't wait should check flashfsGetWriteBufferFreeSpace() first.
+ *
+ * Data that would run off the end of the chip is discarded, as is everything while the chip is being erased or once it
+ * stops responding. Returns the number of bytes accepted.
+ */
+unsigned int flashfsWrite(const uint8_t *data, unsigned int length)
+{
+    uint32_t head, count;
+    unsigned int written = 0;
+
+    if (!flashfsSupported || flashfsIsErasing())
+        return 0;
+
+    length = min(length, flashfsGetSize() - flashfsGetOffset());
+
+    while (length > 0) {
+        if (flashfsGetWriteBufferFreeSpace() == 0) {
+            // Waiting for the chip to be ready also waits for any asynchronous program to finish with the buffer
+            if (!m25p16WaitForReady(FLASHFS_PROGRAM_TIMEOUT_MS))
+                return written;
+
+            programInFlight = 0;
+
+            if (bufferedBytes == FLASHFS_WRITE_BUFFER_SIZE)
+                flashfsProgramFromBuffer(min(bufferedBytes, flashfsBytesUntilPageEnd()), false);
+        }
+
+        head = flashfsGetOffset() % FLASHFS_WRITE_BUFFER_SIZE;
+        count = min(length, min(FLASHFS_WRITE_BUFFER_SIZE - head, flashfsGetWriteBufferFreeSpace()));
+
+        memcpy(flashWriteBuffer + head, data, count);
+
+        bufferedBytes += count;
+        data += count;
+        length -= count;
+        written += count;
+    }
+
+    return written;
+}
+
+/**
+ * Read data that has already been programmed into the chip, waiting for the chip to become idle first. Data still
+ * waiting in the write buffer can't be read until it has been flushed.
+ *
+ * Returns the number of bytes read.
+ */
+int flashfsReadAbs(uint32_t address, uint8_t *buffer, unsigned int length)
+{
+    if (!flashfsSupported || flashfsIsErasing() || address >= programAddress)
+        return 0;
+
+    length = min(length, programAddress - address);
+
+    return m25p16ReadBytes(address, buffer, length);
+}
+
+/**
+ * Erase every sector that holds log data. This only schedules the erase, which is carried out by flashfsProcess() and
+ * is complete once flashfsIsReady() returns true again.
+ */
+void flashfsErase(void)
+{
+    uint32_t sectorSize;
+
+    if (!flashfsSupported)
+        return;
+
+    sectorSize = m25p16GetGeometry()->sectorSize;
+
+    eraseNextSector = 0;
+    eraseEndSector = (flashfsGetOffset() + sectorSize - 1) / sectorSize;
+
+    // Anything still waiting to be programmed would be erased anyway
+    m25p16WaitForReady(FLASHFS_PROGRAM_TIMEOUT_MS);
+    bufferedBytes = 0;
+    programInFlight = 0;
+    programAddress = 0;
+}
+
+/**
+ * Start erasing the next pending sector once the chip has finished with the previous one. Each sector erase keeps the
+ * chip busy for most of a second, so only call this while disarmed.
+ */
+void flashfsProcess(void)
+{
+    if (flashfsIsErasing() && m25p16IsReady()) {
+        m25p16EraseSector(eraseNextSector * m25p16GetGeometry()->sectorSize);
+        eraseNextSector++;
+    }
+}
@@ -0,0 +1,30 @@
+/*
+ * This file is part of baseflight
+ * Licensed under GPL V3 or modified DCL - see https://github.com/multiwii/baseflight/blob/master/README.md
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Size of the RAM buffer that batches up writes into whole page programs
+#define FLASHFS_WRITE_BUFFER_SIZE 256
+
+void flashfsInit(void);
+bool flashfsIsSupported(void);
+bool flashfsIsReady(void);
+bool flashfsIsEOF(void);
+
+uint32_t flashfsGetSize(void);
+uint32_t flashfsGetOffset(void);
+uint32_t flashfsGetWriteBufferFreeSpace(void);
+
+unsigned int flashfsWrite(const uint8_t *data, unsigned int length);
+void flashfsFlushAsync(void);
+void flashfsFlushSync(void);
+
+int flashfsReadAbs(uint32_t address, uint8_t *buffer, unsigned int length);
+
+void flashfsErase(void);
+void flashfsProcess(void);
@@ -7,6 +7,8 @@
 
 #include "telemetry_common.h"
 #include "blackbox.h"
+#include "flashfs.h"
+#include "perf.h"
 
 core_t core;
 int hw_revision = 0;
@@ -43,6 +45,9 @@ int main(void)
     drv_pwm_config_t pwm_params;
     drv_adc_config_t adc_params;
     bool sensorsOK = false;
+#ifndef CJMCU
+    int spiDevice;
+#endif
 #ifdef SOFTSERIAL_LOOPBACK
     serialPort_t* loopbackPort1 = NULL;
     serialPort_t* loopbackPort2 = NULL;
@@ -62,6 +67,7 @@ int main(void)
         hw_revision = NAZE32_REV5;
 
     systemInit();
+    perfInit();
 #ifdef USE_LAME_PRINTF
     init_printf(NULL, _putc);
 #endif
@@ -84,10 +90,16 @@ int main(void)
     activateConfig();
 
 #ifndef CJMCU
-    if (spiInit() == SPI_DEVICE_MPU && hw_revision == NAZE32_REV5)
+    spiDevice = spiInit();
+    if (spiDevice == SPI_DEVICE_MPU && hw_revision == NAZE32_REV5)
         hw_revision = NAZE32_SP;
 #endif
 
+#ifdef FLASHFS
+    if (spiDevice == SPI_DEVICE_FLASH)
+        flashfsInit();
+#endif
+
     if (hw_revision != NAZE32_SP)
         i2cInit(I2C_DEVICE);
 
@@ -249,6 +261,8 @@ int main(void)
     calibratingB = CALIBRATING_BARO_CYCLES;             // 10 seconds init_delay + 200 * 25 ms = 15 seconds before ground pressure settles
     f.SMALL_ANGLE = 1;
 
+    loopInit();
+
     // loopy
     while (1) {
         loop();
@@ -265,6 +265,11 @@ int servoDirection(int nr, int lr)
         return 1;
 }
 
+const motorMixer_t *mixerGetMotorMix(uint8_t index)
+{
+    return &currentMixer[index];
+}
+
 void mixerInit(void)
 {
     int i;
@@ -594,6 +599,7 @@ void mixTable(void)
     for (i = 1; i < numberMotor; i++)
         if (motor[i] > maxMotor)
             maxMotor = motor[i];
+    f.MOTOR_LIMIT_REACHED = maxMotor > mcfg.maxthrottle;
     for (i = 0; i < numberMotor; i++) {
         if (maxMotor > mcfg.maxthrottle)     // this is a way to still have good gyro corrections if at least one motor reaches its max.
             motor[i] -= maxMotor - mcfg.maxthrottle;
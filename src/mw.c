@@ -8,6 +8,10 @@
 #include "cli.h"
 #include "telemetry_common.h"
 #include "blackbox.h"
+#include "blackbox_fielddefs.h"
+#include "flashfs.h"
+#include "perf.h"
+#include "scheduler.h"
 
 #include "buzzer.h"
 
@@ -16,6 +20,8 @@ int16_t debug[4];
 uint32_t currentTime = 0;
 uint32_t previousTime = 0;
 uint16_t cycleTime = 0;         // this is the number in micro second to achieve a full loop, it can differ a little and is taken into account in the PID loop
+uint32_t loopOverrunCount = 0;  // number of looptime slots we've missed because the previous iteration (or the tasks in between) ran long
+uint16_t loopMaxJitter = 0;     // longest delay in microseconds between an iteration being due and it starting, cleared by the blackbox
 int16_t headFreeModeHold;
 
 uint16_t vbat;                  // battery voltage in 0.1V steps
@@ -102,6 +108,7 @@ void annexCode(void)
     static uint32_t calibratedAccTime;
     int32_t tmp, tmp2;
     int32_t axis, prop1, prop2;
+    uint32_t stageStart;
 
     // vbat shit
     static uint8_t vbatTimer = 0;
@@ -203,7 +210,7 @@ void annexCode(void)
         if (f.ARMED)
             LED0_ON;
 
-#ifndef CJMCU
+#if !defined(CJMCU) && !defined(SITL)
         checkTelemetryState();
 #endif
     }
@@ -228,9 +235,11 @@ void annexCode(void)
         }
     }
 
+    stageStart = DWT_CYCCNT;
     serialCom();
+    perfRecord(PERF_STAGE_SERIAL, stageStart);
 
-#ifndef CJMCU
+#if !defined(CJMCU) && !defined(SITL)
     if (!cliMode && feature(FEATURE_TELEMETRY)) {
         handleTelemetry();
     }
@@ -286,6 +295,61 @@ void computeRC(void)
     }
 }
 
+// Whether the blackbox has been told about the flight modes and GPS fix since the log started
+static bool flightStateLogged;
+
+/**
+ * Log any changes of flight mode, failsafe or GPS fix since the last RC update as blackbox events.
+ */
+static void logFlightStateChanges(void)
+{
+    static uint32_t lastFlightModes;
+    static bool lastFailsafe;
+#ifdef GPS
+    static uint8_t lastGpsFix;
+#endif
+    uint32_t flightModes = 0;
+    bool failsafe;
+
+    if (f.ANGLE_MODE)
+        flightModes |= FLIGHT_LOG_MODE_ANGLE;
+    if (f.HORIZON_MODE)
+        flightModes |= FLIGHT_LOG_MODE_HORIZON;
+    if (f.BARO_MODE)
+        flightModes |= FLIGHT_LOG_MODE_BARO;
+    if (f.MAG_MODE)
+        flightModes |= FLIGHT_LOG_MODE_MAG;
+    if (f.HEADFREE_MODE)
+        flightModes |= FLIGHT_LOG_MODE_HEADFREE;
+    if (f.GPS_HOME_MODE)
+        flightModes |= FLIGHT_LOG_MODE_GPS_HOME;
+    if (f.GPS_HOLD_MODE)
+        flightModes |= FLIGHT_LOG_MODE_GPS_HOLD;
+    if (f.PASSTHRU_MODE)
+        flightModes |= FLIGHT_LOG_MODE_PASSTHRU;
+
+    if (flightModes != lastFlightModes || !flightStateLogged) {
+        blackboxLogEvent(FLIGHT_LOG_EVENT_FLIGHT_MODE, flightModes);
+        lastFlightModes = flightModes;
+    }
+
+    // note: if FAILSAFE is disable, failsafeCnt > 5 * FAILSAVE_DELAY is always false
+    failsafe = failsafeCnt > 5 * cfg.failsafe_delay;
+    if (failsafe != lastFailsafe) {
+        blackboxLogEvent(FLIGHT_LOG_EVENT_FAILSAFE, failsafe);
+        lastFailsafe = failsafe;
+    }
+
+#ifdef GPS
+    if (f.GPS_FIX != lastGpsFix || !flightStateLogged) {
+        blackboxLogEvent(FLIGHT_LOG_EVENT_GPS_FIX, f.GPS_FIX ? GPS_numSat : 0);
+        lastGpsFix = f.GPS_FIX;
+    }
+#endif
+
+    flightStateLogged = true;
+}
+
 static void mwArm(void)
 {
     if (calibratingG == 0 && f.ACC_CALIBRATED) {
@@ -298,6 +362,8 @@ static void mwArm(void)
             if (!cliMode && feature(FEATURE_BLACKBOX)) {
                 // Use the Blackbox's sync beep to inform about arming
             	startBlackbox();
+                // Start the log with the flight modes and GPS fix we have
+                flightStateLogged = false;
             } else {
                 // Beep for inform about arming
 #ifdef GPS
@@ -336,6 +402,79 @@ static void mwVario(void)
 
 }
 
+#ifdef MAG
+static bool taskMag(void)
+{
+    return sensors(SENSOR_MAG) && Mag_getADC();
+}
+#endif
+
+#ifdef BARO
+static bool taskBaro(void)
+{
+    return sensors(SENSOR_BARO) && Baro_update();
+}
+
+static bool taskAltitude(void)
+{
+    return sensors(SENSOR_BARO) && getEstimatedAltitude();
+}
+#endif
+
+#ifdef GPS
+static bool taskGps(void)
+{
+    // if GPS feature is enabled, gpsThread() will be called at some intervals to check for stuck
+    // hardware, wrong baud rates, init GPS if needed, etc. Don't use SENSOR_GPS here as gpsThread() can and will
+    // change this based on available hardware
+    if (!feature(FEATURE_GPS))
+        return false;
+
+    gpsThread();
+    return true;
+}
+#endif
+
+static bool taskMisc(void)
+{
+#ifdef SONAR
+    if (sensors(SENSOR_SONAR)) {
+        Sonar_update();
+    }
+#endif
+    if (feature(FEATURE_VARIO) && f.VARIO_MODE)
+        mwVario();
+#ifdef FLASHFS
+    // Flash erases keep the chip busy for seconds at a time, so they're only scheduled while disarmed
+    if (!f.ARMED)
+        flashfsProcess();
+#endif
+    return true;
+}
+
+/*
+ * Work done between control loop iterations. The sensor tasks keep their own timers and report whether they were due,
+ * so they're polled whenever there's time. Baro goes first since its conversions are timed.
+ */
+static task_t loopTasks[] = {
+#ifdef BARO
+    { .name = "baro", .fn = taskBaro, .period = 0, .priority = 4, .perfStage = PERF_STAGE_TASK_BARO },
+    { .name = "altitude", .fn = taskAltitude, .period = 0, .priority = 2, .perfStage = PERF_STAGE_TASK_ALTITUDE },
+#endif
+#ifdef MAG
+    { .name = "mag", .fn = taskMag, .period = 0, .priority = 3, .perfStage = PERF_STAGE_TASK_MAG },
+#endif
+#ifdef GPS
+    { .name = "gps", .fn = taskGps, .period = 10000, .priority = 1, .perfStage = PERF_STAGE_TASK_GPS },
+#endif
+    { .name = "misc", .fn = taskMisc, .period = 10000, .priority = 0, .perfStage = PERF_STAGE_TASK_MISC },
+};
+
+void loopInit(void)
+{
+    schedulerInit(loopTasks, sizeof(loopTasks) / sizeof(loopTasks[0]));
+}
+
 static int32_t errorGyroI[3] = { 0, 0, 0 };
 static int32_t errorAngleI[2] = { 0, 0 };
 
@@ -449,7 +588,7 @@ static void pidRewrite(void)
 
         // limit maximum integrator value to prevent WindUp - accumulating extreme values when system is saturated.
         // I coefficient (I8) moved before integration to make limiting independent from PID settings
-        errorGyroI[axis] = constrain(errorGyroI[axis], (int32_t)-GYRO_I_MAX << 13, (int32_t)+GYRO_I_MAX << 13);
+        errorGyroI[axis] = constrain(errorGyroI[axis], -((int32_t)GYRO_I_MAX << 13), (int32_t)GYRO_I_MAX << 13);
         ITerm = errorGyroI[axis] >> 13;
 
         //-----calculate D-term
@@ -488,6 +627,13 @@ void setPIDController(int type)
     }
 }
 
+/*
+ * How long before a control iteration is due the acc and gyro reads are started. The MPU6050's 14 byte burst takes
+ * about 0.4ms at 400kHz, so it has normally finished by the time computeIMU() asks for it. If the prefetched sample is
+ * more than twice this old when the iteration starts (a background task ran late), it's read again.
+ */
+#define SENSOR_PREFETCH_LEAD_MICROS 500
+
 void loop(void)
 {
     static uint8_t rcDelayCommand;      // this indicates the number of time (multiple of RC measurement at 50Hz) the sticks must be maintained to run or switch off motors
@@ -499,12 +645,15 @@ void loop(void)
     static int16_t initialThrottleHold;
 #endif
     static uint32_t loopTime;
+    static bool sensorsPrefetched;
+    static uint32_t prefetchTime, prefetchCycles;
     uint16_t auxState = 0;
 #ifdef GPS
     static uint8_t GPSNavReset = 1;
 #endif
     bool isThrottleLow = false;
     bool rcReady = false;
+    uint32_t loopStart, stageStart;
 
     // calculate rc stuff from serial-based receivers (spek/sbus)
     if (feature(FEATURE_SERIALRX)) {
@@ -662,11 +811,12 @@ void loop(void)
                 else if (mcfg.retarded_arm && cfg.activate[BOXARM] == 0 && (rcSticks == THR_LO + YAW_CE + PIT_CE + ROL_HI))
                     mwArm();
                 // Calibrating Acc
-                else if (rcSticks == THR_HI + YAW_LO + PIT_LO + ROL_CE)
+                else if (rcSticks == THR_HI + YAW_LO + PIT_LO + ROL_CE) {
                     calibratingA = CALIBRATING_ACC_CYCLES;
                 // Calibrating Mag
-                else if (rcSticks == THR_HI + YAW_HI + PIT_LO + ROL_CE)
+                } else if (rcSticks == THR_HI + YAW_HI + PIT_LO + ROL_CE) {
                     f.CALIBRATE_MAG = 1;
+                }
                 i = 0;
                 // Acc Trim
                 if (rcSticks == THR_HI + YAW_CE + PIT_HI + ROL_CE) {
@@ -692,11 +842,14 @@ void loop(void)
         if (feature(FEATURE_INFLIGHT_ACC_CAL)) {
             if (AccInflightCalibrationArmed && f.ARMED && rcData[THROTTLE] > mcfg.mincheck && !rcOptions[BOXARM]) {   // Copter is airborne and you are turning it off via boxarm : start measurement
                 InflightcalibratingA = 50;
+                blackboxLogEvent(FLIGHT_LOG_EVENT_CALIBRATION, FLIGHT_LOG_CALIBRATION_INFLIGHT_ACC);
                 AccInflightCalibrationArmed = false;
             }
             if (rcOptions[BOXCALIB]) {      // Use the Calib Option to activate : Calib = TRUE Meausrement started, Land and Calib = 0 measurement stored
-                if (!AccInflightCalibrationActive && !AccInflightCalibrationMeasurementDone)
+                if (!AccInflightCalibrationActive && !AccInflightCalibrationMeasurementDone) {
                     InflightcalibratingA = 50;
+                    blackboxLogEvent(FLIGHT_LOG_EVENT_CALIBRATION, FLIGHT_LOG_CALIBRATION_INFLIGHT_ACC);
+                }
                 AccInflightCalibrationActive = true;
             } else if (AccInflightCalibrationMeasurementDone && !f.ARMED) {
                 AccInflightCalibrationMeasurementDone = false;
@@ -865,6 +1018,8 @@ void loop(void)
                 }
             }
         }
+
+        logFlightStateChanges();
         // When armed and motors aren't spinning. Make warning beeps so that accidentally won't lose fingers...
         // Also disarm board after 5 sec so users without buzzer won't lose fingers.
         if (feature(FEATURE_MOTOR_STOP) && f.ARMED && !f.FIXED_WING) {
@@ -878,61 +1033,54 @@ void loop(void)
                 disarmTime = 0;
         }
     } else {                        // not in rc loop
-        static int taskOrder = 0;   // never call all function in the same loop, to avoid high delay spikes
-        switch (taskOrder) {
-        case 0:
-            taskOrder++;
-#ifdef MAG
-            if (sensors(SENSOR_MAG) && Mag_getADC())
-                break;
-#endif
-        case 1:
-            taskOrder++;
-#ifdef BARO
-            if (sensors(SENSOR_BARO) && Baro_update())
-                break;
-#endif
-        case 2:
-            taskOrder++;
-#ifdef BARO
-            if (sensors(SENSOR_BARO) && getEstimatedAltitude())
-                break;
-#endif
-        case 3:
-            // if GPS feature is enabled, gpsThread() will be called at some intervals to check for stuck
-            // hardware, wrong baud rates, init GPS if needed, etc. Don't use SENSOR_GPS here as gpsThread() can and will
-            // change this based on available hardware
-            taskOrder++;
-#ifdef GPS
-            if (feature(FEATURE_GPS)) {
-                gpsThread();
-                break;
-            }
-#endif
-        case 4:
-            taskOrder = 0;
-#ifdef SONAR
-            if (sensors(SENSOR_SONAR)) {
-                Sonar_update();
-            }
-#endif
-            if (feature(FEATURE_VARIO) && f.VARIO_MODE)
-                mwVario();
-            break;
-        }
+        // Run one background task, if there's one that fits in the time left before the next control iteration
+        schedulerRun(mcfg.looptime != 0 && loopTime != 0, loopTime);
     }
 
     currentTime = micros();
+
+    // Start reading the sensors shortly before the next iteration, so the wait overlaps the time we'd idle anyway
+    if (mcfg.looptime != 0 && loopTime != 0 && !sensorsPrefetched
+            && (int32_t)(currentTime - (loopTime - SENSOR_PREFETCH_LEAD_MICROS)) >= 0) {
+        sensorsPrefetch();
+        sensorsPrefetched = true;
+        prefetchTime = currentTime;
+        prefetchCycles = DWT_CYCCNT;
+    }
+
     if (mcfg.looptime == 0 || (int32_t)(currentTime - loopTime) >= 0) {
+        if (mcfg.looptime != 0 && loopTime != 0) {
+            uint32_t lateness = currentTime - loopTime;
+
+            // The next iteration is scheduled from now, so any whole looptimes we're late by are iterations we lost
+            loopOverrunCount += lateness / mcfg.looptime;
+            loopMaxJitter = max(loopMaxJitter, min(lateness, 0xFFFF));
+        }
         loopTime = currentTime + mcfg.looptime;
 
+        if (sensorsPrefetched) {
+            // Don't fly on a sample that sat around while a background task overran
+            if (currentTime - prefetchTime > 2 * SENSOR_PREFETCH_LEAD_MICROS) {
+                sensorsPrefetch();
+                prefetchCycles = DWT_CYCCNT;
+            }
+            sensorsPrefetched = false;
+
+            // How long ago the sensor readings this iteration runs on were asked for
+            perfRecord(PERF_STAGE_SENSOR_AGE, prefetchCycles);
+        }
+
+        loopStart = DWT_CYCCNT;
         computeIMU();
+        stageStart = perfRecord(PERF_STAGE_IMU, loopStart);
         // Measure loop rate just afer reading the sensors
         currentTime = micros();
         cycleTime = (int32_t)(currentTime - previousTime);
         previousTime = currentTime;
         // non IMU critical, temeperatur, serialcom
+        stageStart = DWT_CYCCNT;
         annexCode();
+        perfRecord(PERF_STAGE_ANNEX, stageStart);
 #ifdef MAG
         if (sensors(SENSOR_MAG)) {
             if (abs(rcCommand[YAW]) < 70 && f.MAG_MODE) {
@@ -1021,13 +1169,21 @@ void loop(void)
 #endif
 
         // PID - note this is function pointer set by setPIDController()
+        stageStart = DWT_CYCCNT;
         pid_controller();
+        stageStart = perfRecord(PERF_STAGE_PID, stageStart);
 
         mixTable();
         writeServos();
+        stageStart = perfRecord(PERF_STAGE_MIXER, stageStart);
         writeMotors();
+        stageStart = perfRecord(PERF_STAGE_MOTORS, stageStart);
+
+        if (feature(FEATURE_BLACKBOX) && (!cliMode || blackboxIsShuttingDown())) {
+            handleBlackbox();
+            perfRecord(PERF_STAGE_BLACKBOX, stageStart);
+        }
 
-        if (!cliMode && feature(FEATURE_BLACKBOX))
-        	handleBlackbox();
+        perfRecord(PERF_STAGE_LOOP, loopStart);
     }
 }
@@ -393,6 +393,17 @@ typedef struct master_t {
     // blackbox settings
     uint8_t blackbox_rate_num;              // Together with the denom, chooses fraction of loop iterations to record
     uint8_t blackbox_rate_denom;            //
+    uint8_t blackbox_device;                // Where to log to, see BlackboxDevice enum in blackbox.h
+    uint16_t blackbox_i_interval;           // Loop iterations between keyframes (I-frames)
+    uint8_t blackbox_i_threshold;           // P-frames bigger than this many bytes are sent as keyframes instead, 0 to always keep to blackbox_i_interval
+    uint16_t blackbox_i_max_interval;       // With blackbox_i_threshold set, how far keyframes may be spread out while flight is smooth
+    uint16_t blackbox_slow_interval;        // Loop iterations between slow frames (battery, current, RSSI, mag and baro)
+    uint8_t blackbox_compression;           // 1 to Huffman code the logged frames in blocks, 0 to write them as they are
+    uint8_t blackbox_frame_check;           // 1 to end each logged frame with a CRC so decoders can spot damaged ones
+    uint32_t blackbox_baudrate;             // Baud rate of a serial logger, 0 to agree on the fastest one it supports
+    uint8_t blackbox_prearm_interval;       // Iterations between frames kept while disarmed to log ahead of an arm, 0 = off
+    uint16_t blackbox_capture_window;       // Iterations logged at full rate after a capture trigger fires, 0 = off
+    uint16_t blackbox_capture_gyro;         // Change in gyroData between iterations that triggers a capture, 0 = off
 
     uint8_t magic_ef;                       // magic number, should be 0xEF
     uint8_t chk;                            // XOR checksum
@@ -430,6 +441,7 @@ typedef struct flags_t {
     uint8_t VARIO_MODE;
     uint8_t FIXED_WING;                     // set when in flying_wing or airplane mode. currently used by althold selection code
     uint8_t MOTORS_STOPPED;
+    uint8_t MOTOR_LIMIT_REACHED;            // set by mixTable() when the motors had to be pulled back from maxthrottle
     uint8_t FW_FAILSAFE_RTH_ENABLE;
     uint8_t CLIMBOUT_FW;
 } flags_t;
@@ -452,6 +464,8 @@ extern int accSumCount;
 extern uint32_t currentTime;
 extern uint32_t previousTime;
 extern uint16_t cycleTime;
+extern uint32_t loopOverrunCount;
+extern uint16_t loopMaxJitter;
 extern uint16_t calibratingA;
 extern uint16_t calibratingB;
 extern uint16_t calibratingG;
@@ -514,6 +528,7 @@ extern baro_t baro;
 
 // main
 void setPIDController(int type);
+void loopInit(void);
 void loop(void);
 
 // IMU
@@ -533,6 +548,7 @@ int Baro_update(void);
 void Gyro_getADC(void);
 void Mag_init(void);
 int Mag_getADC(void);
+void sensorsPrefetch(void);
 void Sonar_init(void);
 void Sonar_update(void);
 uint16_t RSSI_getValue(void);
@@ -541,6 +557,7 @@ uint16_t RSSI_getValue(void);
 void mixerInit(void);
 void mixerResetMotors(void);
 void mixerLoadMix(int index);
+const motorMixer_t *mixerGetMotorMix(uint8_t index);
 void servoMixerLoadMix(int index);
 void writeServos(void);
 void writeMotors(void);
@@ -0,0 +1,76 @@
+/*
+ * This file is part of baseflight
+ * Licensed under GPL V3 or modified DCL - see https://github.com/multiwii/baseflight/blob/master/README.md
+ */
+
+#include "board.h"
+#include "perf.h"
+
+/*
+ * Per-stage timing of the main loop using the DWT cycle counter. A stage is timed by grabbing DWT_CYCCNT before it
+ * runs and passing that to perfRecord() afterwards. perfRecord() returns the current count, so back-to-back stages can
+ * be chained without reading the counter twice.
+ */
+
+const char * const perfStageNames[PERF_STAGE_COUNT] = {
+    "loop", "imu", "annex", "serial", "pid", "mixer", "motors", "blackbox",
+    "mag", "baro", "altitude", "gps", "misc", "compress", "iframe", "pframe", "sensorage"
+};
+
+static perfStageStats_t perfStats[PERF_STAGE_COUNT];
+static uint8_t cyclesPerMicro = 1;
+
+void perfInit(void)
+{
+    cyclesPerMicro = SystemCoreClock / 1000000;
+    perfReset();
+}
+
+void perfReset(void)
+{
+    memset(perfStats, 0, sizeof(perfStats));
+}
+
+/**
+ * Add one run of the given stage which started at startCycles and has just finished. Returns the current cycle count.
+ */
+uint32_t perfRecord(perfStage_e stage, uint32_t startCycles)
+{
+    uint32_t now = DWT_CYCCNT;
+    uint32_t cycles = now - startCycles;
+    uint32_t micros = cycles / cyclesPerMicro;
+    perfStageStats_t *stats = &perfStats[stage];
+    int bucket = 0;
+
+    if (stats->count == 0 || cycles < stats->minCycles)
+        stats->minCycles = cycles;
+    if (cycles > stats->maxCycles)
+        stats->maxCycles = cycles;
+    stats->totalCycles += cycles;
+    stats->count++;
+
+    while (bucket < PERF_HISTOGRAM_BUCKETS - 1 && micros >= ((uint32_t)PERF_HISTOGRAM_FIRST_MICROS << bucket))
+        bucket++;
+    if (stats->histogram[bucket] < 0xFFFF)
+        stats->histogram[bucket]++;
+
+    return now;
+}
+
+const perfStageStats_t *perfGetStats(perfStage_e stage)
+{
+    return &perfStats[stage];
+}
+
+uint32_t perfGetAverageCycles(perfStage_e stage)
+{
+    if (perfStats[stage].count == 0)
+        return 0;
+
+    return perfStats[stage].totalCycles / perfStats[stage].count;
+}
+
+uint8_t perfGetCyclesPerMicro(void)
+{
+    return cyclesPerMicro;
+}
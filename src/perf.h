@@ -0,0 +1,51 @@
+/*
+ * This file is part of baseflight
+ * Licensed under GPL V3 or modified DCL - see https://github.com/multiwii/baseflight/blob/master/README.md
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+// Parts of loop() that are timed, keep perfStageNames in perf.c in sync (also the order reported by MSP_PERF)
+typedef enum {
+    PERF_STAGE_LOOP = 0,                    // A whole control loop iteration, computeIMU() through handleBlackbox()
+    PERF_STAGE_IMU,
+    PERF_STAGE_ANNEX,                       // annexCode(), which includes serialCom()
+    PERF_STAGE_SERIAL,
+    PERF_STAGE_PID,
+    PERF_STAGE_MIXER,                       // mixTable() and writeServos()
+    PERF_STAGE_MOTORS,
+    PERF_STAGE_BLACKBOX,
+    PERF_STAGE_TASK_MAG,                    // The scheduler tasks that run between control loop iterations
+    PERF_STAGE_TASK_BARO,
+    PERF_STAGE_TASK_ALTITUDE,
+    PERF_STAGE_TASK_GPS,
+    PERF_STAGE_TASK_MISC,
+    PERF_STAGE_BLACKBOX_COMPRESS,           // Compressing the blackbox frames (part of PERF_STAGE_BLACKBOX)
+    PERF_STAGE_BLACKBOX_IFRAME,             // Encoding one blackbox I-frame (part of PERF_STAGE_BLACKBOX)
+    PERF_STAGE_BLACKBOX_PFRAME,             // Encoding one blackbox P-frame (part of PERF_STAGE_BLACKBOX)
+    PERF_STAGE_SENSOR_AGE,                  // From starting the acc and gyro reads to the iteration that uses them
+    PERF_STAGE_COUNT
+} perfStage_e;
+
+// Bucket 0 counts runs shorter than PERF_HISTOGRAM_FIRST_MICROS, each bucket after that is twice as wide as the last
+#define PERF_HISTOGRAM_BUCKETS      10
+#define PERF_HISTOGRAM_FIRST_MICROS 8
+
+typedef struct perfStageStats_t {
+    uint32_t count;
+    uint32_t minCycles;
+    uint32_t maxCycles;
+    uint64_t totalCycles;
+    uint16_t histogram[PERF_HISTOGRAM_BUCKETS];     // Saturates at 65535
+} perfStageStats_t;
+
+extern const char * const perfStageNames[PERF_STAGE_COUNT];
+
+void perfInit(void);
+void perfReset(void);
+uint32_t perfRecord(perfStage_e stage, uint32_t startCycles);
+const perfStageStats_t *perfGetStats(perfStage_e stage);
+uint32_t perfGetAverageCycles(perfStage_e stage);
+uint8_t perfGetCyclesPerMicro(void);
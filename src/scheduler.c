@@ -0,0 +1,106 @@
+/*
+ * This file is part of baseflight
+ * Licensed under GPL V3 or modified DCL - see https://github.com/multiwii/baseflight/blob/master/README.md
+ */
+
+#include "board.h"
+#include "scheduler.h"
+
+/*
+ * A cooperative scheduler for the work that happens between control loop iterations. Each call runs at most one task
+ * that has something to do, choosing the highest priority task that is due and whose recent execution time fits in the
+ * time left before the next control iteration is due. That way a slow task waits for a longer gap instead of making the
+ * next gyro read late.
+ */
+
+// A task that has been held back for lack of time for this long gets to run even if it doesn't fit in the gap
+#define SCHEDULER_MAX_TASK_DELAY 100000
+
+static task_t *schedulerTasks;
+static int schedulerTaskCount;
+
+/**
+ * Use the given table of tasks, which is sorted into priority order here.
+ */
+void schedulerInit(task_t *tasks, int count)
+{
+    task_t temp;
+    int i, j;
+
+    for (i = 1; i < count; i++) {
+        temp = tasks[i];
+        for (j = i; j > 0 && tasks[j - 1].priority < temp.priority; j--)
+            tasks[j] = tasks[j - 1];
+        tasks[j] = temp;
+    }
+
+    for (i = 0; i < count; i++) {
+        tasks[i].lastRun = micros();
+        tasks[i].waiting = false;
+        tasks[i].executionTime = 0;
+        tasks[i].maxExecutionTime = 0;
+    }
+
+    schedulerTasks = tasks;
+    schedulerTaskCount = count;
+}
+
+/**
+ * Run the most important task that has work to do and fits before deadline (in micros() time). If hasDeadline is false
+ * there's no control iteration to protect and every due task fits.
+ */
+void schedulerRun(bool hasDeadline, uint32_t deadline)
+{
+    uint32_t now = micros();
+    int32_t slack = (int32_t)(deadline - now);
+    uint32_t start, elapsed;
+    task_t *task;
+    bool didWork;
+    int i;
+
+    for (i = 0; i < schedulerTaskCount; i++) {
+        task = &schedulerTasks[i];
+
+        if (now - task->lastRun < task->period)
+            continue;
+
+        if (hasDeadline && (slack < 0 || task->executionTime > (uint32_t)slack)) {
+            if (!task->waiting) {
+                task->waiting = true;
+                task->waitingSince = now;
+            }
+            if (now - task->waitingSince < SCHEDULER_MAX_TASK_DELAY)
+                continue;
+        }
+
+        start = DWT_CYCCNT;
+        didWork = task->fn();
+        elapsed = (DWT_CYCCNT - start) / perfGetCyclesPerMicro();
+        task->waiting = false;
+
+        if (didWork) {
+            perfRecord(task->perfStage, start);
+
+            // Track the worst case, but let it decay so that a one-off spike (e.g. a GPS reconfiguration) is forgotten
+            task->executionTime = max(elapsed, task->executionTime - task->executionTime / 16);
+            task->maxExecutionTime = max(elapsed, task->maxExecutionTime);
+            task->lastRun = now;
+
+            return;
+        }
+
+        // The task wasn't actually due, which only cost us a quick check, so see if another one is
+        now = micros();
+        slack = (int32_t)(deadline - now);
+    }
+}
+
+int schedulerGetTaskCount(void)
+{
+    return schedulerTaskCount;
+}
+
+const task_t *schedulerGetTask(int index)
+{
+    return &schedulerTasks[index];
+}
@@ -0,0 +1,35 @@
+/*
+ * This file is part of baseflight
+ * Licensed under GPL V3 or modified DCL - see https://github.com/multiwii/baseflight/blob/master/README.md
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "perf.h"
+
+// Task body, returns true if it actually had work to do (tasks may keep their own timers and return false until due)
+typedef bool (*taskFuncPtr)(void);
+
+typedef struct task_t {
+    const char *name;
+    taskFuncPtr fn;
+    uint32_t period;                        // Minimum microseconds between runs, 0 to poll the task whenever there's time
+    uint8_t priority;                       // Higher priority tasks get first pick of the spare time
+    perfStage_e perfStage;
+
+    // Maintained by the scheduler
+    uint32_t lastRun;
+    uint32_t waitingSince;                  // When the task was first held back for lack of time, if waiting is set
+    bool waiting;
+    uint32_t executionTime;                 // Recent worst case run time in microseconds, used to decide whether the task fits
+    uint32_t maxExecutionTime;
+} task_t;
+
+void schedulerInit(task_t *tasks, int count);
+void schedulerRun(bool hasDeadline, uint32_t deadline);
+
+int schedulerGetTaskCount(void);
+const task_t *schedulerGetTask(int index);
@@ -71,8 +71,8 @@ retry:
                 accHardware = ACC_ADXL345;
             if (mcfg.acc_hardware == ACC_ADXL345)
                 break;
-            ; // fallthrough
 #endif
+            // fallthrough
         case ACC_MPU6050: // MPU6050
             if (haveMpu6k) {
                 mpu6050Detect(&acc, &gyro, mcfg.gyro_lpf, &core.mpu6050_scale); // yes, i'm rerunning it again.  re-fill acc struct
@@ -80,8 +80,8 @@ retry:
                 if (mcfg.acc_hardware == ACC_MPU6050)
                     break;
             }
-            ; // fallthrough
-#ifdef NAZE
+#ifndef CJMCU
+            // fallthrough
         case ACC_MPU6500: // MPU6500
             if (haveMpu65) {
                 mpu6500Detect(&acc, &gyro, mcfg.gyro_lpf); // yes, i'm rerunning it again.  re-fill acc struct
@@ -89,14 +89,16 @@ retry:
                 if (mcfg.acc_hardware == ACC_MPU6500)
                     break;
             }
-            ; // fallthrough
+#endif
+#ifdef NAZE
+            // fallthrough
         case ACC_MMA8452: // MMA8452
             if (mma8452Detect(&acc)) {
                 accHardware = ACC_MMA8452;
                 if (mcfg.acc_hardware == ACC_MMA8452)
                     break;
             }
-            ; // fallthrough
+            // fallthrough
         case ACC_BMA280: // BMA280
             if (bma280Detect(&acc)) {
                 accHardware = ACC_BMA280;
@@ -151,9 +153,9 @@ retry:
               if (mcfg.mag_hardware == MAG_HMC5883L)
                 break;
           }
-        ; // fallthrough
-          
+
 #ifdef NAZE
+            // fallthrough
         case MAG_AK8975:
             if (ak8975detect(&mag)) {
                 magHardware = MAG_AK8975;
@@ -354,6 +356,7 @@ int Baro_update(void)
 {
     static uint32_t baroDeadline = 0;
     static int state = 0;
+    static bool pressureRead = false;
 
     if ((int32_t)(currentTime - baroDeadline) < 0)
         return 0;
@@ -364,16 +367,19 @@ int Baro_update(void)
         baro.get_up();
         baro.start_ut();
         baroDeadline += baro.ut_delay;
-        baro.calculate(&baroPressure, &baroTemperature);
+        pressureRead = true;
         state = 0;
-        return 2;
+        return 1;
     } else {
+        // get_up() may only have queued its read, which has certainly landed by now, so this is the time to use it
+        if (pressureRead)
+            baro.calculate(&baroPressure, &baroTemperature);
         baro.get_ut();
         baro.start_up();
         Baro_Common();
         state = 1;
         baroDeadline += baro.up_delay;
-        return 1;
+        return 2;
     }
 }
 #endif /* BARO */
@@ -462,6 +468,7 @@ void Gyro_getADC(void)
 
 #ifdef MAG
 static uint8_t magInit = 0;
+static uint32_t magDeadline = 0;    // when Mag_getADC() will next read the sensor
 
 void Mag_init(void)
 {
@@ -474,20 +481,20 @@ void Mag_init(void)
 
 int Mag_getADC(void)
 {
-    static uint32_t t, tCal = 0;
+    static uint32_t tCal = 0;
     static int16_t magZeroTempMin[3];
     static int16_t magZeroTempMax[3];
     uint32_t axis;
 
-    if ((int32_t)(currentTime - t) < 0)
+    if ((int32_t)(currentTime - magDeadline) < 0)
         return 0;                 //each read is spaced by 100ms
-    t = currentTime + 100000;
+    magDeadline = currentTime + 100000;
 
     // Read mag sensor
     mag.read(magADC);
 
     if (f.CALIBRATE_MAG) {
-        tCal = t;
+        tCal = magDeadline;
         for (axis = 0; axis < 3; axis++) {
             mcfg.magZero[axis] = 0;
             magZeroTempMin[axis] = magADC[axis];
@@ -503,7 +510,7 @@ int Mag_getADC(void)
     }
 
     if (tCal != 0) {
-        if ((t - tCal) < 30000000) {    // 30s: you have 30s to turn the multi in all directions
+        if ((magDeadline - tCal) < 30000000) {    // 30s: you have 30s to turn the multi in all directions
             LED0_TOGGLE;
             for (axis = 0; axis < 3; axis++) {
                 if (magADC[axis] < magZeroTempMin[axis])
@@ -523,6 +530,24 @@ int Mag_getADC(void)
 }
 #endif
 
+/*
+ * Called from loop() shortly before each control loop iteration is due (see SENSOR_PREFETCH_LEAD_MICROS) to start the
+ * sensor reads that the iteration is going to need, so they complete in the background instead of being waited for.
+ * Starting them any earlier would leave the PID loop flying on an older sample than a direct read would give it.
+ */
+void sensorsPrefetch(void)
+{
+    if (gyro.prefetch)
+        gyro.prefetch();
+    // The acc and gyro are often the same chip, read with the same prefetch
+    if (sensors(SENSOR_ACC) && acc.prefetch && acc.prefetch != gyro.prefetch)
+        acc.prefetch();
+#ifdef MAG
+    if (sensors(SENSOR_MAG) && mag.prefetch && (int32_t)(currentTime - magDeadline) >= 0)
+        mag.prefetch();
+#endif
+}
+
 #ifdef SONAR
 
 void Sonar_init(void)
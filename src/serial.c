@@ -8,6 +8,10 @@
 
 #include "cli.h"
 #include "telemetry_common.h"
+#include "flashfs.h"
+#include "perf.h"
+#include "blackbox.h"
+#include "blackbox_fielddefs.h"
 
 // Multiwii Serial Protocol 0
 #define MSP_VERSION              0
@@ -76,8 +80,17 @@
 #define MSP_SET_CONFIG           67     //in message          baseflight-specific settings save
 #define MSP_REBOOT               68     //in message          reboot settings
 #define MSP_BUILDINFO            69     //out message         build date as well as some space for future expansion
+#define MSP_DATAFLASH_SUMMARY    70     //out message         flash chip ready flag, sector count, total and used size
+#define MSP_DATAFLASH_READ       71     //out message         read a chunk of flash, address is in the payload
+#define MSP_DATAFLASH_ERASE      72     //in message          erase all the log data on the flash chip
+#define MSP_PERF                 73     //out message         loop timing stats for one stage, stage index is in the payload
+#define MSP_PERF_RESET           74     //in message          clear the loop timing stats
+
+// Largest chunk of flash returned by one MSP_DATAFLASH_READ
+#define DATAFLASH_READ_CHUNK_SIZE 128
 
 #define INBUF_SIZE 64
+#define OUTBUF_SIZE 64
 
 typedef struct box_t {
     const uint8_t boxIndex;         // this is from boxnames enum
@@ -152,6 +165,9 @@ typedef  struct mspPortState_t {
     uint8_t offset;
     uint8_t dataSize;
     serialState_t c_state;
+    uint8_t outBuf[OUTBUF_SIZE];    // reply bytes the port hasn't taken yet
+    uint8_t outBufPos;
+    bool replyDropped;              // the reply being built didn't fit, so none of it is sent
 } mspPortState_t;
 
 static mspPortState_t ports[2];
@@ -161,10 +177,34 @@ static int numTelemetryPorts = 0;
 // static uint8_t checksum, indRX, inBuf[INBUF_SIZE];
 // static uint8_t cmdMSP;
 
+// outgoing reply is collected in the port's outBuf and pushed to the port in bulk rather than byte by byte
+static void serialFlushReply(void)
+{
+    mspPortState_t *s = currentPortState;
+    uint8_t written;
+
+    if (s->outBufPos == 0)
+        return;
+
+    // Whatever the transmitter has no room for yet is kept for the next call rather than waited for
+    written = serialWriteBuf(s->port, s->outBuf, s->outBufPos);
+    memmove(s->outBuf, s->outBuf + written, s->outBufPos - written);
+    s->outBufPos -= written;
+}
+
 void serialize8(uint8_t a)
 {
-    serialWrite(currentPortState->port, a);
-    currentPortState->checksum ^= a;
+    mspPortState_t *s = currentPortState;
+
+    if (s->replyDropped)
+        return;
+
+    if (s->outBufPos == OUTBUF_SIZE)
+        serialFlushReply();
+    // headSerialResponse() made sure the whole reply fits, so this only fails on a reply longer than it announced
+    if (s->outBufPos < OUTBUF_SIZE)
+        s->outBuf[s->outBufPos++] = a;
+    s->checksum ^= a;
 }
 
 void serialize32(uint32_t a)
@@ -202,6 +242,17 @@ uint32_t read32(void)
 
 void headSerialResponse(uint8_t err, uint8_t s)
 {
+    mspPortState_t *state = currentPortState;
+
+    /*
+     * The header announces the length, so a reply that lost bytes on the way would throw the other end out of sync with
+     * the replies after it. If the transmitter and outBuf can't take all of it (header, payload and checksum), send
+     * none of it and let the other end time out and ask again.
+     */
+    state->replyDropped = serialTxBytesFree(state->port) + (OUTBUF_SIZE - state->outBufPos) < 6u + s;
+    if (state->replyDropped)
+        return;
+
     serialize8('$');
     serialize8('M');
     serialize8(err ? '!' : '>');
@@ -223,6 +274,8 @@ void headSerialError(uint8_t s)
 void tailSerialReply(void)
 {
     serialize8(currentPortState->checksum);
+    currentPortState->replyDropped = false;
+    serialFlushReply();
 }
 
 void s_struct(uint8_t *cb, uint8_t siz)
@@ -271,12 +324,14 @@ void serialInit(uint32_t baudrate)
     numTelemetryPorts = 0;
     core.mainport = uartOpen(USART1, NULL, baudrate, MODE_RXTX);
     ports[0].port = core.mainport;
+    ports[0].outBufPos = 0;
     numTelemetryPorts++;
 
     // additional telemetry port available only if spektrum sat isn't already assigned there
     if (hw_revision >= NAZE32_SP  && !mcfg.spektrum_sat_on_flexport) {
         core.flexport = uartOpen(USART3, NULL, baudrate, MODE_RXTX);
         ports[1].port = core.flexport;
+        ports[1].outBufPos = 0;
         numTelemetryPorts++;
     }
 
@@ -428,6 +483,7 @@ static void evaluateCommand(void)
     int32_t lat = 0, lon = 0, alt = 0;
 #endif
     const char *build = __DATE__;
+    bool settingsChanged = false;   // settings can be changed in flight, so these go in the blackbox log
 
     switch (currentPortState->cmdMSP) {
     case MSP_SET_RAW_RC:
@@ -439,6 +495,7 @@ static void evaluateCommand(void)
     case MSP_SET_ACC_TRIM:
         cfg.angleTrim[PITCH] = read16();
         cfg.angleTrim[ROLL]  = read16();
+        settingsChanged = true;
         headSerialReply(0);
         break;
 #ifdef GPS
@@ -459,11 +516,13 @@ static void evaluateCommand(void)
             cfg.I8[i] = read8();
             cfg.D8[i] = read8();
         }
+        settingsChanged = true;
         headSerialReply(0);
         break;
     case MSP_SET_BOX:
         for (i = 0; i < numberBoxItems; i++)
             cfg.activate[availableBoxes[i]] = read16();
+        settingsChanged = true;
         headSerialReply(0);
         break;
     case MSP_SET_RC_TUNING:
@@ -474,6 +533,7 @@ static void evaluateCommand(void)
         cfg.dynThrPID = read8();
         cfg.thrMid8 = read8();
         cfg.thrExpo8 = read8();
+        settingsChanged = true;
         headSerialReply(0);
         break;
     case MSP_SET_MISC:
@@ -496,6 +556,7 @@ static void evaluateCommand(void)
         mcfg.vbatmincellvoltage = read8();  // vbatlevel_warn1 in MWC2.3 GUI
         mcfg.vbatmaxcellvoltage = read8();  // vbatlevel_warn2 in MWC2.3 GUI
         mcfg.vbatwarningcellvoltage = read8(); // vbatlevel when buzzer starts to alert
+        settingsChanged = true;
         headSerialReply(0);
         break;
     case MSP_SET_MOTOR:
@@ -510,6 +571,7 @@ static void evaluateCommand(void)
                 mcfg.current_profile = 0;
             // this writes new profile index and re-reads it
             writeEEPROM(0, false);
+            settingsChanged = true;
         }
         headSerialReply(0);
         break;
@@ -636,6 +698,7 @@ static void evaluateCommand(void)
                     break;
             }
         }
+        settingsChanged = true;
         break;
     case MSP_MOTOR:
         s_struct((uint8_t *)motor, 16);
@@ -794,8 +857,10 @@ static void evaluateCommand(void)
         break;
 #endif /* GPS */
     case MSP_RESET_CONF:
-        if (!f.ARMED)
+        if (!f.ARMED) {
             checkFirstTime(true);
+            settingsChanged = true;
+        }
         headSerialReply(0);
         break;
     case MSP_ACC_CALIBRATION:
@@ -859,6 +924,7 @@ static void evaluateCommand(void)
         mcfg.currentscale = read16();
         mcfg.currentoffset = read16();
         /// ???
+        settingsChanged = true;
         break;
     case MSP_CONFIG:
         headSerialReply(1 + 4 + 1 + 2 + 2 + 2 + 4);
@@ -882,6 +948,7 @@ static void evaluateCommand(void)
         headSerialReply(0);
         for (i = 0; i < MAX_INPUTS; i++)
             mcfg.rcmap[i] = read8();
+        settingsChanged = true;
         break;
 
     case MSP_REBOOT:
@@ -897,10 +964,79 @@ static void evaluateCommand(void)
         serialize32(0); // future exp
         break;
 
+#ifdef FLASHFS
+    case MSP_DATAFLASH_SUMMARY:
+        headSerialReply(1 + 4 + 4 + 4);
+        serialize8((flashfsIsSupported() ? 2 : 0) | (flashfsIsReady() ? 1 : 0));
+        serialize32(m25p16GetGeometry()->sectors);
+        serialize32(flashfsGetSize());
+        serialize32(flashfsGetOffset());
+        break;
+    case MSP_DATAFLASH_READ:
+        {
+            uint32_t address = read32();
+            uint8_t chunk[DATAFLASH_READ_CHUNK_SIZE];
+            uint32_t bytesRead;
+
+            if (f.ARMED) {
+                headSerialError(0);
+                break;
+            }
+
+            bytesRead = flashfsReadAbs(address, chunk, sizeof(chunk));
+            headSerialReply(4 + bytesRead);
+            serialize32(address);
+            for (i = 0; i < bytesRead; i++)
+                serialize8(chunk[i]);
+        }
+        break;
+    case MSP_DATAFLASH_ERASE:
+        if (f.ARMED) {
+            headSerialError(0);
+        } else {
+            flashfsErase();
+            headSerialReply(0);
+        }
+        break;
+#endif
+
+    case MSP_PERF:
+        {
+            uint8_t stage = currentPortState->dataSize > 0 ? read8() : 0;
+            const perfStageStats_t *stats;
+
+            if (stage >= PERF_STAGE_COUNT) {
+                headSerialError(0);
+                break;
+            }
+
+            stats = perfGetStats(stage);
+            headSerialReply(4 + 16 + PERF_HISTOGRAM_BUCKETS * 2);
+            serialize8(PERF_STAGE_COUNT);
+            serialize8(PERF_HISTOGRAM_BUCKETS);
+            serialize8(stage);
+            serialize8(perfGetCyclesPerMicro());
+            serialize32(stats->count);
+            serialize32(stats->minCycles);
+            serialize32(perfGetAverageCycles(stage));
+            serialize32(stats->maxCycles);
+            for (i = 0; i < PERF_HISTOGRAM_BUCKETS; i++)
+                serialize16(stats->histogram[i]);
+        }
+        break;
+    case MSP_PERF_RESET:
+        perfReset();
+        headSerialReply(0);
+        break;
+
     default:                   // we do not know how to handle the (valid) message, indicate error MSP $M!
         headSerialError(0);
         break;
     }
+
+    if (settingsChanged)
+        blackboxLogEvent(FLIGHT_LOG_EVENT_CONFIG_CHANGE, currentPortState->cmdMSP);
+
     tailSerialReply();
 }
 
@@ -930,6 +1066,15 @@ void serialCom(void)
         if (pendReboot)
             systemReset(false); // noreturn
 
+        // The blackbox is reading its logger's replies from the main port, they aren't MSP
+        if (currentPortState->port == core.mainport && blackboxIsNegotiating())
+            continue;
+
+        // Send what's left of the last reply, new commands wait in the receive buffer until it's all out
+        serialFlushReply();
+        if (currentPortState->outBufPos > 0)
+            continue;
+
         while (serialTotalBytesWaiting(currentPortState->port)) {
             c = serialRead(currentPortState->port);
 
@@ -964,6 +1109,9 @@ void serialCom(void)
                     evaluateCommand();      // we got a valid packet, evaluate it
                 }
                 currentPortState->c_state = IDLE;
+                if (currentPortState->outBufPos > 0)
+                    break;
+
             }
         }
     }
@@ -0,0 +1,266 @@
+/*
+ * This file is part of baseflight
+ * Licensed under GPL V3 or modified DCL - see https://github.com/multiwii/baseflight/blob/master/README.md
+ */
+
+#include "board.h"
+#include "flashfs.h"
+
+/*
+ * Host test of flashfs.c and drv_m25p16.c against the simulated M25P16 of the SITL build. Every test writes a known
+ * pattern through flashfsWrite() and reads it back with flashfsReadAbs(), so data that was lost, duplicated or programmed
+ * to the wrong page shows up as a mismatch. Run it with 'make TARGET=SITL test', it exits non-zero on any failure.
+ */
+
+#define CHIP_SIZE (2 * 1024 * 1024)
+#define SECTOR_SIZE (64 * 1024)
+
+#define ARRAY_LENGTH(x) (sizeof(x) / sizeof((x)[0]))
+
+static int failures;
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, __func__, #condition); \
+        failures++; \
+    } \
+} while (0)
+
+// The byte the tests store at address, which repeats neither every page nor every sector
+static uint8_t pattern(uint32_t address, uint8_t seed)
+{
+    return (uint8_t)((address * 7 + address / 251 + seed) ^ (address >> 16));
+}
+
+static void fillPattern(uint8_t *buffer, uint32_t address, unsigned int length, uint8_t seed)
+{
+    unsigned int i;
+
+    for (i = 0; i < length; i++)
+        buffer[i] = pattern(address + i, seed);
+}
+
+// Read [address..address + length) back in reads of readSize bytes and check it holds the pattern
+static bool readbackMatches(uint32_t address, uint32_t length, unsigned int readSize, uint8_t seed)
+{
+    uint8_t buffer[1024];
+    uint32_t end = address + length;
+    int count, i;
+
+    while (address < end) {
+        count = flashfsReadAbs(address, buffer, min(readSize, end - address));
+        if (count <= 0)
+            return false;
+
+        for (i = 0; i < count; i++)
+            if (buffer[i] != pattern(address + i, seed))
+                return false;
+
+        address += count;
+    }
+
+    return true;
+}
+
+// Erase the chip through flashfs, running flashfsProcess() as the disarmed main loop would until it's done
+static void eraseAll(void)
+{
+    flashfsErase();
+
+    while (!flashfsIsReady()) {
+        flashfsProcess();
+        sitlAdvanceTime(1000);
+    }
+}
+
+/**
+ * Writes of all sizes, landing at every alignment to the pages, must come back as written, whichever page boundaries
+ * the reads cross.
+ */
+static void testPageBoundaries(void)
+{
+    static const unsigned int writeSizes[] = { 1, 255, 256, 257, 3, 511, 100, 512, 17, 700, 256, 2 };
+    static const unsigned int readSizes[] = { 1, 13, 255, 256, 257, 1000 };
+    uint8_t data[1024];
+    uint32_t length = 0;
+    unsigned int i, j;
+
+    eraseAll();
+    CHECK(flashfsGetOffset() == 0);
+
+    for (j = 0; j < 4; j++) {
+        for (i = 0; i < ARRAY_LENGTH(writeSizes); i++) {
+            fillPattern(data, length, writeSizes[i], 1);
+            CHECK(flashfsWrite(data, writeSizes[i]) == writeSizes[i]);
+            length += writeSizes[i];
+        }
+    }
+    CHECK(flashfsGetOffset() == length);
+
+    flashfsFlushSync();
+
+    for (i = 0; i < ARRAY_LENGTH(readSizes); i++)
+        CHECK(readbackMatches(0, length, readSizes[i], 1));
+
+    // Reads that start mid-page and stop short of the end of the data
+    CHECK(readbackMatches(255, 2, 2, 1));
+    CHECK(readbackMatches(1000, length - 2000, 777, 1));
+
+    // Nothing past the end of the data can be read
+    CHECK(flashfsReadAbs(length, data, 1) == 0);
+    CHECK(flashfsReadAbs(length - 10, data, 100) == 10);
+
+    // After a reset the log carries on at the end of the data, rounded up to the block searched for free space
+    flashfsInit();
+    CHECK(flashfsIsSupported());
+    CHECK(flashfsGetOffset() == (length + 15) / 16 * 16);
+    CHECK(readbackMatches(0, length, 256, 1));
+}
+
+/**
+ * Feed the log as the blackbox does from the control loop: only ever as much as flashfsGetWriteBufferFreeSpace()
+ * allows, with flashfsFlushAsync() programming pages in the background while time passes.
+ */
+static void testAsyncFlush(void)
+{
+    uint8_t data[FLASHFS_WRITE_BUFFER_SIZE];
+    uint32_t length = 0, total = 3 * SECTOR_SIZE / 2, count;
+    unsigned int iteration = 0;
+
+    eraseAll();
+
+    while (length < total) {
+        // Vary the chunk size so the writes don't line up with the pages
+        count = min(min(flashfsGetWriteBufferFreeSpace(), 1 + (iteration * 53) % 200), total - length);
+
+        fillPattern(data, length, count, 2);
+        CHECK(flashfsWrite(data, count) == count);
+        length += count;
+
+        // And the time between them, so the chip is sometimes still busy and sometimes long done
+        flashfsFlushAsync();
+        sitlAdvanceTime(20 + (iteration * 89) % 1200);
+        iteration++;
+    }
+
+    flashfsFlushSync();
+
+    CHECK(flashfsGetOffset() == total);
+    CHECK(readbackMatches(0, total, 1024, 2));
+}
+
+/**
+ * Data that would run off the end of the chip is dropped, and flashfsWrite() says how much of it was kept.
+ */
+static void testEndOfChip(void)
+{
+    uint8_t data[1024];
+    uint32_t length = 0, count;
+
+    eraseAll();
+    CHECK(flashfsGetSize() == CHIP_SIZE);
+
+    while (length < CHIP_SIZE - 100) {
+        count = min(sizeof(data), CHIP_SIZE - 100 - length);
+
+        fillPattern(data, length, count, 3);
+        CHECK(flashfsWrite(data, count) == count);
+        length += count;
+    }
+    CHECK(!flashfsIsEOF());
+
+    fillPattern(data, length, 300, 3);
+    CHECK(flashfsWrite(data, 300) == 100);
+    CHECK(flashfsIsEOF());
+    CHECK(flashfsGetOffset() == CHIP_SIZE);
+
+    CHECK(flashfsWrite(data, 1) == 0);
+    CHECK(flashfsGetWriteBufferFreeSpace() == 0);
+
+    flashfsFlushSync();
+
+    CHECK(readbackMatches(CHIP_SIZE - 5000, 5000, 1000, 3));
+    CHECK(readbackMatches(0, CHIP_SIZE, 1024, 3));
+
+    // A full chip is found full again after a reset
+    flashfsInit();
+    CHECK(flashfsIsEOF());
+}
+
+/**
+ * While an erase is in progress nothing can be written or read, and once it's done the log starts again from the
+ * beginning of a blank chip.
+ */
+static void testEraseInProgress(void)
+{
+    uint8_t data[1024];
+    uint32_t length = 0, written = 3 * SECTOR_SIZE + 1000;
+    int i;
+
+    eraseAll();
+
+    while (length < written) {
+        fillPattern(data, length, min(sizeof(data), written - length), 4);
+        length += flashfsWrite(data, min(sizeof(data), written - length));
+    }
+    flashfsFlushSync();
+
+    flashfsErase();
+    CHECK(!flashfsIsReady());
+    CHECK(flashfsGetOffset() == 0);
+    CHECK(flashfsGetWriteBufferFreeSpace() == 0);
+    CHECK(flashfsWrite(data, 10) == 0);
+    CHECK(flashfsReadAbs(0, data, 10) == 0);
+
+    // Start the first sector erase, which keeps the chip busy
+    flashfsProcess();
+    sitlAdvanceTime(1000);
+    CHECK(!flashfsIsReady());
+    CHECK(flashfsWrite(data, 10) == 0);
+
+    while (!flashfsIsReady()) {
+        flashfsProcess();
+        sitlAdvanceTime(1000);
+    }
+
+    // Every sector that held data must be blank, so the log starts over at 0 after a reset too
+    flashfsInit();
+    CHECK(flashfsGetOffset() == 0);
+
+    fillPattern(data, 0, 10, 5);
+    CHECK(flashfsWrite(data, 10) == 10);
+    flashfsFlushSync();
+    CHECK(readbackMatches(0, 10, 10, 5));
+    CHECK(flashfsReadAbs(0, data, sizeof(data)) == 10);
+
+    // The old data past the new log must be gone as well
+    for (i = 0; i < 4; i++) {
+        CHECK(m25p16ReadBytes(SECTOR_SIZE * i + 4000, data, 16) == 16);
+        CHECK(data[0] == 0xFF && data[15] == 0xFF);
+    }
+}
+
+int main(void)
+{
+    sitlSpiFlashLoad(NULL);
+
+    CHECK(spiInit() == SPI_DEVICE_FLASH);
+    flashfsInit();
+    CHECK(flashfsIsSupported());
+
+    testPageBoundaries();
+    testAsyncFlush();
+    testEndOfChip();
+    testEraseInProgress();
+
+    // The simulated chip reports anything the driver did that the real one would silently ignore
+    CHECK(sitlSpiFlashComplaints() == 0);
+
+    if (failures > 0) {
+        fprintf(stderr, "flashfs_test: %d checks failed\n", failures);
+        return 1;
+    }
+
+    fprintf(stdout, "flashfs_test: all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,43 @@
+/*
+ * This file is part of baseflight
+ * Licensed under GPL V3 or modified DCL - see https://github.com/multiwii/baseflight/blob/master/README.md
+ */
+#pragma once
+
+// Software-in-the-loop simulation of the hardware, used in place of the drv_* layer by the SITL target
+
+// The simulated core clock, DWT_CYCCNT counts at this rate
+#define SITL_CYCLES_PER_MICRO 72
+
+#define SITL_SERIAL_PORTS 3
+
+// Simulated clock
+void sitlAdvanceTime(uint32_t us);
+void sitlUseHostCycleCounter(bool enable);
+
+// Simulated flash, addresses are the ones the firmware would use on the chip
+const void *sitlFlashPointer(uint32_t address);
+bool sitlFlashLoad(const char *filename);
+
+// Simulated M25P16 on SPI2, for the blackbox's flash device
+bool sitlSpiFlashLoad(const char *filename);
+int sitlSpiFlashComplaints(void);
+
+// Simulated UARTs, index 0 is USART1. input may be -1 and output may be NULL when unused
+void sitlSerialAttach(int index, int input, FILE *output);
+void sitlSerialProcess(void);
+void sitlSerialEmulateLogger(int index, uint32_t maxBaudRate);
+void sitlSerialThrottle(int index, bool enable);
+
+// Sensor and RC trace replay
+bool sitlTraceOpen(const char *filename);
+void sitlTraceUpdate(void);
+void sitlSetRC(uint8_t channel, uint16_t value);
+
+// Simulated motor and servo outputs
+uint16_t sitlGetMotor(uint8_t index);
+uint16_t sitlGetServo(uint8_t index);
+
+// Called by the blackbox for every main frame that makes it into the log, with the values that were encoded
+struct blackboxValues_t;
+void sitlBlackboxFrameLogged(uint32_t iteration, const struct blackboxValues_t *values);
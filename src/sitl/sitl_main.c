@@ -0,0 +1,378 @@
+/*
+ * This file is part of baseflight
+ * Licensed under GPL V3 or modified DCL - see https://github.com/multiwii/baseflight/blob/master/README.md
+ */
+
+#include "board.h"
+#include "mw.h"
+
+#include "blackbox.h"
+#include "flashfs.h"
+#include "perf.h"
+
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Entry point of the SITL target. This does the same setup as main.c against the simulated hardware, then runs loop()
+ * on the simulated clock for the requested amount of time, as fast as the host allows.
+ *
+ * USART1 (the CLI/MSP port, and the blackbox when logging to serial) can be connected to files or pipes, so a run can
+ * be fed CLI commands and will write its blackbox log to a file. Saving the config ends the run (the board would
+ * reboot), the config is kept in the flash file for the next run.
+ */
+
+core_t core;
+int hw_revision = 0;
+
+extern rcReadRawDataPtr rcReadRawFunc;
+extern uint8_t numberMotor;
+
+// receiver read function
+extern uint16_t pwmReadRawRC(uint8_t chan);
+
+#define SITL_DEFAULT_DURATION_SECONDS 10
+#define SITL_DEFAULT_TICK_MICROS 10
+
+// How long we allow for the disarm at the end of the run, and for the blackbox to write out the rest of its log after
+#define SITL_SHUTDOWN_MICROS 2000000
+
+static void _putc(void *p, char c)
+{
+    (void)p;
+    serialWrite(core.mainport, c);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  -d seconds   simulated time to run for (default %d)\n"
+        "  -t micros    simulated time that passes between calls to loop() (default %d)\n"
+        "  -s file      replay sensor and RC readings from this trace file\n"
+        "  -i file      feed this file to USART1, - for stdin\n"
+        "  -o file      write USART1 output to this file, - for stdout\n"
+        "  -l baud      act as a logger on USART1 that agrees to blackbox baud rates up to this one\n"
+        "  -r           only let USART1 send as fast as its baud rate allows\n"
+        "  -e file      keep the config flash in this file\n"
+        "  -f file      keep the contents of the SPI flash chip (the blackbox's flash device) in this file\n"
+        "  -m file      write the motor outputs of every control loop iteration to this file as CSV\n"
+        "  -a seconds   arm with the sticks at this time\n"
+        "  -b           enable the blackbox feature for this run\n"
+        "  -v file      write the values of every frame the blackbox logs to this file as CSV\n"
+        "  -p           time the perf stages with the host clock and print them at the end\n",
+        name, SITL_DEFAULT_DURATION_SECONDS, SITL_DEFAULT_TICK_MICROS);
+}
+
+static FILE *openOutput(const char *filename)
+{
+    FILE *file;
+
+    if (strcmp(filename, "-") == 0)
+        return stdout;
+
+    file = fopen(filename, "wb");
+    if (!file) {
+        perror(filename);
+        exit(1);
+    }
+    return file;
+}
+
+static void setupFlight(void)
+{
+    drv_pwm_config_t pwm_params;
+    drv_adc_config_t adc_params;
+    int i;
+
+    systemInit();
+    perfInit();
+    init_printf(NULL, _putc);
+
+    activateConfig();
+
+    if (spiInit() == SPI_DEVICE_FLASH)
+        flashfsInit();
+
+    memset(&adc_params, 0, sizeof(adc_params));
+    adcInit(&adc_params);
+    if (feature(FEATURE_VBAT))
+        batteryInit();
+    initBoardAlignment();
+
+    sensorsSet(SENSORS_SET);
+    if (!sensorsAutodetect())
+        failureMode(3);
+
+    imuInit();
+    mixerInit();
+
+    serialInit(mcfg.serial_baudrate);
+
+    memset(&pwm_params, 0, sizeof(pwm_params));
+    pwm_params.useServos = core.useServo;
+    pwm_params.idlePulse = feature(FEATURE_3D) ? mcfg.neutral3d : PULSE_1MS;
+    pwm_params.servoCenterPulse = mcfg.midrc;
+    pwmInit(&pwm_params);
+    core.numServos = pwm_params.numServos;
+
+    for (i = 0; i < RC_CHANS; i++)
+        rcData[i] = 1502;
+    rcReadRawFunc = pwmReadRawRC;
+    core.numRCChannels = MAX_INPUTS;
+
+    if (feature(FEATURE_SERIALRX)) {
+        switch (mcfg.serialrx_type) {
+            case SERIALRX_SPEKTRUM1024:
+            case SERIALRX_SPEKTRUM2048:
+                spektrumInit(&rcReadRawFunc);
+                break;
+            case SERIALRX_SBUS:
+                sbusInit(&rcReadRawFunc);
+                break;
+            case SERIALRX_SUMD:
+                sumdInit(&rcReadRawFunc);
+                break;
+            case SERIALRX_MSP:
+                mspInit(&rcReadRawFunc);
+                break;
+        }
+    }
+
+    if (feature(FEATURE_BLACKBOX))
+        initBlackbox();
+
+    previousTime = micros();
+    if (mcfg.mixerConfiguration == MULTITYPE_GIMBAL)
+        calibratingA = CALIBRATING_ACC_CYCLES;
+    calibratingG = CALIBRATING_GYRO_CYCLES;
+    calibratingB = CALIBRATING_BARO_CYCLES;
+    f.SMALL_ANGLE = 1;
+
+    loopInit();
+}
+
+static void writeMotorLog(FILE *file)
+{
+    int i;
+
+    fprintf(file, "%u", currentTime);
+    for (i = 0; i < numberMotor; i++)
+        fprintf(file, ",%u", sitlGetMotor(i));
+    for (i = 0; i < core.numServos; i++)
+        fprintf(file, ",%u", sitlGetServo(i));
+    fputc('\n', file);
+}
+
+static FILE *blackboxValuesOutput;
+
+/**
+ * Write the values of a frame the blackbox logged, with the same field names the log header uses. A new column header
+ * line starts each log, so the file can be checked against the decoded logs with blackbox_decode --verify.
+ */
+void sitlBlackboxFrameLogged(uint32_t iteration, const blackboxValues_t *values)
+{
+    static bool logStarted = false;
+    static uint32_t lastIteration;
+    FILE *file = blackboxValuesOutput;
+    int i;
+
+    if (!file)
+        return;
+
+    if (!logStarted || iteration <= lastIteration) {
+        fprintf(file, "loopIteration,time,axisP[0],axisP[1],axisP[2],axisI[0],axisI[1],axisI[2],axisD[0],axisD[1],axisD[2],"
+            "rcCommand[0],rcCommand[1],rcCommand[2],rcCommand[3],"
+            "gyroData[0],gyroData[1],gyroData[2],accSmooth[0],accSmooth[1],accSmooth[2]");
+        for (i = 0; i < numberMotor; i++)
+            fprintf(file, ",motor[%d]", i);
+        fprintf(file, ",servo[5]\n");
+        logStarted = true;
+    }
+    lastIteration = iteration;
+
+    fprintf(file, "%u,%u", iteration, values->time);
+    for (i = 0; i < XYZ_AXIS_COUNT; i++)
+        fprintf(file, ",%d", values->axisPID_P[i]);
+    for (i = 0; i < XYZ_AXIS_COUNT; i++)
+        fprintf(file, ",%d", values->axisPID_I[i]);
+    for (i = 0; i < XYZ_AXIS_COUNT; i++)
+        fprintf(file, ",%d", values->axisPID_D[i]);
+    for (i = 0; i < 4; i++)
+        fprintf(file, ",%d", values->rcCommand[i]);
+    for (i = 0; i < XYZ_AXIS_COUNT; i++)
+        fprintf(file, ",%d", values->gyroData[i]);
+    for (i = 0; i < XYZ_AXIS_COUNT; i++)
+        fprintf(file, ",%d", values->accSmooth[i]);
+    for (i = 0; i < numberMotor; i++)
+        fprintf(file, ",%d", values->motor[i]);
+    fprintf(file, ",%d\n", values->servo[5]);
+}
+
+static void printPerf(void)
+{
+    const perfStageStats_t *stats;
+    int i;
+
+    fprintf(stderr, "%-10s %10s %8s %8s %8s (us)\n", "stage", "count", "min", "avg", "max");
+    for (i = 0; i < PERF_STAGE_COUNT; i++) {
+        stats = perfGetStats(i);
+        if (stats->count == 0)
+            continue;
+        fprintf(stderr, "%-10s %10u %8.2f %8.2f %8.2f\n", perfStageNames[i], stats->count,
+            (double)stats->minCycles / SITL_CYCLES_PER_MICRO, (double)perfGetAverageCycles(i) / SITL_CYCLES_PER_MICRO,
+            (double)stats->maxCycles / SITL_CYCLES_PER_MICRO);
+    }
+}
+
+/**
+ * Hold the throttle low and the yaw stick over to one side, the stick command for arming (yaw right) or disarming
+ * (yaw left).
+ */
+static void holdArmingSticks(bool arm)
+{
+    sitlSetRC(mcfg.rcmap[THROTTLE], 1000);
+    sitlSetRC(mcfg.rcmap[YAW], arm ? 2000 : 1000);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t duration = SITL_DEFAULT_DURATION_SECONDS * 1000000, tick = SITL_DEFAULT_TICK_MICROS;
+    uint32_t armTime = 0, lastLoopCount = 0, end;
+    const char *traceFilename = NULL, *flashFilename = NULL, *spiFlashFilename = NULL;
+    bool arm = false, enableBlackbox = false, hostProfile = false, armed = false;
+    FILE *uartOutput = NULL, *motorOutput = NULL;
+    int uartInput = -1, opt;
+    struct timespec hostStart, hostEnd;
+    double hostSeconds;
+
+    while ((opt = getopt(argc, argv, "d:t:s:i:o:l:re:f:m:a:bv:ph")) != -1) {
+        switch (opt) {
+            case 'd':
+                duration = atof(optarg) * 1000000;
+                break;
+            case 't':
+                tick = max(atoi(optarg), 1);
+                break;
+            case 's':
+                traceFilename = optarg;
+                break;
+            case 'i':
+                uartInput = strcmp(optarg, "-") == 0 ? STDIN_FILENO : open(optarg, O_RDONLY);
+                if (uartInput < 0) {
+                    perror(optarg);
+                    return 1;
+                }
+                break;
+            case 'o':
+                uartOutput = openOutput(optarg);
+                break;
+            case 'l':
+                sitlSerialEmulateLogger(0, strtoul(optarg, NULL, 10));
+                break;
+            case 'r':
+                sitlSerialThrottle(0, true);
+                break;
+            case 'e':
+                flashFilename = optarg;
+                break;
+            case 'f':
+                spiFlashFilename = optarg;
+                break;
+            case 'm':
+                motorOutput = openOutput(optarg);
+                break;
+            case 'a':
+                arm = true;
+                armTime = atof(optarg) * 1000000;
+                break;
+            case 'b':
+                enableBlackbox = true;
+                break;
+            case 'v':
+                blackboxValuesOutput = openOutput(optarg);
+                break;
+            case 'p':
+                hostProfile = true;
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (traceFilename && !sitlTraceOpen(traceFilename)) {
+        perror(traceFilename);
+        return 1;
+    }
+
+    sitlFlashLoad(flashFilename);
+    sitlSpiFlashLoad(spiFlashFilename);
+    sitlSerialAttach(0, uartInput, uartOutput);
+    sitlUseHostCycleCounter(hostProfile);
+
+    initEEPROM();
+    checkFirstTime(false);
+    readEEPROM();
+
+    if (enableBlackbox)
+        featureSet(FEATURE_BLACKBOX);
+
+    // Give the trace a chance to set up the sticks before we fill rcData with them
+    sitlSetRC(mcfg.rcmap[THROTTLE], 1000);
+    sitlTraceUpdate();
+
+    setupFlight();
+
+    clock_gettime(CLOCK_MONOTONIC, &hostStart);
+
+    end = duration;
+    while ((int32_t)(micros() - end) < 0) {
+        sitlTraceUpdate();
+
+        if (arm && !armed && (int32_t)(micros() - armTime) >= 0) {
+            if (f.ARMED) {
+                armed = true;
+                sitlSetRC(mcfg.rcmap[YAW], 1500);
+            } else {
+                holdArmingSticks(true);
+            }
+        }
+
+        // Disarm at the end so the blackbox finishes its log properly
+        if (f.ARMED && (int32_t)(micros() - duration) >= 0)
+            holdArmingSticks(false);
+
+        sitlSerialProcess();
+        loop();
+
+        if (motorOutput && perfGetStats(PERF_STAGE_LOOP)->count != lastLoopCount) {
+            lastLoopCount = perfGetStats(PERF_STAGE_LOOP)->count;
+            writeMotorLog(motorOutput);
+        }
+
+        sitlAdvanceTime(tick);
+
+        if (end == duration && (int32_t)(micros() - duration) >= 0 && (f.ARMED || feature(FEATURE_BLACKBOX)))
+            end = duration + SITL_SHUTDOWN_MICROS;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &hostEnd);
+    hostSeconds = (hostEnd.tv_sec - hostStart.tv_sec) + (hostEnd.tv_nsec - hostStart.tv_nsec) / 1e9;
+
+    fprintf(stderr, "%.3f s simulated in %.3f s, %u control loops (%.0f per second)\n", micros() / 1e6, hostSeconds,
+        perfGetStats(PERF_STAGE_LOOP)->count, hostSeconds > 0 ? perfGetStats(PERF_STAGE_LOOP)->count / hostSeconds : 0);
+
+    if (hostProfile)
+        printPerf();
+
+    if (uartOutput)
+        fclose(uartOutput);
+    if (motorOutput && motorOutput != uartOutput)
+        fclose(motorOutput);
+    if (blackboxValuesOutput && blackboxValuesOutput != uartOutput && blackboxValuesOutput != motorOutput)
+        fclose(blackboxValuesOutput);
+
+    return 0;
+}
@@ -0,0 +1,78 @@
+/*
+ * This file is part of baseflight
+ * Licensed under GPL V3 or modified DCL - see https://github.com/multiwii/baseflight/blob/master/README.md
+ */
+
+#include "board.h"
+
+/*
+ * Simulated PWM outputs, receiver inputs and ADC for the SITL target. The outputs just remember the last pulse width
+ * written so the simulation can record them, the inputs are set from the trace or by the simulation itself.
+ */
+
+#define SITL_BATTERY_ADC 1353
+
+static uint16_t motors[MAX_MOTORS];
+static uint16_t servos[MAX_SERVOS];
+static uint16_t captures[MAX_INPUTS] = { 1500, 1500, 1500, 1500, 1500, 1500, 1500, 1500 };
+
+bool pwmInit(drv_pwm_config_t *init)
+{
+    int i;
+
+    for (i = 0; i < MAX_MOTORS; i++)
+        motors[i] = init->idlePulse;
+    for (i = 0; i < MAX_SERVOS; i++)
+        servos[i] = init->servoCenterPulse;
+
+    init->numServos = init->useServos ? MAX_SERVOS : 0;
+
+    return false;
+}
+
+void pwmWriteMotor(uint8_t index, uint16_t value)
+{
+    if (index < MAX_MOTORS)
+        motors[index] = value;
+}
+
+void pwmWriteServo(uint8_t index, uint16_t value)
+{
+    if (index < MAX_SERVOS)
+        servos[index] = value;
+}
+
+uint16_t pwmRead(uint8_t channel)
+{
+    return captures[channel];
+}
+
+void sitlSetRC(uint8_t channel, uint16_t value)
+{
+    if (channel < MAX_INPUTS)
+        captures[channel] = value;
+}
+
+uint16_t sitlGetMotor(uint8_t index)
+{
+    return motors[index];
+}
+
+uint16_t sitlGetServo(uint8_t index)
+{
+    return servos[index];
+}
+
+void adcInit(drv_adc_config_t *init)
+{
+    (void)init;
+}
+
+uint16_t adcGetChannel(uint8_t channel)
+{
+    // A 3S pack at about 12.0V through the default 11:1 divider, and nothing on the other channels
+    if (channel == ADC_BATTERY)
+        return SITL_BATTERY_ADC;
+
+    return 0;
+}
@@ -0,0 +1,240 @@
+/*
+ * This file is part of baseflight
+ * Licensed under GPL V3 or modified DCL - see https://github.com/multiwii/baseflight/blob/master/README.md
+ */
+
+#include "board.h"
+
+/*
+ * Simulated sensors for the SITL target. The gyro and accelerometer behave like an MPU6050 (16.4 LSB/dps, 4096 LSB/g),
+ * and a magnetometer and barometer are always present. Without a trace the craft sits still and level.
+ *
+ * A trace is a text file with one sample per line, '#' starts a comment:
+ *
+ *   time gyroX gyroY gyroZ accX accY accZ [magX magY magZ [pressure temperature [rc1 ... rc8]]]
+ *
+ * time is in microseconds since the start of the run and the sensor values are raw readings. pressure is in Pa and
+ * temperature in 0.01 degC, which is what the barometer drivers report. The rc values are receiver pulse widths in
+ * input order (before rcmap). Each sample holds until the time of the next one.
+ */
+
+#define SITL_ACC_1G 4096
+
+extern uint16_t acc_1G;
+
+#define SITL_TRACE_COLUMNS 20
+
+static int16_t simGyro[3];
+static int16_t simAcc[3] = { 0, 0, SITL_ACC_1G };
+static int16_t simMag[3] = { 200, 0, 400 };
+static int32_t simPressure = 101325;
+static int32_t simTemperature = 2500;
+
+static sensor_align_e gyroAlign = CW0_DEG;
+static sensor_align_e accAlign = CW0_DEG;
+
+static FILE *traceFile;
+static int32_t traceSample[SITL_TRACE_COLUMNS];
+static int traceSampleColumns;
+
+static void sitlGyroInit(sensor_align_e align)
+{
+    if (align > 0)
+        gyroAlign = align;
+}
+
+static void sitlGyroRead(int16_t *gyroData)
+{
+    int16_t data[3] = { simGyro[X], simGyro[Y], simGyro[Z] };
+
+    alignSensors(data, gyroData, gyroAlign);
+}
+
+static void sitlAccInit(sensor_align_e align)
+{
+    if (align > 0)
+        accAlign = align;
+}
+
+static void sitlAccRead(int16_t *accData)
+{
+    int16_t data[3] = { simAcc[X], simAcc[Y], simAcc[Z] };
+
+    alignSensors(data, accData, accAlign);
+}
+
+static void sitlMagInit(sensor_align_e align)
+{
+    (void)align;
+}
+
+static void sitlMagRead(int16_t *magData)
+{
+    memcpy(magData, simMag, sizeof(simMag));
+}
+
+static void sitlBaroNop(void)
+{
+}
+
+static void sitlBaroCalculate(int32_t *pressure, int32_t *temperature)
+{
+    if (pressure)
+        *pressure = simPressure;
+    if (temperature)
+        *temperature = simTemperature;
+}
+
+bool mpu6050Detect(sensor_t *acc, sensor_t *gyro, uint16_t lpf, uint8_t *scale)
+{
+    (void)lpf;
+
+    acc->init = sitlAccInit;
+    acc->read = sitlAccRead;
+    acc->prefetch = NULL;
+    gyro->init = sitlGyroInit;
+    gyro->read = sitlGyroRead;
+    gyro->temperature = NULL;
+    gyro->prefetch = NULL;
+    gyro->scale = (4.0f / 16.4f) * (M_PI / 180.0f) * 0.000001f;
+
+    acc_1G = SITL_ACC_1G;
+    if (scale)
+        *scale = 0;
+
+    return true;
+}
+
+bool hmc5883lDetect(sensor_t *mag)
+{
+    mag->init = sitlMagInit;
+    mag->read = sitlMagRead;
+    mag->prefetch = NULL;
+
+    return true;
+}
+
+bool ms5611Detect(baro_t *baro)
+{
+    baro->ut_delay = 10000;
+    baro->up_delay = 10000;
+    baro->start_ut = sitlBaroNop;
+    baro->get_ut = sitlBaroNop;
+    baro->start_up = sitlBaroNop;
+    baro->get_up = sitlBaroNop;
+    baro->calculate = sitlBaroCalculate;
+
+    return true;
+}
+
+// Everything else the autodetection asks about is absent
+bool bmp085Detect(baro_t *baro)
+{
+    (void)baro;
+    return false;
+}
+
+bool adxl345Detect(drv_adxl345_config_t *init, sensor_t *acc)
+{
+    (void)init;
+    (void)acc;
+    return false;
+}
+
+bool mpu6500Detect(sensor_t *acc, sensor_t *gyro, uint16_t lpf)
+{
+    (void)acc;
+    (void)gyro;
+    (void)lpf;
+    return false;
+}
+
+bool l3g4200dDetect(sensor_t *gyro, uint16_t lpf)
+{
+    (void)gyro;
+    (void)lpf;
+    return false;
+}
+
+bool mpu3050Detect(sensor_t *gyro, uint16_t lpf)
+{
+    (void)gyro;
+    (void)lpf;
+    return false;
+}
+
+/**
+ * Read the next sample from the trace into traceSample. Returns false at the end of the trace.
+ */
+static bool sitlTraceReadSample(void)
+{
+    char line[256];
+    char *p, *end;
+
+    while (fgets(line, sizeof(line), traceFile)) {
+        p = strchr(line, '#');
+        if (p)
+            *p = '\0';
+
+        for (traceSampleColumns = 0, p = line; traceSampleColumns < SITL_TRACE_COLUMNS; traceSampleColumns++, p = end) {
+            traceSample[traceSampleColumns] = strtol(p, &end, 10);
+            if (end == p)
+                break;
+        }
+
+        // Skip blank lines, and lines that don't even have the gyro and acc readings
+        if (traceSampleColumns >= 7)
+            return true;
+    }
+
+    return false;
+}
+
+bool sitlTraceOpen(const char *filename)
+{
+    traceFile = fopen(filename, "r");
+    if (!traceFile)
+        return false;
+
+    if (!sitlTraceReadSample()) {
+        fclose(traceFile);
+        traceFile = NULL;
+    }
+
+    return true;
+}
+
+static void sitlTraceApplySample(void)
+{
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        simGyro[i] = traceSample[1 + i];
+        simAcc[i] = traceSample[4 + i];
+        if (traceSampleColumns >= 10)
+            simMag[i] = traceSample[7 + i];
+    }
+
+    if (traceSampleColumns >= 12) {
+        simPressure = traceSample[10];
+        simTemperature = traceSample[11];
+    }
+
+    for (i = 12; i < traceSampleColumns; i++)
+        sitlSetRC(i - 12, traceSample[i]);
+}
+
+/**
+ * Bring the simulated sensors up to the current time. Once the trace runs out the last sample holds.
+ */
+void sitlTraceUpdate(void)
+{
+    while (traceFile && (int32_t)(micros() - (uint32_t)traceSample[0]) >= 0) {
+        sitlTraceApplySample();
+
+        if (!sitlTraceReadSample()) {
+            fclose(traceFile);
+            traceFile = NULL;
+        }
+    }
+}
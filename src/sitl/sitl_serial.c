@@ -0,0 +1,298 @@
+/*
+ * This file is part of baseflight
+ * Licensed under GPL V3 or modified DCL - see https://github.com/multiwii/baseflight/blob/master/README.md
+ */
+
+#include "board.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+/*
+ * Simulated UARTs for the SITL target. Each port can be attached to a file descriptor to read from (a file, a pipe or a
+ * terminal) and a stdio stream to write to. Transmitted data is written out straight away, so the transmit buffer is
+ * always empty. Received data is polled by sitlSerialProcess() once per iteration of the simulation and either queued
+ * for serialRead() or handed to the port's receive callback, just like the UART interrupt would.
+ *
+ * A port can also pretend to have a blackbox logger on the other end which answers the blackbox's baud rate
+ * negotiation, so that can be tried out without a logger that supports it.
+ *
+ * Or its transmit side can be throttled to what the real UART would manage at its baud rate (10 bits a byte), with a
+ * transmit buffer of the same size as the real one that fills up when the flight code writes faster than that. This is
+ * what the blackbox's backpressure handling and frame dropping need to be tried out against. Single bytes written with
+ * serialWrite() are never refused (the real UART would overwrite data it hasn't sent yet), but they take up room.
+ */
+
+#define SITL_SERIAL_BUFFER_SIZE 256
+
+typedef struct {
+    serialPort_t port;
+    USART_TypeDef *USARTx;
+    int input;
+    FILE *output;
+    bool open;
+
+    // For the emulated logger: the fastest rate it agrees to (0 if there's no logger), and the rate it's listening at
+    uint32_t loggerMaxBaudRate;
+    uint32_t loggerBaudRate;
+    char loggerLine[32];
+    int loggerLineLength;
+
+    // For a throttled port: bytes written that the UART wouldn't have sent yet, and the time they've been sent up to
+    bool throttled;
+    uint32_t txQueued;
+    uint32_t txSentTime;
+} sitlSerialPort_t;
+
+static sitlSerialPort_t sitlPorts[SITL_SERIAL_PORTS] = { { .input = -1 }, { .input = -1 }, { .input = -1 } };
+static volatile uint8_t rxBuffers[SITL_SERIAL_PORTS][SITL_SERIAL_BUFFER_SIZE];
+
+static void sitlSerialReceive(sitlSerialPort_t *s, uint8_t ch)
+{
+    if (s->port.callback) {
+        s->port.callback(ch);
+    } else {
+        s->port.rxBuffer[s->port.rxBufferHead] = ch;
+        s->port.rxBufferHead = (s->port.rxBufferHead + 1) % s->port.rxBufferSize;
+    }
+}
+
+// Answer the blackbox's baud rate negotiation, see BLACKBOX_BASE_BAUDRATE in blackbox.c
+static void sitlLoggerReceive(sitlSerialPort_t *s, uint8_t ch)
+{
+    char reply[32];
+    uint32_t baudRate;
+    int i;
+
+    // At any other rate the logger would only hear noise
+    if (s->port.baudRate != s->loggerBaudRate)
+        return;
+
+    if (ch != '\n') {
+        if (s->loggerLineLength < (int)sizeof(s->loggerLine) - 1)
+            s->loggerLine[s->loggerLineLength++] = ch;
+        return;
+    }
+
+    s->loggerLine[s->loggerLineLength] = '\0';
+    s->loggerLineLength = 0;
+
+    if (strcmp(s->loggerLine, "BBPROBE") == 0) {
+        snprintf(reply, sizeof(reply), "BBOK %u\n", (unsigned int)s->loggerMaxBaudRate);
+        for (i = 0; reply[i]; i++)
+            sitlSerialReceive(s, reply[i]);
+    } else if (strncmp(s->loggerLine, "BBBAUD ", 7) == 0) {
+        baudRate = strtoul(s->loggerLine + 7, NULL, 10);
+        if (baudRate <= s->loggerMaxBaudRate)
+            s->loggerBaudRate = baudRate;
+    }
+}
+
+// Take the bytes out of a throttled port's transmit buffer that would have been sent by now
+static void sitlSerialTransmit(sitlSerialPort_t *s)
+{
+    uint32_t now = micros(), sent;
+
+    if (s->txQueued == 0) {
+        s->txSentTime = now;
+        return;
+    }
+
+    sent = (uint64_t)(now - s->txSentTime) * s->port.baudRate / (10 * 1000000);
+
+    if (sent >= s->txQueued) {
+        s->txQueued = 0;
+        s->txSentTime = now;
+    } else if (sent > 0) {
+        // Keep the part of a byte that's on its way for the next call
+        s->txQueued -= sent;
+        s->txSentTime += (uint64_t)sent * 10 * 1000000 / s->port.baudRate;
+    }
+}
+
+static uint32_t sitlSerialTxBytesFree(serialPort_t *instance)
+{
+    sitlSerialPort_t *s = (sitlSerialPort_t *)instance;
+
+    if (!s->throttled)
+        return instance->txBufferSize;
+
+    sitlSerialTransmit(s);
+
+    // Like the real UART, one byte of the ring is always left empty
+    return s->txQueued < instance->txBufferSize ? instance->txBufferSize - 1 - s->txQueued : 0;
+}
+
+static void sitlSerialWrite(serialPort_t *instance, uint8_t ch)
+{
+    sitlSerialPort_t *s = (sitlSerialPort_t *)instance;
+
+    if (s->throttled) {
+        sitlSerialTransmit(s);
+        s->txQueued++;
+    }
+
+    if (s->output)
+        fputc(ch, s->output);
+    if (s->loggerMaxBaudRate)
+        sitlLoggerReceive(s, ch);
+}
+
+static int sitlSerialWriteBuf(serialPort_t *instance, const uint8_t *data, int count)
+{
+    sitlSerialPort_t *s = (sitlSerialPort_t *)instance;
+    int i;
+
+    if (s->throttled) {
+        count = min(count, (int)sitlSerialTxBytesFree(instance));
+        s->txQueued += count;
+    }
+
+    if (s->output)
+        fwrite(data, 1, count, s->output);
+    if (s->loggerMaxBaudRate)
+        for (i = 0; i < count; i++)
+            sitlLoggerReceive(s, data[i]);
+
+    return count;
+}
+
+static uint8_t sitlSerialTotalBytesWaiting(serialPort_t *instance)
+{
+    return (instance->rxBufferHead - instance->rxBufferTail + instance->rxBufferSize) % instance->rxBufferSize;
+}
+
+static uint8_t sitlSerialRead(serialPort_t *instance)
+{
+    uint8_t ch = instance->rxBuffer[instance->rxBufferTail];
+
+    instance->rxBufferTail = (instance->rxBufferTail + 1) % instance->rxBufferSize;
+    return ch;
+}
+
+static void sitlSerialSetBaudRate(serialPort_t *instance, uint32_t baudRate)
+{
+    // What's already been sent went out at the old rate
+    sitlSerialTransmit((sitlSerialPort_t *)instance);
+    instance->baudRate = baudRate;
+}
+
+static bool sitlSerialTransmitBufferEmpty(serialPort_t *instance)
+{
+    sitlSerialPort_t *s = (sitlSerialPort_t *)instance;
+
+    sitlSerialTransmit(s);
+    return s->txQueued == 0;
+}
+
+static void sitlSerialSetMode(serialPort_t *instance, portMode_t mode)
+{
+    instance->mode = mode;
+}
+
+static const struct serialPortVTable sitlSerialVTable[] = {
+    {
+        sitlSerialWrite,
+        sitlSerialWriteBuf,
+        sitlSerialTotalBytesWaiting,
+        sitlSerialTxBytesFree,
+        sitlSerialRead,
+        sitlSerialSetBaudRate,
+        sitlSerialTransmitBufferEmpty,
+        sitlSerialSetMode,
+    }
+};
+
+/**
+ * Connect the port to the given input file descriptor (which is switched to non-blocking) and output stream. Either
+ * may be left out by passing -1 or NULL.
+ */
+void sitlSerialAttach(int index, int input, FILE *output)
+{
+    sitlPorts[index].input = input;
+    sitlPorts[index].output = output;
+
+    if (input >= 0)
+        fcntl(input, F_SETFL, fcntl(input, F_GETFL) | O_NONBLOCK);
+}
+
+/**
+ * Have a logger on the given port which agrees to baud rates up to maxBaudRate. Like a real one, it starts out
+ * listening at 115200 baud.
+ */
+void sitlSerialEmulateLogger(int index, uint32_t maxBaudRate)
+{
+    sitlPorts[index].loggerMaxBaudRate = maxBaudRate;
+    sitlPorts[index].loggerBaudRate = 115200;
+}
+
+/**
+ * Limit how fast the given port sends to its baud rate, see the top of this file.
+ */
+void sitlSerialThrottle(int index, bool enable)
+{
+    sitlPorts[index].throttled = enable;
+}
+
+serialPort_t *uartOpen(USART_TypeDef *USARTx, serialReceiveCallbackPtr callback, uint32_t baudRate, portMode_t mode)
+{
+    sitlSerialPort_t *s;
+    int index;
+
+    if (USARTx == USART1)
+        index = 0;
+    else if (USARTx == USART2)
+        index = 1;
+    else if (USARTx == USART3)
+        index = 2;
+    else
+        return NULL;
+
+    s = &sitlPorts[index];
+    s->USARTx = USARTx;
+    s->port.vTable = sitlSerialVTable;
+    s->port.mode = mode;
+    s->port.baudRate = baudRate;
+    s->port.rxBuffer = rxBuffers[index];
+    s->port.rxBufferSize = SITL_SERIAL_BUFFER_SIZE;
+    s->port.txBufferSize = SITL_SERIAL_BUFFER_SIZE;
+    s->port.callback = callback;
+
+    // Reopening a port (e.g. when the blackbox takes over the main port) drops anything received so far, like the UART
+    s->port.rxBufferHead = s->port.rxBufferTail = 0;
+    s->open = true;
+
+    return &s->port;
+}
+
+/**
+ * Deliver whatever has arrived on the attached inputs since the last call.
+ */
+void sitlSerialProcess(void)
+{
+    uint8_t data[SITL_SERIAL_BUFFER_SIZE];
+    sitlSerialPort_t *s;
+    ssize_t count, i;
+    uint32_t space;
+
+    for (s = sitlPorts; s < sitlPorts + SITL_SERIAL_PORTS; s++) {
+        if (!s->open || s->input < 0 || !(s->port.mode & MODE_RX))
+            continue;
+
+        if (s->port.callback) {
+            space = sizeof(data);
+        } else {
+            // Leave the rest in the pipe until the flight code catches up, rather than overrunning the buffer
+            space = s->port.rxBufferSize - 1 - sitlSerialTotalBytesWaiting(&s->port);
+            if (space == 0)
+                continue;
+        }
+
+        count = read(s->input, data, space);
+        if (count <= 0)
+            continue;
+
+        for (i = 0; i < count; i++)
+            sitlSerialReceive(s, data[i]);
+    }
+}
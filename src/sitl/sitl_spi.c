@@ -0,0 +1,363 @@
+/*
+ * This file is part of baseflight
+ * Licensed under GPL V3 or modified DCL - see https://github.com/multiwii/baseflight/blob/master/README.md
+ */
+
+#include "board.h"
+
+#include <stdarg.h>
+
+/*
+ * Simulated SPI2 with an M25P16 flash chip on it, so the real drv_m25p16.c and flashfs.c run in the SITL build.
+ *
+ * The chip understands the commands drv_m25p16.c uses and behaves like the real one where it matters to the driver:
+ * page programs wrap around within their page and can only clear bits, a sector erase keeps the chip busy for 0.6
+ * seconds and a page program for 0.8ms, every program or erase needs a write enable first, and while the chip is busy
+ * it ignores everything but a status read. Mistakes of the driver that the real chip would silently ignore are
+ * reported on stderr, and counted for the tests.
+ *
+ * Synchronous transfers take about a microsecond a byte (SPI2 runs at 9MHz) of simulated time. An asynchronous
+ * transfer doesn't hold up the caller, the chip gets its bytes (read from the caller's buffer at that point, so
+ * changing the buffer too early corrupts the data like it would on the real board) once the transfer's time is up.
+ */
+
+#define M25P16_COMMAND_READ_ID         0x9F
+#define M25P16_COMMAND_READ_BYTES      0x03
+#define M25P16_COMMAND_READ_STATUS     0x05
+#define M25P16_COMMAND_WRITE_ENABLE    0x06
+#define M25P16_COMMAND_PAGE_PROGRAM    0x02
+#define M25P16_COMMAND_SECTOR_ERASE    0xD8
+
+#define M25P16_SIZE (2 * 1024 * 1024)
+#define M25P16_SECTOR_SIZE (64 * 1024)
+
+#define M25P16_PAGE_PROGRAM_MICROS 800
+#define M25P16_SECTOR_ERASE_MICROS 600000
+
+#define M25P16_STATUS_WIP 0x01
+#define M25P16_STATUS_WEL 0x02
+
+static uint8_t chip[M25P16_SIZE];
+static const char *chipFilename;
+
+static bool selected;
+static uint8_t command;
+static int commandLength;       // bytes received since the chip was selected
+static bool commandIgnored;     // because the chip was busy when it started
+static uint32_t address;
+static bool writeEnabled;
+static uint32_t busyUntil;
+
+static int complaints;          // about mistakes of the driver
+
+static uint8_t pageBuffer[M25P16_PAGESIZE];
+static bool pageBufferUsed[M25P16_PAGESIZE];
+
+// The asynchronous transfer in progress, if any
+static bool asyncBusy;
+static uint32_t asyncEnd;
+static uint8_t *asyncOut;
+static const uint8_t *asyncIn;
+static int asyncLength;
+static spiCallbackPtr asyncCallback;
+static bool asyncCompleting;    // while its callback runs, at the time the transfer ended
+
+static void chipComplain(const char *fmt, ...)
+{
+    va_list va;
+
+    complaints++;
+
+    va_start(va, fmt);
+    fprintf(stderr, "m25p16: ");
+    vfprintf(stderr, fmt, va);
+    fprintf(stderr, "\n");
+    va_end(va);
+}
+
+static bool chipIsBusy(uint32_t now)
+{
+    return (int32_t)(now - busyUntil) < 0;
+}
+
+static void chipSelect(void)
+{
+    selected = true;
+    command = 0;
+    commandLength = 0;
+    commandIgnored = false;
+}
+
+static void chipDeselect(uint32_t now)
+{
+    uint32_t i, page;
+    bool overwrote = false;
+
+    selected = false;
+
+    if (commandLength == 0 || commandIgnored)
+        return;
+
+    switch (command) {
+        case M25P16_COMMAND_WRITE_ENABLE:
+            writeEnabled = true;
+            break;
+
+        case M25P16_COMMAND_PAGE_PROGRAM:
+            if (commandLength < 4)
+                break;
+
+            if (!writeEnabled) {
+                chipComplain("page program at 0x%06x without a write enable, ignored", address);
+                break;
+            }
+
+            // A NOR flash can only clear bits, so data can't be programmed over data that hasn't been erased
+            page = address & ~(M25P16_PAGESIZE - 1);
+            for (i = 0; i < M25P16_PAGESIZE; i++) {
+                if (!pageBufferUsed[i])
+                    continue;
+                if ((chip[page + i] & pageBuffer[i]) != pageBuffer[i])
+                    overwrote = true;
+                chip[page + i] &= pageBuffer[i];
+            }
+            if (overwrote)
+                chipComplain("page program at 0x%06x over data that wasn't erased", address);
+
+            writeEnabled = false;
+            busyUntil = now + M25P16_PAGE_PROGRAM_MICROS;
+            break;
+
+        case M25P16_COMMAND_SECTOR_ERASE:
+            if (commandLength < 4)
+                break;
+
+            if (!writeEnabled) {
+                chipComplain("sector erase at 0x%06x without a write enable, ignored", address);
+                break;
+            }
+
+            memset(chip + (address & ~(M25P16_SECTOR_SIZE - 1)), 0xFF, M25P16_SECTOR_SIZE);
+
+            writeEnabled = false;
+            busyUntil = now + M25P16_SECTOR_ERASE_MICROS;
+            break;
+    }
+}
+
+static uint8_t chipTransfer(uint8_t in, uint32_t now)
+{
+    uint8_t out = 0xFF;
+    int index = commandLength++;
+
+    if (!selected)
+        return out;
+
+    if (index == 0) {
+        command = in;
+
+        if (chipIsBusy(now) && command != M25P16_COMMAND_READ_STATUS) {
+            chipComplain("command 0x%02x while busy, ignored", command);
+            commandIgnored = true;
+        }
+
+        if (command == M25P16_COMMAND_PAGE_PROGRAM) {
+            memset(pageBuffer, 0xFF, sizeof(pageBuffer));
+            memset(pageBufferUsed, 0, sizeof(pageBufferUsed));
+        }
+        return out;
+    }
+
+    if (commandIgnored)
+        return out;
+
+    switch (command) {
+        case M25P16_COMMAND_READ_ID:
+            if (index <= 3)
+                out = (FLASH_M25P16 >> (8 * (3 - index))) & 0xFF;
+            break;
+
+        case M25P16_COMMAND_READ_STATUS:
+            out = (chipIsBusy(now) ? M25P16_STATUS_WIP : 0) | (writeEnabled ? M25P16_STATUS_WEL : 0);
+            break;
+
+        case M25P16_COMMAND_READ_BYTES:
+        case M25P16_COMMAND_PAGE_PROGRAM:
+        case M25P16_COMMAND_SECTOR_ERASE:
+            if (index <= 3) {
+                address = ((address << 8) | in) & (M25P16_SIZE - 1);
+                break;
+            }
+
+            if (command == M25P16_COMMAND_READ_BYTES) {
+                out = chip[address];
+                address = (address + 1) & (M25P16_SIZE - 1);
+            } else if (command == M25P16_COMMAND_PAGE_PROGRAM) {
+                // Data past the end of the page wraps around to its start
+                pageBuffer[(address + index - 4) % M25P16_PAGESIZE] = in;
+                pageBufferUsed[(address + index - 4) % M25P16_PAGESIZE] = true;
+            }
+            break;
+    }
+
+    return out;
+}
+
+/**
+ * Finish the asynchronous transfer in progress once its time is up, running its callback as the interrupt would have.
+ */
+static void spiCompleteAsync(void)
+{
+    int i;
+    uint8_t b;
+
+    if (!asyncBusy || (int32_t)(micros() - asyncEnd) < 0)
+        return;
+
+    for (i = 0; i < asyncLength; i++) {
+        b = chipTransfer(asyncIn ? asyncIn[i] : 0xFF, asyncEnd);
+        if (asyncOut)
+            asyncOut[i] = b;
+    }
+
+    asyncBusy = false;
+
+    asyncCompleting = true;
+    if (asyncCallback)
+        asyncCallback();
+    asyncCompleting = false;
+}
+
+// Where the real driver spins until the asynchronous transfer is done, skip ahead to the end of it
+static void spiWaitAsync(void)
+{
+    if (asyncBusy && (int32_t)(micros() - asyncEnd) < 0)
+        sitlAdvanceTime(asyncEnd - micros());
+
+    spiCompleteAsync();
+}
+
+int spiInit(void)
+{
+    return SPI_DEVICE_FLASH;
+}
+
+void spiSelect(bool select)
+{
+    if (select)
+        chipSelect();
+    else
+        chipDeselect(asyncCompleting ? asyncEnd : micros());
+}
+
+uint8_t spiTransferByte(uint8_t in)
+{
+    uint8_t out;
+
+    spiWaitAsync();
+
+    out = chipTransfer(in, micros());
+    sitlAdvanceTime(1);
+
+    return out;
+}
+
+bool spiTransfer(uint8_t *out, const uint8_t *in, int len)
+{
+    uint8_t b;
+
+    spiWaitAsync();
+
+    while (len--) {
+        b = chipTransfer(in ? *(in++) : 0xFF, micros());
+        if (out)
+            *(out++) = b;
+        sitlAdvanceTime(1);
+    }
+
+    return true;
+}
+
+bool spiTransferAsync(uint8_t *out, const uint8_t *in, int len, spiCallbackPtr callback)
+{
+    spiCompleteAsync();
+
+    if (asyncBusy)
+        return false;
+
+    if (len <= 0) {
+        if (callback)
+            callback();
+        return true;
+    }
+
+    asyncOut = out;
+    asyncIn = in;
+    asyncLength = len;
+    asyncCallback = callback;
+    asyncEnd = micros() + len;
+    asyncBusy = true;
+
+    return true;
+}
+
+bool spiIsBusy(void)
+{
+    spiCompleteAsync();
+
+    // Polling takes time on the real board too, without this a driver spinning until the transfer is done would never
+    // see it finish
+    if (asyncBusy)
+        sitlAdvanceTime(1);
+
+    return asyncBusy;
+}
+
+static void sitlSpiFlashSave(void)
+{
+    FILE *file = fopen(chipFilename, "wb");
+
+    if (!file) {
+        perror(chipFilename);
+        return;
+    }
+
+    fwrite(chip, 1, sizeof(chip), file);
+    fclose(file);
+}
+
+/**
+ * The M25P16 starts out erased, unless filename is given and can be loaded. The chip's contents are written back to
+ * filename when the program exits.
+ */
+bool sitlSpiFlashLoad(const char *filename)
+{
+    FILE *file;
+
+    memset(chip, 0xFF, sizeof(chip));
+
+    if (!filename)
+        return false;
+
+    if (!chipFilename)
+        atexit(sitlSpiFlashSave);
+    chipFilename = filename;
+
+    file = fopen(filename, "rb");
+    if (!file)
+        return false;
+
+    if (fread(chip, 1, sizeof(chip), file) != sizeof(chip))
+        memset(chip, 0xFF, sizeof(chip));
+    fclose(file);
+
+    return true;
+}
+
+/**
+ * The number of mistakes of the driver that have been reported on stderr so far.
+ */
+int sitlSpiFlashComplaints(void)
+{
+    return complaints;
+}
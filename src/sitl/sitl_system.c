@@ -0,0 +1,193 @@
+/*
+ * This file is part of baseflight
+ * Licensed under GPL V3 or modified DCL - see https://github.com/multiwii/baseflight/blob/master/README.md
+ */
+
+#include "board.h"
+
+#include <time.h>
+
+/*
+ * Simulated clock, flash and system functions for the SITL target.
+ *
+ * Time only moves when the simulation says so: sitlAdvanceTime() is called between iterations of loop(), and the delay
+ * functions skip ahead instead of spinning. This keeps a run deterministic no matter how fast the host is. The cycle
+ * counter normally follows the simulated clock, which makes the perf stats useless, so it can be switched over to the
+ * host's clock to profile the flight code instead.
+ */
+
+uint32_t SystemCoreClock = SITL_CYCLES_PER_MICRO * 1000000;
+uint32_t hse_value = 8000000;
+
+static uint64_t simulatedCycles = 0;
+static bool useHostCycleCounter = false;
+
+#define SITL_FLASH_BASE 0x08000000
+#define SITL_FLASH_SIZE (128 * 1024)
+
+static uint8_t flash[SITL_FLASH_SIZE];
+static const char *flashFilename;
+static uint32_t backupRegister;
+
+void sitlAdvanceTime(uint32_t us)
+{
+    simulatedCycles += (uint64_t)us * SITL_CYCLES_PER_MICRO;
+}
+
+void sitlUseHostCycleCounter(bool enable)
+{
+    useHostCycleCounter = enable;
+}
+
+uint32_t sitlCycleCounter(void)
+{
+    struct timespec now;
+
+    if (!useHostCycleCounter)
+        return (uint32_t)simulatedCycles;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)(((uint64_t)now.tv_sec * 1000000000 + now.tv_nsec) * SITL_CYCLES_PER_MICRO / 1000);
+}
+
+uint32_t micros(void)
+{
+    return (uint32_t)(simulatedCycles / SITL_CYCLES_PER_MICRO);
+}
+
+uint32_t millis(void)
+{
+    return (uint32_t)(simulatedCycles / (SITL_CYCLES_PER_MICRO * 1000));
+}
+
+void delayMicroseconds(uint32_t us)
+{
+    sitlAdvanceTime(us);
+}
+
+void delay(uint32_t ms)
+{
+    sitlAdvanceTime(ms * 1000);
+}
+
+void systemInit(void)
+{
+}
+
+void failureMode(uint8_t mode)
+{
+    fprintf(stderr, "failureMode(%u)\n", mode);
+    exit(1);
+}
+
+void systemReset(bool toBootloader)
+{
+    // there's nothing to come back to, a saved config is picked up again on the next run with the same flash file
+    fprintf(stderr, "systemReset(%s)\n", toBootloader ? "bootloader" : "");
+    exit(0);
+}
+
+uint32_t rccReadBkpDr(void)
+{
+    return backupRegister;
+}
+
+void rccWriteBkpDr(uint32_t value)
+{
+    backupRegister = value;
+}
+
+// There are no pins to drive
+void gpioInit(GPIO_TypeDef *gpio, gpio_config_t *config)
+{
+    (void)gpio;
+    (void)config;
+}
+
+void gpioPinRemapConfig(uint32_t remap, bool enable)
+{
+    (void)remap;
+    (void)enable;
+}
+
+// The simulated sensors aren't on a bus
+uint16_t i2cGetErrorCounter(void)
+{
+    return 0;
+}
+
+/**
+ * Stands in for the on-chip flash holding the config, must be called before the config is read. The flash starts out
+ * erased, unless filename is given and can be loaded. The flash is written back to filename whenever the config is saved.
+ */
+bool sitlFlashLoad(const char *filename)
+{
+    FILE *file;
+
+    memset(flash, 0xFF, sizeof(flash));
+    flashFilename = filename;
+
+    if (!filename)
+        return false;
+
+    file = fopen(filename, "rb");
+    if (!file)
+        return false;
+
+    if (fread(flash, 1, sizeof(flash), file) != sizeof(flash))
+        memset(flash, 0xFF, sizeof(flash));
+    fclose(file);
+
+    return true;
+}
+
+const void *sitlFlashPointer(uint32_t address)
+{
+    return flash + (address - SITL_FLASH_BASE) % SITL_FLASH_SIZE;
+}
+
+void FLASH_Unlock(void)
+{
+}
+
+void FLASH_Lock(void)
+{
+    FILE *file;
+
+    if (!flashFilename)
+        return;
+
+    file = fopen(flashFilename, "wb");
+    if (!file)
+        return;
+
+    fwrite(flash, 1, sizeof(flash), file);
+    fclose(file);
+}
+
+void FLASH_ClearFlag(uint32_t FLASH_FLAG)
+{
+    (void)FLASH_FLAG;
+}
+
+FLASH_Status FLASH_ErasePage(uint32_t Page_Address)
+{
+    uint32_t page = (Page_Address - SITL_FLASH_BASE) & ~0x3FF;
+
+    if (page >= SITL_FLASH_SIZE)
+        return FLASH_ERROR_PG;
+
+    memset(flash + page, 0xFF, 0x400);
+    return FLASH_COMPLETE;
+}
+
+FLASH_Status FLASH_ProgramWord(uint32_t Address, uint32_t Data)
+{
+    uint32_t offset = Address - SITL_FLASH_BASE;
+
+    if (offset > SITL_FLASH_SIZE - sizeof(Data))
+        return FLASH_ERROR_PG;
+
+    memcpy(flash + offset, &Data, sizeof(Data));
+    return FLASH_COMPLETE;
+}
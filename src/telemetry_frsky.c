@@ -53,28 +53,45 @@
 // from sensors.c
 extern uint8_t batteryCellCount;
 
+/*
+ * Each frame is put together here and handed to the port in one go when its tail is added. The largest is the one sent
+ * every second: 12 values of up to 6 bytes each (header, ID and two data bytes that may both need stuffing) plus the tail.
+ */
+#define FRSKY_FRAME_BUFFER_SIZE (12 * 6 + 1)
+
+static uint8_t frskyFrame[FRSKY_FRAME_BUFFER_SIZE];
+static uint8_t frskyFramePos = 0;
+
+static void frskyFrameWrite(uint8_t data)
+{
+    if (frskyFramePos < FRSKY_FRAME_BUFFER_SIZE)
+        frskyFrame[frskyFramePos++] = data;
+}
+
 static void sendDataHead(uint8_t id)
 {
-    serialWrite(core.telemport, PROTOCOL_HEADER);
-    serialWrite(core.telemport, id);
+    frskyFrameWrite(PROTOCOL_HEADER);
+    frskyFrameWrite(id);
 }
 
 static void sendTelemetryTail(void)
 {
-    serialWrite(core.telemport, PROTOCOL_TAIL);
+    frskyFrameWrite(PROTOCOL_TAIL);
+    serialWriteBuf(core.telemport, frskyFrame, frskyFramePos);
+    frskyFramePos = 0;
 }
 
 static void serializeFrsky(uint8_t data)
 {
     // take care of byte stuffing
     if (data == 0x5e) {
-        serialWrite(core.telemport, 0x5d);
-        serialWrite(core.telemport, 0x3e);
+        frskyFrameWrite(0x5d);
+        frskyFrameWrite(0x3e);
     } else if (data == 0x5d) {
-        serialWrite(core.telemport, 0x5d);
-        serialWrite(core.telemport, 0x3d);
+        frskyFrameWrite(0x5d);
+        frskyFrameWrite(0x3d);
     } else
-        serialWrite(core.telemport, data);
+        frskyFrameWrite(data);
 }
 
 static void serialize16(int16_t a)
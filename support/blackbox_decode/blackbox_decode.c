@@ -0,0 +1,947 @@
+/*
+ * This file is part of baseflight
+ * Licensed under GPL V3 or modified DCL - see https://github.com/multiwii/baseflight/blob/master/README.md
+ */
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "parser.h"
+
+/*
+ * Decode blackbox logs into CSV. Every log in the input file (one per arm) goes to its own set of files named after
+ * the input: name.01.csv holds the main frames, with the most recent slow frame values alongside each, name.01.gps.csv
+ * the GPS frames and name.01.event the events.
+ *
+ * --binary writes the main frames column by column instead (name.01.col, see writeColumnar() for the layout), which
+ * analysis scripts can map straight into arrays without parsing any text.
+ *
+ * Flights are independent of each other, so they're shared out between worker threads, one flight per thread at a
+ * time. A file with dozens of flights decodes about as many times faster as there are cores.
+ *
+ * --verify compares the decoded main frames against a CSV of the values the firmware encoded (the SITL target writes
+ * one with its -v option). Frames must match row for row on every column the two files have in common, which makes
+ * this a round-trip check of the encoder against this decoder.
+ *
+ * --start and --end only decode the main frames from that stretch of the flight. Logs with a footer (see
+ * FLIGHT_LOG_FOOTER_MAGIC) are decoded from the last indexed keyframe before the start, and up to the first block of
+ * frames that is certain to be past the end, so a few seconds from a long flight take no longer to get than from a
+ * short one. Older logs are decoded in full and the frames outside the stretch are left out.
+ */
+
+#define MAX_LOGS 1024
+#define OUTPUT_BUFFER_SIZE (256 * 1024)
+#define MAX_REPORTED_MISMATCHES 10
+#define MAX_THREADS 64
+
+#define COLUMNAR_MAGIC "BBCOL1\n"
+
+#define ARRAY_LENGTH(x) (sizeof((x))/sizeof((x)[0]))
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+typedef struct {
+    FILE *file;
+    size_t length;
+    char buffer[OUTPUT_BUFFER_SIZE];
+} outputBuffer_t;
+
+typedef struct {
+    FILE *file;
+    char *line;
+    size_t lineSize;
+    int columnCount;
+    int columnForField[FLIGHT_LOG_MAX_FIELDS];     // expected column holding each main field, -1 if there isn't one
+    int iterationColumn;
+    int32_t expected[FLIGHT_LOG_MAX_FIELDS * 2];   // the next expected row, if haveRow
+    bool haveRow;
+    long row;
+    uint32_t matched, mismatched, missing;
+} verifier_t;
+
+// Main frames held in memory until the end of the flight, so they can be written out a column at a time
+typedef struct {
+    int32_t *rows;
+    int columns;
+    size_t count, capacity;
+} columnarBuffer_t;
+
+typedef struct {
+    outputBuffer_t *csv, *gps;
+    columnarBuffer_t *columnar;
+    FILE *events;
+    int logIndex;
+    int32_t slowValues[FLIGHT_LOG_MAX_FIELDS];
+    verifier_t *verifier;
+
+    // Main frames are only written if their time is within this stretch (for --start and --end)
+    bool timeLimited, haveTimeBase;
+    uint32_t timeBase;
+    int64_t timeFrom, timeTo;
+} decodeContext_t;
+
+// One flight to decode
+typedef struct {
+    int index;
+    const uint8_t *data;
+    size_t size;
+    flightLog_t log;
+    bool ok;
+    double seconds;
+
+    flightLogIndex_t footer;
+    bool hasFooter;
+    size_t decodeStart, decodeEnd;      // the part of the log that was decoded
+} decodeJob_t;
+
+static bool toStdout = false;
+static bool binaryOutput = false;
+static const char *outputPrefix;
+
+// The stretch of each flight to decode, in seconds from the start of its log, negative if unlimited
+static double startSeconds = -1, endSeconds = -1;
+
+static decodeJob_t *jobs;
+static int jobCount;
+static int nextJob;
+static verifier_t *verifier;
+
+static void outputFlush(outputBuffer_t *out)
+{
+    fwrite(out->buffer, 1, out->length, out->file);
+    out->length = 0;
+}
+
+static outputBuffer_t *outputOpen(FILE *file)
+{
+    outputBuffer_t *out = malloc(sizeof(*out));
+
+    if (!out)
+        return NULL;
+
+    out->file = file;
+    out->length = 0;
+    return out;
+}
+
+static void outputClose(outputBuffer_t *out)
+{
+    if (!out)
+        return;
+
+    outputFlush(out);
+    if (out->file != stdout)
+        fclose(out->file);
+    free(out);
+}
+
+// Room for the longest line we write in one go, so only the line start has to check for space
+static inline void outputReserve(outputBuffer_t *out, size_t length)
+{
+    if (out->length + length > sizeof(out->buffer))
+        outputFlush(out);
+}
+
+static inline void outputChar(outputBuffer_t *out, char c)
+{
+    out->buffer[out->length++] = c;
+}
+
+static void outputString(outputBuffer_t *out, const char *s)
+{
+    while (*s)
+        out->buffer[out->length++] = *s++;
+}
+
+/**
+ * printf("%d") is most of the cost of writing the CSV, so format the numbers ourselves.
+ */
+static inline void outputInt(outputBuffer_t *out, int32_t value, bool isSigned)
+{
+    char digits[10];
+    uint32_t u;
+    int n = 0;
+
+    if (isSigned && value < 0) {
+        out->buffer[out->length++] = '-';
+        u = -(uint32_t)value;
+    } else {
+        u = (uint32_t)value;
+    }
+
+    do {
+        digits[n++] = '0' + u % 10;
+        u /= 10;
+    } while (u);
+
+    while (n)
+        out->buffer[out->length++] = digits[--n];
+}
+
+static void writeFieldNames(outputBuffer_t *out, const flightLogFrameDef_t *def, bool first)
+{
+    int i;
+
+    for (i = 0; i < def->fieldCount; i++) {
+        outputReserve(out, FLIGHT_LOG_MAX_FIELD_NAME + 2);
+        if (i > 0 || !first)
+            outputChar(out, ',');
+        outputString(out, def->names[i]);
+    }
+}
+
+static void writeValues(outputBuffer_t *out, const flightLogFrameDef_t *def, const int32_t *values, bool first)
+{
+    int i;
+
+    for (i = 0; i < def->fieldCount; i++) {
+        if (i > 0 || !first)
+            outputChar(out, ',');
+        outputInt(out, values[i], def->isSigned[i]);
+    }
+}
+
+static FILE *openLogOutput(const decodeContext_t *ctx, const char *suffix)
+{
+    char filename[4096];
+    FILE *file;
+
+    if (toStdout)
+        return stdout;
+
+    snprintf(filename, sizeof(filename), "%s.%02d.%s", outputPrefix, ctx->logIndex, suffix);
+    file = fopen(filename, "w");
+    if (!file)
+        perror(filename);
+
+    return file;
+}
+
+static bool verifierOpen(verifier_t *v, const char *filename)
+{
+    memset(v, 0, sizeof(*v));
+
+    v->file = fopen(filename, "r");
+    if (!v->file) {
+        perror(filename);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Read the next row of expected values. Returns false at the end of the file, or of this log's rows (the next log
+ * starts with a line of column names).
+ */
+static bool verifierReadRow(verifier_t *v)
+{
+    char *pos, *end;
+    long position;
+    int column;
+
+    v->haveRow = false;
+
+    position = ftell(v->file);
+    if (getline(&v->line, &v->lineSize, v->file) < 0)
+        return false;
+
+    if (!isdigit((unsigned char)v->line[0]) && v->line[0] != '-') {
+        fseek(v->file, position, SEEK_SET);
+        return false;
+    }
+    v->row++;
+
+    for (column = 0, pos = v->line; column < v->columnCount && column < (int)ARRAY_LENGTH(v->expected);
+            column++, pos = end + 1) {
+        v->expected[column] = (int32_t)strtoll(pos, &end, 10);
+        if (*end != ',')
+            break;
+    }
+
+    v->haveRow = true;
+    return true;
+}
+
+/**
+ * Read the column names of the expected CSV and work out where each of the log's main fields is in it.
+ */
+static bool verifierStartLog(verifier_t *v, const flightLog_t *log)
+{
+    const flightLogFrameDef_t *def = &log->frameDefs[FLIGHT_LOG_FRAME_INTRA];
+    char *name, *save;
+    int column, i;
+
+    if (getline(&v->line, &v->lineSize, v->file) < 0) {
+        fprintf(stderr, "Expected values file has no more logs in it\n");
+        return false;
+    }
+    v->row++;
+
+    for (i = 0; i < def->fieldCount; i++)
+        v->columnForField[i] = -1;
+
+    v->line[strcspn(v->line, "\r\n")] = '\0';
+    for (column = 0, name = strtok_r(v->line, ",", &save); name; column++, name = strtok_r(NULL, ",", &save)) {
+        for (i = 0; i < def->fieldCount; i++)
+            if (strcmp(def->names[i], name) == 0)
+                v->columnForField[i] = column;
+    }
+    v->columnCount = column;
+
+    for (i = 0; i < def->fieldCount; i++)
+        if (v->columnForField[i] == -1)
+            fprintf(stderr, "Field %s isn't in the expected values, not checking it\n", def->names[i]);
+
+    v->iterationColumn = log->loopIterationField >= 0 ? v->columnForField[log->loopIterationField] : -1;
+    if (v->iterationColumn < 0) {
+        fprintf(stderr, "Can't match up frames without a loopIteration column\n");
+        return false;
+    }
+
+    verifierReadRow(v);
+    return true;
+}
+
+/**
+ * Compare a decoded frame with the expected row for the same loop iteration. Expected rows for iterations that
+ * weren't decoded (because the frames were damaged) are counted as missing.
+ */
+static void verifierCheckFrame(verifier_t *v, const flightLog_t *log, const int32_t *values)
+{
+    const flightLogFrameDef_t *def = &log->frameDefs[FLIGHT_LOG_FRAME_INTRA];
+    uint32_t iteration = values[log->loopIterationField];
+    int column, i;
+
+    while (v->haveRow && (uint32_t)v->expected[v->iterationColumn] < iteration) {
+        v->missing++;
+        verifierReadRow(v);
+    }
+
+    if (!v->haveRow || (uint32_t)v->expected[v->iterationColumn] != iteration) {
+        if (v->mismatched++ < MAX_REPORTED_MISMATCHES)
+            fprintf(stderr, "Decoded a frame for iteration %u, which wasn't logged\n", iteration);
+        return;
+    }
+
+    for (i = 0; i < def->fieldCount; i++) {
+        column = v->columnForField[i];
+        if (column >= 0 && v->expected[column] != values[i]) {
+            if (v->mismatched++ < MAX_REPORTED_MISMATCHES)
+                fprintf(stderr, "Row %ld: %s decoded as %d, expected %d\n", v->row, def->names[i], values[i],
+                    v->expected[column]);
+            verifierReadRow(v);
+            return;
+        }
+    }
+
+    v->matched++;
+    verifierReadRow(v);
+}
+
+/**
+ * Anything left over in the expected values for this log was encoded but never decoded.
+ */
+static void verifierFinishLog(verifier_t *v)
+{
+    while (v->haveRow) {
+        v->missing++;
+        verifierReadRow(v);
+    }
+}
+
+static bool columnarAppend(columnarBuffer_t *col, const int32_t *main, int mainCount, const int32_t *slow, int slowCount)
+{
+    int32_t *row;
+
+    if (col->count == col->capacity) {
+        col->capacity = col->capacity ? col->capacity * 2 : 4096;
+        row = realloc(col->rows, col->capacity * col->columns * sizeof(int32_t));
+        if (!row)
+            return false;
+        col->rows = row;
+    }
+
+    row = col->rows + col->count++ * col->columns;
+    memcpy(row, main, mainCount * sizeof(int32_t));
+    memcpy(row + mainCount, slow, slowCount * sizeof(int32_t));
+
+    return true;
+}
+
+/**
+ * Write the main frames in columnar form, all in host byte order:
+ *
+ *   "BBCOL1\n"
+ *   uint32_t columnCount, uint32_t frameCount
+ *   columnCount column names, each terminated by a NUL
+ *   columnCount bytes, 1 if the column is signed
+ *   columnCount arrays of frameCount int32_t values, one per column, in the same order as the names
+ *
+ * The columns are the main fields followed by the slow fields, like the CSV.
+ */
+static bool writeColumnar(const decodeContext_t *ctx, const flightLog_t *log)
+{
+    const flightLogFrameDef_t *defs[2] = { &log->frameDefs[FLIGHT_LOG_FRAME_INTRA], &log->frameDefs[FLIGHT_LOG_FRAME_SLOW] };
+    const columnarBuffer_t *col = ctx->columnar;
+    uint32_t header[2] = { col->columns, col->count };
+    outputBuffer_t *out;
+    size_t frame;
+    int column, d, i;
+
+    out = outputOpen(openLogOutput(ctx, "col"));
+    if (!out || !out->file) {
+        free(out);
+        return false;
+    }
+
+    outputString(out, COLUMNAR_MAGIC);
+    memcpy(out->buffer + out->length, header, sizeof(header));
+    out->length += sizeof(header);
+
+    for (d = 0; d < 2; d++)
+        for (i = 0; i < defs[d]->fieldCount; i++) {
+            outputReserve(out, FLIGHT_LOG_MAX_FIELD_NAME + 1);
+            outputString(out, defs[d]->names[i]);
+            outputChar(out, '\0');
+        }
+
+    for (d = 0; d < 2; d++)
+        for (i = 0; i < defs[d]->fieldCount; i++) {
+            outputReserve(out, 1);
+            outputChar(out, defs[d]->isSigned[i]);
+        }
+
+    for (column = 0; column < col->columns; column++) {
+        for (frame = 0; frame < col->count; frame++) {
+            outputReserve(out, sizeof(int32_t));
+            memcpy(out->buffer + out->length, &col->rows[frame * col->columns + column], sizeof(int32_t));
+            out->length += sizeof(int32_t);
+        }
+    }
+
+    outputClose(out);
+    return true;
+}
+
+/**
+ * Is a main frame with this time in the stretch we're decoding? Without an index to give the time the log started at,
+ * the first main frame we see is taken to be the start.
+ */
+static bool frameInTimeRange(decodeContext_t *ctx, uint32_t time)
+{
+    int64_t sinceStart;
+
+    if (!ctx->haveTimeBase) {
+        ctx->timeBase = time;
+        ctx->haveTimeBase = true;
+    }
+
+    sinceStart = (int32_t)(time - ctx->timeBase);
+
+    return (ctx->timeFrom < 0 || sinceStart >= ctx->timeFrom) && (ctx->timeTo < 0 || sinceStart <= ctx->timeTo);
+}
+
+static void onFrame(flightLog_t *log, flightLogFrameType_e type, const int32_t *values, void *context)
+{
+    decodeContext_t *ctx = context;
+    const flightLogFrameDef_t *mainDef = &log->frameDefs[FLIGHT_LOG_FRAME_INTRA];
+    const flightLogFrameDef_t *slowDef = &log->frameDefs[FLIGHT_LOG_FRAME_SLOW];
+    const flightLogFrameDef_t *gpsDef = &log->frameDefs[FLIGHT_LOG_FRAME_GPS];
+
+    switch (type) {
+        case FLIGHT_LOG_FRAME_INTRA:
+        case FLIGHT_LOG_FRAME_INTER:
+            if (ctx->timeLimited && log->timeField >= 0 && !frameInTimeRange(ctx, values[log->timeField]))
+                break;
+
+            if (ctx->verifier)
+                verifierCheckFrame(ctx->verifier, log, values);
+
+            if (ctx->columnar)
+                columnarAppend(ctx->columnar, values, mainDef->fieldCount, ctx->slowValues, slowDef->fieldCount);
+
+            if (ctx->csv) {
+                // A value takes up to 11 characters, plus its comma
+                outputReserve(ctx->csv, (mainDef->fieldCount + slowDef->fieldCount) * 12 + 1);
+                writeValues(ctx->csv, mainDef, values, true);
+                writeValues(ctx->csv, slowDef, ctx->slowValues, false);
+                outputChar(ctx->csv, '\n');
+            }
+            break;
+        case FLIGHT_LOG_FRAME_SLOW:
+            memcpy(ctx->slowValues, values, slowDef->fieldCount * sizeof(values[0]));
+            break;
+        case FLIGHT_LOG_FRAME_GPS:
+            if (ctx->verifier || toStdout)
+                break;
+
+            if (!ctx->gps) {
+                ctx->gps = outputOpen(openLogOutput(ctx, "gps.csv"));
+                if (ctx->gps && ctx->gps->file) {
+                    writeFieldNames(ctx->gps, gpsDef, true);
+                    outputChar(ctx->gps, '\n');
+                }
+            }
+            if (ctx->gps && ctx->gps->file) {
+                outputReserve(ctx->gps, gpsDef->fieldCount * 12 + 1);
+                writeValues(ctx->gps, gpsDef, values, true);
+                outputChar(ctx->gps, '\n');
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static void onEvent(flightLog_t *log, uint8_t event, const uint32_t *data, void *context)
+{
+    // In the order of the FlightLogFlightMode and FlightLogCalibration values
+    static const char *flightModeNames[] = { "ANGLE", "HORIZON", "BARO", "MAG", "HEADFREE", "GPS_HOME", "GPS_HOLD",
+        "PASSTHRU" };
+    static const char *calibrationNames[] = { "gyro", "acc", "mag", "in-flight acc" };
+    decodeContext_t *ctx = context;
+    int i;
+
+    (void)log;
+
+    if (ctx->verifier || toStdout)
+        return;
+
+    if (!ctx->events) {
+        ctx->events = openLogOutput(ctx, "event");
+        if (!ctx->events)
+            return;
+    }
+
+    switch (event) {
+        case FLIGHT_LOG_EVENT_SYNC_BEEP:
+            fprintf(ctx->events, "Sync beep at %u us\n", data[0]);
+            break;
+        case FLIGHT_LOG_EVENT_FRAMES_DROPPED:
+            fprintf(ctx->events, "%u frames dropped\n", data[0]);
+            break;
+        case FLIGHT_LOG_EVENT_CAPTURE_START:
+            // No triggers means we lost the window's first start event and only caught a repeat
+            fprintf(ctx->events, "Capture window from iteration %u, triggers:%s%s%s%s\n", data[0],
+                data[1] & FLIGHT_LOG_CAPTURE_MOTOR_LIMIT ? " motor-limit" : "",
+                data[1] & FLIGHT_LOG_CAPTURE_FAILSAFE ? " failsafe" : "",
+                data[1] & FLIGHT_LOG_CAPTURE_GYRO_SPIKE ? " gyro-spike" : "",
+                data[1] == 0 ? " unknown" : "");
+            break;
+        case FLIGHT_LOG_EVENT_CAPTURE_END:
+            fprintf(ctx->events, "Capture window ends at iteration %u\n", data[0]);
+            break;
+        case FLIGHT_LOG_EVENT_FLIGHT_MODE:
+            fprintf(ctx->events, "%u us: flight modes:", data[0]);
+            for (i = 0; i < (int) (sizeof(flightModeNames) / sizeof(flightModeNames[0])); i++)
+                if (data[1] & (1 << i))
+                    fprintf(ctx->events, " %s", flightModeNames[i]);
+            fprintf(ctx->events, "%s\n", data[1] == 0 ? " ACRO" : "");
+            break;
+        case FLIGHT_LOG_EVENT_FAILSAFE:
+            fprintf(ctx->events, "%u us: failsafe %s\n", data[0], data[1] ? "on" : "off");
+            break;
+        case FLIGHT_LOG_EVENT_CALIBRATION:
+            fprintf(ctx->events, "%u us: %s calibration\n", data[0],
+                data[1] < sizeof(calibrationNames) / sizeof(calibrationNames[0]) ? calibrationNames[data[1]] : "unknown");
+            break;
+        case FLIGHT_LOG_EVENT_GPS_FIX:
+            if (data[1])
+                fprintf(ctx->events, "%u us: GPS fix with %u satellites\n", data[0], data[1]);
+            else
+                fprintf(ctx->events, "%u us: GPS fix lost\n", data[0]);
+            break;
+        case FLIGHT_LOG_EVENT_CONFIG_CHANGE:
+            fprintf(ctx->events, "%u us: settings changed by MSP command %u\n", data[0], data[1]);
+            break;
+        case FLIGHT_LOG_EVENT_LOG_END:
+            fprintf(ctx->events, "%u us: end of log\n", data[0]);
+            break;
+        default:
+            fprintf(ctx->events, "Event %u\n", event);
+            break;
+    }
+}
+
+static void printStats(const decodeJob_t *job)
+{
+    static const char frameLetters[FLIGHT_LOG_FRAME_TYPE_COUNT] = { 'I', 'P', 'G', 'H', 'S' };
+    const flightLog_t *log = &job->log;
+    const flightLogStats_t *stats = &log->stats;
+    const flightLogIndex_t *index = &job->footer;
+    uint64_t totalBytes = 0;
+    int i;
+
+    fprintf(stderr, "Log %d:\n", job->index);
+    if (job->hasFooter)
+        fprintf(stderr, "  %.3f s over %u iterations, %u keyframes (%d indexed), %u flight events\n",
+            index->duration / 1e6, index->iterations, index->keyframeCount, index->entryCount, index->eventCount);
+    if (job->decodeStart > 0 || job->decodeEnd < job->size)
+        fprintf(stderr, "  decoded bytes %zu to %zu of %zu\n", job->decodeStart, job->decodeEnd, job->size);
+    for (i = 0; i < FLIGHT_LOG_FRAME_TYPE_COUNT; i++) {
+        if (stats->frameCount[i] == 0)
+            continue;
+        fprintf(stderr, "  %c frames %9u %6.1f bytes avg %12llu bytes total\n", frameLetters[i], stats->frameCount[i],
+            (double)stats->frameBytes[i] / stats->frameCount[i], (unsigned long long)stats->frameBytes[i]);
+        totalBytes += stats->frameBytes[i];
+    }
+    fprintf(stderr, "  %u events, %u frames dropped by the firmware, %u corrupt, %u unusable, %llu bytes skipped\n",
+        stats->eventCount, stats->droppedFrames, stats->corruptFrames, stats->unusableFrames,
+        (unsigned long long)stats->skippedBytes);
+    if (log->frameCheck != FLIGHT_LOG_FRAME_CHECK_NONE)
+        fprintf(stderr, "  %u frames failed their CRC\n", stats->failedChecks);
+    if (log->compression != FLIGHT_LOG_COMPRESSION_NONE && totalBytes > 0)
+        fprintf(stderr, "  %u blocks, frames compressed to %llu bytes (%.1f%%), %u damaged stretches\n",
+            stats->blockCount, (unsigned long long)stats->blockBytes, 100.0 * stats->blockBytes / totalBytes,
+            stats->corruptBlocks);
+    if (job->seconds > 0)
+        fprintf(stderr, "  decoded in %.3f s (%.1f MB/s)\n", job->seconds, totalBytes / job->seconds / 1e6);
+}
+
+/**
+ * Work out which part of the log to decode to get the frames from ctx's stretch of the flight, using the index.
+ */
+static void findDecodeRange(decodeJob_t *job, const decodeContext_t *ctx)
+{
+    const flightLogIndex_t *index = &job->footer;
+    uint32_t firstOffset;
+    int i;
+
+    job->decodeStart = 0;
+    job->decodeEnd = job->size;
+
+    if (!job->hasFooter)
+        return;
+
+    // Start from the last keyframe at or before the start
+    if (ctx->timeFrom >= 0) {
+        for (i = 0; i < index->entryCount && index->entryTime[i] - index->startTime <= ctx->timeFrom; i++)
+            job->decodeStart = index->entryOffset[i];
+    }
+
+    if (ctx->timeTo < 0)
+        return;
+
+    // The first keyframe after the end can share a block with earlier frames, so stop at the block after it
+    for (i = 0; i < index->entryCount && index->entryTime[i] - index->startTime <= ctx->timeTo; i++)
+        ;
+    if (i < index->entryCount) {
+        for (firstOffset = index->entryOffset[i]; i < index->entryCount && index->entryOffset[i] <= firstOffset; i++)
+            ;
+        if (i < index->entryCount)
+            job->decodeEnd = index->entryOffset[i];
+    }
+}
+
+/**
+ * Decode one flight to its output files (or check it against the expected values).
+ */
+static void decodeJob(decodeJob_t *job)
+{
+    flightLog_t *log = &job->log;
+    const flightLogFrameDef_t *mainDef = &log->frameDefs[FLIGHT_LOG_FRAME_INTRA];
+    const flightLogFrameDef_t *slowDef = &log->frameDefs[FLIGHT_LOG_FRAME_SLOW];
+    struct timespec start, finish;
+    decodeContext_t ctx;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.logIndex = job->index;
+    ctx.verifier = verifier;
+
+    job->hasFooter = flightLogReadIndex(job->data, job->size, &job->footer);
+    job->decodeStart = 0;
+    job->decodeEnd = job->size;
+
+    if (startSeconds >= 0 || endSeconds >= 0) {
+        ctx.timeLimited = true;
+        ctx.timeFrom = startSeconds >= 0 ? (int64_t)(startSeconds * 1e6) : -1;
+        ctx.timeTo = endSeconds >= 0 ? (int64_t)(endSeconds * 1e6) : -1;
+        if (job->hasFooter) {
+            ctx.timeBase = job->footer.startTime;
+            ctx.haveTimeBase = true;
+        }
+        findDecodeRange(job, &ctx);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // Parse the header first so we know which columns to write
+    if (!flightLogParseHeader(log, job->data, job->size)) {
+        fprintf(stderr, "Log %d has no usable header, skipping it\n", job->index);
+        return;
+    }
+
+    if (ctx.verifier) {
+        if (!verifierStartLog(ctx.verifier, log))
+            return;
+    } else if (binaryOutput) {
+        ctx.columnar = calloc(1, sizeof(*ctx.columnar));
+        if (!ctx.columnar)
+            return;
+        ctx.columnar->columns = mainDef->fieldCount + slowDef->fieldCount;
+    } else {
+        ctx.csv = outputOpen(openLogOutput(&ctx, "csv"));
+        if (!ctx.csv || !ctx.csv->file) {
+            free(ctx.csv);
+            return;
+        }
+        writeFieldNames(ctx.csv, mainDef, true);
+        writeFieldNames(ctx.csv, slowDef, false);
+        outputChar(ctx.csv, '\n');
+    }
+
+    job->ok = flightLogParseRange(log, job->data, job->size, job->decodeStart, job->decodeEnd, onFrame, onEvent, &ctx);
+    if (!job->ok)
+        fprintf(stderr, "Log %d couldn't be decoded\n", job->index);
+
+    if (ctx.verifier)
+        verifierFinishLog(ctx.verifier);
+
+    if (ctx.columnar) {
+        if (job->ok)
+            job->ok = writeColumnar(&ctx, log);
+        free(ctx.columnar->rows);
+        free(ctx.columnar);
+    }
+
+    outputClose(ctx.csv);
+    outputClose(ctx.gps);
+    if (ctx.events && ctx.events != stdout)
+        fclose(ctx.events);
+
+    clock_gettime(CLOCK_MONOTONIC, &finish);
+    job->seconds = (finish.tv_sec - start.tv_sec) + (finish.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static void *decodeWorker(void *arg)
+{
+    int i;
+
+    (void)arg;
+
+    while ((i = __sync_fetch_and_add(&nextJob, 1)) < jobCount)
+        decodeJob(&jobs[i]);
+
+    return NULL;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+        "Usage: %s [options] logfile\n"
+        "  --index n        only decode the n-th log in the file (starting from 1)\n"
+        "  --prefix name    name output files name.01.csv and so on (default: the log filename without extension)\n"
+        "  --binary         write the main frames in columnar binary form (name.01.col) instead of CSV\n"
+        "  --threads n      decode up to n flights at once (default: one per CPU)\n"
+        "  --stdout         write the main frames CSV to stdout instead of files\n"
+        "  --verify file    check the decoded main frames against the expected values in this CSV file\n"
+        "  --start s        only decode the main frames from s seconds into each log on\n"
+        "  --end s          only decode the main frames up to s seconds into each log\n",
+        name);
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct option longOptions[] = {
+        { "index", required_argument, NULL, 'i' },
+        { "prefix", required_argument, NULL, 'p' },
+        { "binary", no_argument, NULL, 'b' },
+        { "threads", required_argument, NULL, 't' },
+        { "stdout", no_argument, NULL, 's' },
+        { "verify", required_argument, NULL, 'v' },
+        { "start", required_argument, NULL, 'S' },
+        { "end", required_argument, NULL, 'E' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    const char *verifyFilename = NULL, *inputFilename;
+    char prefix[4096], *dot;
+    size_t logStarts[MAX_LOGS], logEnd;
+    int onlyLog = 0, threadCount = 0, logCount, i, opt, fd, result = 0;
+    pthread_t threads[MAX_THREADS];
+    struct timespec start, finish;
+    verifier_t verifierState;
+    const uint8_t *data;
+    uint64_t totalBytes;
+    double seconds;
+    struct stat st;
+
+    prefix[0] = '\0';
+
+    while ((opt = getopt_long(argc, argv, "", longOptions, NULL)) != -1) {
+        switch (opt) {
+            case 'i':
+                onlyLog = atoi(optarg);
+                break;
+            case 'p':
+                snprintf(prefix, sizeof(prefix), "%s", optarg);
+                break;
+            case 'b':
+                binaryOutput = true;
+                break;
+            case 't':
+                threadCount = atoi(optarg);
+                break;
+            case 's':
+                toStdout = true;
+                break;
+            case 'v':
+                verifyFilename = optarg;
+                break;
+            case 'S':
+                startSeconds = atof(optarg);
+                break;
+            case 'E':
+                endSeconds = atof(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 1;
+    }
+    inputFilename = argv[optind];
+
+    if (!prefix[0]) {
+        snprintf(prefix, sizeof(prefix), "%s", inputFilename);
+        dot = strrchr(prefix, '.');
+        if (dot && !strchr(dot, '/'))
+            *dot = '\0';
+    }
+    outputPrefix = prefix;
+
+    if (toStdout && binaryOutput) {
+        fprintf(stderr, "--binary can only write to files\n");
+        return 1;
+    }
+
+    if (verifyFilename && (startSeconds >= 0 || endSeconds >= 0)) {
+        fprintf(stderr, "--verify checks whole logs, it can't be used with --start or --end\n");
+        return 1;
+    }
+
+    fd = open(inputFilename, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(inputFilename);
+        return 1;
+    }
+
+    if (st.st_size == 0) {
+        fprintf(stderr, "%s is empty\n", inputFilename);
+        return 1;
+    }
+
+    /*
+     * Map the whole file rather than reading it, so each thread can work on its own flights in place. Each flight is
+     * read sequentially, which the kernel's readahead keeps up with even for huge logs.
+     */
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        perror(inputFilename);
+        return 1;
+    }
+    madvise((void *)data, st.st_size, MADV_SEQUENTIAL);
+
+    logCount = flightLogFindLogs(data, st.st_size, logStarts, MAX_LOGS);
+    if (logCount == 0) {
+        fprintf(stderr, "%s doesn't contain any blackbox logs\n", inputFilename);
+        return 1;
+    }
+    if (logCount > MAX_LOGS) {
+        fprintf(stderr, "%s contains %d logs, only decoding the first %d\n", inputFilename, logCount, MAX_LOGS);
+        logCount = MAX_LOGS;
+    }
+    if (onlyLog > logCount) {
+        fprintf(stderr, "%s only contains %d logs\n", inputFilename, logCount);
+        return 1;
+    }
+
+    jobs = calloc(logCount, sizeof(*jobs));
+    if (!jobs)
+        return 1;
+
+    for (i = 0; i < logCount; i++) {
+        if (onlyLog && i + 1 != onlyLog)
+            continue;
+
+        logEnd = i + 1 < logCount ? logStarts[i + 1] : (size_t)st.st_size;
+        jobs[jobCount].index = i + 1;
+        jobs[jobCount].data = data + logStarts[i];
+        jobs[jobCount].size = logEnd - logStarts[i];
+        jobCount++;
+    }
+
+    if (verifyFilename) {
+        if (!verifierOpen(&verifierState, verifyFilename))
+            return 1;
+        verifier = &verifierState;
+    }
+
+    // The expected values and stdout are read and written in log order, so those have to be done one log at a time
+    if (threadCount <= 0)
+        threadCount = sysconf(_SC_NPROCESSORS_ONLN);
+    if (verifier || toStdout || threadCount < 1)
+        threadCount = 1;
+    threadCount = min(min(threadCount, MAX_THREADS), jobCount);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (threadCount == 1) {
+        decodeWorker(NULL);
+    } else {
+        for (i = 0; i < threadCount; i++) {
+            if (pthread_create(&threads[i], NULL, decodeWorker, NULL) != 0) {
+                perror("pthread_create");
+                return 1;
+            }
+        }
+        for (i = 0; i < threadCount; i++)
+            pthread_join(threads[i], NULL);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &finish);
+
+    totalBytes = 0;
+    for (i = 0; i < jobCount; i++) {
+        if (!jobs[i].ok) {
+            result = 1;
+            continue;
+        }
+        printStats(&jobs[i]);
+        totalBytes += jobs[i].size;
+    }
+
+    seconds = (finish.tv_sec - start.tv_sec) + (finish.tv_nsec - start.tv_nsec) / 1e9;
+    if (jobCount > 1 && seconds > 0)
+        fprintf(stderr, "%d logs decoded in %.3f s with %d threads (%.1f MB/s)\n", jobCount, seconds, threadCount,
+            totalBytes / seconds / 1e6);
+
+    if (verifier) {
+        fprintf(stderr, "Verify: %u frames match, %u differ, %u expected frames weren't decoded\n", verifier->matched,
+            verifier->mismatched, verifier->missing);
+        if (verifier->mismatched > 0 || verifier->missing > 0 || verifier->matched == 0)
+            result = 1;
+        fclose(verifier->file);
+        free(verifier->line);
+    }
+
+    free(jobs);
+    munmap((void *)data, st.st_size);
+    close(fd);
+
+    return result;
+}
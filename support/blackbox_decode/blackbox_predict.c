@@ -0,0 +1,608 @@
+/*
+ * This file is part of baseflight
+ * Licensed under GPL V3 or modified DCL - see https://github.com/multiwii/baseflight/blob/master/README.md
+ */
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "parser.h"
+
+/*
+ * Replay blackbox logs through the P-frame encoder with different predictors, to see which one suits each field best.
+ * For every field and every candidate predictor it reports how big the P-frames would have been on average if only
+ * that field's predictor had been changed, keeping every encoding as it is. Then it picks the best predictor for each
+ * field and replays the log again with all of those choices at once.
+ *
+ * The sizes are computed with the firmware's encoding rules, and the size of the log's own P-frames is checked against
+ * the bytes actually in the log, so the numbers are exact rather than estimates.
+ *
+ * With --huffman it instead counts how often each byte value appears in the frames of the (uncompressed) logs, and
+ * prints a code table for blackbox_compress.h built from those counts.
+ */
+
+#define MAX_LOGS 1024
+
+#define HUFFMAN_SYMBOLS 256
+#define HUFFMAN_MAX_CODE_LENGTH 12
+
+static const uint8_t candidates[] = {
+    FLIGHT_LOG_FIELD_PREDICTOR_0,
+    FLIGHT_LOG_FIELD_PREDICTOR_PREVIOUS,
+    FLIGHT_LOG_FIELD_PREDICTOR_STRAIGHT_LINE,
+    FLIGHT_LOG_FIELD_PREDICTOR_AVERAGE_2,
+    FLIGHT_LOG_FIELD_PREDICTOR_LINEAR_3,
+    FLIGHT_LOG_FIELD_PREDICTOR_MIXER
+};
+
+static const char *const candidateNames[] = { "zero", "previous", "straight", "average2", "linear3", "mixer" };
+
+#define CANDIDATE_COUNT ((int)(sizeof(candidates) / sizeof(candidates[0])))
+
+typedef struct replayState_t {
+    int32_t history[FLIGHT_LOG_HISTORY_LENGTH][FLIGHT_LOG_MAX_FIELDS];
+    bool haveHistory;
+
+    // Field i is encoded in the group that starts at groupStart[i] and holds groupSize[groupStart[i]] fields
+    int groupStart[FLIGHT_LOG_MAX_FIELDS];
+    int groupSize[FLIGHT_LOG_MAX_FIELDS];
+
+    // The predictor to use for each field in the second pass
+    uint8_t bestPredictor[FLIGHT_LOG_MAX_FIELDS];
+    bool secondPass;
+
+    int frameOverhead;                                          // the marker, plus the CRC if the log has frame checks
+
+    uint32_t frames;
+    uint64_t loggedBytes;                                       // as encoded with the log's own predictors
+    uint64_t changedBytes[FLIGHT_LOG_MAX_FIELDS][CANDIDATE_COUNT];
+    uint64_t bestBytes;
+} replayState_t;
+
+static int unsignedVBSize(uint32_t value)
+{
+    int size = 1;
+
+    while (value > 127) {
+        value >>= 7;
+        size++;
+    }
+
+    return size;
+}
+
+static int signedVBSize(int32_t value)
+{
+    // ZigZag encode to make the value always positive
+    return unsignedVBSize((uint32_t)((value << 1) ^ (value >> 31)));
+}
+
+static int tag2_3S32Size(const int32_t *values)
+{
+    int x, bits = 2, size;
+
+    for (x = 0; x < 3; x++) {
+        if (values[x] >= 32 || values[x] < -32)
+            bits = 32;
+        else if ((values[x] >= 8 || values[x] < -8) && bits < 6)
+            bits = 6;
+        else if ((values[x] >= 2 || values[x] < -2) && bits < 4)
+            bits = 4;
+    }
+
+    switch (bits) {
+        case 2:
+            return 1;
+        case 4:
+            return 2;
+        case 6:
+            return 3;
+    }
+
+    size = 1;
+    for (x = 0; x < 3; x++) {
+        if (values[x] < 128 && values[x] >= -128)
+            size += 1;
+        else if (values[x] < 32768 && values[x] >= -32768)
+            size += 2;
+        else if (values[x] < 8388608 && values[x] >= -8388608)
+            size += 3;
+        else
+            size += 4;
+    }
+
+    return size;
+}
+
+static int tag8_4S16Size(const int32_t *values)
+{
+    int x, nibbles = 0;
+
+    for (x = 0; x < 4; x++) {
+        if (values[x] == 0)
+            continue;
+        else if (values[x] < 8 && values[x] >= -8)
+            nibbles += 1;
+        else if (values[x] < 128 && values[x] >= -128)
+            nibbles += 2;
+        else
+            nibbles += 4;
+    }
+
+    return 1 + (nibbles + 1) / 2;
+}
+
+static int tag5_4SNBitSize(const int32_t *values, int count)
+{
+    uint32_t magnitudes = 0;
+    bool nonZero = false;
+    int width, i;
+
+    for (i = 0; i < count; i++) {
+        magnitudes |= values[i] ^ (values[i] >> 31);
+        nonZero |= values[i] != 0;
+    }
+
+    if (magnitudes)
+        width = 33 - __builtin_clz(magnitudes);
+    else
+        width = nonZero ? 1 : 0;
+
+    if (width >= 31)
+        width = 32;
+
+    return (5 + width * count + 7) / 8;
+}
+
+static int tag8_8SVBSize(const int32_t *values, int count)
+{
+    int x, size;
+
+    if (count == 1)
+        return signedVBSize(values[0]);
+
+    size = 1;
+    for (x = 0; x < count; x++)
+        if (values[x] != 0)
+            size += signedVBSize(values[x]);
+
+    return size;
+}
+
+/**
+ * Size of the group of fields that starts at 'first', given the residual (value minus prediction) of each field.
+ */
+static int groupSize(const flightLogFrameDef_t *def, const replayState_t *state, int first, const int32_t *residuals)
+{
+    int32_t group[8] = { 0 };
+    int count = state->groupSize[first];
+
+    switch (def->encoding[first]) {
+        case FLIGHT_LOG_FIELD_ENCODING_SIGNED_VB:
+            return signedVBSize(residuals[first]);
+        case FLIGHT_LOG_FIELD_ENCODING_UNSIGNED_VB:
+            return unsignedVBSize(residuals[first]);
+        case FLIGHT_LOG_FIELD_ENCODING_NEG_14BIT:
+            return unsignedVBSize(-residuals[first] & 0x3FFF);
+        case FLIGHT_LOG_FIELD_ENCODING_TAG8_8SVB:
+            return tag8_8SVBSize(residuals + first, count);
+        case FLIGHT_LOG_FIELD_ENCODING_TAG2_3S32:
+            memcpy(group, residuals + first, count * sizeof(group[0]));
+            return tag2_3S32Size(group);
+        case FLIGHT_LOG_FIELD_ENCODING_TAG8_4S16:
+            memcpy(group, residuals + first, count * sizeof(group[0]));
+            return tag8_4S16Size(group);
+        case FLIGHT_LOG_FIELD_ENCODING_TAG5_4SNBIT:
+            return tag5_4SNBitSize(residuals + first, count);
+        case FLIGHT_LOG_FIELD_ENCODING_NULL:
+        default:
+            return 0;
+    }
+}
+
+static void findGroups(const flightLogFrameDef_t *def, replayState_t *state)
+{
+    int i, first;
+
+    for (first = 0; first < def->fieldCount; first += state->groupSize[first]) {
+        state->groupSize[first] = flightLogGroupLength(def, first);
+        for (i = first; i < first + state->groupSize[first]; i++)
+            state->groupStart[i] = first;
+    }
+}
+
+// Size of a whole P-frame including its marker byte (and CRC)
+static int frameSize(const flightLogFrameDef_t *def, const replayState_t *state, const int32_t *residuals)
+{
+    int i, size = state->frameOverhead;
+
+    for (i = 0; i < def->fieldCount; i += state->groupSize[i])
+        size += groupSize(def, state, i, residuals);
+
+    return size;
+}
+
+static bool candidateApplies(const flightLog_t *log, uint8_t predictor, int field)
+{
+    int motor;
+
+    if (predictor != FLIGHT_LOG_FIELD_PREDICTOR_MIXER)
+        return true;
+
+    // Only motors have a mixer prediction, and only if the log has the mixer coefficients
+    for (motor = 0; motor < log->motorCount; motor++)
+        if (log->motorFields[motor] == field)
+            return log->motorMix[motor][0] != 0;
+
+    return false;
+}
+
+static void replayInterframe(const flightLog_t *log, replayState_t *state, const int32_t *values)
+{
+    const flightLogFrameDef_t *def = &log->frameDefs[FLIGHT_LOG_FRAME_INTER];
+    int32_t residuals[FLIGHT_LOG_MAX_FIELDS], changed[FLIGHT_LOG_MAX_FIELDS];
+    int i, c, first, baseSize, baseGroupSize;
+    uint8_t predictor;
+
+    for (i = 0; i < def->fieldCount; i++) {
+        predictor = state->secondPass ? state->bestPredictor[i] : def->predictor[i];
+
+        // loopIteration isn't written in P-frames, its INC prediction is always right
+        if (predictor == FLIGHT_LOG_FIELD_PREDICTOR_INC)
+            residuals[i] = 0;
+        else
+            residuals[i] = (int32_t)((uint32_t)values[i] - flightLogPredict(log, predictor, i, values, state->history));
+    }
+
+    baseSize = frameSize(def, state, residuals);
+    state->frames++;
+
+    if (state->secondPass) {
+        state->bestBytes += baseSize;
+        return;
+    }
+
+    state->loggedBytes += baseSize;
+
+    // Changing one field only changes the size of the group it's in
+    memcpy(changed, residuals, sizeof(changed));
+
+    for (i = 0; i < def->fieldCount; i++) {
+        if (def->encoding[i] == FLIGHT_LOG_FIELD_ENCODING_NULL)
+            continue;
+
+        first = state->groupStart[i];
+        baseGroupSize = groupSize(def, state, first, residuals);
+
+        for (c = 0; c < CANDIDATE_COUNT; c++) {
+            if (!candidateApplies(log, candidates[c], i))
+                continue;
+
+            changed[i] = (int32_t)((uint32_t)values[i] - flightLogPredict(log, candidates[c], i, values, state->history));
+            state->changedBytes[i][c] += baseSize - baseGroupSize + groupSize(def, state, first, changed);
+        }
+
+        changed[i] = residuals[i];
+    }
+}
+
+static void onFrame(flightLog_t *log, flightLogFrameType_e type, const int32_t *values, void *context)
+{
+    replayState_t *state = context;
+    int i;
+
+    switch (type) {
+        case FLIGHT_LOG_FRAME_INTRA:
+            for (i = 0; i < FLIGHT_LOG_HISTORY_LENGTH; i++)
+                memcpy(state->history[i], values, sizeof(state->history[i]));
+            state->haveHistory = true;
+            break;
+        case FLIGHT_LOG_FRAME_INTER:
+            if (!state->haveHistory)
+                break;
+
+            replayInterframe(log, state, values);
+
+            memmove(state->history[1], state->history[0], (FLIGHT_LOG_HISTORY_LENGTH - 1) * sizeof(state->history[0]));
+            memcpy(state->history[0], values, sizeof(state->history[0]));
+            break;
+        default:
+            break;
+    }
+}
+
+static const char *predictorName(uint8_t predictor)
+{
+    int c;
+
+    for (c = 0; c < CANDIDATE_COUNT; c++)
+        if (candidates[c] == predictor)
+            return candidateNames[c];
+
+    return "other";
+}
+
+static void reportLog(const uint8_t *data, size_t size, int logIndex)
+{
+    flightLog_t *log = calloc(1, sizeof(*log));
+    replayState_t *state = calloc(1, sizeof(*state));
+    const flightLogFrameDef_t *def;
+    uint64_t best;
+    double frames;
+    int i, c;
+
+    if (!log || !state || !flightLogParseHeader(log, data, size)) {
+        fprintf(stderr, "Log %d: couldn't parse the header\n", logIndex);
+        goto done;
+    }
+
+    def = &log->frameDefs[FLIGHT_LOG_FRAME_INTER];
+    findGroups(def, state);
+    state->frameOverhead = log->frameCheck == FLIGHT_LOG_FRAME_CHECK_CRC8 ? 2 : 1;
+
+    flightLogParse(log, data, size, onFrame, NULL, state);
+    frames = state->frames;
+
+    if (state->frames == 0) {
+        printf("Log %d: no P-frames\n\n", logIndex);
+        goto done;
+    }
+
+    printf("Log %d: %u P-frames, %.2f bytes/frame as logged\n", logIndex, state->frames, state->loggedBytes / frames);
+
+    // Only a log that decoded cleanly is guaranteed to hold exactly the P-frames we replayed
+    if (log->stats.corruptFrames == 0 && log->stats.unusableFrames == 0
+            && state->loggedBytes != log->stats.frameBytes[FLIGHT_LOG_FRAME_INTER])
+        printf("Warning: the replayed P-frames come to %llu bytes but the log holds %llu\n",
+            (unsigned long long)state->loggedBytes, (unsigned long long)log->stats.frameBytes[FLIGHT_LOG_FRAME_INTER]);
+
+    printf("\nBytes/P-frame when just this field's predictor is changed (* marks the log's own predictor):\n");
+    printf("%-16s", "field");
+    for (c = 0; c < CANDIDATE_COUNT; c++)
+        printf(" %10s", candidateNames[c]);
+    printf("\n");
+
+    for (i = 0; i < def->fieldCount; i++) {
+        state->bestPredictor[i] = def->predictor[i];
+
+        if (def->encoding[i] == FLIGHT_LOG_FIELD_ENCODING_NULL)
+            continue;
+
+        printf("%-16s", def->names[i]);
+
+        best = state->loggedBytes;
+        for (c = 0; c < CANDIDATE_COUNT; c++) {
+            if (!candidateApplies(log, candidates[c], i)) {
+                printf(" %10s", "-");
+                continue;
+            }
+
+            printf(" %9.2f%c", state->changedBytes[i][c] / frames, candidates[c] == def->predictor[i] ? '*' : ' ');
+
+            if (state->changedBytes[i][c] < best) {
+                best = state->changedBytes[i][c];
+                state->bestPredictor[i] = candidates[c];
+            }
+        }
+        printf("\n");
+    }
+
+    // Now replay with every field's best choice at once, since fields that share a group affect each other
+    state->secondPass = true;
+    state->haveHistory = false;
+    state->frames = 0;
+    flightLogParse(log, data, size, onFrame, NULL, state);
+
+    printf("\nWith the best predictor for each field: %.2f bytes/frame (%+.1f%%)\n", state->bestBytes / frames,
+        100.0 * ((double)state->bestBytes - state->loggedBytes) / state->loggedBytes);
+
+    for (i = 0; i < def->fieldCount; i++)
+        if (state->bestPredictor[i] != def->predictor[i])
+            printf("  %s: %s instead of %s\n", def->names[i], predictorName(state->bestPredictor[i]),
+                predictorName(def->predictor[i]));
+    printf("\n");
+
+done:
+    free(log);
+    free(state);
+}
+
+/**
+ * Fill in the Huffman code length of every byte value given how often each one appears. Every value gets a code, even
+ * ones that never appeared, and no code is longer than HUFFMAN_MAX_CODE_LENGTH. If the plain Huffman code would be
+ * too deep, the counts are flattened and the code rebuilt until it fits (that costs very little, since only the
+ * rarest values are affected).
+ */
+static void huffmanCodeLengths(const uint64_t *counts, uint8_t *lengths)
+{
+    uint64_t weight[HUFFMAN_SYMBOLS * 2];
+    int parent[HUFFMAN_SYMBOLS * 2];
+    bool merged[HUFFMAN_SYMBOLS * 2];
+    int nodes, i, depth, node, a, b, shift = 0, longest;
+
+    do {
+        for (i = 0; i < HUFFMAN_SYMBOLS; i++)
+            weight[i] = (counts[i] >> shift) + 1;
+
+        memset(merged, 0, sizeof(merged));
+        nodes = HUFFMAN_SYMBOLS;
+
+        // Repeatedly merge the two lightest nodes that haven't been merged yet, until only the root is left
+        while (nodes < HUFFMAN_SYMBOLS * 2 - 1) {
+            a = b = -1;
+            for (i = 0; i < nodes; i++) {
+                if (merged[i])
+                    continue;
+                if (a < 0 || weight[i] < weight[a]) {
+                    b = a;
+                    a = i;
+                } else if (b < 0 || weight[i] < weight[b]) {
+                    b = i;
+                }
+            }
+            weight[nodes] = weight[a] + weight[b];
+            parent[a] = parent[b] = nodes;
+            merged[a] = merged[b] = true;
+            nodes++;
+        }
+
+        longest = 0;
+        for (i = 0; i < HUFFMAN_SYMBOLS; i++) {
+            depth = 0;
+            for (node = i; node != nodes - 1; node = parent[node])
+                depth++;
+            lengths[i] = depth;
+            if (depth > longest)
+                longest = depth;
+        }
+
+        shift++;
+    } while (longest > HUFFMAN_MAX_CODE_LENGTH);
+}
+
+/**
+ * Print the canonical code for the given code lengths: codes are handed out in order of length, and by byte value
+ * among codes of the same length, which is how the decoder rebuilds them from the lengths alone.
+ */
+static void printHuffmanTable(const uint8_t *lengths, const uint64_t *counts)
+{
+    uint16_t codes[HUFFMAN_SYMBOLS];
+    uint64_t total = 0, bits = 0;
+    uint32_t code = 0;
+    int length, i;
+
+    for (length = 1; length <= HUFFMAN_MAX_CODE_LENGTH; length++) {
+        for (i = 0; i < HUFFMAN_SYMBOLS; i++)
+            if (lengths[i] == length)
+                codes[i] = code++;
+        code <<= 1;
+    }
+
+    for (i = 0; i < HUFFMAN_SYMBOLS; i++) {
+        total += counts[i];
+        bits += counts[i] * lengths[i];
+    }
+
+    printf("// Trained on %llu bytes of frames, which it codes in %.2f bits per byte\n", (unsigned long long)total,
+        total ? (double)bits / total : 0);
+    printf("static const blackboxHuffmanCode_t blackboxHuffmanTable[256] = {");
+    for (i = 0; i < HUFFMAN_SYMBOLS; i++)
+        printf("%s{0x%03x, %2d},", i % 8 == 0 ? "\n    " : " ", codes[i], lengths[i]);
+    printf("\n};\n");
+}
+
+static void countBytes(const uint8_t *data, size_t size, int logIndex, uint64_t *counts)
+{
+    flightLog_t *log = calloc(1, sizeof(*log));
+    const uint8_t *pos;
+
+    if (!log || !flightLogParseHeader(log, data, size)) {
+        fprintf(stderr, "Log %d: couldn't parse the header\n", logIndex);
+    } else if (log->compression != FLIGHT_LOG_COMPRESSION_NONE) {
+        fprintf(stderr, "Log %d: skipped, since it's already compressed\n", logIndex);
+    } else {
+        for (pos = log->dataStart; pos < data + size; pos++)
+            counts[*pos]++;
+    }
+
+    free(log);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+        "Usage: %s [options] logfile\n"
+        "  --index n        only replay the n-th log in the file (starting from 1)\n"
+        "  --huffman        print a compression code table trained on the logs instead\n",
+        name);
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct option longOptions[] = {
+        { "index", required_argument, NULL, 'i' },
+        { "huffman", no_argument, NULL, 'u' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    const char *inputFilename;
+    size_t logStarts[MAX_LOGS], logEnd;
+    int onlyLog = 0, logCount, i, opt, fd;
+    bool huffman = false;
+    uint64_t counts[HUFFMAN_SYMBOLS] = {0};
+    uint8_t lengths[HUFFMAN_SYMBOLS];
+    const uint8_t *data;
+    struct stat st;
+
+    while ((opt = getopt_long(argc, argv, "", longOptions, NULL)) != -1) {
+        switch (opt) {
+            case 'i':
+                onlyLog = atoi(optarg);
+                break;
+            case 'u':
+                huffman = true;
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 1;
+    }
+    inputFilename = argv[optind];
+
+    fd = open(inputFilename, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(inputFilename);
+        return 1;
+    }
+
+    if (st.st_size == 0) {
+        fprintf(stderr, "%s is empty\n", inputFilename);
+        return 1;
+    }
+
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        perror(inputFilename);
+        return 1;
+    }
+
+    logCount = flightLogFindLogs(data, st.st_size, logStarts, MAX_LOGS);
+    if (logCount == 0) {
+        fprintf(stderr, "%s doesn't contain any blackbox logs\n", inputFilename);
+        return 1;
+    }
+    if (logCount > MAX_LOGS)
+        logCount = MAX_LOGS;
+
+    for (i = 0; i < logCount; i++) {
+        if (onlyLog && i + 1 != onlyLog)
+            continue;
+
+        logEnd = i + 1 < logCount ? logStarts[i + 1] : (size_t)st.st_size;
+        if (huffman)
+            countBytes(data + logStarts[i], logEnd - logStarts[i], i + 1, counts);
+        else
+            reportLog(data + logStarts[i], logEnd - logStarts[i], i + 1);
+    }
+
+    if (huffman) {
+        huffmanCodeLengths(counts, lengths);
+        printHuffmanTable(lengths, counts);
+    }
+
+    munmap((void *)data, st.st_size);
+    close(fd);
+
+    return 0;
+}
@@ -0,0 +1,1110 @@
+/*
+ * This file is part of baseflight
+ * Licensed under GPL V3 or modified DCL - see https://github.com/multiwii/baseflight/blob/master/README.md
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "parser.h"
+#include "blackbox_compress.h"
+
+/*
+ * The log is parsed straight out of memory with a cursor, so the inner loop is just the byte-level decoding and the
+ * predictors. Frames carry no length, so a frame is only accepted once we've seen that it ends right where another
+ * frame (or the log) begins, and if the log has "H Frame check:1", that the CRC after it matches. When that check fails
+ * we skip a byte and look for the next frame marker, and ignore P-frames until an I-frame gives us a fresh history to
+ * predict from.
+ *
+ * Compressed logs are first unpacked into a plain stream of frames. Damaged blocks are left out, and the places where
+ * they were are remembered so the frame parser knows the history breaks there.
+ */
+
+#define LOG_START_MARKER "H Product:"
+
+// A block that claims to hold more than this can't have come from the firmware
+#define MAX_BLOCK_RAW_LENGTH 4096
+
+typedef struct {
+    const uint8_t *pos, *end;
+    bool overrun;
+} cursor_t;
+
+typedef struct {
+    int32_t history[FLIGHT_LOG_HISTORY_LENGTH][FLIGHT_LOG_MAX_FIELDS];  // [0] is the previous main frame, [1] the one before that...
+    bool historyValid;
+    uint32_t lastIteration;
+    bool inCaptureWindow;               // every iteration is logged, rather than as the P interval says
+
+    int32_t gpsHome[2];
+} parserState_t;
+
+// Canonical Huffman decoding: the codes of each length are consecutive, starting at firstCode[length]
+typedef struct {
+    uint32_t firstCode[BLACKBOX_HUFFMAN_MAX_CODE_LENGTH + 1];
+    int count[BLACKBOX_HUFFMAN_MAX_CODE_LENGTH + 1];
+    int firstSymbol[BLACKBOX_HUFFMAN_MAX_CODE_LENGTH + 1];
+    uint8_t symbols[256];                   // Byte values in order of code
+} huffmanDecoder_t;
+
+typedef struct {
+    uint8_t *data;
+    size_t size, capacity;
+
+    size_t *gaps;                           // Offsets in data where damaged blocks were left out
+    int gapCount, gapCapacity;
+} unpackedLog_t;
+
+static inline uint8_t readByte(cursor_t *c)
+{
+    if (c->pos >= c->end) {
+        c->overrun = true;
+        return 0;
+    }
+    return *c->pos++;
+}
+
+static uint32_t readUnsignedVB(cursor_t *c)
+{
+    uint32_t result = 0;
+    uint8_t b;
+    int shift;
+
+    // 32-bit values take at most 5 bytes
+    for (shift = 0; shift < 35; shift += 7) {
+        b = readByte(c);
+        result |= (uint32_t)(b & 0x7F) << shift;
+        if (!(b & 0x80))
+            return result;
+    }
+
+    c->overrun = true;
+    return 0;
+}
+
+static int32_t readSignedVB(cursor_t *c)
+{
+    uint32_t i = readUnsignedVB(c);
+
+    // Undo the ZigZag encoding
+    return (int32_t)((i >> 1) ^ -(int32_t)(i & 1));
+}
+
+static inline int32_t signExtend(uint32_t value, int bits)
+{
+    return (int32_t)(value << (32 - bits)) >> (32 - bits);
+}
+
+static void readTag2_3S32(cursor_t *c, int32_t *values)
+{
+    uint8_t lead = readByte(c), b, selector;
+    int i, j;
+
+    switch (lead >> 6) {
+        case 0:
+            values[0] = signExtend((lead >> 4) & 0x03, 2);
+            values[1] = signExtend((lead >> 2) & 0x03, 2);
+            values[2] = signExtend(lead & 0x03, 2);
+            break;
+        case 1:
+            values[0] = signExtend(lead & 0x0F, 4);
+            b = readByte(c);
+            values[1] = signExtend(b >> 4, 4);
+            values[2] = signExtend(b & 0x0F, 4);
+            break;
+        case 2:
+            values[0] = signExtend(lead & 0x3F, 6);
+            values[1] = signExtend(readByte(c) & 0x3F, 6);
+            values[2] = signExtend(readByte(c) & 0x3F, 6);
+            break;
+        case 3:
+            // Each field has its own byte count, first field in the low bits, values are little-endian
+            selector = lead;
+            for (i = 0; i < 3; i++, selector >>= 2) {
+                uint32_t value = 0;
+                int bytes = (selector & 0x03) + 1;
+
+                for (j = 0; j < bytes; j++)
+                    value |= (uint32_t)readByte(c) << (j * 8);
+                values[i] = signExtend(value, bytes * 8);
+            }
+            break;
+    }
+}
+
+static void readTag8_4S16(cursor_t *c, int32_t *values)
+{
+    uint8_t selector = readByte(c), buffer = 0, b1, b2;
+    bool haveNibble = false;
+    int i;
+
+    for (i = 0; i < 4; i++, selector >>= 2) {
+        switch (selector & 0x03) {
+            case 0:
+                values[i] = 0;
+                break;
+            case 1:
+                // Nibbles are packed high half first
+                if (!haveNibble) {
+                    buffer = readByte(c);
+                    values[i] = signExtend(buffer >> 4, 4);
+                    haveNibble = true;
+                } else {
+                    values[i] = signExtend(buffer & 0x0F, 4);
+                    haveNibble = false;
+                }
+                break;
+            case 2:
+                if (!haveNibble) {
+                    values[i] = signExtend(readByte(c), 8);
+                } else {
+                    b1 = buffer << 4;
+                    buffer = readByte(c);
+                    values[i] = signExtend(b1 | (buffer >> 4), 8);
+                }
+                break;
+            case 3:
+                b1 = readByte(c);
+                b2 = readByte(c);
+                if (!haveNibble) {
+                    values[i] = signExtend((b1 << 8) | b2, 16);
+                } else {
+                    values[i] = signExtend(((buffer & 0x0F) << 12) | (b1 << 4) | (b2 >> 4), 16);
+                    buffer = b2;
+                }
+                break;
+        }
+    }
+}
+
+static void readTag8_8SVB(cursor_t *c, int32_t *values, int count)
+{
+    uint8_t header;
+    int i;
+
+    // A lone field is written without the header byte
+    if (count == 1) {
+        values[0] = readSignedVB(c);
+        return;
+    }
+
+    header = readByte(c);
+    for (i = 0; i < count; i++, header >>= 1)
+        values[i] = (header & 0x01) ? readSignedVB(c) : 0;
+}
+
+/**
+ * Read a 5-bit width tag followed by 'count' signed fields of that width, packed most significant bit first.
+ */
+static void readTag5_4SNBit(cursor_t *c, int32_t *values, int count)
+{
+    uint8_t buffer = readByte(c);
+    int width = buffer >> 3, bufferBits = 3, bits, take, i;
+    uint32_t value;
+
+    if (width == 31)
+        width = 32;
+
+    for (i = 0; i < count; i++) {
+        value = 0;
+
+        for (bits = width; bits > 0; bits -= take) {
+            if (bufferBits == 0) {
+                buffer = readByte(c);
+                bufferBits = 8;
+            }
+
+            take = bits < bufferBits ? bits : bufferBits;
+            value = (uint32_t)((uint64_t)value << take) | ((buffer >> (bufferBits - take)) & ((1 << take) - 1));
+            bufferBits -= take;
+        }
+
+        values[i] = width == 0 ? 0 : signExtend(value, width);
+    }
+}
+
+static int groupLimit(uint8_t encoding)
+{
+    switch (encoding) {
+        case FLIGHT_LOG_FIELD_ENCODING_TAG8_8SVB:
+            return 8;
+        case FLIGHT_LOG_FIELD_ENCODING_TAG2_3S32:
+            return 3;
+        case FLIGHT_LOG_FIELD_ENCODING_TAG8_4S16:
+        case FLIGHT_LOG_FIELD_ENCODING_TAG5_4SNBIT:
+            return 4;
+        default:
+            return 1;
+    }
+}
+
+// Do these field names refer to elements of the same array, e.g. "gyroData[0]" and "gyroData[2]"?
+static bool fieldsShareArray(const char *a, const char *b)
+{
+    while (*a && *a == *b && *a != '[') {
+        a++;
+        b++;
+    }
+
+    return *a == '[' && *b == '[';
+}
+
+int flightLogGroupLength(const flightLogFrameDef_t *def, int first)
+{
+    int limit = groupLimit(def->encoding[first]), i;
+
+    for (i = first + 1; i < def->fieldCount && i - first < limit; i++)
+        if (def->encoding[i] != def->encoding[first]
+                || (def->encoding[first] == FLIGHT_LOG_FIELD_ENCODING_TAG5_4SNBIT
+                    && !fieldsShareArray(def->names[first], def->names[i])))
+            break;
+
+    return i - first;
+}
+
+/**
+ * Read the raw values of every field in the frame, before the predictions are added back. Returns false if the frame
+ * uses an encoding we don't know.
+ */
+static bool readFrameFields(cursor_t *c, const flightLogFrameDef_t *def, int32_t *raw)
+{
+    int32_t group[8];
+    int i, count;
+
+    for (i = 0; i < def->fieldCount; ) {
+        switch (def->encoding[i]) {
+            case FLIGHT_LOG_FIELD_ENCODING_SIGNED_VB:
+                raw[i++] = readSignedVB(c);
+                break;
+            case FLIGHT_LOG_FIELD_ENCODING_UNSIGNED_VB:
+                raw[i++] = (int32_t)readUnsignedVB(c);
+                break;
+            case FLIGHT_LOG_FIELD_ENCODING_NEG_14BIT:
+                raw[i++] = -signExtend(readUnsignedVB(c) & 0x3FFF, 14);
+                break;
+            case FLIGHT_LOG_FIELD_ENCODING_TAG8_8SVB:
+                count = flightLogGroupLength(def, i);
+                readTag8_8SVB(c, raw + i, count);
+                i += count;
+                break;
+            case FLIGHT_LOG_FIELD_ENCODING_TAG2_3S32:
+                count = flightLogGroupLength(def, i);
+                readTag2_3S32(c, group);
+                memcpy(raw + i, group, count * sizeof(group[0]));
+                i += count;
+                break;
+            case FLIGHT_LOG_FIELD_ENCODING_TAG8_4S16:
+                count = flightLogGroupLength(def, i);
+                readTag8_4S16(c, group);
+                memcpy(raw + i, group, count * sizeof(group[0]));
+                i += count;
+                break;
+            case FLIGHT_LOG_FIELD_ENCODING_TAG5_4SNBIT:
+                count = flightLogGroupLength(def, i);
+                readTag5_4SNBit(c, raw + i, count);
+                i += count;
+                break;
+            case FLIGHT_LOG_FIELD_ENCODING_NULL:
+                raw[i++] = 0;
+                break;
+            default:
+                return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Does the firmware log a main frame on this iteration, given the "P interval" setting?
+ */
+static bool shouldHaveFrame(const flightLog_t *log, uint32_t iteration)
+{
+    return (iteration % log->iInterval + log->pIntervalNum - 1) % log->pIntervalDenom < (uint32_t)log->pIntervalNum;
+}
+
+static int32_t constrain(int32_t value, int32_t low, int32_t high)
+{
+    return value < low ? low : value > high ? high : value;
+}
+
+// A field of the current frame, or zero if the log doesn't have it
+static int32_t fieldValue(const int32_t *values, int index, int field)
+{
+    return index >= 0 && index < field ? values[index] : 0;
+}
+
+static uint32_t predictMotor(const flightLog_t *log, int field, const int32_t *values)
+{
+    const int32_t *mix = NULL;
+    uint32_t axisPID[3];
+    int32_t rcYaw;
+    int axis, motor;
+
+    for (motor = 0; motor < log->motorCount; motor++)
+        if (log->motorFields[motor] == field)
+            mix = log->motorMix[motor];
+
+    if (!mix)
+        return 0;
+
+    if (fieldValue(values, log->rcCommandFields[3], field) <= log->minthrottle)
+        return log->minthrottle;
+
+    for (axis = 0; axis < 3; axis++)
+        axisPID[axis] = (uint32_t)fieldValue(values, log->axisPIDFields[0][axis], field)
+            + fieldValue(values, log->axisPIDFields[1][axis], field) + fieldValue(values, log->axisPIDFields[2][axis], field);
+
+    if (log->motorCount > 3) {
+        rcYaw = abs(fieldValue(values, log->rcCommandFields[2], field));
+        axisPID[2] = constrain((int32_t)axisPID[2], -100 - rcYaw, 100 + rcYaw);
+    }
+
+    return constrain((int32_t)(mix[0] * (uint32_t)fieldValue(values, log->rcCommandFields[3], field) + mix[1] * axisPID[0]
+        + mix[2] * axisPID[1] + mix[3] * axisPID[2]) / 1000, log->minthrottle, log->maxthrottle);
+}
+
+uint32_t flightLogPredict(const flightLog_t *log, uint8_t predictor, int field, const int32_t *values,
+    const int32_t history[FLIGHT_LOG_HISTORY_LENGTH][FLIGHT_LOG_MAX_FIELDS])
+{
+    switch (predictor) {
+        case FLIGHT_LOG_FIELD_PREDICTOR_PREVIOUS:
+            return history[0][field];
+        case FLIGHT_LOG_FIELD_PREDICTOR_STRAIGHT_LINE:
+            return 2 * (uint32_t)history[0][field] - (uint32_t)history[1][field];
+        case FLIGHT_LOG_FIELD_PREDICTOR_AVERAGE_2:
+            // Integer division truncates towards zero, just like the firmware's
+            if (log->frameDefs[FLIGHT_LOG_FRAME_INTRA].isSigned[field])
+                return (int32_t)(((int64_t)history[0][field] + history[1][field]) / 2);
+            return (uint32_t)(((uint64_t)(uint32_t)history[0][field] + (uint32_t)history[1][field]) / 2);
+        case FLIGHT_LOG_FIELD_PREDICTOR_LINEAR_3:
+            return (int32_t)(4 * (uint32_t)history[0][field] + history[1][field] - 2 * (uint32_t)history[2][field]) / 3;
+        case FLIGHT_LOG_FIELD_PREDICTOR_MIXER:
+            return predictMotor(log, field, values);
+        case FLIGHT_LOG_FIELD_PREDICTOR_MINTHROTTLE:
+            return log->minthrottle;
+        case FLIGHT_LOG_FIELD_PREDICTOR_MOTOR_0:
+            return fieldValue(values, log->motor0Field, field);
+        case FLIGHT_LOG_FIELD_PREDICTOR_1500:
+            return 1500;
+        case FLIGHT_LOG_FIELD_PREDICTOR_VBATREF:
+            return log->vbatref;
+        case FLIGHT_LOG_FIELD_PREDICTOR_0:
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Turn the raw values of a frame into field values by adding on the prediction for each field. Arithmetic wraps
+ * around at 32 bits like it does in the firmware.
+ */
+static void applyPredictors(const flightLog_t *log, const parserState_t *state, const flightLogFrameDef_t *def,
+    const int32_t *raw, int32_t *values)
+{
+    int homeIndex = 0;
+    uint32_t iteration;
+    int i;
+
+    for (i = 0; i < def->fieldCount; i++) {
+        uint32_t prediction;
+
+        switch (def->predictor[i]) {
+            case FLIGHT_LOG_FIELD_PREDICTOR_INC:
+                // Frames that the P interval skips don't count, so jump over them
+                iteration = state->lastIteration + 1;
+                while (!state->inCaptureWindow && !shouldHaveFrame(log, iteration))
+                    iteration++;
+                values[i] = iteration;
+                continue;
+            case FLIGHT_LOG_FIELD_PREDICTOR_HOME_COORD:
+                prediction = homeIndex < 2 ? state->gpsHome[homeIndex++] : 0;
+                break;
+            default:
+                prediction = flightLogPredict(log, def->predictor[i], i, values, state->history);
+                break;
+        }
+
+        values[i] = (int32_t)(prediction + (uint32_t)raw[i]);
+    }
+}
+
+static flightLogFrameType_e frameTypeForMarker(uint8_t marker, bool *isEvent)
+{
+    *isEvent = false;
+
+    switch (marker) {
+        case 'I':
+            return FLIGHT_LOG_FRAME_INTRA;
+        case 'P':
+            return FLIGHT_LOG_FRAME_INTER;
+        case 'G':
+            return FLIGHT_LOG_FRAME_GPS;
+        case 'H':
+            return FLIGHT_LOG_FRAME_GPS_HOME;
+        case 'S':
+            return FLIGHT_LOG_FRAME_SLOW;
+        case 'E':
+            *isEvent = true;
+            return FLIGHT_LOG_FRAME_TYPE_COUNT;
+        default:
+            return FLIGHT_LOG_FRAME_TYPE_COUNT;
+    }
+}
+
+static bool isFrameMarker(uint8_t marker)
+{
+    bool isEvent;
+
+    return frameTypeForMarker(marker, &isEvent) != FLIGHT_LOG_FRAME_TYPE_COUNT || isEvent;
+}
+
+// Read the CRC that follows the frame which began at frameStart, and check it against the frame's bytes
+static bool checkFrameCRC(cursor_t *c, const uint8_t *frameStart)
+{
+    const uint8_t *p;
+    uint8_t crc = 0;
+
+    if (c->overrun)
+        return false;
+
+    for (p = frameStart; p < c->pos; p++)
+        crc = blackboxCrc8(crc, *p);
+
+    return readByte(c) == crc && !c->overrun;
+}
+
+// Split a comma separated list of integers into the given field definition array
+static void parseFieldIntegers(const char *value, const char *end, uint8_t *dest, int *count)
+{
+    int n = 0;
+
+    while (value < end && n < FLIGHT_LOG_MAX_FIELDS) {
+        dest[n++] = (uint8_t)strtol(value, NULL, 10);
+        value = memchr(value, ',', end - value);
+        if (!value)
+            break;
+        value++;
+    }
+
+    if (count)
+        *count = n;
+}
+
+static void parseFieldNames(const char *value, const char *end, flightLogFrameDef_t *def)
+{
+    const char *comma;
+    size_t length;
+
+    def->fieldCount = 0;
+
+    while (value < end && def->fieldCount < FLIGHT_LOG_MAX_FIELDS) {
+        comma = memchr(value, ',', end - value);
+        if (!comma)
+            comma = end;
+
+        length = comma - value;
+        if (length >= FLIGHT_LOG_MAX_FIELD_NAME)
+            length = FLIGHT_LOG_MAX_FIELD_NAME - 1;
+        memcpy(def->names[def->fieldCount], value, length);
+        def->names[def->fieldCount][length] = '\0';
+        def->fieldCount++;
+
+        value = comma + 1;
+    }
+}
+
+static flightLogFrameDef_t *frameDefForLetter(flightLog_t *log, char letter)
+{
+    bool isEvent;
+    flightLogFrameType_e type = frameTypeForMarker(letter, &isEvent);
+
+    return type == FLIGHT_LOG_FRAME_TYPE_COUNT ? NULL : &log->frameDefs[type];
+}
+
+/**
+ * Handle one "H name:value" header line, given the text after the "H ".
+ */
+static void parseHeaderLine(flightLog_t *log, const char *line, const char *end)
+{
+    const char *colon = memchr(line, ':', end - line), *value;
+    flightLogFrameDef_t *def;
+    size_t nameLength;
+    int motor, i;
+
+    if (!colon)
+        return;
+
+    nameLength = colon - line;
+    value = colon + 1;
+
+#define HEADER_IS(s) (nameLength == strlen(s) && memcmp(line, s, nameLength) == 0)
+
+    if (nameLength > 8 && memcmp(line, "Field ", 6) == 0 && line[7] == ' ') {
+        def = frameDefForLetter(log, line[6]);
+        if (!def)
+            return;
+
+        line += 8;
+        nameLength -= 8;
+
+        if (HEADER_IS("name"))
+            parseFieldNames(value, end, def);
+        else if (HEADER_IS("signed"))
+            parseFieldIntegers(value, end, def->isSigned, NULL);
+        else if (HEADER_IS("predictor"))
+            parseFieldIntegers(value, end, def->predictor, NULL);
+        else if (HEADER_IS("encoding"))
+            parseFieldIntegers(value, end, def->encoding, NULL);
+    } else if (HEADER_IS("Data version")) {
+        log->dataVersion = atoi(value);
+    } else if (HEADER_IS("Data compression")) {
+        log->compression = atoi(value);
+    } else if (HEADER_IS("Frame check")) {
+        log->frameCheck = atoi(value);
+    } else if (HEADER_IS("I interval")) {
+        log->iInterval = atoi(value);
+    } else if (HEADER_IS("P interval")) {
+        log->pIntervalNum = atoi(value);
+        value = memchr(value, '/', end - value);
+        if (value)
+            log->pIntervalDenom = atoi(value + 1);
+    } else if (HEADER_IS("minthrottle")) {
+        log->minthrottle = atoi(value);
+    } else if (HEADER_IS("maxthrottle")) {
+        log->maxthrottle = atoi(value);
+    } else if (HEADER_IS("vbatref")) {
+        log->vbatref = atoi(value);
+    } else if (nameLength > 10 && memcmp(line, "motorMix[", 9) == 0) {
+        motor = atoi(line + 9);
+        if (motor >= 0 && motor < FLIGHT_LOG_MAX_MOTORS)
+            for (i = 0; i < 4 && value; i++) {
+                log->motorMix[motor][i] = atoi(value);
+                value = memchr(value, ',', end - value);
+                if (value)
+                    value++;
+            }
+    }
+
+#undef HEADER_IS
+}
+
+/**
+ * Parse the text header at the start of the log, returns a pointer to the first byte of binary frame data.
+ */
+static const uint8_t *parseHeader(flightLog_t *log, const uint8_t *pos, const uint8_t *end)
+{
+    const uint8_t *lineEnd;
+    char line[4096];
+    size_t length;
+
+    while (end - pos >= 2 && pos[0] == 'H' && pos[1] == ' ') {
+        lineEnd = memchr(pos, '\n', end - pos);
+        if (!lineEnd)
+            lineEnd = end;
+
+        // Work on a terminated copy so the number parsing can't run off the end of the mapping
+        length = lineEnd - pos - 2;
+        if (length >= sizeof(line))
+            length = sizeof(line) - 1;
+        memcpy(line, pos + 2, length);
+        line[length] = '\0';
+
+        parseHeaderLine(log, line, line + length);
+
+        pos = lineEnd < end ? lineEnd + 1 : end;
+    }
+
+    return pos;
+}
+
+static int findField(const flightLogFrameDef_t *def, const char *name)
+{
+    int i;
+
+    for (i = 0; i < def->fieldCount; i++)
+        if (strcmp(def->names[i], name) == 0)
+            return i;
+
+    return -1;
+}
+
+int flightLogFindLogs(const uint8_t *data, size_t size, size_t *logStarts, int maxLogs)
+{
+    const uint8_t *pos = data, *end = data + size, *found;
+    int count = 0;
+
+    while (pos < end && (found = memmem(pos, end - pos, LOG_START_MARKER, strlen(LOG_START_MARKER))) != NULL) {
+        if (count < maxLogs)
+            logStarts[count] = found - data;
+        count++;
+        pos = found + strlen(LOG_START_MARKER);
+    }
+
+    return count;
+}
+
+bool flightLogParseHeader(flightLog_t *log, const uint8_t *data, size_t size)
+{
+    flightLogFrameDef_t *mainDef = &log->frameDefs[FLIGHT_LOG_FRAME_INTRA];
+    flightLogFrameDef_t *interDef = &log->frameDefs[FLIGHT_LOG_FRAME_INTER];
+    char name[FLIGHT_LOG_MAX_FIELD_NAME];
+    int axis, i;
+
+    memset(log, 0, sizeof(*log));
+    log->iInterval = 32;
+    log->pIntervalNum = 1;
+    log->pIntervalDenom = 1;
+
+    log->dataStart = parseHeader(log, data, data + size);
+
+    if (mainDef->fieldCount == 0 || log->iInterval < 1 || log->pIntervalNum < 1 || log->pIntervalDenom < 1
+            || log->compression < FLIGHT_LOG_COMPRESSION_NONE || log->compression > FLIGHT_LOG_COMPRESSION_HUFFMAN
+            || log->frameCheck < FLIGHT_LOG_FRAME_CHECK_NONE || log->frameCheck > FLIGHT_LOG_FRAME_CHECK_CRC8)
+        return false;
+
+    // P-frames don't have their own names or signedness, they're the same fields as in the I-frame
+    memcpy(interDef->names, mainDef->names, sizeof(mainDef->names));
+    memcpy(interDef->isSigned, mainDef->isSigned, sizeof(mainDef->isSigned));
+    interDef->fieldCount = mainDef->fieldCount;
+
+    log->loopIterationField = findField(mainDef, "loopIteration");
+    log->timeField = findField(mainDef, "time");
+    log->motor0Field = findField(mainDef, "motor[0]");
+
+    for (axis = 0; axis < 3; axis++) {
+        snprintf(name, sizeof(name), "axisP[%d]", axis);
+        log->axisPIDFields[0][axis] = findField(mainDef, name);
+        snprintf(name, sizeof(name), "axisI[%d]", axis);
+        log->axisPIDFields[1][axis] = findField(mainDef, name);
+        snprintf(name, sizeof(name), "axisD[%d]", axis);
+        log->axisPIDFields[2][axis] = findField(mainDef, name);
+    }
+    for (i = 0; i < 4; i++) {
+        snprintf(name, sizeof(name), "rcCommand[%d]", i);
+        log->rcCommandFields[i] = findField(mainDef, name);
+    }
+    for (log->motorCount = 0; log->motorCount < FLIGHT_LOG_MAX_MOTORS; log->motorCount++) {
+        snprintf(name, sizeof(name), "motor[%d]", log->motorCount);
+        if ((log->motorFields[log->motorCount] = findField(mainDef, name)) < 0)
+            break;
+    }
+
+    return true;
+}
+
+static void buildHuffmanDecoder(huffmanDecoder_t *huff)
+{
+    int length, symbol, n = 0;
+
+    for (length = 1; length <= BLACKBOX_HUFFMAN_MAX_CODE_LENGTH; length++) {
+        huff->firstSymbol[length] = n;
+        huff->count[length] = 0;
+        huff->firstCode[length] = 0;
+
+        for (symbol = 0; symbol < 256; symbol++) {
+            if (blackboxHuffmanTable[symbol].length == length) {
+                if (huff->count[length] == 0)
+                    huff->firstCode[length] = blackboxHuffmanTable[symbol].code;
+                huff->count[length]++;
+                huff->symbols[n++] = symbol;
+            }
+        }
+    }
+}
+
+/**
+ * Unpack the block at the cursor onto the end of the unpacked stream. Returns false, leaving the stream as it was, if
+ * the block is truncated or doesn't pass its CRC.
+ */
+static bool unpackBlock(const huffmanDecoder_t *huff, cursor_t *c, unpackedLog_t *out)
+{
+    uint8_t marker = readByte(c), crc = 0, value = 0;
+    uint32_t rawLength = readUnsignedVB(c), bits = 0, code;
+    int bitCount = 0, length;
+    uint32_t i;
+
+    if (c->overrun || rawLength == 0 || rawLength > MAX_BLOCK_RAW_LENGTH)
+        return false;
+
+    if (out->size + rawLength > out->capacity) {
+        uint8_t *grown;
+
+        out->capacity = (out->size + rawLength) * 2;
+        grown = realloc(out->data, out->capacity);
+        if (!grown)
+            return false;
+        out->data = grown;
+    }
+
+    for (i = 0; i < rawLength; i++) {
+        if (marker == BLACKBOX_BLOCK_STORED) {
+            value = readByte(c);
+        } else {
+            code = 0;
+            for (length = 1; length <= BLACKBOX_HUFFMAN_MAX_CODE_LENGTH; length++) {
+                if (bitCount == 0) {
+                    bits = readByte(c);
+                    bitCount = 8;
+                }
+                bitCount--;
+                code = (code << 1) | ((bits >> bitCount) & 1);
+
+                if (code - huff->firstCode[length] < (uint32_t)huff->count[length]) {
+                    value = huff->symbols[huff->firstSymbol[length] + code - huff->firstCode[length]];
+                    break;
+                }
+            }
+            if (length > BLACKBOX_HUFFMAN_MAX_CODE_LENGTH)
+                return false;
+        }
+
+        out->data[out->size + i] = value;
+        crc = blackboxCrc8(crc, value);
+    }
+
+    if (readByte(c) != crc || c->overrun)
+        return false;
+
+    out->size += rawLength;
+    return true;
+}
+
+/**
+ * Unpack the blocks of a compressed log. Stretches that don't hold a good block are skipped, and recorded as gaps.
+ */
+static bool unpackLog(flightLog_t *log, const uint8_t *start, const uint8_t *end, unpackedLog_t *out)
+{
+    huffmanDecoder_t huff;
+    const uint8_t *blockStart;
+    bool skipping = false;
+    size_t *grown;
+    cursor_t c;
+
+    buildHuffmanDecoder(&huff);
+
+    c.pos = start;
+    c.end = end;
+
+    while (c.pos < c.end) {
+        blockStart = c.pos;
+        c.overrun = false;
+
+        if ((*c.pos == BLACKBOX_BLOCK_HUFFMAN || *c.pos == BLACKBOX_BLOCK_STORED) && unpackBlock(&huff, &c, out)) {
+            log->stats.blockCount++;
+            log->stats.blockBytes += c.pos - blockStart;
+            skipping = false;
+            continue;
+        }
+
+        if (!skipping) {
+            log->stats.corruptBlocks++;
+
+            if (out->gapCount == out->gapCapacity) {
+                out->gapCapacity = out->gapCapacity ? out->gapCapacity * 2 : 16;
+                grown = realloc(out->gaps, out->gapCapacity * sizeof(*out->gaps));
+                if (!grown)
+                    return false;
+                out->gaps = grown;
+            }
+            out->gaps[out->gapCount++] = out->size;
+        }
+        skipping = true;
+        log->stats.skippedBytes++;
+        c.pos = blockStart + 1;
+    }
+
+    return true;
+}
+
+// A footer body's length is 16 bits, so only this much of the end of the log needs searching for one
+#define FOOTER_SEARCH_LENGTH (0xFFFF + FLIGHT_LOG_FOOTER_TRAILER_LENGTH)
+
+/**
+ * Find the footer at the end of the log, returning where its body starts and how long that is. The log may be followed
+ * by whatever the port carried after it, so we search back through the last FOOTER_SEARCH_LENGTH bytes for the last
+ * footer that passes its CRC.
+ */
+static bool findFooter(const uint8_t *data, size_t size, size_t *bodyStart, size_t *bodyLength)
+{
+    const uint8_t *magic, *first;
+    size_t length, i;
+    uint8_t crc;
+
+    first = size > FOOTER_SEARCH_LENGTH ? data + size - FOOTER_SEARCH_LENGTH : data;
+    if (first < data + 3)
+        first = data + 3;
+
+    for (magic = data + size - FLIGHT_LOG_FOOTER_MAGIC_LENGTH; magic >= first; magic--) {
+        if (memcmp(magic, FLIGHT_LOG_FOOTER_MAGIC, FLIGHT_LOG_FOOTER_MAGIC_LENGTH) != 0)
+            continue;
+
+        length = magic[-3] | (magic[-2] << 8);
+        if ((size_t)(magic - 3 - data) < length)
+            continue;
+
+        *bodyStart = magic - 3 - length - data;
+        for (i = 0, crc = 0; i < length; i++)
+            crc = blackboxCrc8(crc, data[*bodyStart + i]);
+
+        if (crc == magic[-1]) {
+            *bodyLength = length;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool flightLogReadIndex(const uint8_t *data, size_t size, flightLogIndex_t *index)
+{
+    uint32_t count, time, offset;
+    size_t bodyStart, bodyLength;
+    cursor_t c;
+    int i;
+
+    if (size < FLIGHT_LOG_FOOTER_TRAILER_LENGTH || !findFooter(data, size, &bodyStart, &bodyLength))
+        return false;
+
+    memset(index, 0, sizeof(*index));
+    index->footerStart = bodyStart;
+
+    c.pos = data + bodyStart;
+    c.end = c.pos + bodyLength;
+    c.overrun = false;
+
+    index->startTime = readUnsignedVB(&c);
+    index->startIteration = readUnsignedVB(&c);
+    index->duration = readUnsignedVB(&c);
+    index->iterations = readUnsignedVB(&c);
+    index->keyframeCount = readUnsignedVB(&c);
+    index->eventCount = readUnsignedVB(&c);
+    count = readUnsignedVB(&c);
+
+    time = index->startTime;
+    offset = 0;
+    for (i = 0; i < (int)count && !c.overrun; i++) {
+        time += readUnsignedVB(&c);
+        offset += readUnsignedVB(&c);
+
+        // Entries past the end of the log can't be any use
+        if (i < FLIGHT_LOG_MAX_INDEX_ENTRIES && offset < bodyStart) {
+            index->entryTime[index->entryCount] = time;
+            index->entryOffset[index->entryCount] = offset;
+            index->entryCount++;
+        }
+    }
+
+    return !c.overrun;
+}
+
+bool flightLogParse(flightLog_t *log, const uint8_t *data, size_t size, flightLogFrameCallback onFrame,
+    flightLogEventCallback onEvent, void *context)
+{
+    return flightLogParseRange(log, data, size, 0, size, onFrame, onEvent, context);
+}
+
+bool flightLogParseRange(flightLog_t *log, const uint8_t *data, size_t size, size_t start, size_t end,
+    flightLogFrameCallback onFrame, flightLogEventCallback onEvent, void *context)
+{
+    const uint8_t *frameStart, *parseStart;
+    size_t bodyStart, bodyLength;
+    int32_t raw[FLIGHT_LOG_MAX_FIELDS], values[FLIGHT_LOG_MAX_FIELDS];
+    parserState_t *state;
+    flightLogFrameType_e type;
+    const flightLogFrameDef_t *def = NULL;
+    bool isEvent, ok, inWindow, resyncing = false;
+    uint8_t event = 0;
+    uint32_t eventData[FLIGHT_LOG_MAX_EVENT_DATA];
+    int i, gapIndex = 0;
+    unpackedLog_t unpacked = { 0 };
+    cursor_t c;
+
+    if (!flightLogParseHeader(log, data, size))
+        return false;
+
+    // The footer isn't made of frames or blocks
+    if (findFooter(data, size, &bodyStart, &bodyLength) && end > bodyStart)
+        end = bodyStart;
+    if (end > size)
+        end = size;
+
+    parseStart = start > (size_t)(log->dataStart - data) ? data + start : log->dataStart;
+    if (parseStart > data + end)
+        parseStart = data + end;
+
+    c.pos = parseStart;
+    c.end = data + end;
+
+    if (log->compression == FLIGHT_LOG_COMPRESSION_HUFFMAN) {
+        if (!unpackLog(log, parseStart, data + end, &unpacked)) {
+            free(unpacked.data);
+            free(unpacked.gaps);
+            return false;
+        }
+        c.pos = unpacked.data;
+        c.end = unpacked.data + unpacked.size;
+    }
+
+    state = calloc(1, sizeof(*state));
+    if (!state) {
+        free(unpacked.data);
+        free(unpacked.gaps);
+        return false;
+    }
+
+    while (c.pos < c.end) {
+        // Frames after a damaged block can't be predicted from the ones before it
+        while (gapIndex < unpacked.gapCount && c.pos >= unpacked.data + unpacked.gaps[gapIndex]) {
+            state->historyValid = false;
+            gapIndex++;
+        }
+
+        frameStart = c.pos;
+        c.overrun = false;
+        type = frameTypeForMarker(readByte(&c), &isEvent);
+
+        if (type == FLIGHT_LOG_FRAME_TYPE_COUNT && !isEvent) {
+            if (!resyncing)
+                log->stats.corruptFrames++;
+            resyncing = true;
+            log->stats.skippedBytes++;
+            continue;
+        }
+
+        if (isEvent) {
+            event = readByte(&c);
+            memset(eventData, 0, sizeof(eventData));
+            switch (event) {
+                case FLIGHT_LOG_EVENT_SYNC_BEEP:
+                case FLIGHT_LOG_EVENT_FRAMES_DROPPED:
+                case FLIGHT_LOG_EVENT_CAPTURE_END:
+                    eventData[0] = readUnsignedVB(&c);
+                    ok = true;
+                    break;
+                case FLIGHT_LOG_EVENT_CAPTURE_START:
+                    eventData[0] = readUnsignedVB(&c);
+                    eventData[1] = readByte(&c);
+                    ok = true;
+                    break;
+                case FLIGHT_LOG_EVENT_FLIGHT_MODE:
+                case FLIGHT_LOG_EVENT_FAILSAFE:
+                case FLIGHT_LOG_EVENT_CALIBRATION:
+                case FLIGHT_LOG_EVENT_GPS_FIX:
+                case FLIGHT_LOG_EVENT_CONFIG_CHANGE:
+                    // The time, then the data
+                    eventData[0] = readUnsignedVB(&c);
+                    eventData[1] = readUnsignedVB(&c);
+                    ok = true;
+                    break;
+                case FLIGHT_LOG_EVENT_LOG_END:
+                    eventData[0] = readUnsignedVB(&c);
+                    ok = true;
+                    break;
+                default:
+                    ok = false;
+                    break;
+            }
+        } else {
+            def = &log->frameDefs[type];
+            ok = def->fieldCount > 0 && readFrameFields(&c, def, raw);
+        }
+
+        if (ok && log->frameCheck == FLIGHT_LOG_FRAME_CHECK_CRC8 && !checkFrameCRC(&c, frameStart)) {
+            log->stats.failedChecks++;
+            ok = false;
+        }
+
+        // Only trust the frame if it ended where the next one starts
+        ok = ok && !c.overrun && c.pos - frameStart <= FLIGHT_LOG_MAX_FRAME_LENGTH
+            && (c.pos == c.end || isFrameMarker(*c.pos));
+
+        if (!ok) {
+            if (!resyncing)
+                log->stats.corruptFrames++;
+            resyncing = true;
+            state->historyValid = false;
+            log->stats.skippedBytes++;
+            c.pos = frameStart + 1;
+            continue;
+        }
+
+        resyncing = false;
+
+        if (isEvent) {
+            log->stats.eventCount++;
+            if (event == FLIGHT_LOG_EVENT_FRAMES_DROPPED)
+                log->stats.droppedFrames += eventData[0];
+            // The window's first frame comes next, whatever the P interval would have skipped to get to it
+            if (event == FLIGHT_LOG_EVENT_CAPTURE_START)
+                state->lastIteration = eventData[0] - 1;
+            // Capture events are repeated before keyframes, only pass on the ones that start or end a window
+            if (event == FLIGHT_LOG_EVENT_CAPTURE_START || event == FLIGHT_LOG_EVENT_CAPTURE_END) {
+                inWindow = event == FLIGHT_LOG_EVENT_CAPTURE_START;
+                if (inWindow == state->inCaptureWindow)
+                    continue;
+                state->inCaptureWindow = inWindow;
+            }
+            if (onEvent)
+                onEvent(log, event, eventData, context);
+            if (event == FLIGHT_LOG_EVENT_LOG_END)
+                break;
+            continue;
+        }
+
+        log->stats.frameCount[type]++;
+        log->stats.frameBytes[type] += c.pos - frameStart;
+
+        switch (type) {
+            case FLIGHT_LOG_FRAME_INTRA:
+                applyPredictors(log, state, def, raw, values);
+                break;
+            case FLIGHT_LOG_FRAME_INTER:
+                if (!state->historyValid) {
+                    log->stats.unusableFrames++;
+                    continue;
+                }
+                applyPredictors(log, state, def, raw, values);
+                break;
+            case FLIGHT_LOG_FRAME_GPS_HOME:
+                applyPredictors(log, state, def, raw, values);
+                if (def->fieldCount >= 2) {
+                    state->gpsHome[0] = values[0];
+                    state->gpsHome[1] = values[1];
+                }
+                break;
+            case FLIGHT_LOG_FRAME_GPS:
+            case FLIGHT_LOG_FRAME_SLOW:
+            default:
+                // These only predict from constants and the home position, not from their own history
+                applyPredictors(log, state, def, raw, values);
+                break;
+        }
+
+        if (type == FLIGHT_LOG_FRAME_INTRA || type == FLIGHT_LOG_FRAME_INTER) {
+            // After an I-frame every history slot holds it, since it has no history of its own
+            if (type == FLIGHT_LOG_FRAME_INTRA) {
+                for (i = 1; i < FLIGHT_LOG_HISTORY_LENGTH; i++)
+                    memcpy(state->history[i], values, sizeof(values));
+            } else {
+                memmove(state->history[1], state->history[0], (FLIGHT_LOG_HISTORY_LENGTH - 1) * sizeof(values));
+            }
+            memcpy(state->history[0], values, sizeof(values));
+            state->historyValid = true;
+            if (log->loopIterationField >= 0)
+                state->lastIteration = values[log->loopIterationField];
+        }
+
+        if (onFrame)
+            onFrame(log, type, values, context);
+    }
+
+    free(state);
+    free(unpacked.data);
+    free(unpacked.gaps);
+
+    return true;
+}
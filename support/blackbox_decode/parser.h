@@ -0,0 +1,175 @@
+/*
+ * This file is part of baseflight
+ * Licensed under GPL V3 or modified DCL - see https://github.com/multiwii/baseflight/blob/master/README.md
+ */
+
+#ifndef PARSER_H_
+#define PARSER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "blackbox_fielddefs.h"
+
+/*
+ * Host-side parser for the logs written by src/blackbox.c. Everything about the layout of the frames is taken from the
+ * "H Field" lines in the log header, using the same predictor and encoding numbers as blackbox_fielddefs.h, so the
+ * parser keeps working when fields are added to the firmware.
+ */
+
+#define FLIGHT_LOG_MAX_FIELDS 64
+#define FLIGHT_LOG_MAX_FIELD_NAME 32
+
+#define FLIGHT_LOG_MAX_MOTORS 8
+
+// Most values an event carries
+#define FLIGHT_LOG_MAX_EVENT_DATA 2
+
+// How many main frames of history the predictors can look back on
+#define FLIGHT_LOG_HISTORY_LENGTH 3
+
+// A frame longer than this can't have come from the firmware, so we must have lost sync with the stream
+#define FLIGHT_LOG_MAX_FRAME_LENGTH 256
+
+typedef enum {
+    FLIGHT_LOG_FRAME_INTRA = 0,
+    FLIGHT_LOG_FRAME_INTER,
+    FLIGHT_LOG_FRAME_GPS,
+    FLIGHT_LOG_FRAME_GPS_HOME,
+    FLIGHT_LOG_FRAME_SLOW,
+    FLIGHT_LOG_FRAME_TYPE_COUNT
+} flightLogFrameType_e;
+
+typedef struct flightLogFrameDef_t {
+    int fieldCount;
+    char names[FLIGHT_LOG_MAX_FIELDS][FLIGHT_LOG_MAX_FIELD_NAME];
+    uint8_t isSigned[FLIGHT_LOG_MAX_FIELDS];
+    uint8_t predictor[FLIGHT_LOG_MAX_FIELDS];
+    uint8_t encoding[FLIGHT_LOG_MAX_FIELDS];
+} flightLogFrameDef_t;
+
+typedef struct flightLogStats_t {
+    uint32_t frameCount[FLIGHT_LOG_FRAME_TYPE_COUNT];
+    uint64_t frameBytes[FLIGHT_LOG_FRAME_TYPE_COUNT];
+    uint32_t eventCount;
+    uint32_t corruptFrames;             // frames that failed to decode, or weren't followed by a valid frame
+    uint32_t failedChecks;              // frames that decoded but didn't match their CRC (logs with frame checks)
+    uint32_t unusableFrames;            // P-frames we couldn't decode because a frame they depend on was lost
+    uint32_t droppedFrames;             // frames the firmware reported it had to throw away
+    uint64_t skippedBytes;              // bytes skipped while resynchronising
+
+    // Compressed logs only: blocks unpacked, the bytes they took up in the file, and damaged stretches skipped
+    uint32_t blockCount;
+    uint64_t blockBytes;
+    uint32_t corruptBlocks;
+} flightLogStats_t;
+
+// Most entries we'll read from a log's keyframe index
+#define FLIGHT_LOG_MAX_INDEX_ENTRIES 256
+
+/*
+ * What the footer at the end of a log says about it (see FLIGHT_LOG_FOOTER_MAGIC). Entries are in time order, each the
+ * time of a keyframe and the offset from the start of the log to decode from to reach it.
+ */
+typedef struct flightLogIndex_t {
+    uint32_t startTime, startIteration;
+    uint32_t duration, iterations;
+    uint32_t keyframeCount, eventCount;
+
+    int entryCount;
+    uint32_t entryTime[FLIGHT_LOG_MAX_INDEX_ENTRIES];
+    uint32_t entryOffset[FLIGHT_LOG_MAX_INDEX_ENTRIES];
+
+    size_t footerStart;                 // where the footer starts, which is where the log's frames end
+} flightLogIndex_t;
+
+typedef struct flightLog_t flightLog_t;
+
+/*
+ * Decoded frames are handed to the callbacks with one value per field of the frame's definition. Values are stored as
+ * 32-bit integers, the field's isSigned tells whether to read them as int32_t or uint32_t.
+ *
+ * Events come with the values they carry (see FlightLogEvent for what those are), the rest of 'data' is zero.
+ */
+typedef void (*flightLogFrameCallback)(flightLog_t *log, flightLogFrameType_e type, const int32_t *values, void *context);
+typedef void (*flightLogEventCallback)(flightLog_t *log, uint8_t event, const uint32_t *data, void *context);
+
+struct flightLog_t {
+    // The main frame definition is shared by I and P frames, only the predictors and encodings differ
+    flightLogFrameDef_t frameDefs[FLIGHT_LOG_FRAME_TYPE_COUNT];
+
+    // From the system information headers
+    int dataVersion;
+    int iInterval;
+    int pIntervalNum, pIntervalDenom;
+    int minthrottle, maxthrottle;
+    uint32_t vbatref;
+    int compression;                    // FlightLogCompression
+    int frameCheck;                     // FlightLogFrameCheck
+
+    // The mixer's throttle, roll, pitch and yaw coefficients for each motor, scaled by 1000
+    int32_t motorMix[FLIGHT_LOG_MAX_MOTORS][4];
+
+    // Index of well-known main fields, or -1 if the log doesn't have them
+    int loopIterationField, timeField, motor0Field;
+    int axisPIDFields[3][3];            // [P, I, D][axis]
+    int rcCommandFields[4];
+    int motorFields[FLIGHT_LOG_MAX_MOTORS];
+    int motorCount;
+
+    // First byte after the text header
+    const uint8_t *dataStart;
+
+    flightLogStats_t stats;
+};
+
+/**
+ * Find the start of every log in the given data (each arm writes a new header, so a file can hold many). Stores up to
+ * maxLogs offsets in logStarts and returns how many logs there are in total.
+ */
+int flightLogFindLogs(const uint8_t *data, size_t size, size_t *logStarts, int maxLogs);
+
+/**
+ * Read just the text header of the log that starts at data, filling in the frame definitions and settings. Returns
+ * false if the header doesn't describe any main frame fields.
+ */
+bool flightLogParseHeader(flightLog_t *log, const uint8_t *data, size_t size);
+
+/**
+ * Parse the single log held in data[0..size), calling onFrame for every frame that decodes correctly and onEvent for
+ * every event. Either callback may be NULL. Returns false if the log's header can't be understood.
+ */
+bool flightLogParse(flightLog_t *log, const uint8_t *data, size_t size, flightLogFrameCallback onFrame,
+    flightLogEventCallback onEvent, void *context);
+
+/**
+ * Like flightLogParse(), but only decode the frames in data[start..end), which should start at one of the offsets from
+ * the log's index (anything that comes before the first keyframe there can't be decoded). The header is still read
+ * from the start of data.
+ */
+bool flightLogParseRange(flightLog_t *log, const uint8_t *data, size_t size, size_t start, size_t end,
+    flightLogFrameCallback onFrame, flightLogEventCallback onEvent, void *context);
+
+/**
+ * Read the footer from the end of the single log held in data[0..size). Returns false if it doesn't have one, which is
+ * the case for logs from older firmware and logs that were cut short.
+ */
+bool flightLogReadIndex(const uint8_t *data, size_t size, flightLogIndex_t *index);
+
+/**
+ * How many fields, starting with 'first', the firmware writes together as one group (1 for fields that aren't group
+ * encoded).
+ */
+int flightLogGroupLength(const flightLogFrameDef_t *def, int first);
+
+/**
+ * Compute the prediction that the given predictor makes for main frame field 'field', which the firmware subtracted
+ * before writing the field. 'values' holds the fields of the current frame that come before this one and history[0]
+ * is the previous main frame, history[1] the one before that and so on. Predictors that depend on the parser's state
+ * (INC and HOME_COORD) aren't handled here.
+ */
+uint32_t flightLogPredict(const flightLog_t *log, uint8_t predictor, int field, const int32_t *values,
+    const int32_t history[FLIGHT_LOG_HISTORY_LENGTH][FLIGHT_LOG_MAX_FIELDS]);
+
+#endif